@@ -0,0 +1,122 @@
+#include "../rcmgralloc.h"
+
+#include "psb.h"
+
+#include "logging.h"
+#include "byteorder.h"
+
+#include "../debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+#define PSB_HEADERSIZE 12
+#define PSB_CLIPSIZE 20
+
+static inline uint32_t get32(const uint8_t* d) {
+    return d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+}
+
+bool psb_load(uint8_t* data, size_t size, struct psb* b) {
+    if (size < PSB_HEADERSIZE) {
+        plog(LL_ERROR | LF_FUNCLN, "Unexpected end of stream");
+        return false;
+    }
+    if (data[0] != 'P' || data[1] != 'S' || data[2] != 'B') {
+        plog(
+            LL_ERROR,
+            "PSB header magic wrong (expected 50 53 42, got %02X %02X %02X)",
+            data[0], data[1], data[2]
+        );
+        return false;
+    }
+    if (data[3] != PSB_VER) {
+        plog(LL_ERROR, "PSB version wrong (expected " STR(PSB_VER) ", got %d)", data[3]);
+        return false;
+    }
+    uint32_t count = get32(data + 4);
+    uint32_t namessize = get32(data + 8);
+    size_t namesoff = PSB_HEADERSIZE + (size_t)count * PSB_CLIPSIZE;
+    if (count > (size - PSB_HEADERSIZE) / PSB_CLIPSIZE || namessize > size - namesoff) {
+        plog(LL_ERROR | LF_FUNCLN, "Unexpected end of stream");
+        return false;
+    }
+    const char* names = (const char*)data + namesoff;
+    if (namessize && names[namessize - 1]) {
+        plog(LL_ERROR, "PSB clip names are not terminated");
+        return false;
+    }
+    struct psb_clip* clips = malloc(count * sizeof(*clips));
+    if (!clips && count) {
+        plog(LL_ERROR | LF_FUNCLN, LE_MEMALLOC);
+        return false;
+    }
+    const uint8_t* c = data + PSB_HEADERSIZE;
+    for (uint32_t i = 0; i < count; ++i, c += PSB_CLIPSIZE) {
+        uint32_t nameoff = get32(c);
+        uint32_t dataoff = get32(c + 4);
+        uint32_t len = get32(c + 8);
+        uint32_t rate = get32(c + 12);
+        bool stereo = c[16] & 1;
+        if (nameoff >= namessize) {
+            plog(LL_ERROR, "PSB clip %u name is out of bounds", (unsigned)i);
+            goto fail;
+        }
+        clips[i].name = names + nameoff;
+        if (i && strcmp(clips[i - 1].name, clips[i].name) >= 0) {
+            plog(LL_ERROR, "PSB clip '%s' is not sorted or is a duplicate", clips[i].name);
+            goto fail;
+        }
+        size_t bytes = (size_t)len * (stereo + 1) * sizeof(int16_t);
+        if (dataoff % PSB_ALIGN || dataoff < namesoff + namessize || dataoff > size || bytes > size - dataoff) {
+            plog(LL_ERROR, "PSB clip '%s' data is out of bounds or misaligned", clips[i].name);
+            goto fail;
+        }
+        if (!rate) {
+            plog(LL_ERROR, "PSB clip '%s' rate must not be 0", clips[i].name);
+            goto fail;
+        }
+        clips[i].samples = (int16_t*)(data + dataoff);
+        clips[i].len = len;
+        clips[i].rate = rate;
+        clips[i].stereo = stereo;
+    }
+    #if BYTEORDER == BO_BE
+    {
+        // all at once, since clips are allowed to share data
+        size_t start = (namesoff + namessize + PSB_ALIGN - 1) / PSB_ALIGN * PSB_ALIGN;
+        if (start < size) {
+            int16_t* s = (int16_t*)(data + start);
+            for (size_t j = 0; j < (size - start) / sizeof(*s); ++j) s[j] = swaple16(s[j]);
+        }
+    }
+    #endif
+    b->data = data;
+    b->size = size;
+    b->clips = clips;
+    b->clipcount = count;
+    return true;
+    fail:;
+    free(clips);
+    return false;
+}
+
+const struct psb_clip* psb_find(const struct psb* b, const char* name) {
+    uint32_t l = 0, r = b->clipcount;
+    while (l < r) {
+        uint32_t m = l + (r - l) / 2;
+        int c = strcmp(name, b->clips[m].name);
+        if (!c) return &b->clips[m];
+        if (c < 0) r = m;
+        else l = m + 1;
+    }
+    return NULL;
+}
+
+void psb_free(struct psb* b) {
+    free(b->clips);
+    free(b->data);
+}
@@ -0,0 +1,33 @@
+#ifndef PSRC_COMMON_PSB_H
+#define PSRC_COMMON_PSB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PSB_VER 0
+#define PSB_ALIGN 16 // clip data starts on a multiple of this from the start of the file
+
+// A sound bank is kept as the whole file in one buffer. The clips point into it, so they share one allocation
+// instead of each having their own.
+struct psb_clip {
+    const char* name; // in 'data' of 'struct psb'
+    int16_t* samples; // signed 16-bit, interleaved if stereo
+    uint32_t len; // in samples
+    uint32_t rate;
+    bool stereo;
+};
+
+struct psb {
+    uint8_t* data; // the file
+    size_t size;
+    struct psb_clip* clips; // sorted by name
+    uint32_t clipcount;
+};
+
+// takes ownership of 'data' if it succeeds
+bool psb_load(uint8_t* data, size_t size, struct psb*);
+const struct psb_clip* psb_find(const struct psb*, const char* name); // returns NULL if there is no clip with that name
+void psb_free(struct psb*);
+
+#endif
@@ -0,0 +1,362 @@
+#include "../rcmgralloc.h"
+
+#include "ptm.h"
+
+#include "logging.h"
+#include "byteorder.h"
+#include "string.h"
+
+#include "../debug.h"
+#include "../attribs.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+#define get8 ds_bin_getc_noerr
+static inline uint32_t get32(struct datastream* ds) {
+    uint32_t v;
+    v = ds_bin_getc_noerr(ds);
+    v |= ds_bin_getc_noerr(ds) << 8;
+    v |= ds_bin_getc_noerr(ds) << 16;
+    v |= (uint32_t)ds_bin_getc_noerr(ds) << 24;
+    return v;
+}
+static inline float getf32(struct datastream* ds) {
+    float v;
+    ds_bin_read(ds, 4, &v);
+    return swaplefloat(v);
+}
+static char* getstr(struct datastream* ds) {
+    struct charbuf cb;
+    cb_init(&cb, 16);
+    int c;
+    while ((c = ds_bin_getc(ds)) != DS_END && c) cb_add(&cb, c);
+    if (c == DS_END) {
+        cb_dump(&cb);
+        return NULL;
+    }
+    return cb_finalize(&cb);
+}
+
+void ptm_free(struct ptm* m) {
+    for (unsigned i = 0; i < m->samplecount; ++i) {
+        free(m->samples[i].name);
+        free(m->samples[i].data);
+    }
+    free(m->samples);
+    for (unsigned i = 0; i < m->instrumentcount; ++i) {
+        free(m->instruments[i].name);
+        free(m->instruments[i].samples);
+    }
+    free(m->instruments);
+    free(m->tracks);
+    for (unsigned i = 0; i < m->groupcount; ++i) {
+        free(m->groups[i].name);
+    }
+    free(m->groups);
+    for (unsigned i = 0; i < m->patterncount; ++i) {
+        struct ptm_pattern* p = &m->patterns[i];
+        free(p->gcmds);
+        if (p->tracks) {
+            for (unsigned j = 0; j < m->trackcount; ++j) {
+                free(p->tracks[j].notes);
+                free(p->tracks[j].lcmds);
+            }
+            free(p->tracks);
+        }
+    }
+    free(m->patterns);
+    free(m->sequence);
+    free(m->name);
+    free(m->author);
+    free(m->comments);
+}
+
+#define PTM_LOAD_EOSERR(lbl) do {plog(LL_ERROR | LF_FUNCLN, "Unexpected end of stream"); goto lbl;} while (0)
+#define PTM_LOAD_OOMERR(lbl) do {plog(LL_ERROR | LF_FUNCLN, LE_MEMALLOC); goto lbl;} while (0)
+bool ptm_load(struct datastream* ds, struct ptm* m) {
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Checking header...");
+    #endif
+    {
+        char h[3];
+        if (ds_bin_read(ds, 3, h) != 3) {
+            plog(LL_ERROR | LF_FUNCLN, "Unexpected end of stream");
+            return false;
+        }
+        if (h[0] != 'P' || h[1] != 'T' || h[2] != 'M') {
+            plog(
+                LL_ERROR,
+                "PTM header magic wrong (expected 50 54 4D, got %02X %02X %02X)",
+                h[0], h[1], h[2]
+            );
+            return false;
+        }
+    }
+    {
+        int v = ds_bin_getc(ds);
+        if (v == DS_END) {
+            plog(LL_ERROR | LF_FUNCLN, "Unexpected end of stream");
+            return false;
+        }
+        if (v != PTM_VER) {
+            plog(LL_ERROR, "PTM version wrong (expected " STR(PTM_VER) ", got %d)", v);
+            return false;
+        }
+    }
+    memset(m, 0, sizeof(*m));
+    if (!(m->name = getstr(ds))) PTM_LOAD_EOSERR(retfalse);
+    if (!(m->author = getstr(ds))) PTM_LOAD_EOSERR(retfalse);
+    if (!(m->comments = getstr(ds))) PTM_LOAD_EOSERR(retfalse);
+    m->bpm = get8(ds);
+    m->notesperbeat = get8(ds);
+    if (!m->bpm || !m->notesperbeat) {
+        plog(LL_ERROR, "BPM and notes per beat must not be 0");
+        goto retfalse;
+    }
+
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Reading samples...");
+    #endif
+    {
+        unsigned ct = get8(ds);
+        if (ct) {
+            if (!(m->samples = calloc(ct, sizeof(*m->samples)))) PTM_LOAD_OOMERR(retfalse);
+            m->samplecount = ct;
+        }
+        for (unsigned i = 0; i < ct; ++i) {
+            struct ptm_sample* s = &m->samples[i];
+            if (!(s->name = getstr(ds))) PTM_LOAD_EOSERR(retfalse);
+            s->note = get8(ds);
+            s->rate = get32(ds);
+            s->loopstart = get32(ds);
+            s->loopend = get32(ds);
+            bool is16bit = get8(ds) & 1;
+            unsigned type = get8(ds);
+            s->len = get32(ds);
+            if (ds_bin_atend(ds)) PTM_LOAD_EOSERR(retfalse);
+            if (type >= PTM_SMPTYPE__COUNT) {
+                plog(LL_ERROR, "Invalid type on sample %u (%u)", i, type);
+                goto retfalse;
+            }
+            if (is16bit != (type == PTM_SMPTYPE_WAV_I16)) {
+                plog(LL_ERROR, "16-bit flag on sample %u does not match its type", i);
+                goto retfalse;
+            }
+            if (!s->rate) {
+                plog(LL_ERROR, "Sample %u has a rate of 0", i);
+                goto retfalse;
+            }
+            if (s->loopend > s->len) s->loopend = s->len;
+            if (!s->len) continue;
+            if (!(s->data = malloc(s->len * sizeof(*s->data)))) PTM_LOAD_OOMERR(retfalse);
+            if (type == PTM_SMPTYPE_WAV_I16) {
+                if (ds_bin_read(ds, s->len * 2, s->data) != s->len * 2) PTM_LOAD_EOSERR(retfalse);
+                #if BYTEORDER == BO_BE
+                for (uint32_t j = 0; j < s->len; ++j) s->data[j] = swaple16(s->data[j]);
+                #endif
+            } else {
+                // convert in place from the back so the bytes are not overwritten before they are read
+                uint8_t* d = (uint8_t*)s->data;
+                if (ds_bin_read(ds, s->len, d) != s->len) PTM_LOAD_EOSERR(retfalse);
+                uint32_t j = s->len;
+                while (j) {
+                    --j;
+                    s->data[j] = ((int)d[j] - 128) * 256;
+                }
+            }
+        }
+    }
+
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Reading instruments...");
+    #endif
+    {
+        unsigned ct = get8(ds);
+        if (ct) {
+            if (!(m->instruments = calloc(ct, sizeof(*m->instruments)))) PTM_LOAD_OOMERR(retfalse);
+            m->instrumentcount = ct;
+        }
+        for (unsigned i = 0; i < ct; ++i) {
+            struct ptm_instrument* in = &m->instruments[i];
+            if (!(in->name = getstr(ds))) PTM_LOAD_EOSERR(retfalse);
+            unsigned sct = get8(ds);
+            if (sct) {
+                if (!(in->samples = malloc(sct * sizeof(*in->samples)))) PTM_LOAD_OOMERR(retfalse);
+                in->samplecount = sct;
+                for (unsigned j = 0; j < sct; ++j) {
+                    in->samples[j].minnote = get8(ds);
+                    in->samples[j].sample = get8(ds);
+                    if (in->samples[j].sample >= m->samplecount) {
+                        plog(LL_ERROR, "Instrument %u refers to invalid sample %u", i, (unsigned)in->samples[j].sample);
+                        goto retfalse;
+                    }
+                }
+            }
+            in->attack = getf32(ds);
+            in->attackinfl = getf32(ds);
+            in->decay = getf32(ds);
+            in->decayinfl = getf32(ds);
+            in->sustain[0] = getf32(ds);
+            in->sustain[1] = getf32(ds);
+            in->sustaininfl[0] = getf32(ds);
+            in->sustaininfl[1] = getf32(ds);
+            in->release = getf32(ds);
+            in->releaseinfl = getf32(ds);
+            if (ds_bin_atend(ds)) PTM_LOAD_EOSERR(retfalse);
+        }
+    }
+
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Reading tracks...");
+    #endif
+    {
+        unsigned ct = get8(ds);
+        if (ds_bin_read(ds, (ct + 7) / 8, m->trackmask) != (ct + 7) / 8) PTM_LOAD_EOSERR(retfalse);
+        if (ct) {
+            if (!(m->tracks = malloc(ct * sizeof(*m->tracks)))) PTM_LOAD_OOMERR(retfalse);
+            m->trackcount = ct;
+        }
+        for (unsigned i = 0; i < ct; ++i) {
+            struct ptm_track* t = &m->tracks[i];
+            t->enabled = get8(ds) & 1;
+            t->instrument = get8(ds);
+            t->volume[0] = get8(ds);
+            t->volume[1] = get8(ds);
+            if (t->instrument >= m->instrumentcount && t->instrument != PTM_ALL) {
+                plog(LL_ERROR, "Track %u refers to invalid instrument %u", i, (unsigned)t->instrument);
+                goto retfalse;
+            }
+        }
+        if (ds_bin_atend(ds)) PTM_LOAD_EOSERR(retfalse);
+    }
+
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Reading groups...");
+    #endif
+    {
+        unsigned ct = get8(ds);
+        if (ct) {
+            if (!(m->groups = calloc(ct, sizeof(*m->groups)))) PTM_LOAD_OOMERR(retfalse);
+            m->groupcount = ct;
+        }
+        for (unsigned i = 0; i < ct; ++i) {
+            struct ptm_group* g = &m->groups[i];
+            if (!(g->name = getstr(ds))) PTM_LOAD_EOSERR(retfalse);
+            g->bpmmul = getf32(ds);
+            g->volmul[0] = getf32(ds);
+            g->volmul[1] = getf32(ds);
+            unsigned masksz = (m->trackcount + 7) / 8;
+            if (ds_bin_read(ds, masksz, g->trackmask) != masksz) PTM_LOAD_EOSERR(retfalse);
+            if (!(g->bpmmul > 0.0f)) {
+                plog(LL_ERROR, "Group %u has an invalid BPM multiplier", i);
+                goto retfalse;
+            }
+        }
+    }
+
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Reading patterns...");
+    #endif
+    {
+        unsigned ct = get8(ds);
+        if (ct) {
+            if (!(m->patterns = calloc(ct, sizeof(*m->patterns)))) PTM_LOAD_OOMERR(retfalse);
+            m->patterncount = ct;
+        }
+        for (unsigned i = 0; i < ct; ++i) {
+            struct ptm_pattern* p = &m->patterns[i];
+            p->duration = get8(ds) + 1;
+            unsigned gct = get8(ds);
+            if (gct) {
+                if (!(p->gcmds = malloc(gct * sizeof(*p->gcmds)))) PTM_LOAD_OOMERR(retfalse);
+                p->gcmdcount = gct;
+                for (unsigned j = 0; j < gct; ++j) {
+                    struct ptm_gcmd* c = &p->gcmds[j];
+                    unsigned type = get8(ds);
+                    c->value = get8(ds);
+                    c->duration = get8(ds) + 1;
+                    if (type >= PTM_GCMD__COUNT) {
+                        plog(LL_ERROR, "Invalid global command on pattern %u (%u)", i, type);
+                        goto retfalse;
+                    }
+                    c->type = type;
+                }
+            }
+            if (!m->trackcount) continue;
+            if (!(p->tracks = calloc(m->trackcount, sizeof(*p->tracks)))) PTM_LOAD_OOMERR(retfalse);
+            for (unsigned j = 0; j < m->trackcount; ++j) {
+                struct ptm_trackdata* t = &p->tracks[j];
+                unsigned nct = get8(ds) + 1;
+                if (!(t->notes = malloc(nct * sizeof(*t->notes)))) PTM_LOAD_OOMERR(retfalse);
+                t->notecount = nct;
+                unsigned lcmdsize = 0;
+                unsigned lcmdct = 0;
+                for (unsigned k = 0; k < nct; ++k) {
+                    struct ptm_note* n = &t->notes[k];
+                    n->note = (int8_t)get8(ds);
+                    n->duration = get8(ds) + 1;
+                    n->lcmdcount = get8(ds);
+                    n->lcmd = lcmdct;
+                    if (!n->lcmdcount) continue;
+                    if (lcmdct + n->lcmdcount > lcmdsize) {
+                        lcmdsize = (lcmdsize) ? lcmdsize * 2 : 8;
+                        while (lcmdct + n->lcmdcount > lcmdsize) lcmdsize *= 2;
+                        struct ptm_lcmd* tmp = realloc(t->lcmds, lcmdsize * sizeof(*t->lcmds));
+                        if (!tmp) PTM_LOAD_OOMERR(retfalse);
+                        t->lcmds = tmp;
+                    }
+                    for (unsigned l = 0; l < n->lcmdcount; ++l) {
+                        struct ptm_lcmd* c = &t->lcmds[lcmdct++];
+                        unsigned type = get8(ds);
+                        c->value = get8(ds);
+                        if (type >= PTM_LCMD__COUNT) {
+                            plog(LL_ERROR, "Invalid local command on pattern %u, track %u (%u)", i, j, type);
+                            goto retfalse;
+                        }
+                        c->type = type;
+                        if (c->type == PTM_LCMD_INSTR && c->value >= m->instrumentcount && c->value != PTM_ALL) {
+                            plog(LL_ERROR, "Pattern %u, track %u refers to invalid instrument %u", i, j, (unsigned)c->value);
+                            goto retfalse;
+                        }
+                    }
+                }
+            }
+            if (ds_bin_atend(ds)) PTM_LOAD_EOSERR(retfalse);
+        }
+    }
+
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG | LF_FUNC, "Reading sequence...");
+    #endif
+    {
+        unsigned len = get8(ds);
+        m->loopindex = get8(ds);
+        if (len) {
+            if (!(m->sequence = malloc(len))) PTM_LOAD_OOMERR(retfalse);
+            m->sequencelen = len;
+            if (ds_bin_read(ds, len, m->sequence) != len) PTM_LOAD_EOSERR(retfalse);
+            for (unsigned i = 0; i < len; ++i) {
+                if (m->sequence[i] >= m->patterncount) {
+                    plog(LL_ERROR, "Sequence index %u refers to invalid pattern %u", i, (unsigned)m->sequence[i]);
+                    goto retfalse;
+                }
+            }
+            if (m->loopindex >= len) {
+                plog(LL_ERROR, "Loop index %u is past the end of the sequence", (unsigned)m->loopindex);
+                goto retfalse;
+            }
+        }
+        if (ds_bin_atend(ds)) PTM_LOAD_EOSERR(retfalse);
+    }
+
+    return true;
+
+    retfalse:;
+    ptm_free(m);
+    return false;
+}
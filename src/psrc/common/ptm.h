@@ -0,0 +1,158 @@
+#ifndef PSRC_COMMON_PTM_H
+#define PSRC_COMMON_PTM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "datastream.h"
+
+#include "../attribs.h"
+
+#define PTM_VER 0
+
+#define PTM_NOTE_SILENCE (-128)
+#define PTM_ALL 0xFF // track for the track commands and instrument for PTM_LCMD_INSTR
+
+// struct member order is sorted by type size
+
+struct ptm;
+struct ptm_sample;
+    PACKEDENUM ptm_smptype {
+        PTM_SMPTYPE_WAV_U8,
+        PTM_SMPTYPE_WAV_I16,
+        PTM_SMPTYPE__COUNT
+    };
+struct ptm_instrument;
+struct ptm_instrsample;
+struct ptm_track;
+struct ptm_group;
+struct ptm_pattern;
+struct ptm_gcmd;
+    PACKEDENUM ptm_gcmdtype {
+        PTM_GCMD_VOL,
+        PTM_GCMD_VOL_L,
+        PTM_GCMD_VOL_R,
+        PTM_GCMD_GLIDEVOL,
+        PTM_GCMD_GLIDEVOL_L,
+        PTM_GCMD_GLIDEVOL_R,
+        PTM_GCMD_VOLGLIDESPEED,
+        PTM_GCMD_BPM,
+        PTM_GCMD_GLIDEBPM,
+        PTM_GCMD_BPMGLIDESPEED,
+        PTM_GCMD_ENABLETRACK,
+        PTM_GCMD_DISABLETRACK,
+        PTM_GCMD_TOGGLETRACK,
+        PTM_GCMD__COUNT
+    };
+struct ptm_trackdata;
+struct ptm_note;
+struct ptm_lcmd;
+    PACKEDENUM ptm_lcmdtype {
+        PTM_LCMD_VOL,
+        PTM_LCMD_VOL_L,
+        PTM_LCMD_VOL_R,
+        PTM_LCMD_GLIDEVOL,
+        PTM_LCMD_GLIDEVOL_L,
+        PTM_LCMD_GLIDEVOL_R,
+        PTM_LCMD_VOLGLIDESPEED,
+        PTM_LCMD_PITCH,
+        PTM_LCMD_GLIDEPITCH,
+        PTM_LCMD_PITCHGLIDESPEED,
+        PTM_LCMD_INSTR,
+        PTM_LCMD__COUNT
+    };
+
+struct ptm {
+    uint8_t trackmask[32]; // tracks enabled at the start
+    struct ptm_sample* samples;
+    struct ptm_instrument* instruments;
+    struct ptm_track* tracks;
+    struct ptm_group* groups;
+    struct ptm_pattern* patterns;
+    uint8_t* sequence; // pattern indices
+    char* name;
+    char* author;
+    char* comments;
+    uint8_t bpm;
+    uint8_t notesperbeat;
+    uint8_t samplecount;
+    uint8_t instrumentcount;
+    uint8_t trackcount;
+    uint8_t groupcount;
+    uint8_t patterncount;
+    uint8_t sequencelen;
+    uint8_t loopindex;
+};
+
+struct ptm_sample {
+    char* name;
+    int16_t* data; // converted to signed 16-bit
+    uint32_t rate;
+    uint32_t loopstart;
+    uint32_t loopend; // exclusive, no loop if not after 'loopstart'
+    uint32_t len; // in samples
+    uint8_t note; // half steps from C0 that the sample plays at its rate
+};
+
+// Envelope times are in seconds, and the sustain volume is from 0 to 1 for left and right. The note influences
+// scale each value by 2^(influence * (note - PTM_INFLUENCE_NOTE) / 12), so an influence of -1 halves the time an
+// octave up.
+#define PTM_INFLUENCE_NOTE 48 // C4
+struct ptm_instrument {
+    char* name;
+    struct ptm_instrsample* samples; // sorted from highest to lowest minimum note
+    float attack, attackinfl;
+    float decay, decayinfl;
+    float sustain[2], sustaininfl[2];
+    float release, releaseinfl;
+    uint8_t samplecount;
+};
+struct ptm_instrsample {
+    uint8_t minnote;
+    uint8_t sample;
+};
+
+struct ptm_track {
+    uint8_t volume[2];
+    uint8_t instrument;
+    bool enabled;
+};
+
+struct ptm_group {
+    char* name;
+    float bpmmul;
+    float volmul[2];
+    uint8_t trackmask[32];
+};
+
+struct ptm_pattern {
+    struct ptm_gcmd* gcmds;
+    struct ptm_trackdata* tracks; // one per track in 'struct ptm'
+    uint16_t duration; // in notes
+    uint8_t gcmdcount;
+};
+struct ptm_gcmd {
+    uint16_t duration; // notes until the next command
+    enum ptm_gcmdtype type;
+    uint8_t value;
+};
+struct ptm_trackdata {
+    struct ptm_note* notes;
+    struct ptm_lcmd* lcmds;
+    uint16_t notecount;
+};
+struct ptm_note {
+    uint16_t lcmd; // index of the first in the track data's 'lcmds'
+    uint16_t duration;
+    int8_t note; // PTM_NOTE_SILENCE, or any other negative value to keep playing the last note
+    uint8_t lcmdcount;
+};
+struct ptm_lcmd {
+    enum ptm_lcmdtype type;
+    uint8_t value;
+};
+
+bool ptm_load(struct datastream*, struct ptm*);
+void ptm_free(struct ptm*);
+
+#endif
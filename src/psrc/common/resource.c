@@ -22,6 +22,7 @@
         #include "../../minimp3/minimp3_ex.h"
     #endif
     #include "../engine/ptf.h"
+    #include "../engine/audiomix.h"
 #endif
 
 #if PLATFORM == PLAT_NXDK || PLATFORM == PLAT_GDK
@@ -54,8 +55,10 @@ static const char* const rctypenames[RC__COUNT] = {
     "font",
     "map",
     "model",
+    "music",
     "script",
     "sound",
+    "soundbank",
     "texture",
     "values"
 };
@@ -65,8 +68,10 @@ static const char* const* const rcextensions[RC__COUNT] = {
     (const char* const[]){"ttf", "otf", NULL},
     (const char* const[]){"pmf", NULL},
     (const char* const[]){"p3m", NULL},
+    (const char* const[]){"ptm", NULL},
     (const char* const[]){"bas", NULL},
     (const char* const[]){"ogg", "mp3", "wav", NULL},
+    (const char* const[]){"psb", NULL},
     (const char* const[]){"ptf", "png", "jpg", "tga", "bmp", NULL},
     (const char* const[]){"txt", NULL}
 };
@@ -109,6 +114,11 @@ struct resource {
             struct rcopt_model model_opt;
             void* model_end;
         };
+        struct {
+            struct rc_music music;
+            //struct rcopt_music music_opt;
+            void* music_end;
+        };
         struct {
             struct rc_script script;
             struct rcopt_script script_opt;
@@ -119,6 +129,11 @@ struct resource {
             struct rcopt_sound sound_opt;
             void* sound_end;
         };
+        struct {
+            struct rc_soundbank soundbank;
+            //struct rcopt_soundbank soundbank_opt;
+            void* soundbank_end;
+        };
         struct {
             struct rc_texture texture;
             struct rcopt_texture texture_opt;
@@ -137,8 +152,10 @@ static const size_t rcallocsz[RC__COUNT] = {
     offsetof(struct resource, font_end),
     offsetof(struct resource, map_end),
     offsetof(struct resource, model_end),
+    offsetof(struct resource, music_end),
     offsetof(struct resource, script_end),
     offsetof(struct resource, sound_end),
+    offsetof(struct resource, soundbank_end),
     offsetof(struct resource, texture_end),
     offsetof(struct resource, values_end)
 };
@@ -159,8 +176,10 @@ static const void* const defaultrcopts[RC__COUNT] = {
     NULL,
     &(struct rcopt_map){0},
     &(struct rcopt_model){0},
+    NULL,
     &(struct rcopt_script){0},
-    &(struct rcopt_sound){true},
+    &(struct rcopt_sound){true, 0},
+    NULL,
     &(struct rcopt_texture){false, RCOPT_TEXTURE_QLT_HIGH},
     NULL
 };
@@ -693,6 +712,9 @@ static inline bool cmpRcOpt(enum rctype type, struct resource* rc, const void* o
         case RC_MODEL: {
             if (((const struct rcopt_model*)opt)->flags != rc->model_opt.flags) return false;
         } return true;
+        case RC_SOUND: {
+            if (((const struct rcopt_sound*)opt)->resample != rc->sound_opt.resample) return false;
+        } return true;
         case RC_TEXTURE: {
             if (((const struct rcopt_texture*)opt)->needsalpha != rc->texture_opt.needsalpha) return false;
             if (((const struct rcopt_texture*)opt)->quality != rc->texture_opt.quality) return false;
@@ -933,6 +955,65 @@ static struct resource* newRc(enum rctype type) {
     #endif
     return rc;
 }
+#ifndef PSRC_MODULE_SERVER
+static void resampleSound(struct resource* rc, const struct rcopt_sound* o, enum rcprefix prefix, const char* path) {
+    if (!o->resample || rc->sound.format != RC_SOUND_FRMT_WAV || rc->sound.freq == o->resample) return;
+    int len;
+    int16_t* data = audiomix_resample(
+        rc->sound.data, rc->sound.is8bit, rc->sound.len, rc->sound.channels,
+        rc->sound.freq, o->resample, &len
+    );
+    if (!data) {
+        plog(LL_WARN, "Failed to resample sound '%s:%s'", rcprefixnames[prefix], path);
+        return;
+    }
+    if (rc->sound.bank) unlockRc(rc->sound.bank);
+    else if (rc->sound.sdlfree) SDL_FreeWAV(rc->sound.data);
+    else free(rc->sound.data);
+    rc->sound.data = (uint8_t*)data;
+    rc->sound.len = len;
+    rc->sound.size = len * rc->sound.channels * sizeof(*data);
+    rc->sound.freq = o->resample;
+    rc->sound.is8bit = false;
+    rc->sound.sdlfree = 0;
+    rc->sound.bank = NULL;
+}
+// makes a sound that points into the clip from the bank named after the directory in 'path'
+static struct resource* getBankedSound(enum rcprefix prefix, const char* path, const struct rcopt_sound* o) {
+    if (prefix == RCPREFIX_NATIVE) return NULL;
+    const char* name = strrchr(path, '/');
+    if (!name || name == path || !name[1]) return NULL;
+    struct charbuf cb;
+    cb_init(&cb, 64);
+    cb_addstr(&cb, rcprefixnames[prefix]);
+    cb_add(&cb, ':');
+    cb_addpartstr(&cb, path, name - path);
+    ++name;
+    struct rc_soundbank* bank = getRc(RC_SOUNDBANK, cb_peek(&cb), NULL, 0, NULL);
+    cb_dump(&cb);
+    if (!bank) return NULL;
+    const struct psb_clip* c = psb_find(&bank->bank, name);
+    if (!c) {
+        unlockRc(bank);
+        return NULL;
+    }
+    struct resource* rc = newRc(RC_SOUND);
+    rc->sound.format = RC_SOUND_FRMT_WAV;
+    rc->sound.data = (uint8_t*)c->samples;
+    rc->sound.len = c->len;
+    rc->sound.channels = c->stereo + 1;
+    rc->sound.size = c->len * rc->sound.channels * sizeof(*c->samples);
+    rc->sound.freq = c->rate;
+    rc->sound.stereo = c->stereo;
+    rc->sound.is8bit = false;
+    rc->sound.sdlfree = 0;
+    rc->sound.bank = bank; // keeps the reference from getRc
+    rc->sound_opt = *o;
+    resampleSound(rc, o, prefix, path);
+    return rc;
+}
+#endif
+
 void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, struct charbuf* err) {
     enum rcprefix prefix;
     char* path = rcIdToPath(id, flags & LOADRC_FLAG_ALLOWNATIVE, &prefix);
@@ -979,6 +1060,9 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
     #endif
     struct rcaccess acc;
     if (!getRcAcc(type, prefix, path, pathcrc, &acc)) {
+        #ifndef PSRC_MODULE_SERVER
+        if (type == RC_SOUND && (rc = getBankedSound(prefix, path, (opt) ? opt : defaultrcopts[type]))) goto found;
+        #endif
         plog(LL_ERROR, "Failed to find %s '%s:%s'", rctypenames[type], rcprefixnames[prefix], path);
         free(path);
         return NULL;
@@ -1015,6 +1099,20 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
             rc->model.model = m;
             rc->model_opt = *o;
         } break;
+        #ifndef PSRC_MODULE_SERVER
+        case RC_MUSIC: {
+            struct datastream ds;
+            if (!dsFromRcAcc(&acc, &ds)) goto fail;
+            struct ptm m;
+            if (!ptm_load(&ds, &m)) {
+                ds_close(&ds);
+                goto fail;
+            }
+            ds_close(&ds);
+            rc = newRc(RC_MUSIC);
+            rc->music.music = m;
+        } break;
+        #endif
         case RC_SCRIPT: {
             if (acc.src != RCSRC_FS) goto fail;
             const struct rcopt_script* o = opt;
@@ -1031,7 +1129,7 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
             if (acc.src != RCSRC_FS) goto fail;
             const struct rcopt_sound* o = opt;
             if (acc.ext == rcextensions[RC_SOUND][0]) {
-                if (o->decodewhole) {
+                if (o->decodewhole || o->resample) {
                     stb_vorbis* v = stb_vorbis_open_filename(acc.fs.path, NULL, NULL);
                     if (!v) goto fail;
                     rc = newRc(RC_SOUND);
@@ -1077,7 +1175,7 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
             } else if (acc.ext == rcextensions[RC_SOUND][1]) {
                 #ifdef PSRC_USEMINIMP3
                 mp3dec_ex_t* m = rcmgr_malloc(sizeof(*m));
-                if (o->decodewhole) {
+                if (o->decodewhole || o->resample) {
                     if (mp3dec_ex_open(m, acc.fs.path, MP3D_SEEK_TO_SAMPLE)) {free(m); goto fail;}
                     rc = newRc(RC_SOUND);
                     rc->sound.format = RC_SOUND_FRMT_WAV;
@@ -1118,7 +1216,6 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
                     rc->sound.stereo = (m->info.channels > 1);
                     rc->sound_opt = *o;
                     mp3dec_ex_close(m);
-                    free(data);
                 }
                 free(m);
                 #else
@@ -1187,6 +1284,34 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
                     goto fail;
                 }
             }
+            if (rc) {
+                rc->sound.bank = NULL;
+                resampleSound(rc, o, prefix, path);
+            }
+        } break;
+        case RC_SOUNDBANK: {
+            if (acc.src != RCSRC_FS) goto fail;
+            // the whole bank in one read, the clips are used in place
+            FILE* f = fopen(acc.fs.path, "rb");
+            if (!f) goto fail;
+            fseek(f, 0, SEEK_END);
+            long sz = ftell(f);
+            if (sz <= 0) {fclose(f); goto fail;}
+            uint8_t* data = rcmgr_malloc(sz);
+            fseek(f, 0, SEEK_SET);
+            if (fread(data, 1, sz, f) != (size_t)sz) {
+                fclose(f);
+                free(data);
+                goto fail;
+            }
+            fclose(f);
+            struct psb b;
+            if (!psb_load(data, sz, &b)) {
+                free(data);
+                goto fail;
+            }
+            rc = newRc(RC_SOUNDBANK);
+            rc->soundbank.bank = b;
         } break;
         case RC_TEXTURE: {
             const struct rcopt_texture* o = opt;
@@ -1301,6 +1426,9 @@ void* getRc(enum rctype type, const char* id, const void* opt, unsigned flags, s
         default: goto fail;
     }
     delRcAcc(&acc);
+    #ifndef PSRC_MODULE_SERVER
+    found:;
+    #endif
     rc->header.prefix = prefix;
     rc->header.path = path;
     rc->header.pathcrc = pathcrc;
@@ -1331,18 +1459,39 @@ static inline void freeRcHeader(struct rcheader* rh) {
     free(rh->path);
 }
 
+static void rlsRc_nolock(void* rp) {
+    struct resource* rc = (void*)((char*)rp - offsetof(struct resource, data));
+    if (!--rc->header.refs) {
+        enum rctype type = rc->header.type;
+        rc->header.zreftick = rctick;
+        rcgroups[type].pages[rc->header.index / 16].zref |= 1 << (rc->header.index % 16);
+        ++rcgroups[type].zrefct;
+    }
+}
+
 static void freeRcData(enum rctype type, struct resource* rc) {
     switch (type) {
         case RC_MODEL: {
             p3m_free(&rc->model.model);
         } break;
+        #ifndef PSRC_MODULE_SERVER
+        case RC_MUSIC: {
+            ptm_free(&rc->music.music);
+        } break;
+        #endif
         case RC_SCRIPT: {
             //pb_deletescript(&rc->script.script);
         } break;
         case RC_SOUND: {
-            if (rc->sound.format == RC_SOUND_FRMT_WAV && rc->sound.sdlfree) SDL_FreeWAV(rc->sound.data);
+            if (rc->sound.bank) rlsRc_nolock(rc->sound.bank);
+            else if (rc->sound.format == RC_SOUND_FRMT_WAV && rc->sound.sdlfree) SDL_FreeWAV(rc->sound.data);
             else free(rc->sound.data);
         } break;
+        #ifndef PSRC_MODULE_SERVER
+        case RC_SOUNDBANK: {
+            psb_free(&rc->soundbank.bank);
+        } break;
+        #endif
         case RC_TEXTURE: {
             free(rc->texture.data);
         } break;
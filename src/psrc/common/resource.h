@@ -4,6 +4,8 @@
 #include "config.h"
 #include "pbasic.h"
 #include "p3m.h"
+#include "ptm.h"
+#include "psb.h"
 #include "string.h"
 #include "versioning.h"
 
@@ -30,8 +32,10 @@ PACKEDENUM rctype {
     RC_FONT,
     RC_MAP,
     RC_MODEL,
+    RC_MUSIC,
     RC_SCRIPT,
     RC_SOUND,
+    RC_SOUNDBANK,
     RC_TEXTURE,
     RC_VALUES,
     RC__COUNT,
@@ -42,8 +46,10 @@ struct rc_config;
 struct rc_font;
 struct rc_map;
 struct rc_model;
+struct rc_music;
 struct rc_script;
 struct rc_sound;
+struct rc_soundbank;
 struct rc_texture;
 struct rc_values;
 
@@ -56,8 +62,10 @@ struct rcopt_map;
         RCOPT_MAP_LOADSECT_SERVER,
     };
 struct rcopt_model;
+//struct rcopt_music;
 struct rcopt_script;
 struct rcopt_sound;
+//struct rcopt_soundbank;
 struct rcopt_texture;
     enum rcopt_texture_qlt {
         RCOPT_TEXTURE_QLT_HIGH, // 1x size
@@ -99,6 +107,11 @@ struct rcopt_model {
 };
 #pragma pack(pop)
 
+// RC_MUSIC
+struct rc_music {
+    struct ptm music;
+};
+
 // RC_SCRIPT
 struct rc_script {
     struct pb_script script;
@@ -125,13 +138,22 @@ struct rc_sound {
     uint8_t stereo : 1;
     uint8_t is8bit : 1; // data is AUDIO_S8 instead of AUDIO_S16SYS for FRMT_WAV
     uint8_t sdlfree : 1; // use SDL_FreeWAV
+    struct rc_soundbank* bank; // if not NULL, 'data' points into this bank and is not freed
 };
 #pragma pack(push, 1)
 struct rcopt_sound {
     bool decodewhole;
+    int resample; // if not 0, decode the whole sound and resample it to this rate so it can be mixed without resampling
 };
 #pragma pack(pop)
 
+// RC_SOUNDBANK
+// Sounds that are not found as files are looked for in a bank named after the directory they would be in, so
+// 'sounds/ui/click' can come from the clip 'click' in 'sounds/ui.psb'.
+struct rc_soundbank {
+    struct psb bank;
+};
+
 // RC_TEXTURE
 enum rc_texture_frmt {
     RC_TEXTURE_FRMT_RGB = 3,
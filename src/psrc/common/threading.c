@@ -9,6 +9,15 @@
 
 #include "../glue.h"
 
+#if !(PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USESTDTHREAD)
+    #include <sched.h>
+    #if PLATFORM == PLAT_LINUX || PLATFORM == PLAT_ANDROID
+        #include <sys/resource.h>
+        #include <sys/syscall.h>
+        #include <unistd.h>
+    #endif
+#endif
+
 #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD) && !defined(PSRC_COMMON_THREADING_USESTDTHREAD)
 DWORD WINAPI threadwrapper(LPVOID t) {
     ((thread_t*)t)->ret = ((thread_t*)t)->func(&((thread_t*)t)->data);
@@ -22,6 +31,49 @@ static int threadwrapper(void* t) {
     return 0;
 }
 #else
+// runs on the new thread, since Linux only lets a thread's own nice value be changed by its TID
+static void setattr(thread_t* t) {
+    bool high = (t->attr.prio == THREADPRIO_HIGH);
+    if (t->attr.prio == THREADPRIO_REALTIME) {
+        #if defined(SCHED_FIFO)
+        struct sched_param p = {.sched_priority = (sched_get_priority_min(SCHED_FIFO) + sched_get_priority_max(SCHED_FIFO)) / 2};
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &p)) {
+            #if DEBUG(1)
+            plog(LL_INFO | LF_DEBUG, "Thread %s could not be made real-time", (t->name) ? t->name : "(null)");
+            #endif
+            high = true;
+        }
+        #else
+        high = true;
+        #endif
+    }
+    #if PLATFORM == PLAT_LINUX || PLATFORM == PLAT_ANDROID
+    if (high || t->attr.prio == THREADPRIO_LOW) {
+        if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), (high) ? -10 : 10)) {
+            #if DEBUG(1)
+            plog(LL_INFO | LF_DEBUG, "Failed to set priority of thread %s", (t->name) ? t->name : "(null)");
+            #endif
+        }
+    }
+    #else
+    (void)high;
+    #endif
+    #if defined(__GLIBC__)
+    if (t->attr.affinity) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int i = 0; i < 64 && i < CPU_SETSIZE; ++i) {
+            if (t->attr.affinity & ((uint64_t)1 << i)) CPU_SET(i, &set);
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            #if DEBUG(1)
+            plog(LL_INFO | LF_DEBUG, "Failed to set CPU affinity of thread %s", (t->name) ? t->name : "(null)");
+            #endif
+        }
+    }
+    #endif
+}
+
 static void* threadwrapper(void* t) {
     #ifndef PSRC_COMMON_THREADING_NONAMES
         #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
@@ -36,17 +88,20 @@ static void* threadwrapper(void* t) {
             #endif
         #endif
     #endif
+    setattr(t);
     ((thread_t*)t)->ret = ((thread_t*)t)->func(&((thread_t*)t)->data);
     pthread_exit(((thread_t*)t)->ret);
     return ((thread_t*)t)->ret;
 }
 #endif
 
-bool createThread(thread_t* t, const char* n, threadfunc_t f, void* a) {
+bool createThread(thread_t* t, const char* n, const struct threadattr* attr, threadfunc_t f, void* a) {
     #if DEBUG(1)
     plog(LL_INFO | LF_DEBUG, "Starting thread %s...", (n) ? n : "(null)");
     #endif
     t->name = (n) ? strdup(n) : NULL;
+    if (attr) t->attr = *attr;
+    else t->attr = (struct threadattr){0};
     t->func = f;
     t->data.self = t;
     t->data.args = a;
@@ -68,6 +123,27 @@ bool createThread(thread_t* t, const char* n, threadfunc_t f, void* a) {
         #endif
         return false;
     }
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD) && !defined(PSRC_COMMON_THREADING_USESTDTHREAD)
+    if (t->attr.prio != THREADPRIO_NORMAL) {
+        static const int prios[] = {
+            [THREADPRIO_LOW] = THREAD_PRIORITY_BELOW_NORMAL,
+            [THREADPRIO_HIGH] = THREAD_PRIORITY_ABOVE_NORMAL,
+            [THREADPRIO_REALTIME] = THREAD_PRIORITY_TIME_CRITICAL
+        };
+        if (!SetThreadPriority(t->thread, prios[t->attr.prio])) {
+            #if DEBUG(1)
+            plog(LL_INFO | LF_DEBUG, "Failed to set priority of thread %s", (n) ? n : "(null)");
+            #endif
+        }
+    }
+    #if PLATFORM != PLAT_NXDK
+    if (t->attr.affinity && !SetThreadAffinityMask(t->thread, (DWORD_PTR)t->attr.affinity)) {
+        #if DEBUG(1)
+        plog(LL_INFO | LF_DEBUG, "Failed to set CPU affinity of thread %s", (n) ? n : "(null)");
+        #endif
+    }
+    #endif
+    #endif
     #if DEBUG(1)
     plog(LL_INFO | LF_DEBUG, "Started thread %s", (n) ? n : "(null)");
     #endif
@@ -13,11 +13,25 @@
         #include <windows.h>
     #else
         #include <pthread.h>
+        #include <time.h>
     #endif
 #else
     #include <threads.h>
+    #include <time.h>
 #endif
 
+enum threadprio {
+    THREADPRIO_NORMAL,
+    THREADPRIO_LOW,
+    THREADPRIO_HIGH,
+    THREADPRIO_REALTIME, // falls back to THREADPRIO_HIGH if the OS does not allow it
+};
+// best effort, failing to apply these does not stop the thread from starting
+struct threadattr {
+    enum threadprio prio;
+    uint64_t affinity; // bitmask of CPUs the thread may run on, or 0 for any
+};
+
 struct thread_t;
 struct thread_data {
     struct thread_t* self;
@@ -36,6 +50,7 @@ typedef struct thread_t {
     thrd_t thread;
     #endif
     char* name;
+    struct threadattr attr;
     threadfunc_t func;
     struct thread_data data;
     void* ret;
@@ -49,12 +64,29 @@ typedef pthread_mutex_t mutex_t;
 #else
 typedef mtx_t mutex_t;
 #endif
+#ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+#if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+typedef CONDITION_VARIABLE cond_t;
+#else
+typedef pthread_cond_t cond_t;
+#endif
+#else
+typedef cnd_t cond_t;
+#endif
 struct accesslock {
     volatile int counter; // TODO: make atomic
     mutex_t lock;
 };
 
-bool createThread(thread_t*, const char* name, threadfunc_t func, void* args);
+// for lock-free handoffs between threads
+#define atomicLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomicStore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomicFence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define atomicAdd(p, v) __atomic_add_fetch((p), (v), __ATOMIC_ACQ_REL) // returns the new value
+// weak, so it may fail spuriously and has to be retried in a loop; 'e' is updated to the current value on failure
+#define atomicCmpXchg(p, e, v) __atomic_compare_exchange_n((p), (e), (v), true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+bool createThread(thread_t*, const char* name, const struct threadattr* attr /*can be NULL*/, threadfunc_t func, void* args);
 void quitThread(thread_t*);
 void destroyThread(thread_t*, void** ret);
 
@@ -120,6 +152,92 @@ static inline void destroyMutex(mutex_t* m) {
     #endif
 }
 
+static inline bool createCond(cond_t* c) {
+    #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+    InitializeConditionVariable(c);
+    return true;
+    #else
+    return !pthread_cond_init(c, NULL);
+    #endif
+    #else
+    return (cnd_init(c) == thrd_success);
+    #endif
+}
+// 'm' must be locked, can wake up spuriously
+static inline void waitCond(cond_t* c, mutex_t* m) {
+    #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+    SleepConditionVariableCS(c, m, INFINITE);
+    #else
+    pthread_cond_wait(c, m);
+    #endif
+    #else
+    cnd_wait(c, m);
+    #endif
+}
+// same as waitCond, but gives up after about 'ms' milliseconds
+static inline void waitCondTimeout(cond_t* c, mutex_t* m, unsigned ms) {
+    #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+    SleepConditionVariableCS(c, m, ms);
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(c, m, &ts);
+    #endif
+    #else
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    cnd_timedwait(c, m, &ts);
+    #endif
+}
+static inline void signalCond(cond_t* c) {
+    #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+    WakeConditionVariable(c);
+    #else
+    pthread_cond_signal(c);
+    #endif
+    #else
+    cnd_signal(c);
+    #endif
+}
+static inline void broadcastCond(cond_t* c) {
+    #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+    WakeAllConditionVariable(c);
+    #else
+    pthread_cond_broadcast(c);
+    #endif
+    #else
+    cnd_broadcast(c);
+    #endif
+}
+static inline void destroyCond(cond_t* c) {
+    #ifndef PSRC_COMMON_THREADING_USESTDTHREAD
+    #if (PLATFLAGS & PLATFLAG_WINDOWSLIKE) && !defined(PSRC_COMMON_THREADING_USEWINPTHREAD)
+    (void)c;
+    #else
+    pthread_cond_destroy(c);
+    #endif
+    #else
+    cnd_destroy(c);
+    #endif
+}
+
 static inline bool createAccessLock(struct accesslock* a) {
     if (!createMutex(&a->lock)) return false;
     a->counter = 0;
@@ -178,6 +296,15 @@ static inline void yieldReadAccess(struct accesslock* a) {
     unlockMutex(&a->lock);
 }
 
+#else
+
+// single threaded, so plain accesses are enough
+#define atomicLoad(p) (*(p))
+#define atomicStore(p, v) ((void)(*(p) = (v)))
+#define atomicFence() ((void)0)
+#define atomicAdd(p, v) (*(p) += (v))
+#define atomicCmpXchg(p, e, v) ((*(p) == *(e)) ? (*(p) = (v), true) : (*(e) = *(p), false))
+
 #endif
 
 #endif
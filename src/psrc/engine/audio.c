@@ -1,6 +1,7 @@
 #include "../rcmgralloc.h"
 
 #include "audio.h"
+#include "audiomix.h"
 
 #undef newAudioEmitter
 #undef editAudioEmitter
@@ -10,6 +11,8 @@
 #include "../common/logging.h"
 #include "../common/string.h"
 #include "../common/time.h"
+#include "../common/filesystem.h"
+#include "../common/byteorder.h"
 
 #include "../common.h"
 #include "../debug.h"
@@ -17,10 +20,32 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <math.h>
+#include <string.h>
 
 struct audiostate audiostate;
 
+#ifndef PSRC_NOMT
+static void decahead_wake(void) {
+    lockMutex(&audiostate.decahead.lock);
+    audiostate.decahead.woken = true;
+    signalCond(&audiostate.decahead.wake);
+    unlockMutex(&audiostate.decahead.lock);
+}
+#endif
+
 static inline void stopSound_inline(struct audiosound* s) {
+    #ifndef PSRC_NOMT
+    // the decode thread frees it
+    if (s->decahead) {
+        if (s->decblk.blk) {
+            atomicAdd(&s->decblk.blk->refs, -1);
+            s->decblk.blk = NULL;
+        }
+        atomicStore(&s->decahead->stop, 1);
+        s->decahead = NULL;
+        decahead_wake();
+    }
+    #endif
     switch ((uint8_t)s->rc->format) {
         case RC_SOUND_FRMT_VORBIS: {
             stb_vorbis_close(s->vorbis);
@@ -40,7 +65,193 @@ static inline void stopSound_inline(struct audiosound* s) {
 }
 static inline void stop3DSound_inline(struct audiosound_3d* s) {
     stopSound_inline(&s->data);
-    --audiostate.emitters.data[s->emitter].uses;
+    struct audioemitter* e = &audiostate.emitters.data[s->emitter];
+    if (!--e->uses) {
+        e->sndrange = 0.0f;
+        e->sndoff = 0.0f;
+        if (e->reach >= audiostate.emitgrid.maxreach) audiostate.emitgrid.maxreachdirty = true;
+        e->reach = 0.0f;
+    }
+}
+
+static inline int emitgrid_tocell(float v) {
+    v = floorf(v / AUDIO_EMITGRIDCELL);
+    if (!(v > -1048576.0f)) return -1048576; // also catches NaN
+    if (v > 1048576.0f) return 1048576;
+    return v;
+}
+static inline unsigned emitgrid_hash(int x, int y, int z) {
+    return ((unsigned)x * 73856093u ^ (unsigned)y * 19349663u ^ (unsigned)z * 83492791u) & (AUDIO_EMITGRIDBUCKETS - 1);
+}
+static void emitgrid_remove(int ei) {
+    struct audioemitter* e = &audiostate.emitters.data[ei];
+    if (!e->ingrid) return;
+    int* p = &audiostate.emitgrid.buckets[emitgrid_hash(e->cell[0], e->cell[1], e->cell[2])];
+    while (*p != ei) p = &audiostate.emitters.data[*p].gridnext;
+    *p = e->gridnext;
+    e->ingrid = false;
+    if (e->reach >= audiostate.emitgrid.maxreach) audiostate.emitgrid.maxreachdirty = true;
+}
+// call after the emitter's position, range, or sounds change
+static void emitgrid_update(int ei) {
+    struct audioemitter* e = &audiostate.emitters.data[ei];
+    int cell[3] = {emitgrid_tocell(e->pos[0]), emitgrid_tocell(e->pos[1]), emitgrid_tocell(e->pos[2])};
+    if (!e->ingrid || cell[0] != e->cell[0] || cell[1] != e->cell[1] || cell[2] != e->cell[2]) {
+        emitgrid_remove(ei);
+        e->cell[0] = cell[0];
+        e->cell[1] = cell[1];
+        e->cell[2] = cell[2];
+        int* b = &audiostate.emitgrid.buckets[emitgrid_hash(cell[0], cell[1], cell[2])];
+        e->gridnext = *b;
+        *b = ei;
+        e->ingrid = true;
+    }
+    float reach = (e->uses) ? e->range * e->sndrange + e->sndoff : 0.0f;
+    if (!(reach >= 0.0f)) reach = 0.0f;
+    if (reach < e->reach && e->reach >= audiostate.emitgrid.maxreach) audiostate.emitgrid.maxreachdirty = true;
+    e->reach = reach;
+    if (reach > audiostate.emitgrid.maxreach) audiostate.emitgrid.maxreach = reach;
+}
+static inline void emitgrid_check(struct audioemitter* e, unsigned stamp) {
+    if (!e->uses) return;
+    float d[3] = {e->pos[0] - audiostate.listener.pos[0], e->pos[1] - audiostate.listener.pos[1], e->pos[2] - audiostate.listener.pos[2]};
+    if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] > e->reach * e->reach) return;
+    e->near = stamp;
+    if (audiostate.emitgrid.nearlen == audiostate.emitgrid.nearsize) {
+        audiostate.emitgrid.nearsize *= 2;
+        audiostate.emitgrid.near = realloc(audiostate.emitgrid.near, audiostate.emitgrid.nearsize * sizeof(*audiostate.emitgrid.near));
+    }
+    audiostate.emitgrid.near[audiostate.emitgrid.nearlen++] = e - audiostate.emitters.data;
+}
+// marks the emitters that the listener is within reach of with a new stamp
+static void emitgrid_mark(void) {
+    unsigned stamp = ++audiostate.emitgrid.stamp;
+    audiostate.emitgrid.nearlen = 0;
+    int elen = audiostate.emitters.len;
+    struct audioemitter* edata = audiostate.emitters.data;
+    if (audiostate.emitgrid.maxreachdirty) {
+        float maxreach = 0.0f;
+        for (int ei = 0; ei < elen; ++ei) {
+            if (edata[ei].ingrid && edata[ei].reach > maxreach) maxreach = edata[ei].reach;
+        }
+        audiostate.emitgrid.maxreach = maxreach;
+        audiostate.emitgrid.maxreachdirty = false;
+    }
+    float r = ceilf(audiostate.emitgrid.maxreach / AUDIO_EMITGRIDCELL);
+    float span = r * 2.0f + 1.0f;
+    if (span * span * span >= elen) {
+        // more cells to look in than there are emitters
+        for (int ei = 0; ei < elen; ++ei) {
+            if (edata[ei].ingrid) emitgrid_check(&edata[ei], stamp);
+        }
+        return;
+    }
+    int ir = r;
+    int c[3] = {
+        emitgrid_tocell(audiostate.listener.pos[0]),
+        emitgrid_tocell(audiostate.listener.pos[1]),
+        emitgrid_tocell(audiostate.listener.pos[2])
+    };
+    for (int z = c[2] - ir; z <= c[2] + ir; ++z) {
+        for (int y = c[1] - ir; y <= c[1] + ir; ++y) {
+            for (int x = c[0] - ir; x <= c[0] + ir; ++x) {
+                for (int ei = audiostate.emitgrid.buckets[emitgrid_hash(x, y, z)]; ei >= 0; ei = edata[ei].gridnext) {
+                    struct audioemitter* e = &edata[ei];
+                    if (e->cell[0] == x && e->cell[1] == y && e->cell[2] == z) emitgrid_check(e, stamp);
+                }
+            }
+        }
+    }
+}
+
+#define AUDIO_OCCLVOL 0.5f // volume taken away when fully occluded
+#define AUDIO_OCCLLPFILT 0.75f // low-pass added when fully occluded
+#define AUDIO_OCCLSTEP 0.1f // most the occlusion can change per update, so new results fade in
+
+static void occl_trace(struct vis_level* l) {
+    for (int i = 0; i < audiostate.occl.raycount; ++i) {
+        struct audioocclray* r = &audiostate.occl.rays[i];
+        r->solid = (l) ? traceVisSolid(l, r->from, r->to) : 0.0f;
+    }
+}
+#ifndef PSRC_NOMT
+static void* occlthread(struct thread_data* td) {
+    plog(LL_INFO, "Audio occlusion thread started");
+    lockMutex(&audiostate.occl.lock);
+    while (1) {
+        while (atomicLoad(&audiostate.occl.state) != AUDIOOCCLSTATE_BUSY && !td->shouldclose) {
+            waitCond(&audiostate.occl.wake, &audiostate.occl.lock);
+        }
+        if (td->shouldclose) break;
+        occl_trace(audiostate.occl.level);
+        atomicStore(&audiostate.occl.state, AUDIOOCCLSTATE_DONE);
+    }
+    unlockMutex(&audiostate.occl.lock);
+    plog(LL_INFO, "Audio occlusion thread stopped");
+    return NULL;
+}
+#endif
+static void occl_apply(void) {
+    for (int i = 0; i < audiostate.occl.raycount; ++i) {
+        struct audioocclray* r = &audiostate.occl.rays[i];
+        if (r->emitter >= audiostate.emitters.len) continue;
+        struct audioemitter* e = &audiostate.emitters.data[r->emitter];
+        if (e->max < 0 || e->serial != r->serial) continue;
+        e->occltarget = r->solid / (r->solid + audiostate.occl.thickness);
+    }
+    audiostate.occl.raycount = 0;
+}
+// Picks up the last batch if it is done and sends the next emitters in reach to be traced. Called after the emitters
+// are stamped.
+static void occl_update(void) {
+    if (!audiostate.occl.enabled) return;
+    int nearlen = audiostate.emitgrid.nearlen;
+    int* near = audiostate.emitgrid.near;
+    for (int i = 0; i < nearlen; ++i) {
+        struct audioemitter* e = &audiostate.emitters.data[near[i]];
+        if (e->occl < e->occltarget) {
+            e->occl += AUDIO_OCCLSTEP;
+            if (e->occl > e->occltarget) e->occl = e->occltarget;
+        } else if (e->occl > e->occltarget) {
+            e->occl -= AUDIO_OCCLSTEP;
+            if (e->occl < e->occltarget) e->occl = e->occltarget;
+        }
+    }
+    #ifndef PSRC_NOMT
+    uint8_t state = atomicLoad(&audiostate.occl.state);
+    if (state == AUDIOOCCLSTATE_BUSY) return;
+    if (state == AUDIOOCCLSTATE_DONE) occl_apply();
+    #endif
+    if (!nearlen) return;
+    int count = (nearlen < AUDIO_OCCLBATCH) ? nearlen : AUDIO_OCCLBATCH;
+    int next = audiostate.occl.next;
+    if (next >= nearlen) next = 0;
+    for (int i = 0; i < count; ++i) {
+        int ei = near[next];
+        struct audioemitter* e = &audiostate.emitters.data[ei];
+        struct audioocclray* r = &audiostate.occl.rays[i];
+        r->emitter = ei;
+        r->serial = e->serial;
+        r->from[0] = audiostate.listener.pos[0];
+        r->from[1] = audiostate.listener.pos[1];
+        r->from[2] = audiostate.listener.pos[2];
+        r->to[0] = e->pos[0];
+        r->to[1] = e->pos[1];
+        r->to[2] = e->pos[2];
+        if (++next == nearlen) next = 0;
+    }
+    audiostate.occl.next = next;
+    audiostate.occl.raycount = count;
+    #ifndef PSRC_NOMT
+    // the thread is waiting (or about to) as the last batch was picked up, so this does not wait on any tracing
+    lockMutex(&audiostate.occl.lock);
+    atomicStore(&audiostate.occl.state, AUDIOOCCLSTATE_BUSY);
+    signalCond(&audiostate.occl.wake);
+    unlockMutex(&audiostate.occl.lock);
+    #else
+    occl_trace(audiostate.occl.level);
+    occl_apply();
+    #endif
 }
 
 static bool adjfilters = true;
@@ -72,11 +283,12 @@ static bool adjfilters = true;
 static void calc3DSoundFx(struct audiosound_3d* s) {
     struct audioemitter* e = &audiostate.emitters.data[s->emitter];
     s->fx[1].speedmul = roundf(e->speed * s->speed * 32.0f);
-    float vol[2] = {s->vol[0] * e->vol[0], s->vol[1] * e->vol[1]};
+    float occlvol = 1.0f - e->occl * AUDIO_OCCLVOL;
+    float vol[2] = {s->vol[0] * e->vol[0] * occlvol, s->vol[1] * e->vol[1] * occlvol};
     float pos[3];
-    pos[0] = e->pos[0] + s->pos[0] - audiostate.cam.pos[0];
-    pos[1] = e->pos[1] + s->pos[1] - audiostate.cam.pos[1];
-    pos[2] = e->pos[2] + s->pos[2] - audiostate.cam.pos[2];
+    pos[0] = e->pos[0] + s->pos[0] - audiostate.listener.pos[0];
+    pos[1] = e->pos[1] + s->pos[1] - audiostate.listener.pos[1];
+    pos[2] = e->pos[2] + s->pos[2] - audiostate.listener.pos[2];
     float range = e->range * s->range;
     if (isnormal(range)) {
         float dist = sqrtf(pos[0] * pos[0] + pos[1] * pos[1] + pos[2] * pos[2]);
@@ -98,15 +310,15 @@ static void calc3DSoundFx(struct audiosound_3d* s) {
                 }
                 float tmp[3];
                 float mul[3][3];
-                mul[0][0] = audiostate.cam.sinx * audiostate.cam.siny * audiostate.cam.sinz + audiostate.cam.cosy * audiostate.cam.cosz;
-                mul[0][1] = audiostate.cam.cosx * -audiostate.cam.sinz;
-                mul[0][2] = audiostate.cam.sinx * audiostate.cam.cosy * audiostate.cam.sinz + audiostate.cam.siny * audiostate.cam.cosz;
-                mul[1][0] = audiostate.cam.sinx * audiostate.cam.siny * audiostate.cam.cosz + audiostate.cam.cosy * audiostate.cam.sinz;
-                mul[1][1] = audiostate.cam.cosx * audiostate.cam.cosz;
-                mul[1][2] = -audiostate.cam.sinx * audiostate.cam.cosy * audiostate.cam.cosz + audiostate.cam.siny * audiostate.cam.sinz;
-                mul[2][0] = audiostate.cam.cosx * -audiostate.cam.siny;
-                mul[2][1] = audiostate.cam.sinx;
-                mul[2][2] = audiostate.cam.cosx * audiostate.cam.cosy;
+                mul[0][0] = audiostate.listener.sinx * audiostate.listener.siny * audiostate.listener.sinz + audiostate.listener.cosy * audiostate.listener.cosz;
+                mul[0][1] = audiostate.listener.cosx * -audiostate.listener.sinz;
+                mul[0][2] = audiostate.listener.sinx * audiostate.listener.cosy * audiostate.listener.sinz + audiostate.listener.siny * audiostate.listener.cosz;
+                mul[1][0] = audiostate.listener.sinx * audiostate.listener.siny * audiostate.listener.cosz + audiostate.listener.cosy * audiostate.listener.sinz;
+                mul[1][1] = audiostate.listener.cosx * audiostate.listener.cosz;
+                mul[1][2] = -audiostate.listener.sinx * audiostate.listener.cosy * audiostate.listener.cosz + audiostate.listener.siny * audiostate.listener.sinz;
+                mul[2][0] = audiostate.listener.cosx * -audiostate.listener.siny;
+                mul[2][1] = audiostate.listener.sinx;
+                mul[2][2] = audiostate.listener.cosx * audiostate.listener.cosy;
                 tmp[0] = pos[0] * mul[0][0] + pos[1] * mul[0][1] + pos[2] * mul[0][2];
                 tmp[1] = pos[0] * mul[1][0] + pos[1] * mul[1][1] + pos[2] * mul[1][2];
                 tmp[2] = pos[0] * mul[2][0] + pos[1] * mul[2][1] + pos[2] * mul[2][2];
@@ -155,7 +367,7 @@ static void calc3DSoundFx(struct audiosound_3d* s) {
         s->fx[1].volmul[2] = 0;
     }
     s->maxvol = (s->fx[0].volmul[2] > s->fx[1].volmul[2]) ? s->fx[0].volmul[2] : s->fx[1].volmul[2];
-    register float tmp = 1.0f - (1.0f - s->lpfilt) * (1.0f - e->lpfilt);
+    register float tmp = 1.0f - (1.0f - s->lpfilt) * (1.0f - e->lpfilt) * (1.0f - e->occl * AUDIO_OCCLLPFILT);
     if (tmp > 0.0f) {
         tmp = 1.0f - tmp;
         int lpfiltmul = (int)roundf(tmp * tmp * audiostate.freq);
@@ -324,21 +536,457 @@ static ALWAYSINLINE void getmp3at_mono(struct audiosound* s, int pos, int* out)
 
 #endif
 
+#ifndef PSRC_NOMT
+
+// Only the decode thread touches the cache
+static inline unsigned deccache_hash(struct rc_sound* rc, long k) {
+    return ((uintptr_t)rc / sizeof(void*) * 31 + k) % AUDIO_DECCACHEBUCKETS;
+}
+static struct audiodecblk* deccache_find(struct rc_sound* rc, long k) {
+    struct audiodecblk* b = audiostate.deccache.buckets[deccache_hash(rc, k)];
+    while (b) {
+        if (b->rc == rc && b->index == k) break;
+        b = b->hnext;
+    }
+    return b;
+}
+static void deccache_lruunlink(struct audiodecblk* b) {
+    if (b->lprev) b->lprev->lnext = b->lnext;
+    else audiostate.deccache.head = b->lnext;
+    if (b->lnext) b->lnext->lprev = b->lprev;
+    else audiostate.deccache.tail = b->lprev;
+}
+static void deccache_lrupush(struct audiodecblk* b) {
+    b->lprev = NULL;
+    b->lnext = audiostate.deccache.head;
+    if (b->lnext) b->lnext->lprev = b;
+    else audiostate.deccache.tail = b;
+    audiostate.deccache.head = b;
+}
+static inline void deccache_touch(struct audiodecblk* b) {
+    if (audiostate.deccache.head == b) return;
+    deccache_lruunlink(b);
+    deccache_lrupush(b);
+}
+static inline size_t deccache_blksize(void) {
+    return sizeof(struct audiodecblk) + audiostate.audbuflen * 2 * sizeof(int16_t);
+}
+static void deccache_free(struct audiodecblk* b) {
+    struct audiodecblk** bp = &audiostate.deccache.buckets[deccache_hash(b->rc, b->index)];
+    while (*bp != b) bp = &(*bp)->hnext;
+    *bp = b->hnext;
+    deccache_lruunlink(b);
+    audiostate.deccache.size -= deccache_blksize();
+    free(b);
+}
+// returns NULL if the cache is full of blocks that are still in use
+static struct audiodecblk* deccache_add(struct rc_sound* rc, long k) {
+    size_t blksize = deccache_blksize();
+    struct audiodecblk* b;
+    if (audiostate.deccache.size + blksize > audiostate.deccache.budget) {
+        // a voice may still be looking at an unreferenced block it found before it was taken back (see
+        // decahead_getblk()), so it is reused instead of freed
+        atomicFence();
+        b = audiostate.deccache.tail;
+        while (b && atomicLoad(&b->refs)) b = b->lprev;
+        if (!b) return NULL;
+        struct audiodecblk** bp = &audiostate.deccache.buckets[deccache_hash(b->rc, b->index)];
+        while (*bp != b) bp = &(*bp)->hnext;
+        *bp = b->hnext;
+        deccache_lruunlink(b);
+    } else {
+        b = malloc(blksize);
+        if (!b) return NULL;
+        b->refs = 0;
+        b->data = (int16_t*)(b + 1);
+        audiostate.deccache.size += blksize;
+    }
+    b->rc = rc;
+    atomicStore(&b->index, k);
+    unsigned h = deccache_hash(rc, k);
+    b->hnext = audiostate.deccache.buckets[h];
+    audiostate.deccache.buckets[h] = b;
+    deccache_lrupush(b);
+    return b;
+}
+// drops the blocks of a sound nothing is playing anymore (or everything if 'rc' is NULL)
+static void deccache_purge(struct rc_sound* rc) {
+    struct audiodecblk* b = audiostate.deccache.head;
+    while (b) {
+        struct audiodecblk* next = b->lnext;
+        if ((!rc || b->rc == rc) && !atomicLoad(&b->refs)) deccache_free(b);
+        b = next;
+    }
+}
+static void decahead_decode(struct audiodecahead* da, long k, int16_t* out, void* scratch) {
+    int blocklen = audiostate.audbuflen;
+    long off = k * blocklen;
+    int got = 0;
+    switch ((uint8_t)da->rc->format) {
+        case RC_SOUND_FRMT_VORBIS: {
+            if (da->decpos != off) stb_vorbis_seek(da->vorbis, off);
+            int16_t* d[2] = {out, out + blocklen};
+            got = stb_vorbis_get_samples_short(da->vorbis, 2, d, blocklen);
+        } break;
+        #ifdef PSRC_USEMINIMP3
+        case RC_SOUND_FRMT_MP3: {
+            int ch = da->rc->channels;
+            mp3d_sample_t* d = scratch;
+            if (da->decpos != off) mp3dec_ex_seek(da->mp3, off * ch);
+            got = mp3dec_ex_read(da->mp3, d, blocklen * ch) / ch;
+            int r = (ch > 1);
+            for (int i = 0; i < got; ++i) {
+                out[i] = d[i * ch];
+                out[blocklen + i] = d[i * ch + r];
+            }
+        } break;
+        #endif
+    }
+    if (got < 0) got = 0;
+    if (got < blocklen) {
+        memset(out + got, 0, (blocklen - got) * sizeof(*out));
+        memset(out + blocklen + got, 0, (blocklen - got) * sizeof(*out));
+        da->decpos = -1;
+    } else {
+        da->decpos = off + got;
+    }
+    (void)scratch;
+}
+
+static inline bool decahead_wants(long k, long head, int blockcount, bool loop) {
+    long d = k - head;
+    if (d < 0 && loop) d += blockcount;
+    return (d >= 0 && d < AUDIO_DECAHEADBLOCKS - 1);
+}
+// decodes the nearest block after the head the voice does not have yet and hands it over, returns false if there was
+// nothing to decode
+static bool decahead_fill(struct audiodecahead* da, void* scratch) {
+    long head = atomicLoad(&da->head);
+    bool loop = atomicLoad(&da->loop);
+    for (int j = 0; j < AUDIO_DECAHEADBLOCKS - 1 && j < da->blockcount; ++j) {
+        long k = head + j;
+        if (k >= da->blockcount) {
+            // a sound that does not loop just stops at the end
+            if (!loop) break;
+            k -= da->blockcount;
+        }
+        int slot = -1;
+        bool have = false;
+        for (int i = 0; i < AUDIO_DECAHEADBLOCKS; ++i) {
+            struct audiodecblk* b = da->blks[i];
+            if (!b) {
+                if (slot < 0) slot = i;
+            } else if (b->index == k) {
+                have = true;
+                break;
+            } else if (slot < 0 || da->blks[slot]) {
+                // prefer an empty slot, then one with a block that fell behind
+                if (!decahead_wants(b->index, head, da->blockcount, loop)) slot = i;
+            }
+        }
+        if (have) continue;
+        // there are more slots than wanted blocks, so one is always free
+        bool decoded = false;
+        struct audiodecblk* b = deccache_find(da->rc, k);
+        if (b) {
+            // another voice playing the same sound may have already decoded it
+            deccache_touch(b);
+        } else {
+            b = deccache_add(da->rc, k);
+            if (!b) return false;
+            decahead_decode(da, k, b->data, scratch);
+            decoded = true;
+        }
+        atomicAdd(&b->refs, 1);
+        struct audiodecblk* old = da->blks[slot];
+        atomicStore(&da->blks[slot], b);
+        if (old) atomicAdd(&old->refs, -1);
+        if (decoded) return true;
+    }
+    return false;
+}
+
+static void decahead_free(struct audiodecahead* da, struct audiodecahead* others) {
+    switch ((uint8_t)da->rc->format) {
+        case RC_SOUND_FRMT_VORBIS: {
+            stb_vorbis_close(da->vorbis);
+        } break;
+        #ifdef PSRC_USEMINIMP3
+        case RC_SOUND_FRMT_MP3: {
+            mp3dec_ex_close(da->mp3);
+            free(da->mp3);
+        } break;
+        #endif
+    }
+    for (int i = 0; i < AUDIO_DECAHEADBLOCKS; ++i) {
+        if (da->blks[i]) atomicAdd(&da->blks[i]->refs, -1);
+    }
+    // the blocks are keyed by the resource, so they cannot outlive the last lock the voices hold on it
+    while (others && others->rc != da->rc) others = others->next;
+    if (!others) deccache_purge(da->rc);
+    unlockRc(da->rc);
+    free(da);
+}
+
+static void* decaheadthread(struct thread_data* td) {
+    plog(LL_INFO, "Audio decode thread started");
+    struct audiodecahead* list = NULL;
+    void* scratch = td->args;
+    bool busy = false;
+    while (1) {
+        lockMutex(&audiostate.decahead.lock);
+        // keeps going while there was something to decode last pass, otherwise sleeps until a voice moves on to
+        // another block, starts, or stops
+        if (!busy) {
+            while (!audiostate.decahead.woken && !td->shouldclose) {
+                waitCond(&audiostate.decahead.wake, &audiostate.decahead.lock);
+            }
+        }
+        audiostate.decahead.woken = false;
+        if (td->shouldclose) {
+            unlockMutex(&audiostate.decahead.lock);
+            break;
+        }
+        while (audiostate.decahead.pending) {
+            struct audiodecahead* da = audiostate.decahead.pending;
+            audiostate.decahead.pending = da->next;
+            da->next = list;
+            list = da;
+        }
+        unlockMutex(&audiostate.decahead.lock);
+        // one block per voice per pass so a voice that just started does not wait on all the others
+        busy = false;
+        struct audiodecahead** dp = &list;
+        while (*dp) {
+            struct audiodecahead* da = *dp;
+            if (atomicLoad(&da->stop)) {
+                *dp = da->next;
+                decahead_free(da, list);
+                continue;
+            }
+            if (decahead_fill(da, scratch)) busy = true;
+            dp = &da->next;
+        }
+    }
+    lockMutex(&audiostate.decahead.lock);
+    while (audiostate.decahead.pending) {
+        struct audiodecahead* da = audiostate.decahead.pending;
+        audiostate.decahead.pending = da->next;
+        decahead_free(da, NULL);
+    }
+    unlockMutex(&audiostate.decahead.lock);
+    while (list) {
+        struct audiodecahead* da = list;
+        list = da->next;
+        decahead_free(da, NULL);
+    }
+    free(scratch);
+    plog(LL_INFO, "Audio decode thread stopped");
+    return NULL;
+}
+
+static void decahead_start(struct audiosound* s) {
+    s->decahead = NULL;
+    s->decblk.start = s->decblk.end = 0;
+    s->decblk.blk = NULL;
+    s->decblk.miss = -1;
+    if (!audiostate.decahead.enabled) return;
+    struct rc_sound* rc = s->rc;
+    int blocklen = audiostate.audbuflen;
+    if (!rc->len || blocklen <= 0) return;
+    // if any of this fails, the mixer decodes the sound itself
+    struct audiodecahead* da = malloc(sizeof(*da));
+    if (!da) return;
+    switch ((uint8_t)rc->format) {
+        case RC_SOUND_FRMT_VORBIS: {
+            da->vorbis = stb_vorbis_open_memory(rc->data, rc->size, NULL, NULL);
+            if (!da->vorbis) {
+                free(da);
+                return;
+            }
+        } break;
+        #ifdef PSRC_USEMINIMP3
+        case RC_SOUND_FRMT_MP3: {
+            da->mp3 = malloc(sizeof(*da->mp3));
+            if (!da->mp3) {
+                free(da);
+                return;
+            }
+            if (mp3dec_ex_open_buf(da->mp3, rc->data, rc->size, MP3D_SEEK_TO_SAMPLE)) {
+                free(da->mp3);
+                free(da);
+                return;
+            }
+        } break;
+        #endif
+        default: {
+            free(da);
+        } return;
+    }
+    lockRc(rc);
+    da->rc = rc;
+    da->decpos = 0;
+    da->blockcount = (rc->len + blocklen - 1) / blocklen;
+    da->head = 0;
+    da->loop = 0;
+    da->stop = 0;
+    for (int i = 0; i < AUDIO_DECAHEADBLOCKS; ++i) {
+        da->blks[i] = NULL;
+    }
+    lockMutex(&audiostate.decahead.lock);
+    da->next = audiostate.decahead.pending;
+    audiostate.decahead.pending = da;
+    audiostate.decahead.woken = true;
+    signalCond(&audiostate.decahead.wake);
+    unlockMutex(&audiostate.decahead.lock);
+    s->decahead = da;
+}
+
+// called by the mixer before reading a voice, tells the decode thread where to decode ahead of
+static void decahead_sethead(struct audiosound* s, long pos, bool loop) {
+    struct audiodecahead* da = s->decahead;
+    if (!da) return;
+    s->decblk.miss = -1;
+    if (pos < 0) {
+        pos = 0;
+    } else if (pos >= s->rc->len) {
+        if (!loop) return;
+        pos %= s->rc->len;
+    }
+    long k = pos / audiostate.audbuflen;
+    if (da->loop != loop) atomicStore(&da->loop, loop);
+    if (da->head != k) {
+        atomicStore(&da->head, k);
+        decahead_wake();
+    }
+}
+// Takes a reference to a block the decode thread handed over without locking. The decode thread takes a block back
+// before checking if it is referenced, and the mixer references a block before checking that it was not taken back,
+// so one of them always sees the other.
+static bool decahead_getblk(struct audiosound* s, long pos) {
+    struct audiodecahead* da = s->decahead;
+    if (!da) return false;
+    long k = pos / audiostate.audbuflen;
+    if (k == s->decblk.miss) return false;
+    struct audiodecblk* b = NULL;
+    for (int i = 0; i < AUDIO_DECAHEADBLOCKS; ++i) {
+        struct audiodecblk* tmp = atomicLoad(&da->blks[i]);
+        if (!tmp || atomicLoad(&tmp->index) != k) continue;
+        atomicAdd(&tmp->refs, 1);
+        atomicFence();
+        if (atomicLoad(&da->blks[i]) == tmp && atomicLoad(&tmp->index) == k) {
+            b = tmp;
+            break;
+        }
+        atomicAdd(&tmp->refs, -1);
+    }
+    if (s->decblk.blk) atomicAdd(&s->decblk.blk->refs, -1);
+    s->decblk.blk = b;
+    if (!b) {
+        s->decblk.start = s->decblk.end = 0;
+        s->decblk.miss = k;
+        return false;
+    }
+    s->decblk.start = k * audiostate.audbuflen;
+    s->decblk.end = s->decblk.start + audiostate.audbuflen;
+    return true;
+}
+static ALWAYSINLINE bool getdecat(struct audiosound* s, long pos, int* out_l, int* out_r) {
+    if (pos < s->decblk.start || pos >= s->decblk.end) {
+        if (!decahead_getblk(s, pos)) return false;
+    }
+    int i = pos - s->decblk.start;
+    *out_l = s->decblk.blk->data[i];
+    *out_r = s->decblk.blk->data[i + audiostate.audbuflen];
+    return true;
+}
+static ALWAYSINLINE bool getdecat_mono(struct audiosound* s, long pos, int* out) {
+    int l, r;
+    if (!getdecat(s, pos, &l, &r)) return false;
+    *out = (l + r) / 2;
+    return true;
+}
+
+static bool startDecodeThread(size_t cachebudget) {
+    audiostate.decahead.pending = NULL;
+    memset(audiostate.deccache.buckets, 0, sizeof(audiostate.deccache.buckets));
+    audiostate.deccache.head = audiostate.deccache.tail = NULL;
+    audiostate.deccache.size = 0;
+    // enough for every block a few voices could want at once
+    size_t minbudget = deccache_blksize() * AUDIO_DECAHEADBLOCKS * 4;
+    audiostate.deccache.budget = (cachebudget > minbudget) ? cachebudget : minbudget;
+    // handed to the thread, which frees it when it stops
+    #ifdef PSRC_USEMINIMP3
+    void* scratch = malloc(audiostate.audbuflen * 2 * sizeof(mp3d_sample_t));
+    if (!scratch) return false;
+    #else
+    void* scratch = NULL;
+    #endif
+    if (!createMutex(&audiostate.decahead.lock)) {
+        free(scratch);
+        return false;
+    }
+    if (!createCond(&audiostate.decahead.wake)) {
+        destroyMutex(&audiostate.decahead.lock);
+        free(scratch);
+        return false;
+    }
+    audiostate.decahead.woken = false;
+    if (!createThread(&audiostate.decahead.thread, "audio decode", NULL, decaheadthread, scratch)) {
+        destroyCond(&audiostate.decahead.wake);
+        destroyMutex(&audiostate.decahead.lock);
+        free(scratch);
+        return false;
+    }
+    return true;
+}
+static void stopDecodeThread(void) {
+    lockMutex(&audiostate.decahead.lock);
+    quitThread(&audiostate.decahead.thread);
+    signalCond(&audiostate.decahead.wake);
+    unlockMutex(&audiostate.decahead.lock);
+    destroyThread(&audiostate.decahead.thread, NULL);
+    destroyCond(&audiostate.decahead.wake);
+    destroyMutex(&audiostate.decahead.lock);
+    deccache_purge(NULL);
+}
+
+#else
+
+#define decahead_start(s)
+#define decahead_sethead(s, p, l)
+#define getdecat(s, p, l, r) (false)
+#define getdecat_mono(s, p, o) (false)
+
+#endif
+
+// only what the resampling needs, the volume and filters are ramped by the block kernels
 static ALWAYSINLINE void interpfx(struct audiosound_fx* sfx, struct audiosound_fx* fx, int i, int ii, int samples) {
     fx->posoff = (sfx[0].posoff * ii + sfx[1].posoff * i) / samples;
     fx->speedmul = (sfx[0].speedmul * ii + sfx[1].speedmul * i) / samples;
-    fx->volmul[0] = (sfx[0].volmul[0] * ii + sfx[1].volmul[0] * i) / samples;
-    fx->volmul[1] = (sfx[0].volmul[1] * ii + sfx[1].volmul[1] * i) / samples;
-    fx->lpfiltmul = (sfx[0].lpfiltmul * ii + sfx[1].lpfiltmul * i) / samples;
-    fx->hpfiltmul = (sfx[0].hpfiltmul * ii + sfx[1].hpfiltmul * i) / samples;
 }
+static inline int16_t mixfilt_tos16(float v) {
+    if (v > 32767.0f) return 32767;
+    if (v < -32768.0f) return -32768;
+    return (int16_t)v;
+}
+// frac is kept in [0, div), and it rarely moves by more than a few samples per output sample, so the division is
+// only needed for big jumps
 #define MIXSOUND3D_CALCPOS() do {\
-    register int mul = ((fx.posoff - fxoff + 1) * freq) * fx.speedmul;\
+    frac += ((fx.posoff - fxoff + 1) * freq) * fx.speedmul;\
     fxoff = fx.posoff;\
-    offset += mul / div;\
-    frac += mul % div;\
-    offset += frac / div;\
-    frac %= div;\
+    if (frac >= div) {\
+        if (frac < div * 4) {\
+            do {frac -= div; ++offset;} while (frac >= div);\
+        } else {\
+            offset += frac / div;\
+            frac %= div;\
+        }\
+    } else if (frac < 0) {\
+        register int tmpoff = (frac + 1) / div - 1;\
+        offset += tmpoff;\
+        frac -= tmpoff * div;\
+    }\
     pos = offset;\
 } while (0)
 #define MIXSOUND3D_LOOP_COMMON(wp, wp2, poob, p2oob) do {\
@@ -350,18 +998,15 @@ static ALWAYSINLINE void interpfx(struct audiosound_fx* sfx, struct audiosound_f
             if (!(p2oob)) {\
                 wp2;\
                 MIXSOUND_GETSAMPLE(pos2, o2);\
-                uint8_t tmpfrac = frac / outfreq;\
-                uint8_t ifrac = 32 - tmpfrac;\
-                o1 = (o1 * ifrac + o2 * tmpfrac) / 32;\
+                vbuf[i] = o1 + (o2 - o1) * (frac * idiv);\
+            } else {\
+                vbuf[i] = o1;\
             }\
+        } else {\
+            vbuf[i] = o1;\
         }\
-        if (filterfx) {\
-            hplastout = (hplastout + o1 - hplastin) * fx.hpfiltmul / audiostate.freq;\
-            hplastin = o1;\
-            o1 = lplastout = lplastout + (hplastout - lplastout) * fx.lpfiltmul / audiostate.freq;\
-        }\
-        audbuf[0][i] += o1 * fx.volmul[0] / 32768;\
-        audbuf[1][i] += o1 * fx.volmul[1] / 32768;\
+    } else {\
+        vbuf[i] = 0.0f;\
     }\
 } while (0)
 #define MIXSOUND3D_LOOP(wp, wp2, poob, p2oob) do {\
@@ -372,7 +1017,7 @@ static ALWAYSINLINE void interpfx(struct audiosound_fx* sfx, struct audiosound_f
             MIXSOUND3D_CALCPOS();\
             MIXSOUND3D_LOOP_COMMON(wp, wp2, poob, p2oob);\
             ++i;\
-            if (i == audiostate.audbuf.len) {if (poob) return false; break;}\
+            if (i == audiostate.audbuf.len) {if (poob) ended = true; break;}\
             --ii;\
         }\
     } else {\
@@ -381,19 +1026,100 @@ static ALWAYSINLINE void interpfx(struct audiosound_fx* sfx, struct audiosound_f
             MIXSOUND3D_CALCPOS();\
             MIXSOUND3D_LOOP_COMMON(wp, wp2, poob, p2oob);\
             ++i;\
-            if (i == audiostate.audbuf.len) {if (poob) return false; break;}\
+            if (i == audiostate.audbuf.len) {if (poob) ended = true; break;}\
+        }\
+    }\
+} while (0)
+// one source sample per output sample, for sounds already at the output rate with no speed or doppler change
+#define MIXSOUND3D_COPY(wp, poob) do {\
+    register int i = 0;\
+    while (1) {\
+        pos = ++offset;\
+        if (!(poob)) {\
+            wp;\
+            MIXSOUND_GETSAMPLE(pos, o1);\
+            vbuf[i] = o1;\
+        } else {\
+            vbuf[i] = 0.0f;\
+        }\
+        ++i;\
+        if (i == audiostate.audbuf.len) {if (poob) ended = true; break;}\
+    }\
+} while (0)
+// fetches the window of source samples the sinc filter reads, each only once
+#define MIXSOUND3D_SINCFETCH(wp, poob) do {\
+    float* src = scratch->src;\
+    for (register int i = 0; i < sincwin; ++i) {\
+        pos = sincstart + i;\
+        if (!(poob)) {\
+            wp;\
+            MIXSOUND_GETSAMPLE(pos, o1);\
+            src[i] = o1;\
+        } else {\
+            src[i] = 0.0f;\
         }\
     }\
 } while (0)
 #define MIXSOUND3D_BODY() do {\
-    if (flags & SOUNDFLAG_LOOP) {\
+    if (taps) {\
+        if (flags & SOUNDFLAG_LOOP) {\
+            if (flags & SOUNDFLAG_WRAP) MIXSOUND3D_SINCFETCH(pos = ((pos % len) + len) % len, 0);\
+            else MIXSOUND3D_SINCFETCH(if (pos >= 0) pos %= len, (pos < 0));\
+        } else {\
+            MIXSOUND3D_SINCFETCH(, (pos >= len || pos < 0));\
+        }\
+    } else if (copy) {\
+        if (flags & SOUNDFLAG_LOOP) {\
+            if (flags & SOUNDFLAG_WRAP) MIXSOUND3D_COPY(pos = ((pos % len) + len) % len, 0);\
+            else MIXSOUND3D_COPY(if (pos >= 0) pos %= len, (pos < 0));\
+        } else {\
+            MIXSOUND3D_COPY(, (pos >= len || pos < 0));\
+        }\
+    } else if (flags & SOUNDFLAG_LOOP) {\
         if (flags & SOUNDFLAG_WRAP) MIXSOUND3D_LOOP(pos = ((pos % len) + len) % len, pos2 = ((pos2 % len) + len) % len, 0, 0);\
         else MIXSOUND3D_LOOP(if (pos >= 0) pos %= len, if (pos2 >= 0) pos2 %= len, (pos < 0), 0);\
     } else {\
         MIXSOUND3D_LOOP(,,(pos >= len || pos < 0), (pos2 >= len));\
     }\
 } while (0)
-static bool mixsound_3d(struct audiosound_3d* s, int** audbuf) {
+// per mixing thread buffers, the sinc resampler's are allocated when first needed and grown with the window
+struct mixscratch {
+    float* vbuf;
+    float* src;
+    int srcsize;
+    int* off;
+    uint16_t* phase;
+};
+#define MIXSCRATCH_MAXWIN(t) (audiostate.audbuf.len * 8 + (t)) // past this, a voice falls back to linear
+static bool mixscratch_prep(struct mixscratch* m, int win) {
+    if (!m->off) {
+        m->off = malloc(audiostate.audbuf.len * sizeof(*m->off));
+        if (!m->off) return false;
+        m->phase = malloc(audiostate.audbuf.len * sizeof(*m->phase));
+        if (!m->phase) {
+            free(m->off);
+            m->off = NULL;
+            return false;
+        }
+    }
+    if (win > m->srcsize) {
+        float* tmp = realloc(m->src, win * sizeof(*m->src));
+        if (!tmp) return false;
+        m->src = tmp;
+        m->srcsize = win;
+    }
+    return true;
+}
+static void mixscratch_free(struct mixscratch* m) {
+    free(m->src);
+    free(m->off);
+    free(m->phase);
+    m->src = NULL;
+    m->srcsize = 0;
+    m->off = NULL;
+    m->phase = NULL;
+}
+static bool mixsound_3d(struct audiosound_3d* s, int** audbuf, struct mixscratch* scratch) {
     struct rc_sound* rc = s->data.rc;
     if (!rc) return true;
     int len = rc->len;
@@ -407,50 +1133,24 @@ static bool mixsound_3d(struct audiosound_3d* s, int** audbuf) {
     int frac = s->data.frac;
     int fxoff = s->fxoff;
     bool filterfx;
-    #if 0
-    int16_t lplastout;
-    int16_t hplastout;
-    int16_t hplastin;
-    #endif
-    int16_t lplastout = s->lplastout;
-    int16_t hplastout = s->hplastout;
-    int16_t hplastin = s->hplastin;
+    bool ended = false;
     if (s->fxchanged) {
         //puts("fxchanged");
         sfx[0] = s->fx[0];
         sfx[1] = s->fx[1];
-        sfx[0].volmul[0] = sfx[0].volmul[0] * audiostate.vol.master / 100;
-        sfx[0].volmul[1] = sfx[0].volmul[1] * audiostate.vol.master / 100;
-        sfx[1].volmul[0] = sfx[1].volmul[0] * audiostate.vol.master / 100;
-        sfx[1].volmul[1] = sfx[1].volmul[1] * audiostate.vol.master / 100;
-        if (sfx[0].lpfiltmul != audiostate.freq || sfx[0].hpfiltmul != audiostate.freq ||
-            sfx[1].lpfiltmul != audiostate.freq || sfx[1].lpfiltmul != audiostate.freq) {
-            filterfx = true;
-            #if 0
-            lplastout = s->lplastout;
-            hplastout = s->hplastout;
-            hplastin = s->hplastin;
-            #endif
-        } else {
-            filterfx = false;
-        }
     } else {
-        fx = s->fx[1];
-        fx.volmul[0] = fx.volmul[0] * audiostate.vol.master / 100;
-        fx.volmul[1] = fx.volmul[1] * audiostate.vol.master / 100;
-        if (fx.lpfiltmul != audiostate.freq || fx.hpfiltmul != audiostate.freq) {
-            filterfx = true;
-            #if 0
-            lplastout = s->lplastout;
-            hplastout = s->hplastout;
-            hplastin = s->hplastin;
-            #endif
-        } else {
-            filterfx = false;
-        }
-    }
+        sfx[0] = sfx[1] = fx = s->fx[1];
+    }
+    sfx[0].volmul[0] = sfx[0].volmul[0] * audiostate.vol.master / 100;
+    sfx[0].volmul[1] = sfx[0].volmul[1] * audiostate.vol.master / 100;
+    sfx[1].volmul[0] = sfx[1].volmul[0] * audiostate.vol.master / 100;
+    sfx[1].volmul[1] = sfx[1].volmul[1] * audiostate.vol.master / 100;
+    filterfx = (sfx[0].lpfiltmul != audiostate.freq || sfx[0].hpfiltmul != audiostate.freq ||
+                sfx[1].lpfiltmul != audiostate.freq || sfx[1].hpfiltmul != audiostate.freq);
     int outfreq = audiostate.freq;
-    {
+    if (freq == outfreq) {
+        freq = outfreq = 1;
+    } else {
         int outfreq2 = outfreq, gcd = freq;
         while (outfreq2) {
             int tmp = gcd % outfreq2;
@@ -461,10 +1161,58 @@ static bool mixsound_3d(struct audiosound_3d* s, int** audbuf) {
         freq /= gcd;
     }
     int div = outfreq * 32;
+    float idiv = 1.0f / div;
+    bool copy = (freq == 1 && outfreq == 1 && !frac && sfx[0].speedmul == 32 && sfx[1].speedmul == 32 &&
+                 sfx[0].posoff == fxoff && sfx[1].posoff == fxoff);
+    float* vbuf = scratch->vbuf;
+    int buflen = audiostate.audbuf.len;
     long pos;
     long pos2;
     bool stereo = rc->stereo;
     int o1, o2;
+    // With the sinc tables, the positions are stepped through first, then the window of source samples they cover
+    // is fetched, then the filter runs over the whole buffer in one go.
+    int taps = (copy) ? 0 : audiomixsinc.taps;
+    const float* sinctable = NULL;
+    long sincstart = offset;
+    int sincwin = 0;
+    if (taps) {
+        long offset0 = offset;
+        int frac0 = frac, fxoff0 = fxoff;
+        if (mixscratch_prep(scratch, taps)) {
+            uint64_t rdiv = ((uint64_t)AUDIOMIX_SINC_PHASES << 32) / div;
+            int* off = scratch->off;
+            uint16_t* phase = scratch->phase;
+            register int i = 0, ii = buflen;
+            while (1) {
+                if (s->fxchanged) interpfx(sfx, &fx, i, ii, buflen);
+                MIXSOUND3D_CALCPOS();
+                off[i] = pos - offset0;
+                phase[i] = ((uint64_t)frac * rdiv + 0x80000000U) >> 32;
+                ++i;
+                if (i == buflen) break;
+                --ii;
+            }
+            long winstart;
+            long win = audiomix_sincwindow(off, buflen, taps, &winstart);
+            if (win <= MIXSCRATCH_MAXWIN(taps) && mixscratch_prep(scratch, win)) {
+                sincwin = win;
+                sincstart = offset0 + winstart;
+                if (!(flags & SOUNDFLAG_LOOP)) ended = (pos >= len || pos < 0);
+                else if (!(flags & SOUNDFLAG_WRAP)) ended = (pos < 0);
+                int maxspeed = (sfx[0].speedmul > sfx[1].speedmul) ? sfx[0].speedmul : sfx[1].speedmul;
+                sinctable = audiomixsinc.table[audiomix_sincband((float)freq * maxspeed / div)];
+            }
+        }
+        if (!sincwin) {
+            // the window would be too big (or there is no memory), so go back and interpolate linearly instead
+            offset = offset0;
+            frac = frac0;
+            fxoff = fxoff0;
+            taps = 0;
+        }
+    }
+    decahead_sethead(&s->data, sincstart, flags & SOUNDFLAG_LOOP);
     switch (rc->format) {
         case RC_SOUND_FRMT_WAV: {
             union {
@@ -507,51 +1255,59 @@ static bool mixsound_3d(struct audiosound_3d* s, int** audbuf) {
             }
         } break;
         case RC_SOUND_FRMT_VORBIS: {
-            #define MIXSOUND_GETSAMPLE(p, o) getvorbisat_mono(&s->data, p, stereo, &o)
+            #define MIXSOUND_GETSAMPLE(p, o) do {\
+                if (!getdecat_mono(&s->data, p, &o)) getvorbisat_mono(&s->data, p, stereo, &o);\
+            } while (0)
             MIXSOUND3D_BODY();
             #undef MIXSOUND_GETSAMPLE
         } break;
         #ifdef PSRC_USEMINIMP3
         case RC_SOUND_FRMT_MP3: {
-            #define MIXSOUND_GETSAMPLE(p, o) getmp3at_mono(&s->data, p, &o)
+            #define MIXSOUND_GETSAMPLE(p, o) do {\
+                if (!getdecat_mono(&s->data, p, &o)) getmp3at_mono(&s->data, p, &o);\
+            } while (0)
             MIXSOUND3D_BODY();
             #undef MIXSOUND_GETSAMPLE
         } break;
         #endif
     }
+    if (taps) audiomixkern.sinc(vbuf, buflen, scratch->src, scratch->off, scratch->phase, sinctable, taps);
+    if (filterfx) {
+        float lplastout = s->lplastout;
+        float hplastout = s->hplastout;
+        float hplastin = s->hplastin;
+        float ifreq = 1.0f / audiostate.freq;
+        if (sfx[0].hpfiltmul == sfx[1].hpfiltmul) {
+            audiomixkern.hpfilt(vbuf, buflen, sfx[1].hpfiltmul * ifreq, &hplastin, &hplastout);
+        } else {
+            audiomix_hpfilt_ramp(vbuf, buflen, sfx[0].hpfiltmul * ifreq, sfx[1].hpfiltmul * ifreq, &hplastin, &hplastout);
+        }
+        if (sfx[0].lpfiltmul == sfx[1].lpfiltmul) {
+            audiomixkern.lpfilt(vbuf, buflen, sfx[1].lpfiltmul * ifreq, &lplastout);
+        } else {
+            audiomix_lpfilt_ramp(vbuf, buflen, sfx[0].lpfiltmul * ifreq, sfx[1].lpfiltmul * ifreq, &lplastout);
+        }
+        s->lplastout = mixfilt_tos16(lplastout);
+        s->hplastout = mixfilt_tos16(hplastout);
+        s->hplastin = mixfilt_tos16(hplastin);
+    }
+    audiomixkern.addscaled(audbuf[0], vbuf, buflen, sfx[0].volmul[0], sfx[1].volmul[0]);
+    audiomixkern.addscaled(audbuf[1], vbuf, buflen, sfx[0].volmul[1], sfx[1].volmul[1]);
+    if (ended) return false;
     if (s->fxchanged) s->fxchanged = false;
     s->data.offset = offset;
     s->data.frac = frac;
     s->fxoff = fxoff;
-    s->lplastout = lplastout;
-    s->hplastout = hplastout;
-    s->hplastin = hplastin;
     return true;
 }
+#undef MIXSOUND3D_COPY
+#undef MIXSOUND3D_SINCFETCH
 #undef MIXSOUND3D_LOOP_COMMON
 #undef MIXSOUND3D_LOOP
 #undef MIXSOUND3D_BODY
-#define MIXSOUND3DFAKE_BODY(c) {\
-    if (s->fxchanged) {\
-        register int i = 0, ii = audiostate.audbuf.len;\
-        while (1) {\
-            interpfx(sfx, &fx, i, ii, audiostate.audbuf.len);\
-            MIXSOUND3D_CALCPOS();\
-            c\
-            ++i;\
-            if (i == audiostate.audbuf.len) {if (MIXSOUND_POSCHECK) return false; break;}\
-            --ii;\
-        }\
-    } else {\
-        register int i = 0;\
-        while (1) {\
-            MIXSOUND3D_CALCPOS();\
-            c\
-            ++i;\
-            if (i == audiostate.audbuf.len) {if (MIXSOUND_POSCHECK) return false; break;}\
-        }\
-    }\
-}
+// Voices that are not heard are only advanced, all at once by the whole buffer instead of stepping through it.
+// The speed is taken as the average over the buffer, which is not exact while it is changing, but nothing is
+// heard until the voice is mixed again, and compressed sounds seek to wherever it ends up then.
 static bool mixsound_3d_fake(struct audiosound_3d* s) {
     struct rc_sound* rc = s->data.rc;
     if (!rc) return true;
@@ -561,19 +1317,10 @@ static bool mixsound_3d_fake(struct audiosound_3d* s) {
     struct audioemitter* e = &audiostate.emitters.data[s->emitter];
     if (e->paused) return true;
     uint8_t flags = s->flags;
-    struct audiosound_fx fx, sfx[2];
-    long offset = s->data.offset;
-    int fxoff = s->fxoff;
-    int frac = s->data.frac;
-    if (s->fxchanged) {
-        //puts("fxchanged");
-        sfx[0] = s->fx[0];
-        sfx[1] = s->fx[1];
-    } else {
-        fx = s->fx[1];
-    }
     int outfreq = audiostate.freq;
-    {
+    if (freq == outfreq) {
+        freq = outfreq = 1;
+    } else {
         int outfreq2 = outfreq, gcd = freq;
         while (outfreq2) {
             int tmp = gcd % outfreq2;
@@ -584,33 +1331,30 @@ static bool mixsound_3d_fake(struct audiosound_3d* s) {
         freq /= gcd;
     }
     int div = outfreq * 32;
-    long pos;
+    int posoff = s->fx[1].posoff;
+    int speedmul2 = ((s->fxchanged) ? s->fx[0].speedmul : s->fx[1].speedmul) + s->fx[1].speedmul;
+    int64_t step = ((int64_t)(posoff - s->fxoff + audiostate.audbuf.len) * freq * speedmul2) / 2 + s->data.frac;
+    int64_t adv = step / div;
+    int64_t frac = step % div;
+    if (frac < 0) {
+        frac += div;
+        --adv;
+    }
+    // now the position of the last sample in the buffer, which is what the mixer checks for the end
+    long offset = s->data.offset + adv;
     if (flags & SOUNDFLAG_LOOP) {
-        if (flags & SOUNDFLAG_WRAP) {
-            #define MIXSOUND_POSCHECK 0
-            MIXSOUND3DFAKE_BODY (
-                pos = ((pos % len) + len) % len;
-            )
-            #undef MIXSOUND_POSCHECK
-        } else {
-            #define MIXSOUND_POSCHECK (pos < 0)
-            MIXSOUND3DFAKE_BODY (
-                if (pos >= 0) pos %= len;
-            )
-            #undef MIXSOUND_POSCHECK
-        }
+        if (!(flags & SOUNDFLAG_WRAP) && offset < 0) return false;
+        // keeps long-running loops from creeping towards overflow
+        if (offset >= len) offset %= len;
     } else {
-        #define MIXSOUND_POSCHECK (pos >= len || pos < 0)
-        MIXSOUND3DFAKE_BODY ()
-        #undef MIXSOUND_POSCHECK
+        if (offset >= len || offset < 0) return false;
     }
     if (s->fxchanged) s->fxchanged = false;
     s->data.offset = offset;
     s->data.frac = frac;
-    s->fxoff = fxoff;
+    s->fxoff = posoff;
     return true;
 }
-#undef MIXSOUND3DFAKE_BODY
 #undef MIXSOUND3D_CALCPOS
 
 #define MIXSOUND2D_CALCPOS() do {\
@@ -620,7 +1364,7 @@ static bool mixsound_3d_fake(struct audiosound_3d* s) {
     frac %= outfreq;\
     pos = offset;\
 } while (0)
-#define MIXSOUND2D_LOOP_COMMON(wp, wp2, poob, p2oob, v) do {\
+#define MIXSOUND2D_LOOP_COMMON(wp, wp2, poob, p2oob) do {\
     if (!(poob)) {\
         wp;\
         MIXSOUND_GETSAMPLE(pos, l1, r1);\
@@ -635,29 +1379,20 @@ static bool mixsound_3d_fake(struct audiosound_3d* s) {
                 r1 = (r1 * ifrac + r2 * tmpfrac) / 32;\
             }\
         }\
-        audbuf[0][i] += l1 * v / 32768;\
-        audbuf[1][i] += r1 * v / 32768;\
+        vbuf[0][i] = l1;\
+        vbuf[1][i] = r1;\
+    } else {\
+        vbuf[0][i] = 0.0f;\
+        vbuf[1][i] = 0.0f;\
     }\
 } while (0)
 #define MIXSOUND2D_LOOP(wp, wp2, poob, p2oob) do {\
-    if (oldvol != newvol) {\
-        register int i = 0, ii = audiostate.audbuf.len;\
-        while (1) {\
-            vol = (oldvol * ii + newvol * i) / audiostate.audbuf.len;\
-            MIXSOUND2D_CALCPOS();\
-            MIXSOUND2D_LOOP_COMMON(wp, wp2, poob, p2oob, vol);\
-            ++i;\
-            if (i == audiostate.audbuf.len) {if (poob) return false; break;}\
-            --ii;\
-        }\
-    } else {\
-        register int i = 0;\
-        while (1) {\
-            MIXSOUND2D_CALCPOS();\
-            MIXSOUND2D_LOOP_COMMON(wp, wp2, poob, p2oob, newvol);\
-            ++i;\
-            if (i == audiostate.audbuf.len) {if (poob) return false; break;}\
-        }\
+    register int i = 0;\
+    while (1) {\
+        MIXSOUND2D_CALCPOS();\
+        MIXSOUND2D_LOOP_COMMON(wp, wp2, poob, p2oob);\
+        ++i;\
+        if (i == audiostate.audbuf.len) {if (poob) ended = true; break;}\
     }\
 } while (0)
 #define MIXSOUND2D_BODY() do {\
@@ -690,7 +1425,9 @@ static bool mixsound_2d(struct audiosound* s, int** audbuf, uint8_t flags, int o
     int l2, r2;
     oldvol = oldvol * volmul * audiostate.vol.master / 10000;
     newvol = newvol * volmul * audiostate.vol.master / 10000;
-    int vol;
+    bool ended = false;
+    float* vbuf[2] = {audiostate.audbuf.voice[0], audiostate.audbuf.voice[1]};
+    decahead_sethead(s, offset, flags & SOUNDFLAG_LOOP);
     switch (rc->format) {
         case RC_SOUND_FRMT_WAV: {
             union {
@@ -736,18 +1473,25 @@ static bool mixsound_2d(struct audiosound* s, int** audbuf, uint8_t flags, int o
             }
         } break;
         case RC_SOUND_FRMT_VORBIS: {
-            #define MIXSOUND_GETSAMPLE(p, l, r) getvorbisat(s, p, &l, &r)
+            #define MIXSOUND_GETSAMPLE(p, l, r) do {\
+                if (!getdecat(s, p, &l, &r)) getvorbisat(s, p, &l, &r);\
+            } while (0)
             MIXSOUND2D_BODY();
             #undef MIXSOUND_GETSAMPLE
         } break;
         #ifdef PSRC_USEMINIMP3
         case RC_SOUND_FRMT_MP3: {
-            #define MIXSOUND_GETSAMPLE(p, l, r) getmp3at(s, p, stereo, &l, &r)
+            #define MIXSOUND_GETSAMPLE(p, l, r) do {\
+                if (!getdecat(s, p, &l, &r)) getmp3at(s, p, stereo, &l, &r);\
+            } while (0)
             MIXSOUND2D_BODY();
             #undef MIXSOUND_GETSAMPLE
         } break;
         #endif
     }
+    audiomixkern.addscaled(audbuf[0], vbuf[0], audiostate.audbuf.len, oldvol, newvol);
+    audiomixkern.addscaled(audbuf[1], vbuf[1], audiostate.audbuf.len, oldvol, newvol);
+    if (ended) return false;
     s->offset = offset;
     s->frac = frac;
     return true;
@@ -802,226 +1546,350 @@ static bool mixsound_2d_fake(struct audiosound* s, uint8_t flags) {
 #undef MIXSOUND2DFAKE_BODY
 #undef MIXSOUND2D_CALCPOS
 
-static void doReverb(unsigned len, int* outl, int* outr) {
-    int mix = roundf(audiostate.env.reverb.mix[1] * 256.0f);
-    if (!mix) return;
-    int feedback = roundf(audiostate.env.reverb.feedback[1] * 256.0f);
-    if (!audiostate.env.reverb.size) {
-        register unsigned size = len - 1;
+// Feedback delay network: each line's output is damped by the reverb filters, scaled so every line decays at the
+// same rate per second, then mixed back into all of the lines through a Householder matrix (I - 2/N * ones). The
+// lines are at least a block long, so a block of every line's output can be read before any of it is written,
+// which keeps all of the work on contiguous runs the block kernels and the compiler can vectorize.
+static const float reverbratios[AUDIO_REVERB_LINES] = {0.53f, 0.61f, 0.70f, 0.79f, 0.89f, 1.0f, 1.12f, 1.26f};
+struct reverbparams {
+    float mix;
+    float gain[AUDIO_REVERB_LINES];
+    float lpa;
+    float hph;
+};
+static void getreverbparams(int i, struct reverbparams* p) {
+    float filtamount = 1.0f - audiostate.env.reverb.lpfilt.amount[i];
+    int lpmul = (int)roundf(filtamount * filtamount * audiostate.freq);
+    if (adjfilters && audiostate.freq != 44100) ADJLPFILTMUL(filtamount, lpmul, 44100);
+    filtamount = audiostate.env.reverb.hpfilt.amount[i];
+    int hpmul = (int)roundf(filtamount * filtamount * audiostate.freq);
+    if (adjfilters && audiostate.freq != 44100) ADJHPFILTMUL(filtamount, hpmul, 44100);
+    hpmul = audiostate.freq - hpmul;
+    p->mix = audiostate.env.reverb.mix[i];
+    p->lpa = (float)lpmul / audiostate.freq;
+    p->hph = (float)hpmul / audiostate.freq;
+    float feedback = audiostate.env.reverb.feedback[i];
+    if (feedback < 0.0f) feedback = 0.0f;
+    else if (feedback > 1.0f) feedback = 1.0f;
+    // 'feedback' is per 'delay', so the lines are scaled by how many times they go around in that long
+    float meanlen = audiostate.env.reverb.delay[1] * audiostate.freq;
+    for (int l = 0; l < AUDIO_REVERB_LINES; ++l) {
+        p->gain[l] = powf(feedback, audiostate.env.reverb.len[l] / meanlen);
+    }
+}
+static void freeReverb(void) {
+    free(audiostate.env.reverb.buf);
+    audiostate.env.reverb.buf = NULL;
+    audiostate.env.reverb.size = 0;
+    audiostate.env.reverb.head = 0;
+    for (int l = 0; l < AUDIO_REVERB_LINES; ++l) {
+        audiostate.env.reverb.lpfilt.lastout[l] = 0.0f;
+        audiostate.env.reverb.hpfilt.lastout[l] = 0.0f;
+        audiostate.env.reverb.hpfilt.lastin[l] = 0.0f;
+    }
+}
+static void doReverb(int* outl, int* outr) {
+    unsigned meanlen = roundf(audiostate.env.reverb.delay[1] * audiostate.freq);
+    if (!meanlen) {
+        if (audiostate.env.reverb.buf) freeReverb();
+        return;
+    }
+    bool changed = audiostate.env.reverbchanged;
+    if (!changed && !audiostate.env.reverb.mix[1]) return;
+    if (changed && !audiostate.env.reverb.mix[0] && !audiostate.env.reverb.mix[1]) return;
+    unsigned maxlen = 0, minlen = ~0U;
+    for (int l = 0; l < AUDIO_REVERB_LINES; ++l) {
+        unsigned len = roundf(meanlen * reverbratios[l]);
+        if (l && len <= audiostate.env.reverb.len[l - 1]) len = audiostate.env.reverb.len[l - 1] + 1;
+        if (!len) len = 1;
+        audiostate.env.reverb.len[l] = len;
+        if (len > maxlen) maxlen = len;
+        if (len < minlen) minlen = len;
+    }
+    if (audiostate.env.reverb.size < maxlen) {
+        freeReverb();
+        register unsigned size = maxlen - 1;
         size |= size >> 1;
         size |= size >> 2;
         size |= size >> 4;
         size |= size >> 8;
         size |= size >> 16;
         ++size;
+        audiostate.env.reverb.buf = calloc(size * AUDIO_REVERB_LINES, sizeof(*audiostate.env.reverb.buf));
+        if (!audiostate.env.reverb.buf) return;
         audiostate.env.reverb.size = size;
-        audiostate.env.reverb.buf[0] = calloc(size, sizeof(**audiostate.env.reverb.buf));
-        audiostate.env.reverb.buf[1] = calloc(size, sizeof(**audiostate.env.reverb.buf));
     }
-    register unsigned head = audiostate.env.reverb.head;
-    register unsigned tail = (head + (audiostate.env.reverb.size - len)) % audiostate.env.reverb.size;
-    register float filtamount = 1.0f - audiostate.env.reverb.lpfilt.amount[1];
-    int lpmul = (int)roundf(filtamount * filtamount * audiostate.freq);
-    if (adjfilters && audiostate.freq != 44100) ADJLPFILTMUL(filtamount, lpmul, 44100);
-    filtamount = audiostate.env.reverb.hpfilt.amount[1];
-    int hpmul = (int)roundf(filtamount * filtamount * audiostate.freq);
-    if (adjfilters && audiostate.freq != 44100) ADJHPFILTMUL(filtamount, hpmul, 44100);
-    hpmul = audiostate.freq - hpmul;
-    //printf("filtmul (high = off): [%d, %d]\n", lpmul, hpmul);
-    int lplastoutl = audiostate.env.reverb.lpfilt.lastout[0];
-    int lplastoutr = audiostate.env.reverb.lpfilt.lastout[1];
-    int hplastoutl = audiostate.env.reverb.hpfilt.lastout[0];
-    int hplastoutr = audiostate.env.reverb.hpfilt.lastout[1];
-    int hplastinl = audiostate.env.reverb.hpfilt.lastin[0];
-    int hplastinr = audiostate.env.reverb.hpfilt.lastin[1];
-    for (register int i = 0; i < audiostate.audbuf.len; ++i) {
-        int in[2] = {outl[i], outr[i]};
-        int out[2] = {audiostate.env.reverb.buf[0][tail], audiostate.env.reverb.buf[1][tail]};
-        hplastoutl = (hplastoutl + out[0] - hplastinl) * hpmul / audiostate.freq;
-        hplastoutr = (hplastoutr + out[1] - hplastinr) * hpmul / audiostate.freq;
-        hplastinl = out[0];
-        hplastinr = out[1];
-        out[0] = lplastoutl = lplastoutl + (hplastoutl - lplastoutl) * lpmul / audiostate.freq;
-        out[1] = lplastoutr = lplastoutr + (hplastoutr - lplastoutr) * lpmul / audiostate.freq;
-        outl[i] += out[0] * mix / 256;
-        outr[i] += out[1] * mix / 256;
-        in[0] += out[0] * feedback / 256;
-        in[1] += out[1] * feedback / 256;
-        if (in[0] < -32768) in[0] = -32768;
-        else if (in[0] > 32767) in[0] = 32767;
-        if (in[1] < -32768) in[1] = -32768;
-        else if (in[1] > 32767) in[1] = 32767;
-        audiostate.env.reverb.buf[0][head] = in[0];
-        audiostate.env.reverb.buf[1][head] = in[1];
-        head = (head + 1) % audiostate.env.reverb.size;
-        tail = (tail + 1) % audiostate.env.reverb.size;
-    }
-    audiostate.env.reverb.head = head;
-    if (lplastoutl < -32768) lplastoutl = -32768;
-    else if (lplastoutl > 32767) lplastoutl = 32767;
-    if (lplastoutr < -32768) lplastoutr = -32768;
-    else if (lplastoutr > 32767) lplastoutr = 32767;
-    if (hplastoutl < -32768) hplastoutl = -32768;
-    else if (hplastoutl > 32767) hplastoutl = 32767;
-    if (hplastoutr < -32768) hplastoutr = -32768;
-    else if (hplastoutr > 32767) hplastoutr = 32767;
-    if (hplastinl < -32768) hplastinl = -32768;
-    else if (hplastinl > 32767) hplastinl = 32767;
-    if (hplastinr < -32768) hplastinr = -32768;
-    else if (hplastinr > 32767) hplastinr = 32767;
-    audiostate.env.reverb.lpfilt.lastout[0] = lplastoutl;
-    audiostate.env.reverb.lpfilt.lastout[1] = lplastoutr;
-    audiostate.env.reverb.hpfilt.lastout[0] = hplastoutl;
-    audiostate.env.reverb.hpfilt.lastout[1] = hplastoutr;
-    audiostate.env.reverb.hpfilt.lastin[0] = hplastinl;
-    audiostate.env.reverb.hpfilt.lastin[1] = hplastinr;
-}
-static void doGradReverb(unsigned curlen, unsigned nextlen, int* outl, int* outr) {
-    int curmix = roundf(audiostate.env.reverb.mix[0] * 256.0f);
-    int nextmix = roundf(audiostate.env.reverb.mix[1] * 256.0f);
-    if (!curmix && !nextmix) return;
-    int curfeedback = roundf(audiostate.env.reverb.feedback[0] * 256.0f);
-    int nextfeedback = roundf(audiostate.env.reverb.feedback[1] * 256.0f);
-    register unsigned head;
-    unsigned maxlen = (nextlen >= curlen) ? nextlen : curlen;
-    if (audiostate.env.reverb.size < maxlen) {
-        free(audiostate.env.reverb.buf[0]);
-        free(audiostate.env.reverb.buf[1]);
-        register unsigned size = maxlen - 1;
-        size |= size >> 1;
-        size |= size >> 2;
-        size |= size >> 4;
-        size |= size >> 8;
-        size |= size >> 16;
-        ++size;
-        audiostate.env.reverb.size = size;
-        audiostate.env.reverb.buf[0] = calloc(size, sizeof(**audiostate.env.reverb.buf));
-        audiostate.env.reverb.buf[1] = calloc(size, sizeof(**audiostate.env.reverb.buf));
-        head = 0;
-    } else {
-        head = audiostate.env.reverb.head;
-    }
-    register unsigned tail = (head + (audiostate.env.reverb.size - nextlen)) % audiostate.env.reverb.size;
-    register float curfiltamount = 1.0f - audiostate.env.reverb.lpfilt.amount[0];
-    register float nextfiltamount = 1.0f - audiostate.env.reverb.lpfilt.amount[1];
-    int curlpmul = (int)roundf(curfiltamount * curfiltamount * audiostate.freq);
-    int nextlpmul = (int)roundf(nextfiltamount * nextfiltamount * audiostate.freq);
-    #if 1
-    if (adjfilters && audiostate.freq != 44100) {
-        ADJLPFILTMUL(curfiltamount, curlpmul, 44100);
-        ADJLPFILTMUL(nextfiltamount, nextlpmul, 44100);
+    struct reverbparams p[2];
+    getreverbparams(1, &p[1]);
+    if (changed) getreverbparams(0, &p[0]);
+    else p[0] = p[1];
+    int blocklen = (minlen < AUDIO_REVERB_BLOCK) ? minlen : AUDIO_REVERB_BLOCK;
+    unsigned size = audiostate.env.reverb.size;
+    unsigned mask = size - 1;
+    unsigned head = audiostate.env.reverb.head;
+    float* lbuf[AUDIO_REVERB_LINES];
+    for (int l = 0; l < AUDIO_REVERB_LINES; ++l) {
+        lbuf[l] = audiostate.env.reverb.buf + l * size;
+    }
+    float y[AUDIO_REVERB_LINES][AUDIO_REVERB_BLOCK];
+    float in[2][AUDIO_REVERB_BLOCK];
+    float sum[AUDIO_REVERB_BLOCK];
+    int buflen = audiostate.audbuf.len;
+    for (int off = 0; off < buflen; off += blocklen) {
+        int len = buflen - off;
+        if (len > blocklen) len = blocklen;
+        float t = (changed) ? (off + len * 0.5f) / buflen : 1.0f;
+        float it = 1.0f - t;
+        float lpa = p[0].lpa * it + p[1].lpa * t;
+        float hph = p[0].hph * it + p[1].hph * t;
+        float mix = (p[0].mix * it + p[1].mix * t) * 0.5f;
+        for (int i = 0; i < len; ++i) {
+            in[0][i] = outl[off + i];
+            in[1][i] = outr[off + i];
+            sum[i] = 0.0f;
+        }
+        for (int l = 0; l < AUDIO_REVERB_LINES; ++l) {
+            float* yl = y[l];
+            unsigned rp = (head - audiostate.env.reverb.len[l]) & mask;
+            int first = size - rp;
+            if (first > len) first = len;
+            memcpy(yl, lbuf[l] + rp, first * sizeof(*yl));
+            memcpy(yl + first, lbuf[l], (len - first) * sizeof(*yl));
+            audiomixkern.hpfilt(yl, len, hph, &audiostate.env.reverb.hpfilt.lastin[l], &audiostate.env.reverb.hpfilt.lastout[l]);
+            audiomixkern.lpfilt(yl, len, lpa, &audiostate.env.reverb.lpfilt.lastout[l]);
+            // even lines go to the left, odd to the right, with alternating signs so the sides do not correlate
+            float m = (l & 2) ? -mix : mix;
+            int* dst = (l & 1) ? outr + off : outl + off;
+            float g = p[0].gain[l] * it + p[1].gain[l] * t;
+            for (int i = 0; i < len; ++i) {
+                dst[i] += (int)(yl[i] * m);
+                yl[i] *= g;
+                sum[i] += yl[i];
+            }
+        }
+        for (int i = 0; i < len; ++i) {
+            sum[i] *= -2.0f / AUDIO_REVERB_LINES;
+        }
+        for (int l = 0; l < AUDIO_REVERB_LINES; ++l) {
+            const float* yl = y[l];
+            const float* il = in[l & 1];
+            unsigned wp = head & mask;
+            int first = size - wp;
+            if (first > len) first = len;
+            float* d = lbuf[l] + wp;
+            for (int i = 0; i < first; ++i) {
+                d[i] = il[i] + yl[i] + sum[i];
+            }
+            d = lbuf[l] - first;
+            for (int i = first; i < len; ++i) {
+                d[i] = il[i] + yl[i] + sum[i];
+            }
+        }
+        head += len;
     }
+    audiostate.env.reverb.head = head & mask;
+}
+// 3D voices only touch their own state while mixing, so they are split between the mixer thread and the
+// workers, each summing into its own buffers. Stopping the ones that ended is left to the mixer thread.
+#define MIXPOOL_MINJOBS 8 // fewer mixed voices than this are not worth waking the workers for
+#define MIXPOOL_MAXTHREADS 8
+struct mixjob {
+    struct audiosound_3d* s;
+    uint8_t mix : 1; // advanced without mixing if not set
+    uint8_t ended : 1;
+};
+#ifndef PSRC_NOMT
+struct mixworker {
+    thread_t thread;
+    int index;
+    int* audbuf[2];
+    struct mixscratch scratch;
+};
+#endif
+static struct {
+    struct mixjob* data;
+    int len;
+    int size;
+    int mixcount;
+    #ifndef PSRC_NOMT
+    int threads;
+    struct mixworker* workers;
+    mutex_t lock;
+    cond_t start;
+    cond_t done;
+    unsigned gen;
+    int pending;
     #endif
-    curfiltamount = audiostate.env.reverb.hpfilt.amount[0];
-    nextfiltamount = audiostate.env.reverb.hpfilt.amount[1];
-    int curhpmul = audiostate.freq - (int)roundf(curfiltamount * curfiltamount * audiostate.freq);
-    int nexthpmul = audiostate.freq - (int)roundf(nextfiltamount * nextfiltamount * audiostate.freq);
-    #if 1
-    if (adjfilters && audiostate.freq != 44100) {
-        ADJHPFILTMUL(curfiltamount, curhpmul, 44100);
-        ADJHPFILTMUL(nextfiltamount, nexthpmul, 44100);
-    }
-    curhpmul = audiostate.freq - curhpmul;
-    nexthpmul = audiostate.freq - nexthpmul;
+    struct mixscratch scratch; // the mixer thread's own
+} mixpool;
+
+static void addmixjobs(struct audiovoicegroup_world* g) {
+    int playcount = g->playcount;
+    if (playcount > g->len) playcount = g->len;
+    if (mixpool.len + g->len > mixpool.size) {
+        mixpool.size = mixpool.len + g->len;
+        mixpool.data = realloc(mixpool.data, mixpool.size * sizeof(*mixpool.data));
+    }
+    for (int si = 0; si < g->len; ++si) {
+        struct mixjob* j = &mixpool.data[mixpool.len++];
+        j->s = &g->data[g->sortdata[si]];
+        j->mix = (si < playcount && j->s->maxvol);
+        j->ended = 0;
+        mixpool.mixcount += j->mix;
+    }
+}
+static void runmixjobs(int first, int step, int** audbuf, struct mixscratch* scratch) {
+    for (int i = first; i < mixpool.len; i += step) {
+        struct mixjob* j = &mixpool.data[i];
+        if (!((j->mix) ? mixsound_3d(j->s, audbuf, scratch) : mixsound_3d_fake(j->s))) j->ended = 1;
+    }
+}
+
+#ifndef PSRC_NOMT
+static void* mixworker(struct thread_data* td) {
+    struct mixworker* w = td->args;
+    unsigned gen = 0;
+    lockMutex(&mixpool.lock);
+    while (1) {
+        while (mixpool.gen == gen && !td->shouldclose) waitCond(&mixpool.start, &mixpool.lock);
+        if (td->shouldclose) break;
+        gen = mixpool.gen;
+        unlockMutex(&mixpool.lock);
+        memset(w->audbuf[0], 0, audiostate.audbuf.len * sizeof(**w->audbuf));
+        memset(w->audbuf[1], 0, audiostate.audbuf.len * sizeof(**w->audbuf));
+        runmixjobs(w->index, mixpool.threads + 1, w->audbuf, &w->scratch);
+        lockMutex(&mixpool.lock);
+        if (!--mixpool.pending) signalCond(&mixpool.done);
+    }
+    unlockMutex(&mixpool.lock);
+    return NULL;
+}
+static void stopMixWorkers(void) {
+    if (!mixpool.threads) return;
+    lockMutex(&mixpool.lock);
+    for (int i = 0; i < mixpool.threads; ++i) {
+        quitThread(&mixpool.workers[i].thread);
+    }
+    broadcastCond(&mixpool.start);
+    unlockMutex(&mixpool.lock);
+    for (int i = 0; i < mixpool.threads; ++i) {
+        struct mixworker* w = &mixpool.workers[i];
+        destroyThread(&w->thread, NULL);
+        free(w->audbuf[0]);
+        free(w->audbuf[1]);
+        free(w->scratch.vbuf);
+        mixscratch_free(&w->scratch);
+    }
+    free(mixpool.workers);
+    mixpool.workers = NULL;
+    destroyCond(&mixpool.start);
+    destroyCond(&mixpool.done);
+    destroyMutex(&mixpool.lock);
+    mixpool.threads = 0;
+}
+static void startMixWorkers(int threads) {
+    mixpool.threads = 0;
+    if (threads <= 0) return;
+    if (threads > MIXPOOL_MAXTHREADS) threads = MIXPOOL_MAXTHREADS;
+    if (!createMutex(&mixpool.lock)) return;
+    if (!createCond(&mixpool.start)) {
+        destroyMutex(&mixpool.lock);
+        return;
+    }
+    if (!createCond(&mixpool.done)) {
+        destroyCond(&mixpool.start);
+        destroyMutex(&mixpool.lock);
+        return;
+    }
+    mixpool.gen = 0;
+    mixpool.pending = 0;
+    mixpool.workers = malloc(threads * sizeof(*mixpool.workers));
+    if (!mixpool.workers) {
+        plog(LL_WARN, "Failed to allocate audio mixing workers");
+        destroyCond(&mixpool.start);
+        destroyCond(&mixpool.done);
+        destroyMutex(&mixpool.lock);
+        return;
+    }
+    for (int i = 0; i < threads; ++i) {
+        struct mixworker* w = &mixpool.workers[i];
+        w->index = i + 1;
+        w->audbuf[0] = malloc(audiostate.audbuf.len * sizeof(**w->audbuf));
+        w->audbuf[1] = malloc(audiostate.audbuf.len * sizeof(**w->audbuf));
+        w->scratch = (struct mixscratch){.vbuf = malloc(audiostate.audbuf.len * sizeof(*w->scratch.vbuf))};
+        char name[16];
+        snprintf(name, sizeof(name), "audio mix %d", i + 1);
+        if (!w->audbuf[0] || !w->audbuf[1] || !w->scratch.vbuf || !createThread(&w->thread, name, &(struct threadattr){.prio = THREADPRIO_HIGH}, mixworker, w)) {
+            free(w->audbuf[0]);
+            free(w->audbuf[1]);
+            free(w->scratch.vbuf);
+            plog(LL_WARN, "Failed to start audio mixing worker %d", i + 1);
+            break;
+        }
+        ++mixpool.threads;
+    }
+    if (!mixpool.threads) {
+        free(mixpool.workers);
+        mixpool.workers = NULL;
+        destroyCond(&mixpool.start);
+        destroyCond(&mixpool.done);
+        destroyMutex(&mixpool.lock);
+    }
+}
+#endif
+
+static void runcmds(void);
+static void queuecmd(const struct audiocmd*);
+static void updatestate(float framemult);
+static void mixsounds(int16_t* out) {
+    runcmds();
+    #ifndef PSRC_NOMT
+    if (audiostate.mixthread.update) {
+        updatestate(audiostate.mixthread.framemult);
+        audiostate.mixthread.update = false;
+        audiostate.mixthread.framemult = 0.0f;
+    }
     #endif
-    int lplastoutl = audiostate.env.reverb.lpfilt.lastout[0];
-    int lplastoutr = audiostate.env.reverb.lpfilt.lastout[1];
-    int hplastoutl = audiostate.env.reverb.hpfilt.lastout[0];
-    int hplastoutr = audiostate.env.reverb.hpfilt.lastout[1];
-    int hplastinl = audiostate.env.reverb.hpfilt.lastin[0];
-    int hplastinr = audiostate.env.reverb.hpfilt.lastin[1];
-    for (register int i = 0, ii = audiostate.audbuf.len; i < audiostate.audbuf.len; ++i, --ii) {
-        int mix = (curmix * ii + nextmix * i) / audiostate.audbuf.len;
-        int feedback = (curfeedback * ii + nextfeedback * i) / audiostate.audbuf.len;
-        int lpmul = (curlpmul * ii + nextlpmul * i) / audiostate.audbuf.len;
-        int hpmul = (curhpmul * ii + nexthpmul * i) / audiostate.audbuf.len;
-        int in[2] = {outl[i], outr[i]};
-        int out[2] = {audiostate.env.reverb.buf[0][tail], audiostate.env.reverb.buf[1][tail]};
-        hplastoutl = (hplastoutl + out[0] - hplastinl) * hpmul / audiostate.freq;
-        hplastoutr = (hplastoutr + out[1] - hplastinr) * hpmul / audiostate.freq;
-        hplastinl = out[0];
-        hplastinr = out[1];
-        out[0] = lplastoutl = lplastoutl + (hplastoutl - lplastoutl) * lpmul / audiostate.freq;
-        out[1] = lplastoutr = lplastoutr + (hplastoutr - lplastoutr) * lpmul / audiostate.freq;
-        outl[i] += out[0] * mix / 256;
-        outr[i] += out[1] * mix / 256;
-        in[0] += out[0] * feedback / 256;
-        in[1] += out[1] * feedback / 256;
-        if (in[0] < -32768) in[0] = -32768;
-        else if (in[0] > 32767) in[0] = 32767;
-        if (in[1] < -32768) in[1] = -32768;
-        else if (in[1] > 32767) in[1] = 32767;
-        audiostate.env.reverb.buf[0][head] = in[0];
-        audiostate.env.reverb.buf[1][head] = in[1];
-        head = (head + 1) % audiostate.env.reverb.size;
-        tail = (tail + 1) % audiostate.env.reverb.size;
-    }
-    audiostate.env.reverb.head = head;
-    if (lplastoutl < -32768) lplastoutl = -32768;
-    else if (lplastoutl > 32767) lplastoutl = 32767;
-    if (lplastoutr < -32768) lplastoutr = -32768;
-    else if (lplastoutr > 32767) lplastoutr = 32767;
-    if (hplastoutl < -32768) hplastoutl = -32768;
-    else if (hplastoutl > 32767) hplastoutl = 32767;
-    if (hplastoutr < -32768) hplastoutr = -32768;
-    else if (hplastoutr > 32767) hplastoutr = 32767;
-    if (hplastinl < -32768) hplastinl = -32768;
-    else if (hplastinl > 32767) hplastinl = 32767;
-    if (hplastinr < -32768) hplastinr = -32768;
-    else if (hplastinr > 32767) hplastinr = 32767;
-    audiostate.env.reverb.lpfilt.lastout[0] = lplastoutl;
-    audiostate.env.reverb.lpfilt.lastout[1] = lplastoutr;
-    audiostate.env.reverb.hpfilt.lastout[0] = hplastoutl;
-    audiostate.env.reverb.hpfilt.lastout[1] = hplastoutr;
-    audiostate.env.reverb.hpfilt.lastin[0] = hplastinl;
-    audiostate.env.reverb.hpfilt.lastin[1] = hplastinr;
-    if (!nextlen) {
-        free(audiostate.env.reverb.buf[0]);
-        free(audiostate.env.reverb.buf[1]);
-    }
-}
-static void mixsounds(int buf) {
-    int* audbuf[2] = {audiostate.audbuf.data[buf][0], audiostate.audbuf.data[buf][1]};
+    int* audbuf[2] = {audiostate.audbuf.data[0], audiostate.audbuf.data[1]};
     memset(audbuf[0], 0, audiostate.audbuf.len * sizeof(**audbuf));
     memset(audbuf[1], 0, audiostate.audbuf.len * sizeof(**audbuf));
     // 3D mixing
     {
-        int playcount = audiostate.voices.world.playcount;
-        if (playcount > audiostate.voices.world.len) {
-            playcount = audiostate.voices.world.len;
-        } else if (playcount < audiostate.voices.world.len) {
-            int si = playcount;
-            do {
-                struct audiosound_3d* s = &audiostate.voices.world.data[audiostate.voices.world.sortdata[si++]];
-                if (!mixsound_3d_fake(s)) stop3DSound_inline(s);
-            } while (si < audiostate.voices.world.len);
-        }
-        for (int si = 0; si < playcount; ++si) {
-            struct audiosound_3d* s = &audiostate.voices.world.data[audiostate.voices.world.sortdata[si]];
-            if (!((s->maxvol) ? mixsound_3d(s, audbuf) : mixsound_3d_fake(s))) stop3DSound_inline(s);
-        }
-        playcount = audiostate.voices.worldbg.playcount;
-        if (playcount > audiostate.voices.worldbg.len) {
-            playcount = audiostate.voices.worldbg.len;
-        } else if (playcount < audiostate.voices.worldbg.len) {
-            int si = playcount;
-            do {
-                struct audiosound_3d* s = &audiostate.voices.worldbg.data[audiostate.voices.worldbg.sortdata[si++]];
-                if (!mixsound_3d_fake(s)) stop3DSound_inline(s);
-            } while (si < audiostate.voices.worldbg.len);
-        }
-        for (int si = 0; si < playcount; ++si) {
-            struct audiosound_3d* s = &audiostate.voices.worldbg.data[audiostate.voices.worldbg.sortdata[si]];
-            if (!((s->maxvol) ? mixsound_3d(s, audbuf) : mixsound_3d_fake(s))) stop3DSound_inline(s);
-        }
-    }
-    if (!audiostate.env.reverbchanged) {
-        unsigned len = roundf(audiostate.env.reverb.delay[1] * audiostate.freq);
-        if (len) doReverb(len, audbuf[0], audbuf[1]);
-    } else {
-        unsigned curlen = roundf(audiostate.env.reverb.delay[0] * audiostate.freq);
-        unsigned nextlen = roundf(audiostate.env.reverb.delay[1] * audiostate.freq);
-        if (curlen && nextlen) doGradReverb(curlen, nextlen, audbuf[0], audbuf[1]);
+        mixpool.len = 0;
+        mixpool.mixcount = 0;
+        mixpool.scratch.vbuf = audiostate.audbuf.voice[0];
+        addmixjobs(&audiostate.voices.world);
+        addmixjobs(&audiostate.voices.worldbg);
+        #ifndef PSRC_NOMT
+        if (mixpool.threads && mixpool.mixcount >= MIXPOOL_MINJOBS) {
+            lockMutex(&mixpool.lock);
+            mixpool.pending = mixpool.threads;
+            ++mixpool.gen;
+            broadcastCond(&mixpool.start);
+            unlockMutex(&mixpool.lock);
+            runmixjobs(0, mixpool.threads + 1, audbuf, &mixpool.scratch);
+            lockMutex(&mixpool.lock);
+            while (mixpool.pending) waitCond(&mixpool.done, &mixpool.lock);
+            unlockMutex(&mixpool.lock);
+            for (int w = 0; w < mixpool.threads; ++w) {
+                if (w + 1 >= mixpool.len) break; // had nothing to do
+                int* wbuf[2] = {mixpool.workers[w].audbuf[0], mixpool.workers[w].audbuf[1]};
+                for (register int i = 0; i < audiostate.audbuf.len; ++i) {
+                    audbuf[0][i] += wbuf[0][i];
+                    audbuf[1][i] += wbuf[1][i];
+                }
+            }
+        } else
+        #endif
+        {
+            runmixjobs(0, 1, audbuf, &mixpool.scratch);
+        }
+        for (int i = 0; i < mixpool.len; ++i) {
+            if (mixpool.data[i].ended) stop3DSound_inline(mixpool.data[i].s);
+        }
+    }
+    doReverb(audbuf[0], audbuf[1]);
+    if (audiostate.env.reverbchanged) {
         audiostate.env.reverb.delay[0] = audiostate.env.reverb.delay[1];
         audiostate.env.reverb.feedback[0] = audiostate.env.reverb.feedback[1];
         audiostate.env.reverb.mix[0] = audiostate.env.reverb.mix[1];
@@ -1162,50 +2030,41 @@ static void mixsounds(int buf) {
         struct audiosound* s = &audiostate.voices.alerts.data[i].data;
         if (s->rc && !mixsound_2d(s, audbuf, 0, 32768, 32768, audiostate.vol.alerts)) stopSound_inline(&audiostate.voices.ui);
     }
-    // TODO: music
-    // TODO: voice chat
-    int16_t* out = audiostate.audbuf.out[buf];
-    if (audiostate.channels < 2) {
-        for (register int i = 0; i < audiostate.audbuf.len; ++i) {
-            register int sample = (audbuf[0][i] + audbuf[1][i]) / 2;
-            if (sample > 32767) sample = 32767;
-            else if (sample < -32768) sample = -32768;
-            out[i] = sample;
-        }
-    } else {
-        for (register int c = 0; c < 2; ++c) {
-            for (register int i = 0; i < audiostate.audbuf.len; ++i) {
-                register int sample = audbuf[c][i];
-                if (sample > 32767) sample = 32767;
-                else if (sample < -32768) sample = -32768;
-                out[i * audiostate.channels + c] = sample;
-            }
-        }
+    if (audiostate.voices.music.rc) {
+        ptmplay_render(
+            &audiostate.voices.music.player, audbuf[0], audbuf[1], audiostate.audbuf.len,
+            audiostate.vol.music * audiostate.vol.master / 10000.0f
+        );
     }
+    // TODO: voice chat
+    audiomixkern.pack(audbuf[0], audbuf[1], out, audiostate.audbuf.len, audiostate.channels);
 }
 
 static void callback(void* data, uint16_t* stream, int len) {
     (void)data;
+    unsigned played = audiostate.played;
     #if DEBUG(3)
-    plog(LL_INFO | LF_DEBUG, "Playing %d...", audiostate.audbufindex);
+    plog(LL_INFO | LF_DEBUG, "Playing %u...", played);
     #endif
-    int mixaudbufindex = audiostate.mixaudbufindex;
-    if (mixaudbufindex == (audiostate.audbufindex + 3) % 4 || mixaudbufindex < 0) {
+    unsigned mixed = atomicLoad(&audiostate.mixed);
+    if (mixed == played) {
         #if DEBUG(2)
         plog(LL_INFO | LF_DEBUG, "Mixer is beind!");
         #endif
         memset(stream, 0, len);
+        if (mixed) atomicStore(&audiostate.latency.cbunderruns, audiostate.latency.cbunderruns + 1);
     } else {
         int samples = len / sizeof(*stream) / audiostate.channels;
         if (audiostate.audbuf.len == samples) {
-            memcpy(stream, audiostate.audbuf.out[audiostate.audbufindex % 2], len);
+            memcpy(stream, audiostate.audbuf.out[played % audiostate.audbuf.outcount], len);
         } else {
             plog(LL_WARN | LF_DEBUG, "Mismatch between buffer length (%d) and requested samples (%d)", audiostate.audbuf.len, samples);
         }
         #if DEBUG(3)
-        plog(LL_INFO | LF_DEBUG, "Finished playing %d", audiostate.audbufindex);
+        plog(LL_INFO | LF_DEBUG, "Finished playing %u", played);
         #endif
-        audiostate.audbufindex = (audiostate.audbufindex + 1) % 4;
+        // the mixer thread polls this instead of being woken so the callback never waits on a lock
+        atomicStore(&audiostate.played, played + 1);
     }
 }
 
@@ -1236,108 +2095,265 @@ static void setSoundData(struct audiosound* s, struct rc_sound* rc) {
     }
     s->offset = 0;
     s->frac = 0;
+    decahead_start(s);
 }
 
-static inline int updsnds_cmp(struct audiosound_3d* s1, struct audiosound_3d* s2) {
-    if (!s1->data.rc) {
-        if (!s2->data.rc) return 0;
-        return 1;
+// stopped voices sort after silent ones
+#define updsnds_key(i) ((s[(i)].data.rc) ? s[(i)].maxvol : -1)
+// Puts the 'k' loudest voices at the start of sortdata (only those are mixed, the order otherwise does not
+// matter). sortdata is kept between updates, so if the loud voices are the same as last time, nothing moves.
+static void updsnds_select(struct audiovoicegroup_world* g, int k, int audible) {
+    struct audiosound_3d* s = g->data;
+    int* sortdata = g->sortdata;
+    int glen = g->len;
+    #define sel_swap(a, b) do {\
+        int sel_swap_tmp = sortdata[(a)];\
+        sortdata[(a)] = sortdata[(b)];\
+        sortdata[(b)] = sel_swap_tmp;\
+    } while (0)
+    if (audible <= k) {
+        // everything audible fits, just move it to the front
+        int l = 0, r = glen - 1;
+        while (1) {
+            while (l < r && updsnds_key(sortdata[l]) > 0) ++l;
+            while (l < r && updsnds_key(sortdata[r]) <= 0) --r;
+            if (l >= r) break;
+            sel_swap(l, r);
+        }
+        return;
+    }
+    {
+        int minin = updsnds_key(sortdata[0]);
+        for (int i = 1; i < k; ++i) {
+            int v = updsnds_key(sortdata[i]);
+            if (v < minin) minin = v;
+        }
+        int i = k;
+        while (i < glen && updsnds_key(sortdata[i]) <= minin) ++i;
+        if (i == glen) return;
+    }
+    // quickselect
+    int l = 0, r = glen - 1;
+    while (l < r) {
+        int m = (l + r) / 2;
+        if (updsnds_key(sortdata[m]) > updsnds_key(sortdata[l])) sel_swap(m, l);
+        if (updsnds_key(sortdata[r]) > updsnds_key(sortdata[l])) sel_swap(r, l);
+        if (updsnds_key(sortdata[r]) > updsnds_key(sortdata[m])) sel_swap(r, m);
+        int pivot = updsnds_key(sortdata[m]);
+        int i = l, j = r;
+        while (i <= j) {
+            while (updsnds_key(sortdata[i]) > pivot) ++i;
+            while (updsnds_key(sortdata[j]) < pivot) --j;
+            if (i <= j) {
+                sel_swap(i, j);
+                ++i;
+                --j;
+            }
+        }
+        if (k <= j) r = j;
+        else if (k >= i) l = i;
+        else break;
     }
-    if (!s2->data.rc) return -1;
-    return s2->maxvol - s1->maxvol;
+    #undef sel_swap
 }
 static void updsnds_world(struct audiovoicegroup_world* g) {
     int glen = g->len;
     if (!glen) return;
     struct audiosound_3d* s = g->data;
-    int* sortdata = g->sortdata;
-    {
-        int si = 0;
-        while (1) {
-            if (s->data.rc && !s->fxchanged) {
-                s->fx[0] = s->fx[1];
-                s->fxchanged = true;
+    int audible = 0;
+    for (int si = 0; si < glen; ++si, ++s) {
+        if (!s->data.rc) continue;
+        if (!s->fxchanged) {
+            s->fx[0] = s->fx[1];
+            s->fxchanged = true;
+            struct audioemitter* e = &audiostate.emitters.data[s->emitter];
+            if (e->near == audiostate.emitgrid.stamp) {
                 calc3DSoundFx(s);
+            } else {
+                // out of reach, so it is silent and only the speed matters for keeping its place
+                s->fx[1].speedmul = roundf(e->speed * s->speed * 32.0f);
+                s->fx[1].volmul[0] = 0;
+                s->fx[1].volmul[1] = 0;
+                s->fx[1].volmul[2] = 0;
+                s->maxvol = s->fx[0].volmul[2];
             }
-            ++si;
-            if (si == glen) break;
-            ++s;
         }
+        if (s->maxvol > 0) ++audible;
     }
-    s = g->data;
-    if (glen == 1) {
-        sortdata[0] = 0;
-    } else {
-        for (int i = 0; i < g->size; ++i) {
-            sortdata[i] = i;
-        }
-        struct qssi {
-            int l, r;
-        };
-        int sp = 0;
-        struct qssi sdata[16];
-        #define qs_swap(a, b) {\
-            int qs_swap_tmp = sortdata[(a)];\
-            sortdata[(a)] = sortdata[(b)];\
-            sortdata[(b)] = qs_swap_tmp;\
-        }
-        const int lim = 7;
-        while (1) {
-            struct qssi d = {0, glen};
-            struct qssi t;
-            if (d.l - d.r > lim) {
-                t.l = d.l + 1;
-                t.r = d.r - 1;
-                {
-                    int m = (d.l + d.r) / 2;
-                    qs_swap(m, d.l);
-                }
-                if (updsnds_cmp(&s[sortdata[t.l]], &s[sortdata[t.r]]) > 0) {
-                    qs_swap(t.l, t.r);
-                }
-                if (updsnds_cmp(&s[sortdata[d.l]], &s[sortdata[t.r]]) > 0) {
-                    qs_swap(d.l, t.r);
-                }
-                if (updsnds_cmp(&s[sortdata[t.l]], &s[sortdata[d.l]]) > 0) {
-                    qs_swap(t.l, d.l);
-                }
-                while (1) {
-                    do {
-                        ++t.l;
-                    } while (updsnds_cmp(&s[sortdata[t.l]], &s[sortdata[d.l]]) < 0);
-                    do {
-                        --t.r;
-                    } while (updsnds_cmp(&s[sortdata[t.r]], &s[sortdata[d.l]]) > 0);
-                    if (t.l > t.r) break;
-                    qs_swap(t.l, t.r);
-                }
-                qs_swap(d.l, t.r);
-                if (t.r - d.l > d.r - t.l) {
-                    sdata[sp++] = (struct qssi){d.l, t.r};
-                    d.l = t.l;
-                } else {
-                    sdata[sp++] = (struct qssi){t.l, d.r};
-                    d.r = t.r;
-                }
-            } else {
-                for (t.r = d.l, t.l = t.r + 1; t.l < d.r; t.r = t.l, ++t.l) {
-                    while (updsnds_cmp(&s[sortdata[t.r]], &s[sortdata[t.r + 1]]) > 0) {
-                        qs_swap(t.r, t.r + 1);
-                        if (t.r == d.l) break;
-                        --t.r;
-                    }
-                }
-                if (sp > 0) d = sdata[--sp];
-                else break;
-            }
+    if (glen > g->playcount) updsnds_select(g, g->playcount, audible);
+}
+#undef updsnds_key
+static void setlistener(const float* pos, const float* rot) {
+    audiostate.listener.pos[0] = pos[0];
+    audiostate.listener.pos[1] = pos[1];
+    audiostate.listener.pos[2] = pos[2];
+    audiostate.listener.rotradx = rot[0] * (float)M_PI / 180.0f;
+    audiostate.listener.rotrady = rot[1] * -(float)M_PI / 180.0f;
+    audiostate.listener.rotradz = rot[2] * (float)M_PI / 180.0f;
+    audiostate.listener.sinx = sinf(audiostate.listener.rotradx);
+    audiostate.listener.cosx = cosf(audiostate.listener.rotradx);
+    audiostate.listener.siny = sinf(audiostate.listener.rotrady);
+    audiostate.listener.cosy = cosf(audiostate.listener.rotrady);
+    audiostate.listener.sinz = sinf(audiostate.listener.rotradz);
+    audiostate.listener.cosz = cosf(audiostate.listener.rotradz);
+}
+static void updsnds(void) {
+    emitgrid_mark();
+    occl_update();
+    updsnds_world(&audiostate.voices.world);
+    updsnds_world(&audiostate.voices.worldbg);
+}
+
+static void putle16(uint8_t* d, uint16_t v) {
+    d[0] = v;
+    d[1] = v >> 8;
+}
+static void putle32(uint8_t* d, uint32_t v) {
+    d[0] = v;
+    d[1] = v >> 8;
+    d[2] = v >> 16;
+    d[3] = v >> 24;
+}
+static void writewavheader(void) {
+    uint8_t h[44];
+    memcpy(h, "RIFF", 4);
+    putle32(h + 4, 36 + audiostate.offline.wavdatasize);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    putle32(h + 16, 16);
+    putle16(h + 20, 1); // PCM
+    putle16(h + 22, audiostate.channels);
+    putle32(h + 24, audiostate.freq);
+    putle32(h + 28, audiostate.freq * audiostate.channels * 2);
+    putle16(h + 32, audiostate.channels * 2);
+    putle16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    putle32(h + 40, audiostate.offline.wavdatasize);
+    fseek(audiostate.offline.wav, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), audiostate.offline.wav);
+}
+static void writeoffline(void) {
+    if (audiostate.outmode != AUDIOOUTPUT_WAV) return;
+    #if BYTEORDER == BO_BE
+    int16_t* d = audiostate.audbuf.out[0];
+    for (unsigned i = 0; i < audiostate.audbuf.outsize / sizeof(*d); ++i) d[i] = swaple16(d[i]);
+    #endif
+    if (fwrite(audiostate.audbuf.out[0], 1, audiostate.audbuf.outsize, audiostate.offline.wav) == audiostate.audbuf.outsize) {
+        audiostate.offline.wavdatasize += audiostate.audbuf.outsize;
+    }
+}
+
+static inline unsigned latencytobufs(unsigned ms) {
+    unsigned b = ((uint64_t)ms * audiostate.freq + audiostate.audbuf.len * 500) / ((uint64_t)audiostate.audbuf.len * 1000);
+    return (b) ? b : 1;
+}
+static inline unsigned bufstolatency(unsigned b) {
+    return (uint64_t)b * audiostate.audbuf.len * 1000 / audiostate.freq;
+}
+// 'queued' is how many buffers were still waiting to be played before 'mixed' more were mixed in 'mixtime' us
+static void adaptlatency(unsigned queued, unsigned underruns, unsigned mixed, uint64_t mixtime) {
+    if (mixed) {
+        float load = (float)mixtime * audiostate.freq / ((float)mixed * audiostate.audbuf.len * 1000000.0f);
+        audiostate.latency.mixload += (load - audiostate.latency.mixload) * 0.1f;
+    }
+    if (underruns) {
+        audiostate.latency.underruns += underruns;
+        #if DEBUG(1)
+        plog(LL_WARN | LF_DEBUG, "Audio underrun (%u total)", audiostate.latency.underruns);
+        #endif
+        if (audiostate.latency.adaptive && audiostate.outbufcount < audiostate.latency.max) {
+            ++audiostate.outbufcount;
+            plog(
+                LL_INFO, "Audio latency raised to %u buffers (%ums) after an underrun",
+                audiostate.outbufcount, bufstolatency(audiostate.outbufcount)
+            );
         }
-        #undef qs_swap
+        audiostate.latency.calm = 0;
+        audiostate.latency.lowwater = -1;
+        return;
+    }
+    if (queued < audiostate.latency.lowwater) audiostate.latency.lowwater = queued;
+    audiostate.latency.calm += mixed;
+    if (audiostate.latency.calm < audiostate.latency.period) return;
+    // only give back a buffer if one would still have been left over the whole time and mixing has room to spare
+    if (audiostate.latency.adaptive && audiostate.outbufcount > audiostate.latency.min &&
+        audiostate.latency.lowwater >= 2 && audiostate.latency.mixload < 0.5f) {
+        --audiostate.outbufcount;
+        #if DEBUG(1)
+        plog(
+            LL_INFO | LF_DEBUG, "Audio latency lowered to %u buffers (%ums)",
+            audiostate.outbufcount, bufstolatency(audiostate.outbufcount)
+        );
+        #endif
     }
+    audiostate.latency.calm = 0;
+    audiostate.latency.lowwater = -1;
 }
-void updateSounds(float framemult) {
+
+// fills the callback's ring up to 'outbufcount' buffers ahead
+static void mixahead(void) {
+    uint64_t t = altutime();
+    unsigned mixed = audiostate.mixed;
+    unsigned queued = mixed - atomicLoad(&audiostate.played);
+    unsigned cbunderruns = atomicLoad(&audiostate.latency.cbunderruns);
+    unsigned underruns = cbunderruns - audiostate.latency.lastcbunderruns;
+    audiostate.latency.lastcbunderruns = cbunderruns;
+    while (audiostate.mixed - atomicLoad(&audiostate.played) < audiostate.outbufcount) {
+        #if DEBUG(3)
+        plog(LL_INFO | LF_DEBUG, "Mixing %u...", audiostate.mixed);
+        #endif
+        mixsounds(audiostate.audbuf.out[audiostate.mixed % audiostate.audbuf.outcount]);
+        #if DEBUG(3)
+        plog(LL_INFO | LF_DEBUG, "Finished mixing %u", audiostate.mixed);
+        #endif
+        atomicStore(&audiostate.mixed, audiostate.mixed + 1);
+    }
+    adaptlatency(queued, underruns, audiostate.mixed - mixed, altutime() - t);
+}
+
+#ifndef PSRC_NOMT
+static void* mixerthread(struct thread_data* td) {
+    // check back about twice per buffer played
+    unsigned poll = (unsigned)((uint64_t)audiostate.audbuf.len * 500 / audiostate.freq);
+    if (poll < 1) poll = 1;
+    lockMutex(&audiostate.mixthread.lock);
+    while (!td->shouldclose) {
+        if (audiostate.mixed - atomicLoad(&audiostate.played) < audiostate.outbufcount) {
+            unlockMutex(&audiostate.mixthread.lock);
+            mixahead();
+            lockMutex(&audiostate.mixthread.lock);
+        } else {
+            waitCondTimeout(&audiostate.mixthread.wake, &audiostate.mixthread.lock, poll);
+            // may have been woken with the ring full because the command queue filled up, so make room for more
+            unlockMutex(&audiostate.mixthread.lock);
+            runcmds();
+            lockMutex(&audiostate.mixthread.lock);
+        }
+    }
+    unlockMutex(&audiostate.mixthread.lock);
+    return NULL;
+}
+#endif
+
+void renderAudio(unsigned buffers) {
     #ifndef PSRC_NOMT
     acquireWriteAccess(&audiostate.lock);
     #endif
+    if (audiostate.valid && audiostate.outmode != AUDIOOUTPUT_DEVICE) {
+        runcmds();
+        setlistener(audiostate.cam.pos, audiostate.cam.rot);
+        updsnds();
+        for (; buffers; --buffers) {
+            mixsounds(audiostate.audbuf.out[0]);
+            writeoffline();
+        }
+    }
+    #ifndef PSRC_NOMT
+    releaseWriteAccess(&audiostate.lock);
+    #endif
+}
+
+// the part of updateSounds() that is done by whichever thread owns the audio state
+static void updatestate(float framemult) {
     if (audiostate.voices.ambience.oldfade != audiostate.voices.ambience.fade) audiostate.voices.ambience.oldfade = audiostate.voices.ambience.fade;
     if (audiostate.voices.ambience.index) {
         if (audiostate.voices.ambience.fade == 1.0f) {
@@ -1370,39 +2386,57 @@ void updateSounds(float framemult) {
             if (audiostate.voices.ambience.fade < 0.0f) audiostate.voices.ambience.fade = 0.0f;
         }
     }
-    audiostate.cam.rotradx = audiostate.cam.rot[0] * (float)M_PI / 180.0f;
-    audiostate.cam.rotrady = audiostate.cam.rot[1] * -(float)M_PI / 180.0f;
-    audiostate.cam.rotradz = audiostate.cam.rot[2] * (float)M_PI / 180.0f;
-    audiostate.cam.sinx = sinf(audiostate.cam.rotradx);
-    audiostate.cam.cosx = cosf(audiostate.cam.rotradx);
-    audiostate.cam.siny = sinf(audiostate.cam.rotrady);
-    audiostate.cam.cosy = cosf(audiostate.cam.rotrady);
-    audiostate.cam.sinz = sinf(audiostate.cam.rotradz);
-    audiostate.cam.cosz = cosf(audiostate.cam.rotradz);
-    updsnds_world(&audiostate.voices.world);
-    updsnds_world(&audiostate.voices.worldbg);
-    if (audiostate.usecallback) {
-        while (audiostate.mixaudbufindex != (audiostate.audbufindex + 1) % 4 || audiostate.mixaudbufindex < 0) {
-            int mixbufi = (audiostate.mixaudbufindex + 1) % 4;
-            #if DEBUG(3)
-            plog(LL_INFO | LF_DEBUG, "Mixing %d...", mixbufi);
-            #endif
-            mixsounds(mixbufi % 2);
-            #if DEBUG(3)
-            plog(LL_INFO | LF_DEBUG, "Finished mixing %d", mixbufi);
-            #endif
-            audiostate.mixaudbufindex = mixbufi;
+    updsnds();
+}
+
+void updateSounds(float framemult) {
+    #ifndef PSRC_NOMT
+    if (audiostate.mixthread.enabled) {
+        queuecmd(&(struct audiocmd){
+            .type = AUDIOCMD_UPDATE,
+            .update = {
+                .campos = {audiostate.cam.pos[0], audiostate.cam.pos[1], audiostate.cam.pos[2]},
+                .camrot = {audiostate.cam.rot[0], audiostate.cam.rot[1], audiostate.cam.rot[2]},
+                .framemult = framemult
+            }
+        });
+        return;
+    }
+    acquireWriteAccess(&audiostate.lock);
+    #endif
+    if (audiostate.valid) runcmds();
+    setlistener(audiostate.cam.pos, audiostate.cam.rot);
+    updatestate(framemult);
+    if (audiostate.outmode != AUDIOOUTPUT_DEVICE) {
+        // keep pace with real time as if a device was consuming the buffers
+        if (audiostate.valid) {
+            uint64_t t = altutime();
+            uint64_t buftime = (uint64_t)audiostate.audbuf.len * 1000000 / audiostate.freq;
+            if (t > audiostate.offline.next + buftime * audiostate.outbufcount) audiostate.offline.next = t;
+            while (audiostate.offline.next <= t) {
+                mixsounds(audiostate.audbuf.out[0]);
+                writeoffline();
+                audiostate.offline.next += buftime;
+            }
         }
+    } else if (audiostate.usecallback) {
+        mixahead();
     } else {
         #ifndef PSRC_USESDL1
+        uint64_t t = altutime();
         uint32_t qs = SDL_GetQueuedAudioSize(audiostate.output);
+        unsigned queued = qs / audiostate.audbuf.outsize;
+        unsigned count = 0;
         if (qs < audiostate.audbuf.outsize * audiostate.outbufcount) {
-            int count = (audiostate.audbuf.outsize * audiostate.outbufcount - qs) / audiostate.audbuf.outsize;
-            for (int i = 0; i < count; ++i) {
-                mixsounds(0);
+            count = (audiostate.audbuf.outsize * audiostate.outbufcount - qs) / audiostate.audbuf.outsize;
+            for (unsigned i = 0; i < count; ++i) {
+                mixsounds(audiostate.audbuf.out[0]);
                 SDL_QueueAudio(audiostate.output, audiostate.audbuf.out[0], audiostate.audbuf.outsize);
             }
         }
+        // the device ran dry since the last update if nothing is left after the first buffers went in
+        adaptlatency(queued, (!qs && audiostate.mixed), count, altutime() - t);
+        audiostate.mixed += count;
         #endif
     }
     #ifndef PSRC_NOMT
@@ -1410,88 +2444,80 @@ void updateSounds(float framemult) {
     #endif
 }
 
-int newAudioEmitter(int max, unsigned bg, ... /*soundfx*/) {
-    #ifndef PSRC_NOMT
-    acquireReadAccess(&audiostate.lock);
-    #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseReadAccess(&audiostate.lock);
-        #endif
-        return -1;
-    }
-    int index = -1;
-    for (int i = 0; i < audiostate.emitters.len; ++i) {
-        if (audiostate.emitters.data[i].max == -1) {
-            index = i;
-            break;
-        }
-    }
-    #ifndef PSRC_NOMT
-    readToWriteAccess(&audiostate.lock);
-    #endif
-    if (index == -1) {
-        if (audiostate.emitters.len == audiostate.emitters.size) {
-            audiostate.emitters.size *= 2;
-            audiostate.emitters.data = realloc(audiostate.emitters.data, audiostate.emitters.size);
-        }
-        index = audiostate.emitters.len++;
-    }
-    struct audioemitter* e = &audiostate.emitters.data[index];
-    *e = (struct audioemitter){
-        .max = max,
-        .bg = bg,
-        .vol[0] = 1.0f,
-        .vol[1] = 1.0f,
-        .speed = 1.0f,
-        .range = 50.0f
-    };
-    va_list args;
-    va_start(args, bg);
-    enum soundfx fx;
-    while ((fx = va_arg(args, int)) != SOUNDFXENUM__END) {
-        switch ((uint8_t)fx) {
+static void getsoundfx(va_list* args, struct audiocmd_fx* fx) {
+    fx->set = 0;
+    enum soundfx f;
+    while ((f = va_arg(*args, int)) != SOUNDFXENUM__END) {
+        switch ((uint8_t)f) {
             case SOUNDFXENUM_VOL:
-                e->vol[0] = va_arg(args, double);
-                e->vol[1] = va_arg(args, double);
+                fx->vol[0] = va_arg(*args, double);
+                fx->vol[1] = va_arg(*args, double);
                 break;
             case SOUNDFXENUM_SPEED:
-                e->speed = va_arg(args, double);
+                fx->speed = va_arg(*args, double);
                 break;
             case SOUNDFXENUM_POS:
-                e->pos[0] = va_arg(args, double);
-                e->pos[1] = va_arg(args, double);
-                e->pos[2] = va_arg(args, double);
+                fx->pos[0] = va_arg(*args, double);
+                fx->pos[1] = va_arg(*args, double);
+                fx->pos[2] = va_arg(*args, double);
                 break;
             case SOUNDFXENUM_RANGE:
-                e->range = va_arg(args, double);
+                fx->range = va_arg(*args, double);
                 break;
             case SOUNDFXENUM_LPFILT:
-                e->lpfilt = va_arg(args, double);
+                fx->lpfilt = va_arg(*args, double);
                 break;
             case SOUNDFXENUM_HPFILT:
-                e->hpfilt = va_arg(args, double);
+                fx->hpfilt = va_arg(*args, double);
                 break;
+            default:
+                continue;
         }
+        fx->set |= 1 << f;
     }
-    va_end(args);
-    #ifndef PSRC_NOMT
-    releaseWriteAccess(&audiostate.lock);
-    #endif
-    return index;
 }
+// works on both emitters and 3D sounds
+#define APPLYSOUNDFX(d, fx) do {\
+    if ((fx)->set & (1 << SOUNDFXENUM_VOL)) {\
+        (d)->vol[0] = (fx)->vol[0];\
+        (d)->vol[1] = (fx)->vol[1];\
+    }\
+    if ((fx)->set & (1 << SOUNDFXENUM_SPEED)) (d)->speed = (fx)->speed;\
+    if ((fx)->set & (1 << SOUNDFXENUM_POS)) {\
+        (d)->pos[0] = (fx)->pos[0];\
+        (d)->pos[1] = (fx)->pos[1];\
+        (d)->pos[2] = (fx)->pos[2];\
+    }\
+    if ((fx)->set & (1 << SOUNDFXENUM_RANGE)) (d)->range = (fx)->range;\
+    if ((fx)->set & (1 << SOUNDFXENUM_LPFILT)) (d)->lpfilt = (fx)->lpfilt;\
+    if ((fx)->set & (1 << SOUNDFXENUM_HPFILT)) (d)->hpfilt = (fx)->hpfilt;\
+} while (0)
 
-void deleteAudioEmitter(int ei) {
-    if (ei < 0) return;
-    #ifndef PSRC_NOMT
-    acquireWriteAccess(&audiostate.lock);
-    #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseWriteAccess(&audiostate.lock);
-        #endif
-        return;
+static void cmd_newemitter(struct audiocmd* c) {
+    int index = c->emitter;
+    if (index >= audiostate.emitters.size) {
+        do {
+            audiostate.emitters.size *= 2;
+        } while (index >= audiostate.emitters.size);
+        audiostate.emitters.data = realloc(audiostate.emitters.data, audiostate.emitters.size * sizeof(*audiostate.emitters.data));
     }
+    // indices are handed out in order, but commands from different threads might not arrive in order
+    while (audiostate.emitters.len <= index) audiostate.emitters.data[audiostate.emitters.len++] = (struct audioemitter){.max = -1};
+    struct audioemitter* e = &audiostate.emitters.data[index];
+    *e = (struct audioemitter){
+        .max = c->newemitter.max,
+        .bg = c->flags,
+        .vol[0] = 1.0f,
+        .vol[1] = 1.0f,
+        .speed = 1.0f,
+        .range = 50.0f,
+        .serial = ++audiostate.occl.serial
+    };
+    APPLYSOUNDFX(e, &c->newemitter.fx);
+    emitgrid_update(index);
+}
+
+static void cmd_deleteemitter(int ei) {
     struct audioemitter* e = &audiostate.emitters.data[ei];
     if (e->bg) {
         for (int si = 0; si < audiostate.voices.worldbg.len; ++si) {
@@ -1504,316 +2530,403 @@ void deleteAudioEmitter(int ei) {
             if (s->data.rc && s->emitter == ei) stop3DSound_inline(s);
         }
     }
+    emitgrid_remove(ei);
     e->max = -1;
-    #ifndef PSRC_NOMT
-    releaseWriteAccess(&audiostate.lock);
-    #endif
 }
 
-void pauseAudioEmitter(int ei, bool p) {
-    if (ei < 0) return;
-    #ifndef PSRC_NOMT
-    acquireWriteAccess(&audiostate.lock);
-    #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseWriteAccess(&audiostate.lock);
-        #endif
-        return;
+static void cmd_stopemitter(int ei) {
+    struct audioemitter* e = &audiostate.emitters.data[ei];
+    struct audiovoicegroup_world* g = (e->bg) ? &audiostate.voices.worldbg : &audiostate.voices.world;
+    for (int si = 0; si < g->len; ++si) {
+        struct audiosound_3d* s = &g->data[si];
+        if (s->data.rc && s->emitter == ei) stop3DSound_inline(s);
     }
-    audiostate.emitters.data[ei].paused = p;
-    #ifndef PSRC_NOMT
-    releaseWriteAccess(&audiostate.lock);
-    #endif
 }
 
-void stopAudioEmitter(int ei) {
-    if (ei < 0) return;
-    #ifndef PSRC_NOMT
-    acquireReadAccess(&audiostate.lock);
-    #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseReadAccess(&audiostate.lock);
-        #endif
-        return;
-    }
+static void cmd_editemitter(struct audiocmd* c) {
+    int ei = c->emitter;
     struct audioemitter* e = &audiostate.emitters.data[ei];
-    if (e->bg) {
-        for (int si = 0; si < audiostate.voices.worldbg.len; ++si) {
-            struct audiosound_3d* s = &audiostate.voices.worldbg.data[si];
-            if (s->data.rc && s->emitter == ei) {
-                #ifndef PSRC_NOMT
-                readToWriteAccess(&audiostate.lock);
-                #endif
-                stop3DSound_inline(s);
-                #ifndef PSRC_NOMT
-                releaseWriteAccess(&audiostate.lock);
-                #endif
-            }
-        }
-    } else {
-        for (int si = 0; si < audiostate.voices.world.len; ++si) {
-            struct audiosound_3d* s = &audiostate.voices.world.data[si];
-            if (s->data.rc && s->emitter == ei) {
-                #ifndef PSRC_NOMT
-                readToWriteAccess(&audiostate.lock);
-                #endif
-                stop3DSound_inline(s);
-                #ifndef PSRC_NOMT
-                releaseWriteAccess(&audiostate.lock);
-                #endif
+    APPLYSOUNDFX(e, &c->editemitter);
+    emitgrid_update(ei);
+    struct audiovoicegroup_world* g = (e->bg) ? &audiostate.voices.worldbg : &audiostate.voices.world;
+    for (int si = 0; si < g->len; ++si) {
+        struct audiosound_3d* s = &g->data[si];
+        if (s->data.rc && s->emitter == ei) {
+            if (!c->flags && !s->fxchanged) {
+                s->fx[0] = s->fx[1];
+                s->fxchanged = true;
             }
+            calc3DSoundFx(s);
         }
     }
-    #ifndef PSRC_NOMT
-    releaseReadAccess(&audiostate.lock);
-    #endif
 }
 
-void editAudioEmitter(int ei, unsigned immediate, ...) {
-    if (ei < 0) return;
-    #ifndef PSRC_NOMT
-    acquireReadAccess(&audiostate.lock);
-    #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseReadAccess(&audiostate.lock);
-        #endif
+static void cmd_playsound(struct audiocmd* c) {
+    int ei = c->emitter;
+    struct rc_sound* rc = c->playsound.rc;
+    struct audioemitter* e = &audiostate.emitters.data[ei];
+    if (e->max && e->uses == e->max) {
+        unlockRc(rc);
         return;
     }
-    struct audioemitter* e = &audiostate.emitters.data[ei];
-    va_list args;
-    va_start(args, immediate);
-    enum soundfx fx;
-    while ((fx = va_arg(args, int)) != SOUNDFXENUM__END) {
-        switch ((uint8_t)fx) {
-            case SOUNDFXENUM_VOL:
-                e->vol[0] = va_arg(args, double);
-                e->vol[1] = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_SPEED:
-                e->speed = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_POS:
-                e->pos[0] = va_arg(args, double);
-                e->pos[1] = va_arg(args, double);
-                e->pos[2] = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_RANGE:
-                e->range = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_LPFILT:
-                e->lpfilt = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_HPFILT:
-                e->hpfilt = va_arg(args, double);
-                break;
-        }
-    }
-    va_end(args);
-    if (e->bg) {
-        for (int si = 0; si < audiostate.voices.worldbg.len; ++si) {
-            struct audiosound_3d* s = &audiostate.voices.worldbg.data[si];
-            if (s->data.rc && s->emitter == ei) {
-                #ifndef PSRC_NOMT
-                readToWriteAccess(&audiostate.lock);
-                #endif
-                if (!immediate && !s->fxchanged) {
-                    s->fx[0] = s->fx[1];
-                    s->fxchanged = true;
-                }
-                calc3DSoundFx(s);
-                #ifndef PSRC_NOMT
-                writeToReadAccess(&audiostate.lock);
-                #endif
-            }
-        }
-    } else {
-        for (int si = 0; si < audiostate.voices.world.len; ++si) {
-            struct audiosound_3d* s = &audiostate.voices.world.data[si];
-            if (s->data.rc && s->emitter == ei) {
-                #ifndef PSRC_NOMT
-                readToWriteAccess(&audiostate.lock);
-                #endif
-                if (!immediate && !s->fxchanged) {
-                    s->fx[0] = s->fx[1];
-                    s->fxchanged = true;
-                }
-                calc3DSoundFx(s);
-                #ifndef PSRC_NOMT
-                writeToReadAccess(&audiostate.lock);
-                #endif
-            }
+    struct audiovoicegroup_world* g = (e->bg) ? &audiostate.voices.worldbg : &audiostate.voices.world;
+    struct audiosound_3d* s = NULL;
+    int glen = g->len;
+    for (int i = 0; i < glen; ++i) {
+        if (!g->data[i].data.rc) {
+            s = &g->data[i];
+            break;
         }
     }
-    #ifndef PSRC_NOMT
-    releaseReadAccess(&audiostate.lock);
-    #endif
-}
-
-void playSound(int ei, struct rc_sound* rc, unsigned f, ...) {
-    if (ei < 0) return;
-    #ifndef PSRC_NOMT
-    acquireReadAccess(&audiostate.lock);
-    #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseReadAccess(&audiostate.lock);
-        #endif
-        return;
-    }
-    struct audiosound_3d* s;
-    {
-        struct audiovoicegroup_world* g;
-        struct audioemitter* e = &audiostate.emitters.data[ei];
-        if (e->max && e->uses == e->max) {
-            #ifndef PSRC_NOMT
-            releaseReadAccess(&audiostate.lock);
-            #endif
-            return;
-        }
-        s = NULL;
-        g = (e->bg) ? &audiostate.voices.worldbg : &audiostate.voices.world;
-        int glen = g->len;
-        for (int i = 0; i < glen; ++i) {
-            struct audiosound_3d* tmps = &g->data[i];
-            if (!tmps->data.rc) {
-                s = tmps;
-                #ifndef PSRC_NOMT
-                readToWriteAccess(&audiostate.lock);
-                #endif
-                goto found;
-            }
-        }
-        #ifndef PSRC_NOMT
-        readToWriteAccess(&audiostate.lock);
-        #endif
+    if (!s) {
         if (glen == g->size) {
             g->size = g->size * 3 / 2;
             g->data = realloc(g->data, g->size * sizeof(*g->data));
+            g->sortdata = realloc(g->sortdata, g->size * sizeof(*g->sortdata));
         }
         s = &g->data[glen];
+        g->sortdata[glen] = glen;
         ++g->len;
     }
-    found:;
-    lockRc(rc);
     *s = (struct audiosound_3d){
         .emitter = ei,
-        .flags = f,
+        .flags = c->flags,
         .vol[0] = 1.0f,
         .vol[1] = 1.0f,
         .speed = 1.0f,
         .range = 1.0f
     };
     setSoundData(&s->data, rc);
-    va_list args;
-    va_start(args, f);
-    enum soundfx fx;
-    while ((fx = va_arg(args, int)) != SOUNDFXENUM__END) {
-        switch ((uint8_t)fx) {
-            case SOUNDFXENUM_VOL:
-                s->vol[0] = va_arg(args, double);
-                s->vol[1] = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_SPEED:
-                s->speed = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_POS:
-                s->pos[0] = va_arg(args, double);
-                s->pos[1] = va_arg(args, double);
-                s->pos[2] = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_RANGE:
-                s->range = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_LPFILT:
-                s->lpfilt = va_arg(args, double);
-                break;
-            case SOUNDFXENUM_HPFILT:
-                s->hpfilt = va_arg(args, double);
-                break;
-        }
-    }
-    va_end(args);
+    APPLYSOUNDFX(s, &c->playsound.fx);
+    ++e->uses;
+    if (s->range > e->sndrange) e->sndrange = s->range;
+    float off = sqrtf(s->pos[0] * s->pos[0] + s->pos[1] * s->pos[1] + s->pos[2] * s->pos[2]);
+    if (off > e->sndoff) e->sndoff = off;
+    emitgrid_update(ei);
     calc3DSoundFx(s);
     s->fxoff = s->fx[1].posoff;
+}
+
+static void cmd_setmusic(struct rc_music* rc) {
+    if (audiostate.voices.music.rc) {
+        ptmplay_free(&audiostate.voices.music.player);
+        unlockRc(audiostate.voices.music.rc);
+        audiostate.voices.music.rc = NULL;
+    }
+    if (!rc) return;
+    if (!ptmplay_init(&audiostate.voices.music.player, &rc->music, audiostate.freq)) {
+        plog(LL_ERROR | LF_FUNC, LE_MEMALLOC);
+        unlockRc(rc);
+        return;
+    }
+    audiostate.voices.music.rc = rc;
+    if (audiostate.voices.music.style) {
+        int g = ptmplay_findgroup(&rc->music, audiostate.voices.music.style);
+        if (g >= 0) ptmplay_setgroup(&audiostate.voices.music.player, g);
+    }
+}
+
+static void cmd_setmusicstyle(char* style) {
+    free(audiostate.voices.music.style);
+    audiostate.voices.music.style = style;
+    if (audiostate.voices.music.rc) {
+        ptmplay_setgroup(
+            &audiostate.voices.music.player,
+            (style) ? ptmplay_findgroup(&audiostate.voices.music.rc->music, style) : -1
+        );
+    }
+}
+
+static void cmd_editsoundenv(struct audiocmd* c) {
+    uint8_t set = c->env.set;
+    const float* v = c->env.value;
+    if (set & (1 << SOUNDENVENUM_LPFILT)) {
+        audiostate.env.lpfilt.amount[1] = v[SOUNDENVENUM_LPFILT - 1];
+        audiostate.env.filterchanged = 1;
+    }
+    if (set & (1 << SOUNDENVENUM_HPFILT)) {
+        audiostate.env.hpfilt.amount[1] = v[SOUNDENVENUM_HPFILT - 1];
+        audiostate.env.filterchanged = 1;
+    }
+    if (set & (1 << SOUNDENVENUM_REVERB_DELAY)) {
+        audiostate.env.reverb.delay[1] = v[SOUNDENVENUM_REVERB_DELAY - 1];
+        audiostate.env.reverbchanged = 1;
+    }
+    if (set & (1 << SOUNDENVENUM_REVERB_FEEDBACK)) {
+        audiostate.env.reverb.feedback[1] = v[SOUNDENVENUM_REVERB_FEEDBACK - 1];
+        audiostate.env.reverbchanged = 1;
+    }
+    if (set & (1 << SOUNDENVENUM_REVERB_MIX)) {
+        audiostate.env.reverb.mix[1] = v[SOUNDENVENUM_REVERB_MIX - 1];
+        audiostate.env.reverbchanged = 1;
+    }
+    if (set & (1 << SOUNDENVENUM_REVERB_LPFILT)) {
+        audiostate.env.reverb.lpfilt.amount[1] = v[SOUNDENVENUM_REVERB_LPFILT - 1];
+        audiostate.env.reverbchanged = 1;
+    }
+    if (set & (1 << SOUNDENVENUM_REVERB_HPFILT)) {
+        audiostate.env.reverb.hpfilt.amount[1] = v[SOUNDENVENUM_REVERB_HPFILT - 1];
+        audiostate.env.reverbchanged = 1;
+    }
+}
+
+// takes ownership of the resources and strings in the command
+static void docmd(struct audiocmd* c) {
+    switch (c->type) {
+        case AUDIOCMD_NEWEMITTER:
+            cmd_newemitter(c);
+            break;
+        case AUDIOCMD_EDITEMITTER:
+            cmd_editemitter(c);
+            break;
+        case AUDIOCMD_PAUSEEMITTER:
+            audiostate.emitters.data[c->emitter].paused = c->flags;
+            break;
+        case AUDIOCMD_STOPEMITTER:
+            cmd_stopemitter(c->emitter);
+            break;
+        case AUDIOCMD_DELETEEMITTER:
+            cmd_deleteemitter(c->emitter);
+            break;
+        case AUDIOCMD_PLAYSOUND:
+            cmd_playsound(c);
+            break;
+        case AUDIOCMD_PLAYUISOUND:
+            if (audiostate.voices.ui.rc) stopSound_inline(&audiostate.voices.ui);
+            setSoundData(&audiostate.voices.ui, c->sound);
+            break;
+        case AUDIOCMD_SETAMBIENTSOUND:
+            if (audiostate.voices.ambience.queue) unlockRc(audiostate.voices.ambience.queue);
+            audiostate.voices.ambience.queue = c->sound;
+            break;
+        case AUDIOCMD_SETMUSIC:
+            cmd_setmusic(c->music);
+            break;
+        case AUDIOCMD_SETMUSICSTYLE:
+            cmd_setmusicstyle(c->style);
+            break;
+        case AUDIOCMD_EDITSOUNDENV:
+            cmd_editsoundenv(c);
+            break;
+        case AUDIOCMD_UPDATE:
+            #ifndef PSRC_NOMT
+            // only the latest camera matters, so the update is done once before the next buffer
+            setlistener(c->update.campos, c->update.camrot);
+            audiostate.mixthread.framemult += c->update.framemult;
+            audiostate.mixthread.update = true;
+            #endif
+            break;
+    }
+}
+static void dropcmd(struct audiocmd* c) {
+    switch (c->type) {
+        case AUDIOCMD_PLAYSOUND:
+            unlockRc(c->playsound.rc);
+            break;
+        case AUDIOCMD_PLAYUISOUND:
+        case AUDIOCMD_SETAMBIENTSOUND:
+            unlockRc(c->sound);
+            break;
+        case AUDIOCMD_SETMUSIC:
+            if (c->music) unlockRc(c->music);
+            break;
+        case AUDIOCMD_SETMUSICSTYLE:
+            // still kept for when audio is started again
+            free(audiostate.voices.music.style);
+            audiostate.voices.music.style = c->style;
+            break;
+        default:
+            break;
+    }
+}
+
+static bool pushcmd(const struct audiocmd* c) {
+    unsigned pos = atomicLoad(&audiostate.cmds.tail);
+    while (1) {
+        struct audiocmdslot* s = &audiostate.cmds.slots[pos % AUDIO_CMDQUEUESIZE];
+        int d = (int)(atomicLoad(&s->seq) - pos);
+        if (!d) {
+            // claim the slot, then fill it and hand it to the consumer
+            if (atomicCmpXchg(&audiostate.cmds.tail, &pos, pos + 1)) {
+                s->cmd = *c;
+                atomicStore(&s->seq, pos + 1);
+                return true;
+            }
+        } else if (d < 0) {
+            return false;
+        } else {
+            pos = atomicLoad(&audiostate.cmds.tail);
+        }
+    }
+}
+static bool popcmd(struct audiocmd* c) {
+    unsigned pos = audiostate.cmds.head;
+    struct audiocmdslot* s = &audiostate.cmds.slots[pos % AUDIO_CMDQUEUESIZE];
+    // empty, or the producer that claimed it is not done filling it yet
+    if (atomicLoad(&s->seq) != pos + 1) return false;
+    *c = s->cmd;
+    atomicStore(&s->seq, pos + AUDIO_CMDQUEUESIZE);
+    audiostate.cmds.head = pos + 1;
+    return true;
+}
+// call with the write lock held, or from the mixer thread while it is running
+static void runcmds(void) {
+    struct audiocmd c;
+    while (popcmd(&c)) docmd(&c);
+}
+static void dropcmds(void) {
+    struct audiocmd c;
+    while (popcmd(&c)) dropcmd(&c);
+}
+static void queuecmd(const struct audiocmd* c) {
+    if (pushcmd(c)) return;
     #ifndef PSRC_NOMT
-    releaseWriteAccess(&audiostate.lock);
+    if (audiostate.mixthread.enabled) {
+        // the mixer thread owns the state, so wake it up to make room instead
+        do {
+            lockMutex(&audiostate.mixthread.lock);
+            signalCond(&audiostate.mixthread.wake);
+            unlockMutex(&audiostate.mixthread.lock);
+            yield();
+        } while (!pushcmd(c));
+        return;
+    }
     #endif
-}
-void playUISound(struct rc_sound* rc) {
+    // the queue is full, so catch up on it here instead
     #ifndef PSRC_NOMT
     acquireWriteAccess(&audiostate.lock);
     #endif
-    if (audiostate.voices.ui.rc) stopSound_inline(&audiostate.voices.ui);
-    lockRc(rc);
-    setSoundData(&audiostate.voices.ui, rc);
+    struct audiocmd tmp = *c;
+    if (audiostate.valid) {
+        runcmds();
+        docmd(&tmp);
+    } else {
+        dropcmds();
+        dropcmd(&tmp);
+    }
     #ifndef PSRC_NOMT
     releaseWriteAccess(&audiostate.lock);
     #endif
 }
-void setAmbientSound(struct rc_sound* rc) {
+
+int newAudioEmitter(int max, unsigned bg, ... /*soundfx*/) {
+    if (!audiostate.valid) return -1;
     #ifndef PSRC_NOMT
-    acquireWriteAccess(&audiostate.lock);
+    lockMutex(&audiostate.cmds.emitterlock);
     #endif
-    if (audiostate.voices.ambience.queue) unlockRc(audiostate.voices.ambience.queue);
-    lockRc(rc);
-    audiostate.voices.ambience.queue = rc;
+    int index = -1;
+    for (int i = 0; i < audiostate.cmds.emitterslen; ++i) {
+        if (!audiostate.cmds.emitters[i]) {
+            index = i;
+            break;
+        }
+    }
+    if (index == -1) {
+        if (audiostate.cmds.emitterslen == audiostate.cmds.emitterssize) {
+            audiostate.cmds.emitterssize = (audiostate.cmds.emitterssize) ? audiostate.cmds.emitterssize * 2 : 16;
+            audiostate.cmds.emitters = realloc(audiostate.cmds.emitters, audiostate.cmds.emitterssize);
+        }
+        index = audiostate.cmds.emitterslen++;
+    }
+    audiostate.cmds.emitters[index] = 1;
     #ifndef PSRC_NOMT
-    releaseWriteAccess(&audiostate.lock);
+    unlockMutex(&audiostate.cmds.emitterlock);
     #endif
+    struct audiocmd c = {.type = AUDIOCMD_NEWEMITTER, .flags = bg, .emitter = index};
+    c.newemitter.max = max;
+    va_list args;
+    va_start(args, bg);
+    getsoundfx(&args, &c.newemitter.fx);
+    va_end(args);
+    queuecmd(&c);
+    return index;
 }
 
-void editSoundEnv(enum soundenv env, ...) {
-    if (env == SOUNDENVENUM__END) return;
+void deleteAudioEmitter(int ei) {
+    if (ei < 0 || !audiostate.valid) return;
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_DELETEEMITTER, .emitter = ei});
+    // safe to hand out again since anything using the index will be queued after the delete
     #ifndef PSRC_NOMT
-    acquireWriteAccess(&audiostate.lock);
+    lockMutex(&audiostate.cmds.emitterlock);
     #endif
-    if (!audiostate.valid) {
-        #ifndef PSRC_NOMT
-        releaseWriteAccess(&audiostate.lock);
-        #endif
-        return;
-    }
+    if (ei < audiostate.cmds.emitterslen) audiostate.cmds.emitters[ei] = 0;
+    #ifndef PSRC_NOMT
+    unlockMutex(&audiostate.cmds.emitterlock);
+    #endif
+}
+
+void pauseAudioEmitter(int ei, bool p) {
+    if (ei < 0 || !audiostate.valid) return;
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_PAUSEEMITTER, .flags = p, .emitter = ei});
+}
+
+void stopAudioEmitter(int ei) {
+    if (ei < 0 || !audiostate.valid) return;
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_STOPEMITTER, .emitter = ei});
+}
+
+void editAudioEmitter(int ei, unsigned immediate, ...) {
+    if (ei < 0 || !audiostate.valid) return;
+    struct audiocmd c = {.type = AUDIOCMD_EDITEMITTER, .flags = immediate, .emitter = ei};
+    va_list args;
+    va_start(args, immediate);
+    getsoundfx(&args, &c.editemitter);
+    va_end(args);
+    queuecmd(&c);
+}
+
+void playSound(int ei, struct rc_sound* rc, unsigned f, ...) {
+    if (ei < 0 || !audiostate.valid) return;
+    struct audiocmd c = {.type = AUDIOCMD_PLAYSOUND, .flags = f, .emitter = ei};
+    lockRc(rc);
+    c.playsound.rc = rc;
+    va_list args;
+    va_start(args, f);
+    getsoundfx(&args, &c.playsound.fx);
+    va_end(args);
+    queuecmd(&c);
+}
+void playUISound(struct rc_sound* rc) {
+    if (!audiostate.valid) return;
+    lockRc(rc);
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_PLAYUISOUND, .sound = rc});
+}
+void setAmbientSound(struct rc_sound* rc) {
+    if (!audiostate.valid) return;
+    lockRc(rc);
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_SETAMBIENTSOUND, .sound = rc});
+}
+void setMusic(struct rc_music* rc) {
+    if (!audiostate.valid) return;
+    if (rc) lockRc(rc);
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_SETMUSIC, .music = rc});
+}
+void setMusicStyle(const char* style) {
+    queuecmd(&(struct audiocmd){.type = AUDIOCMD_SETMUSICSTYLE, .style = (style) ? strdup(style) : NULL});
+}
+
+void setAudioLevel(struct vis_level* l) {
+    #ifndef PSRC_NOMT
+    lockMutex(&audiostate.occl.lock);
+    #endif
+    audiostate.occl.level = l;
+    #ifndef PSRC_NOMT
+    unlockMutex(&audiostate.occl.lock);
+    #endif
+}
+
+void editSoundEnv(enum soundenv env, ...) {
+    if (env == SOUNDENVENUM__END || !audiostate.valid) return;
+    struct audiocmd c = {.type = AUDIOCMD_EDITSOUNDENV};
     va_list args;
     va_start(args, env);
     do {
-        switch ((uint8_t)env) {
-            case SOUNDENVENUM_LPFILT:
-                audiostate.env.lpfilt.amount[1] = va_arg(args, double);
-                audiostate.env.filterchanged = 1;
-                break;
-            case SOUNDENVENUM_HPFILT:
-                audiostate.env.hpfilt.amount[1] = va_arg(args, double);
-                audiostate.env.filterchanged = 1;
-                break;
-            case SOUNDENVENUM_REVERB_DELAY:
-                audiostate.env.reverb.delay[1] = va_arg(args, double);
-                audiostate.env.reverbchanged = 1;
-                break;
-            case SOUNDENVENUM_REVERB_FEEDBACK:
-                audiostate.env.reverb.feedback[1] = va_arg(args, double);
-                audiostate.env.reverbchanged = 1;
-                break;
-            case SOUNDENVENUM_REVERB_MIX:
-                audiostate.env.reverb.mix[1] = va_arg(args, double);
-                audiostate.env.reverbchanged = 1;
-                break;
-            case SOUNDENVENUM_REVERB_LPFILT:
-                audiostate.env.reverb.lpfilt.amount[1] = va_arg(args, double);
-                audiostate.env.reverbchanged = 1;
-                break;
-            case SOUNDENVENUM_REVERB_HPFILT:
-                audiostate.env.reverb.hpfilt.amount[1] = va_arg(args, double);
-                audiostate.env.reverbchanged = 1;
-                break;
-        }
+        if ((uint8_t)env > SOUNDENVENUM_REVERB_HPFILT) continue;
+        c.env.value[env - 1] = va_arg(args, double);
+        c.env.set |= 1 << env;
     } while ((env = va_arg(args, int)) != SOUNDENVENUM__END);
     va_end(args);
-    #ifndef PSRC_NOMT
-    releaseWriteAccess(&audiostate.lock);
-    #endif
+    queuecmd(&c);
 }
 
 void updateAudioConfig(enum audioopt opt, ...) {
@@ -1837,11 +2950,39 @@ void updateAudioConfig(enum audioopt opt, ...) {
     va_end(args);
 }
 
+static enum audiooutput getoutmode(void) {
+    char* tmp = cfg_getvar(&config, "Audio", "output");
+    if (!tmp) return AUDIOOUTPUT_DEVICE;
+    enum audiooutput m;
+    if (!strcmp(tmp, "null")) {
+        m = AUDIOOUTPUT_NULL;
+    } else if (!strcmp(tmp, "wav")) {
+        m = AUDIOOUTPUT_WAV;
+    } else {
+        if (strcmp(tmp, "device")) plog(LL_WARN, "Unknown audio output '%s', using 'device'", tmp);
+        m = AUDIOOUTPUT_DEVICE;
+    }
+    free(tmp);
+    return m;
+}
+
 bool initAudio(void) {
     #ifndef PSRC_NOMT
     if (!createAccessLock(&audiostate.lock)) return false;
+    if (!createMutex(&audiostate.cmds.emitterlock)) return false;
+    if (!createMutex(&audiostate.occl.lock)) return false;
+    if (!createCond(&audiostate.occl.wake)) return false;
+    if (!createMutex(&audiostate.mixthread.lock)) return false;
+    if (!createCond(&audiostate.mixthread.wake)) return false;
+    audiostate.mixthread.enabled = false;
     #endif
-    if (SDL_Init(SDL_INIT_AUDIO)) {
+    for (unsigned i = 0; i < AUDIO_CMDQUEUESIZE; ++i) {
+        audiostate.cmds.slots[i].seq = i;
+    }
+    audiostate.cmds.head = 0;
+    audiostate.cmds.tail = 0;
+    // offline output does not need an audio device
+    if (getoutmode() == AUDIOOUTPUT_DEVICE && SDL_Init(SDL_INIT_AUDIO)) {
         plog(LL_CRIT | LF_FUNCLN, "Failed to init audio: %s", SDL_GetError());
         return false;
     }
@@ -1884,6 +3025,14 @@ bool startAudio(void) {
     #else
     audiostate.usecallback = true;
     #endif
+    #ifndef PSRC_NOMT
+    tmp = cfg_getvar(&config, "Audio", "mixthread");
+    bool mixthread = strbool(tmp, true);
+    free(tmp);
+    // the mixer thread hands buffers to the device through the callback's ring
+    if (mixthread) audiostate.usecallback = true;
+    audiostate.mixthread.enabled = false;
+    #endif
     #ifndef PSRC_USESDL1
     int flags = 0;
     #endif
@@ -1921,40 +3070,124 @@ bool startAudio(void) {
     inspec.callback = (audiostate.usecallback) ? (audcb)callback : NULL;
     inspec.userdata = NULL;
     bool success;
+    audiostate.outmode = getoutmode();
     #ifndef PSRC_USESDL1
-    SDL_AudioDeviceID output = SDL_OpenAudioDevice(NULL, false, &inspec, &outspec, flags);
-    if (output > 0) {
-        success = true;
-    } else {
-        inspec.channels = 1;
-        success = ((output = SDL_OpenAudioDevice(NULL, false, &inspec, &outspec, flags)) > 0);
-    }
-    #else
-    success = (SDL_OpenAudio(&inspec, &outspec) != -1);
+    SDL_AudioDeviceID output = 0;
     #endif
-    if (success) {
+    if (audiostate.outmode != AUDIOOUTPUT_DEVICE) {
+        audiostate.usecallback = false;
+        outspec = inspec;
+        if (audiostate.outmode == AUDIOOUTPUT_WAV) {
+            tmp = cfg_getvar(&config, "Audio", "output.file");
+            char* p;
+            if (tmp) {
+                p = strpath(tmp);
+                free(tmp);
+            } else {
+                p = mkpath((dirs[DIR_USER]) ? dirs[DIR_USER] : dirs[DIR_MAIN], "audio.wav", NULL);
+            }
+            audiostate.offline.wav = fopen(p, "wb");
+            if (audiostate.offline.wav) {
+                audiostate.offline.wavdatasize = 0;
+                audiostate.freq = outspec.freq;
+                audiostate.channels = outspec.channels;
+                writewavheader();
+                plog(LL_INFO, "Writing audio to %s", p);
+                success = true;
+            } else {
+                plog(LL_ERROR, "Failed to open %s for writing", p);
+                success = false;
+            }
+            free(p);
+        } else {
+            success = true;
+        }
+        audiostate.offline.next = altutime();
+    } else {
         #ifndef PSRC_USESDL1
-        audiostate.output = output;
-        plog(LL_INFO, "Audio info (device id %d):", (int)output);
+        output = SDL_OpenAudioDevice(NULL, false, &inspec, &outspec, flags);
+        if (output > 0) {
+            success = true;
+        } else {
+            inspec.channels = 1;
+            success = ((output = SDL_OpenAudioDevice(NULL, false, &inspec, &outspec, flags)) > 0);
+        }
         #else
-        plog(LL_INFO, "Audio info:");
+        success = (SDL_OpenAudio(&inspec, &outspec) != -1);
         #endif
+    }
+    if (success) {
+        if (audiostate.outmode != AUDIOOUTPUT_DEVICE) {
+            plog(LL_INFO, "Audio info (%s output):", (audiostate.outmode == AUDIOOUTPUT_WAV) ? "WAV" : "null");
+        } else {
+            #ifndef PSRC_USESDL1
+            audiostate.output = output;
+            plog(LL_INFO, "Audio info (device id %d):", (int)output);
+            #else
+            plog(LL_INFO, "Audio info:");
+            #endif
+        }
         plog(LL_INFO, "  Frequency: %d", outspec.freq);
         plog(LL_INFO, "  Channels: %d (%s)", outspec.channels, (outspec.channels == 1) ? "mono" : "stereo");
         plog(LL_INFO, "  Samples: %d", (int)outspec.samples);
         audiostate.freq = outspec.freq;
         audiostate.channels = outspec.channels;
         audiostate.audbuf.len = outspec.samples;
-        audiostate.audbuf.data[0][0] = malloc(outspec.samples * sizeof(***audiostate.audbuf.data));
-        audiostate.audbuf.data[0][1] = malloc(outspec.samples * sizeof(***audiostate.audbuf.data));
-        if (audiostate.usecallback) {
-            audiostate.audbuf.data[1][0] = malloc(outspec.samples * sizeof(***audiostate.audbuf.data));
-            audiostate.audbuf.data[1][1] = malloc(outspec.samples * sizeof(***audiostate.audbuf.data));
+        audiostate.audbuf.data[0] = malloc(outspec.samples * sizeof(**audiostate.audbuf.data));
+        audiostate.audbuf.data[1] = malloc(outspec.samples * sizeof(**audiostate.audbuf.data));
+        audiostate.audbuf.voice[0] = malloc(outspec.samples * sizeof(**audiostate.audbuf.voice));
+        audiostate.audbuf.voice[1] = malloc(outspec.samples * sizeof(**audiostate.audbuf.voice));
+        {
+            unsigned ms;
+            tmp = cfg_getvar(&config, "Audio", "latency");
+            if (tmp) {
+                ms = atoi(tmp);
+                free(tmp);
+            } else {
+                ms = 40;
+            }
+            audiostate.latency.min = latencytobufs(ms);
+            tmp = cfg_getvar(&config, "Audio", "latency.max");
+            if (tmp) {
+                ms = atoi(tmp);
+                free(tmp);
+            } else {
+                ms = 200;
+            }
+            audiostate.latency.max = latencytobufs(ms);
+            if (audiostate.latency.max < audiostate.latency.min) audiostate.latency.max = audiostate.latency.min;
+            tmp = cfg_getvar(&config, "Audio", "latency.adaptive");
+            audiostate.latency.adaptive = strbool(tmp, true);
+            free(tmp);
+            tmp = cfg_getvar(&config, "Audio", "outbufcount");
+            if (tmp) {
+                audiostate.outbufcount = atoi(tmp);
+                free(tmp);
+            } else {
+                audiostate.outbufcount = 2;
+            }
+            if (audiostate.outbufcount < audiostate.latency.min) audiostate.outbufcount = audiostate.latency.min;
+            else if (audiostate.outbufcount > audiostate.latency.max) audiostate.outbufcount = audiostate.latency.max;
+            audiostate.latency.underruns = 0;
+            audiostate.latency.cbunderruns = 0;
+            audiostate.latency.lastcbunderruns = 0;
+            audiostate.latency.period = latencytobufs(5000);
+            audiostate.latency.calm = 0;
+            audiostate.latency.lowwater = -1;
+            audiostate.latency.mixload = 0.0f;
+            plog(
+                LL_INFO, "  Latency: %u buffers (%ums, %u to %u allowed%s)", audiostate.outbufcount,
+                bufstolatency(audiostate.outbufcount), audiostate.latency.min, audiostate.latency.max,
+                (audiostate.latency.adaptive) ? ", adaptive" : ""
+            );
         }
         audiostate.audbuf.outsize = outspec.samples * sizeof(**audiostate.audbuf.out) * outspec.channels;
-        audiostate.audbuf.out[0] = malloc(audiostate.audbuf.outsize);
-        if (audiostate.usecallback) {
-            audiostate.audbuf.out[1] = malloc(audiostate.audbuf.outsize);
+        // the callback may still be reading one buffer while the mixer keeps up to 'latency.max' ahead
+        audiostate.audbuf.outcount = (audiostate.usecallback && audiostate.outmode == AUDIOOUTPUT_DEVICE) ?
+            audiostate.latency.max + 1 : 1;
+        audiostate.audbuf.out = malloc(audiostate.audbuf.outcount * sizeof(*audiostate.audbuf.out));
+        for (unsigned i = 0; i < audiostate.audbuf.outcount; ++i) {
+            audiostate.audbuf.out[i] = malloc(audiostate.audbuf.outsize);
         }
         {
             int voicecount;
@@ -2005,16 +3238,17 @@ bool startAudio(void) {
         audiostate.voices.ambience.oldfade = 1.0;
         audiostate.voices.ambience.fade = 1.0;
         audiostate.voices.ambience.index = 1;
+        audiostate.voices.music.rc = NULL;
         audiostate.emitters.len = 0;
         audiostate.emitters.size = 4;
         audiostate.emitters.data = malloc(audiostate.emitters.size * sizeof(*audiostate.emitters.data));
-        tmp = cfg_getvar(&config, "Audio", "outbufcount");
-        if (tmp) {
-            audiostate.outbufcount = atoi(tmp);
-            free(tmp);
-        } else {
-            audiostate.outbufcount = 2;
-        }
+        for (int i = 0; i < AUDIO_EMITGRIDBUCKETS; ++i) audiostate.emitgrid.buckets[i] = -1;
+        audiostate.emitgrid.maxreach = 0.0f;
+        audiostate.emitgrid.maxreachdirty = false;
+        audiostate.emitgrid.stamp = 0;
+        audiostate.emitgrid.nearlen = 0;
+        audiostate.emitgrid.nearsize = 16;
+        audiostate.emitgrid.near = malloc(audiostate.emitgrid.nearsize * sizeof(*audiostate.emitgrid.near));
         tmp = cfg_getvar(&config, "Audio", "decodebuf");
         if (tmp) {
             audiostate.audbuflen = atoi(tmp);
@@ -2037,8 +3271,48 @@ bool startAudio(void) {
             audiostate.soundrcopt.decodewhole = false;
             #endif
         }
-        audiostate.audbufindex = 0;
-        audiostate.mixaudbufindex = -1;
+        audiostate.sfxrcopt.decodewhole = true;
+        tmp = cfg_getvar(&config, "Audio", "preresample");
+        audiostate.sfxrcopt.resample = (strbool(tmp, true)) ? audiostate.freq : 0;
+        free(tmp);
+        #ifndef PSRC_NOMT
+        tmp = cfg_getvar(&config, "Audio", "decodeahead");
+        audiostate.decahead.enabled = strbool(tmp, true);
+        free(tmp);
+        int cachebudget = 4096;
+        tmp = cfg_getvar(&config, "Audio", "decodecache");
+        if (tmp) {
+            cachebudget = atoi(tmp);
+            free(tmp);
+            if (cachebudget < 0) cachebudget = 0;
+        }
+        if (audiostate.decahead.enabled && !startDecodeThread((size_t)cachebudget * 1024)) {
+            plog(LL_WARN, "Failed to start audio decode thread");
+            audiostate.decahead.enabled = false;
+        }
+        #endif
+        tmp = cfg_getvar(&config, "Audio", "occlusion");
+        audiostate.occl.enabled = strbool(tmp, true);
+        free(tmp);
+        tmp = cfg_getvar(&config, "Audio", "occlusion.thickness");
+        if (tmp) {
+            audiostate.occl.thickness = atof(tmp);
+            free(tmp);
+            if (!(audiostate.occl.thickness > 0.0f)) audiostate.occl.thickness = 1.0f;
+        } else {
+            audiostate.occl.thickness = 1.0f;
+        }
+        audiostate.occl.raycount = 0;
+        audiostate.occl.next = 0;
+        #ifndef PSRC_NOMT
+        audiostate.occl.state = AUDIOOCCLSTATE_IDLE;
+        if (audiostate.occl.enabled && !createThread(&audiostate.occl.thread, "audio occlusion", NULL, occlthread, NULL)) {
+            plog(LL_WARN, "Failed to start audio occlusion thread");
+            audiostate.occl.enabled = false;
+        }
+        #endif
+        audiostate.played = 0;
+        audiostate.mixed = 0;
         {
             char s[4];
             #define sa_getvolcfg(v, d) ((cfg_getvarto(&config, "Audio", (v), s, sizeof(s))) ? atoi(s) : (d))
@@ -2057,15 +3331,83 @@ bool startAudio(void) {
             adjfilters = strbool(tmp, adjfilters);
             free(tmp);
         }
+        tmp = cfg_getvar(&config, "Audio", "simd");
+        setAudioMixKern(strbool(tmp, true));
+        free(tmp);
+        plog(LL_INFO, "  Mixer kernels: %s", audiomixkern.name);
+        {
+            // 0 = linear, then 8, 16, or 32 tap sinc
+            int quality = 1;
+            tmp = cfg_getvar(&config, "Audio", "quality.resampling");
+            if (tmp) {
+                quality = atoi(tmp);
+                free(tmp);
+            }
+            if (quality < 0) quality = 0;
+            else if (quality > 3) quality = 3;
+            if (!setAudioMixSinc((quality) ? 4 << quality : 0)) {
+                plog(LL_WARN, "Failed to allocate resampling tables, falling back to linear interpolation");
+            }
+            if (audiomixsinc.taps) plog(LL_INFO, "  Resampling: %d tap sinc", audiomixsinc.taps);
+            else plog(LL_INFO, "  Resampling: linear");
+        }
+        #ifndef PSRC_NOMT
+        {
+            int threads;
+            tmp = cfg_getvar(&config, "Audio", "mixthreads");
+            if (tmp) {
+                threads = atoi(tmp);
+                free(tmp);
+            } else {
+                threads = -1;
+            }
+            if (threads < 0) {
+                // leave a core for the main thread and one for everything else
+                #ifndef PSRC_USESDL1
+                threads = SDL_GetCPUCount() - 2;
+                #else
+                threads = 0;
+                #endif
+            }
+            startMixWorkers(threads);
+            plog(LL_INFO, "  Mixer workers: %d", mixpool.threads);
+        }
+        #endif
+        // anything queued while audio was stopped refers to the old emitters
+        dropcmds();
         audiostate.valid = true;
-        #ifndef PSRC_USESDL1
-        SDL_PauseAudioDevice(output, 0);
-        #else
-        SDL_PauseAudio(0);
+        if (audiostate.outmode == AUDIOOUTPUT_DEVICE) {
+            #ifndef PSRC_USESDL1
+            SDL_PauseAudioDevice(output, 0);
+            #else
+            SDL_PauseAudio(0);
+            #endif
+        }
+        #ifndef PSRC_NOMT
+        if (mixthread && audiostate.usecallback && audiostate.outmode == AUDIOOUTPUT_DEVICE) {
+            struct threadattr attr = {.prio = THREADPRIO_REALTIME};
+            tmp = cfg_getvar(&config, "Audio", "mixthread.cpu");
+            if (tmp) {
+                int cpu = atoi(tmp);
+                free(tmp);
+                if (cpu >= 0 && cpu < 64) attr.affinity = (uint64_t)1 << cpu;
+            }
+            audiostate.mixthread.update = false;
+            audiostate.mixthread.framemult = 0.0f;
+            if (createThread(&audiostate.mixthread.thread, "audio mixer", &attr, mixerthread, NULL)) {
+                audiostate.mixthread.enabled = true;
+            } else {
+                plog(LL_WARN, "Failed to start audio mixer thread, mixing on updates instead");
+            }
+        }
+        plog(LL_INFO, "  Mixer thread: %s", (audiostate.mixthread.enabled) ? "yes" : "no");
         #endif
-    } else {
+    } else if (audiostate.outmode == AUDIOOUTPUT_DEVICE) {
         audiostate.valid = false;
         plog(LL_ERROR, "Failed to get audio info for default output device; audio disabled: %s", SDL_GetError());
+    } else {
+        audiostate.valid = false;
+        plog(LL_ERROR, "Failed to start offline audio output; audio disabled");
     }
     #ifndef PSRC_NOMT
     releaseWriteAccess(&audiostate.lock);
@@ -2076,16 +3418,38 @@ bool startAudio(void) {
 void stopAudio(void) {
     if (audiostate.valid) {
         #ifndef PSRC_NOMT
+        if (audiostate.mixthread.enabled) {
+            lockMutex(&audiostate.mixthread.lock);
+            quitThread(&audiostate.mixthread.thread);
+            signalCond(&audiostate.mixthread.wake);
+            unlockMutex(&audiostate.mixthread.lock);
+            destroyThread(&audiostate.mixthread.thread, NULL);
+            audiostate.mixthread.enabled = false;
+        }
         acquireWriteAccess(&audiostate.lock);
         #endif
         audiostate.valid = false;
-        #ifndef PSRC_USESDL1
-        SDL_PauseAudioDevice(audiostate.output, 1);
-        SDL_CloseAudioDevice(audiostate.output);
-        #else
-        SDL_PauseAudio(1);
-        SDL_CloseAudio();
+        dropcmds();
+        #ifndef PSRC_NOMT
+        lockMutex(&audiostate.cmds.emitterlock);
+        #endif
+        audiostate.cmds.emitterslen = 0;
+        #ifndef PSRC_NOMT
+        unlockMutex(&audiostate.cmds.emitterlock);
         #endif
+        if (audiostate.outmode == AUDIOOUTPUT_DEVICE) {
+            #ifndef PSRC_USESDL1
+            SDL_PauseAudioDevice(audiostate.output, 1);
+            SDL_CloseAudioDevice(audiostate.output);
+            #else
+            SDL_PauseAudio(1);
+            SDL_CloseAudio();
+            #endif
+        } else if (audiostate.outmode == AUDIOOUTPUT_WAV) {
+            // fill in the sizes now that they are known
+            writewavheader();
+            fclose(audiostate.offline.wav);
+        }
         if (audiostate.voices.ui.rc) stopSound_inline(&audiostate.voices.ui);
         for (int i = 0; i < audiostate.voices.alerts.count; ++i) {
             struct audiosound* s = &audiostate.voices.alerts.data[i].data;
@@ -2097,24 +3461,54 @@ void stopAudio(void) {
             if (s->rc) stopSound_inline(s);
         }
         free(audiostate.voices.world.data);
+        free(audiostate.voices.world.sortdata);
         for (int i = 0; i < audiostate.voices.worldbg.len; ++i) {
             struct audiosound* s = &audiostate.voices.worldbg.data[i].data;
             if (s->rc) stopSound_inline(s);
         }
         free(audiostate.voices.worldbg.data);
+        free(audiostate.voices.worldbg.sortdata);
+        #ifndef PSRC_NOMT
+        stopMixWorkers();
+        #endif
+        free(mixpool.data);
+        mixpool.data = NULL;
+        mixpool.size = 0;
+        mixscratch_free(&mixpool.scratch);
+        setAudioMixSinc(0);
+        freeReverb();
         if (audiostate.voices.ambience.queue) unlockRc(audiostate.voices.ambience.queue);
         if (audiostate.voices.ambience.data[0].rc) stopSound_inline(&audiostate.voices.ambience.data[0]);
         if (audiostate.voices.ambience.data[1].rc) stopSound_inline(&audiostate.voices.ambience.data[1]);
-        free(audiostate.audbuf.data[0][0]);
-        free(audiostate.audbuf.data[0][1]);
-        if (audiostate.usecallback) {
-            free(audiostate.audbuf.data[1][0]);
-            free(audiostate.audbuf.data[1][1]);
+        if (audiostate.voices.music.rc) {
+            ptmplay_free(&audiostate.voices.music.player);
+            unlockRc(audiostate.voices.music.rc);
+            audiostate.voices.music.rc = NULL;
         }
-        free(audiostate.audbuf.out[0]);
-        if (audiostate.usecallback) {
-            free(audiostate.audbuf.out[1]);
+        #ifndef PSRC_NOMT
+        if (audiostate.decahead.enabled) {
+            stopDecodeThread();
+            audiostate.decahead.enabled = false;
+        }
+        if (audiostate.occl.enabled) {
+            lockMutex(&audiostate.occl.lock);
+            quitThread(&audiostate.occl.thread);
+            signalCond(&audiostate.occl.wake);
+            unlockMutex(&audiostate.occl.lock);
+            destroyThread(&audiostate.occl.thread, NULL);
+            audiostate.occl.enabled = false;
+        }
+        #endif
+        free(audiostate.emitgrid.near);
+        if (audiostate.latency.underruns) plog(LL_INFO, "Audio underruns: %u", audiostate.latency.underruns);
+        free(audiostate.audbuf.data[0]);
+        free(audiostate.audbuf.data[1]);
+        free(audiostate.audbuf.voice[0]);
+        free(audiostate.audbuf.voice[1]);
+        for (unsigned i = 0; i < audiostate.audbuf.outcount; ++i) {
+            free(audiostate.audbuf.out[i]);
         }
+        free(audiostate.audbuf.out);
         #ifndef PSRC_NOMT
         releaseWriteAccess(&audiostate.lock);
         #endif
@@ -2122,7 +3516,18 @@ void stopAudio(void) {
 }
 
 void quitAudio(void) {
+    dropcmds();
+    free(audiostate.voices.music.style);
+    audiostate.voices.music.style = NULL;
+    free(audiostate.cmds.emitters);
+    audiostate.cmds.emitters = NULL;
+    audiostate.cmds.emitterssize = 0;
     #ifndef PSRC_NOMT
+    destroyMutex(&audiostate.cmds.emitterlock);
+    destroyCond(&audiostate.mixthread.wake);
+    destroyMutex(&audiostate.mixthread.lock);
+    destroyCond(&audiostate.occl.wake);
+    destroyMutex(&audiostate.occl.lock);
     destroyAccessLock(&audiostate.lock);
     #endif
 }
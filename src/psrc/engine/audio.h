@@ -6,6 +6,9 @@
 #include "../common/resource.h"
 #include "../common/threading.h"
 
+#include "ptmplay.h"
+#include "vis.h"
+
 #include "../../stb/stb_vorbis.h"
 #ifdef PSRC_USEMINIMP3
     #include "../../minimp3/minimp3_ex.h"
@@ -23,6 +26,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "../attribs.h"
 
@@ -31,12 +35,42 @@ struct audioemitter {
     int uses;
     uint8_t paused : 1;
     uint8_t bg : 1;
+    uint8_t ingrid : 1;
     float vol[2];
     float speed;
     float pos[3];
     float range;
     float lpfilt;
     float hpfilt;
+    float sndrange; // largest range and offset of the sounds played on it, reset when the last one stops
+    float sndoff;
+    float reach; // how far from 'pos' any of its sounds can be heard
+    int cell[3];
+    int gridnext; // next emitter in the same grid bucket, or -1
+    unsigned near; // equal to the grid's stamp if the listener was in reach on the last update
+    unsigned serial; // tells results for an emitter apart from ones for an earlier emitter at the same index
+    float occl; // from 0 (clear) to 1 (fully occluded), ramped towards 'occltarget'
+    float occltarget;
+};
+// Emitters are hashed into a grid of cubic cells by position so that each update only has to look at the cells
+// within reach of the listener. Sounds on emitters that are out of reach are silenced without working out their fx.
+#define AUDIO_EMITGRIDCELL 64.0f
+#define AUDIO_EMITGRIDBUCKETS 256 // must be a power of 2
+// Occlusion is found by tracing from the listener to the emitters in reach through the solid cubes of the level. The
+// mixer hands a batch of emitters at a time to the occlusion thread, going round robin, and picks up the results on a
+// later update so it never waits on the tracing. Each emitter keeps its last result until it comes up again.
+#define AUDIO_OCCLBATCH 32
+struct audioocclray {
+    int emitter;
+    unsigned serial;
+    float from[3];
+    float to[3];
+    float solid; // length of the ray inside solid cubes
+};
+PACKEDENUM audioocclstate {
+    AUDIOOCCLSTATE_IDLE,
+    AUDIOOCCLSTATE_BUSY, // the occlusion thread owns the batch
+    AUDIOOCCLSTATE_DONE
 };
 
 struct audiosound_audbuf {
@@ -56,6 +90,44 @@ struct audiosound_fx {
     int lpfiltmul; // from 0 to output freq
     int hpfiltmul; // from 0 to output freq
 };
+#define AUDIO_REVERB_LINES 8 // delay lines in the reverb's feedback network
+#define AUDIO_REVERB_BLOCK 64 // the reverb's parameters are interpolated once per this many samples
+#ifndef PSRC_NOMT
+#define AUDIO_DECAHEADBLOCKS 4 // blocks handed to a voice, filled from the head onwards with one spare for one behind it
+#define AUDIO_DECCACHEBUCKETS 256
+// A block of decoded audio in the cache shared by all voices playing the same sound. Blocks are 'audbuflen' samples
+// of planar stereo (left, then right), keyed by the sound and the block's index in it. The cache itself is only
+// touched by the decode thread. Blocks nobody holds a reference to are reused least recently used first once the
+// cache is over budget, and are only freed once no voice is playing the sound, so a voice that looked at a block just
+// before it was reused can still safely see that it changed.
+struct audiodecblk {
+    struct audiodecblk* hnext;
+    struct audiodecblk* lprev; // LRU list, most recently used first
+    struct audiodecblk* lnext;
+    struct rc_sound* rc;
+    volatile long index;
+    volatile int refs; // voices reading it, and the decode thread for each voice it is handed to
+    int16_t* data;
+};
+// A voice's compressed audio decoded ahead of the playhead by the decode thread into the cache, from the block at
+// 'head' onwards. Finished blocks are handed to the mixer in 'blks' without locking.
+struct audiodecahead {
+    struct audiodecahead* next;
+    struct rc_sound* rc;
+    union {
+        stb_vorbis* vorbis;
+        #ifdef PSRC_USEMINIMP3
+        mp3dec_ex_t* mp3;
+        #endif
+    };
+    long decpos; // where the decoder is, to skip seeking when decoding in order
+    int blockcount;
+    volatile long head; // block the mixer is at, only written by the mixer
+    volatile uint8_t loop; // if the decode thread should go back to the start after the last block, set by the mixer
+    volatile uint8_t stop; // set when the sound stops, the decode thread frees it
+    struct audiodecblk* volatile blks[AUDIO_DECAHEADBLOCKS]; // only written by the decode thread
+};
+#endif
 struct audiosound {
     struct rc_sound* rc;
     union {
@@ -65,6 +137,14 @@ struct audiosound {
         #endif
     };
     struct audiosound_audbuf audbuf;
+    #ifndef PSRC_NOMT
+    struct audiodecahead* decahead;
+    struct {
+        long start, end; // samples covered by 'blk', empty if none
+        struct audiodecblk* blk; // referenced until the voice moves off of it or stops
+        long miss; // block that was not ready, not looked for again until the next buffer
+    } decblk;
+    #endif
     long offset;
     int frac;
 };
@@ -98,26 +178,154 @@ struct audiovoicegroup_world {
     int size;
     int playcount;
 };
+// Calls into the audio API are queued as commands and applied by whichever thread mixes next, before it mixes, so
+// they never wait on the mixer. The queue is a bounded ring that any thread can add to; each slot's 'seq' says
+// whether it is free for the producer at that position or filled for the consumer.
+#define AUDIO_CMDQUEUESIZE 1024 // must be a power of 2
+PACKEDENUM audiocmdtype {
+    AUDIOCMD_NEWEMITTER,
+    AUDIOCMD_EDITEMITTER,
+    AUDIOCMD_PAUSEEMITTER,
+    AUDIOCMD_STOPEMITTER,
+    AUDIOCMD_DELETEEMITTER,
+    AUDIOCMD_PLAYSOUND,
+    AUDIOCMD_PLAYUISOUND,
+    AUDIOCMD_SETAMBIENTSOUND,
+    AUDIOCMD_SETMUSIC,
+    AUDIOCMD_SETMUSICSTYLE,
+    AUDIOCMD_EDITSOUNDENV,
+    AUDIOCMD_UPDATE // only queued when the mixer thread is running
+};
+struct audiocmd_fx {
+    uint8_t set; // 1 << SOUNDFXENUM_*
+    float vol[2];
+    float speed;
+    float pos[3];
+    float range;
+    float lpfilt;
+    float hpfilt;
+};
+struct audiocmd {
+    enum audiocmdtype type;
+    uint8_t flags; // bg for NEWEMITTER, immediate for EDITEMITTER, paused for PAUSEEMITTER, sound flags for PLAYSOUND
+    int emitter;
+    union {
+        struct {
+            int max;
+            struct audiocmd_fx fx;
+        } newemitter;
+        struct audiocmd_fx editemitter;
+        struct {
+            struct rc_sound* rc; // locked by the caller, unlocked by the mixer if it is not played
+            struct audiocmd_fx fx;
+        } playsound;
+        struct rc_sound* sound;
+        struct rc_music* music;
+        char* style;
+        struct {
+            uint8_t set; // 1 << SOUNDENVENUM_*
+            float value[7]; // indexed by SOUNDENVENUM_* - 1
+        } env;
+        struct {
+            float campos[3];
+            float camrot[3];
+            float framemult;
+        } update;
+    };
+};
+struct audiocmdslot {
+    volatile unsigned seq;
+    struct audiocmd cmd;
+};
+
+enum audiooutput {
+    AUDIOOUTPUT_DEVICE,
+    AUDIOOUTPUT_NULL, // mix and discard
+    AUDIOOUTPUT_WAV // mix into a WAV file
+};
+
 struct audiostate {
     #ifndef PSRC_NOMT
     struct accesslock lock;
     #endif
     volatile bool valid;
     bool usecallback;
+    uint8_t outmode; // enum audiooutput
+    struct {
+        FILE* wav;
+        uint32_t wavdatasize;
+        uint64_t next; // when the next buffer is due if paced to real time
+    } offline;
     #ifndef PSRC_USESDL1
     SDL_AudioDeviceID output;
     #endif
     int freq;
     int channels;
-    volatile int8_t audbufindex;
-    volatile int8_t mixaudbufindex;
+    volatile unsigned played; // buffers taken by the callback
+    volatile unsigned mixed; // buffers mixed
     int audbuflen;
-    unsigned outbufcount;
+    unsigned outbufcount; // how many buffers to keep mixed ahead, adjusted between the latency bounds
+    struct {
+        unsigned min; // in buffers
+        unsigned max;
+        bool adaptive;
+        unsigned underruns; // total since the device was opened
+        volatile unsigned cbunderruns; // counted by the callback, folded into 'underruns' by the mixer
+        unsigned lastcbunderruns;
+        unsigned period; // buffers to go without underruns before trying a shorter queue
+        unsigned calm; // buffers since the last underrun or change
+        unsigned lowwater; // fewest buffers left queued during the calm period
+        float mixload; // smoothed fraction of each buffer's play time spent mixing it
+    } latency;
+    #ifndef PSRC_NOMT
+    // Keeps the callback's ring filled on its own so main thread stalls do not starve the device. While it runs, it
+    // owns everything the mixer touches; updateSounds() only queues the camera and frame time for it, and the spatial
+    // update is done on this thread before the next buffer.
+    struct {
+        bool enabled;
+        thread_t thread;
+        mutex_t lock;
+        cond_t wake; // signaled when the command queue is full or the thread should stop; the callback is polled for instead
+        bool update; // an update was queued since the last buffer
+        float framemult; // summed over the updates since the last buffer
+    } mixthread;
+    #endif
+    #ifndef PSRC_NOMT
+    struct {
+        bool enabled;
+        thread_t thread;
+        mutex_t lock;
+        cond_t wake; // signaled when there is something new to decode or free, or the thread should stop
+        bool woken; // so a wake while the decode thread is busy is not lost
+        struct audiodecahead* pending; // added by the API, taken by the decode thread
+    } decahead;
+    struct {
+        struct audiodecblk* buckets[AUDIO_DECCACHEBUCKETS];
+        struct audiodecblk* head; // most recently used
+        struct audiodecblk* tail;
+        size_t size;
+        size_t budget;
+    } deccache;
+    #endif
+    struct {
+        struct audiocmdslot slots[AUDIO_CMDQUEUESIZE];
+        volatile unsigned head; // only touched with the write lock held
+        volatile unsigned tail;
+        #ifndef PSRC_NOMT
+        mutex_t emitterlock;
+        #endif
+        uint8_t* emitters; // which emitter indices have been handed out
+        int emitterslen;
+        int emitterssize;
+    } cmds;
     struct rcopt_sound soundrcopt;
+    struct rcopt_sound sfxrcopt; // for short, often played sounds; resampled to the output rate at load time
     struct {
-        int16_t* out[2];
+        int16_t** out; // ring of 'latency.max + 1' buffers with the callback, otherwise just one
+        unsigned outcount;
         unsigned outsize;
-        int* data[2][2];
+        int* data[2];
+        float* voice[2]; // scratch for resampling a voice before it is filtered and mixed in
         int len;
     } audbuf;
     struct {
@@ -125,6 +333,30 @@ struct audiostate {
         int len;
         int size;
     } emitters;
+    struct {
+        int buckets[AUDIO_EMITGRIDBUCKETS]; // first emitter in each, or -1
+        float maxreach;
+        bool maxreachdirty; // set when the emitter with the largest reach may have shrunk
+        unsigned stamp;
+        int* near; // emitters stamped on the last update
+        int nearlen;
+        int nearsize;
+    } emitgrid;
+    struct {
+        bool enabled;
+        float thickness; // of solid between the listener and an emitter for half occlusion
+        struct vis_level* level;
+        struct audioocclray rays[AUDIO_OCCLBATCH];
+        int raycount;
+        int next; // where in the near list to continue from
+        unsigned serial;
+        #ifndef PSRC_NOMT
+        thread_t thread;
+        mutex_t lock; // held while tracing or changing the level
+        cond_t wake; // signaled when a batch is handed over or the thread should stop
+        volatile uint8_t state; // enum audioocclstate
+        #endif
+    } occl;
     struct {
         struct audiosound ui;
         struct {
@@ -142,10 +374,9 @@ struct audiostate {
             uint8_t index;
         } ambience;
         struct {
-            struct rc_sound* queue;
-            struct audiosound data;
-            float vol;
-            float oldvol;
+            struct rc_music* rc;
+            struct ptmplay player;
+            char* style; // kept so that it carries over to the next song
         } music;
     } voices;
     struct {
@@ -174,29 +405,32 @@ struct audiostate {
             float delay[2];
             float feedback[2];
             float mix[2];
-            int16_t* buf[2];
-            unsigned len;
+            float* buf; // AUDIO_REVERB_LINES delay lines of 'size' samples each
             unsigned size;
             unsigned head;
+            unsigned len[AUDIO_REVERB_LINES];
             struct {
                 float amount[2];
-                int16_t lastout[2];
+                float lastout[AUDIO_REVERB_LINES];
             } lpfilt;
             struct {
                 float amount[2];
-                int16_t lastout[2];
-                int16_t lastin[2];
+                float lastout[AUDIO_REVERB_LINES];
+                float lastin[AUDIO_REVERB_LINES];
             } hpfilt;
         } reverb;
     } env;
     struct {
         float pos[3];
         float rot[3];
+    } cam; // set before calling updateSounds()
+    struct {
+        float pos[3];
         float rotradx, rotrady, rotradz;
         float sinx, cosx;
         float siny, cosy;
         float sinz, cosz;
-    } cam;
+    } listener; // the camera as of the last update
 };
 
 extern struct audiostate audiostate;
@@ -267,12 +501,14 @@ void playSound(int emitter, struct rc_sound* rc, unsigned /*uint8_t*/ flags, ...
 void playUISound(struct rc_sound* rc);
 void playAlertSound(struct rc_sound* rc); // TODO: maybe add speed?
 void setAmbientSound(struct rc_sound* rc);
-void setMusic(struct rc_sound* rc); // TODO: make rc_music once PTM is added
-void setMusicStyle(const char*);
+void setMusic(struct rc_music* rc); // NULL to stop
+void setMusicStyle(const char*); // the name of a group in the song, or NULL for none
+void setAudioLevel(struct vis_level*); // for occlusion, NULL for none
 
 void editSoundEnv(enum soundenv, ...);
 #define editSoundEnv(...) editSoundEnv(__VA_ARGS__, SOUNDENVENUM__END)
 
 void updateSounds(float framemult);
+void renderAudio(unsigned buffers); // mixes as fast as possible; does nothing unless the output is offline
 
 #endif
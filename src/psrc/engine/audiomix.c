@@ -0,0 +1,543 @@
+#include "../rcmgralloc.h"
+
+#include "audiomix.h"
+
+#include "../platform.h"
+
+#if PLATFORM == PLAT_NXDK || PLATFORM == PLAT_GDK
+    #include <SDL.h>
+#elif defined(PSRC_USESDL1)
+    #include <SDL/SDL.h>
+#else
+    #include <SDL2/SDL.h>
+#endif
+
+#include <math.h>
+
+#ifndef PSRC_NOSIMD
+    #if defined(__SSE2__) || defined(_M_AMD64) || defined(_M_X64)
+        #include <emmintrin.h>
+        #define AUDIOMIX_USESSE2
+        #if !defined(PSRC_USESDL1) && SDL_VERSION_ATLEAST(2, 0, 4)
+            #if defined(__GNUC__) || defined(__clang__)
+                #include <immintrin.h>
+                #define AUDIOMIX_USEAVX2
+                #define AUDIOMIX_AVX2FUNC __attribute__((target("avx2")))
+            #elif defined(_MSC_VER)
+                #include <immintrin.h>
+                #define AUDIOMIX_USEAVX2
+                #define AUDIOMIX_AVX2FUNC
+            #endif
+        #endif
+    #elif defined(__ARM_NEON)
+        #include <arm_neon.h>
+        #define AUDIOMIX_USENEON
+    #endif
+#endif
+
+// added to the filter inputs so a decaying tail settles on a tiny normal value instead of going subnormal
+#define AUDIOMIX_DENORMFIX 1e-20f
+
+struct audiomixkern audiomixkern;
+
+static inline int16_t clamps16(int s) {
+    if (s > 32767) return 32767;
+    if (s < -32768) return -32768;
+    return s;
+}
+
+static void addscaled_scalar(int* out, const float* in, int len, int v0, int v1) {
+    float v = v0 / 32768.0f;
+    if (v0 == v1) {
+        for (int i = 0; i < len; ++i) {
+            out[i] += (int)(in[i] * v);
+        }
+    } else {
+        float dv = (float)(v1 - v0) / 32768.0f / len;
+        for (int i = 0; i < len; ++i) {
+            out[i] += (int)(in[i] * (v + dv * i));
+        }
+    }
+}
+static void lpfilt_scalar(float* buf, int len, float a, float* lastout) {
+    float y = *lastout;
+    for (int i = 0; i < len; ++i) {
+        y += (buf[i] + AUDIOMIX_DENORMFIX - y) * a;
+        buf[i] = y;
+    }
+    *lastout = y;
+}
+static void hpfilt_scalar(float* buf, int len, float h, float* lastin, float* lastout) {
+    float x1 = *lastin, y = *lastout;
+    for (int i = 0; i < len; ++i) {
+        float x = buf[i];
+        y = (y + x - x1 + AUDIOMIX_DENORMFIX) * h;
+        x1 = x;
+        buf[i] = y;
+    }
+    *lastin = x1;
+    *lastout = y;
+}
+static void pack_scalar(const int* l, const int* r, int16_t* out, int len, int channels) {
+    if (channels < 2) {
+        for (int i = 0; i < len; ++i) {
+            out[i] = clamps16((l[i] + r[i]) / 2);
+        }
+    } else {
+        for (int i = 0; i < len; ++i) {
+            out[i * channels] = clamps16(l[i]);
+            out[i * channels + 1] = clamps16(r[i]);
+        }
+    }
+}
+
+void audiomix_lpfilt_ramp(float* buf, int len, float a0, float a1, float* lastout) {
+    float y = *lastout;
+    float da = (a1 - a0) / len;
+    for (int i = 0; i < len; ++i) {
+        y += (buf[i] + AUDIOMIX_DENORMFIX - y) * (a0 + da * i);
+        buf[i] = y;
+    }
+    *lastout = y;
+}
+void audiomix_hpfilt_ramp(float* buf, int len, float h0, float h1, float* lastin, float* lastout) {
+    float x1 = *lastin, y = *lastout;
+    float dh = (h1 - h0) / len;
+    for (int i = 0; i < len; ++i) {
+        float x = buf[i];
+        y = (y + x - x1 + AUDIOMIX_DENORMFIX) * (h0 + dh * i);
+        x1 = x;
+        buf[i] = y;
+    }
+    *lastin = x1;
+    *lastout = y;
+}
+
+static void sinc_scalar(float* out, int len, const float* src, const int* off, const uint16_t* phase, const float* table, int taps) {
+    for (int i = 0; i < len; ++i) {
+        const float* x = src + off[i];
+        const float* h = table + phase[i] * taps;
+        float acc = 0.0f;
+        for (int j = 0; j < taps; ++j) {
+            acc += x[j] * h[j];
+        }
+        out[i] = acc;
+    }
+}
+
+static const struct audiomixkern audiomixkern_scalar = {
+    "scalar",
+    addscaled_scalar,
+    lpfilt_scalar,
+    hpfilt_scalar,
+    pack_scalar,
+    sinc_scalar
+};
+
+// The one-pole filters are recursive, so 4 outputs at a time are computed from the last output of the previous
+// group instead: y[n + k] = p^(k + 1) * y[n - 1] + sum(j = 0..k, g * p^(k - j) * u[n + j])
+struct onepolecoeffs {
+    float pw[4]; // p^(k + 1)
+    float c[4][4]; // [j][k]
+};
+static void calcOnePoleCoeffs(struct onepolecoeffs* o, float p, float g) {
+    float pk[4] = {1.0f, p, p * p, p * p * p};
+    for (int k = 0; k < 4; ++k) {
+        o->pw[k] = pk[k] * p;
+        for (int j = 0; j < 4; ++j) {
+            o->c[j][k] = (k >= j) ? g * pk[k - j] : 0.0f;
+        }
+    }
+}
+
+#if defined(AUDIOMIX_USESSE2)
+
+static void addscaled_sse2(int* out, const float* in, int len, int v0, int v1) {
+    int i = 0;
+    float v = v0 / 32768.0f;
+    float dv = (float)(v1 - v0) / 32768.0f / len;
+    __m128 vv = _mm_add_ps(_mm_set1_ps(v), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(dv)));
+    __m128 vstep = _mm_set1_ps(dv * 4.0f);
+    for (; i + 4 <= len; i += 4) {
+        __m128i s = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), vv));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(out + i)), s));
+        vv = _mm_add_ps(vv, vstep);
+    }
+    for (; i < len; ++i) {
+        out[i] += (int)(in[i] * (v + dv * i));
+    }
+}
+#define AUDIOMIX_SSE2_BCAST(v, l) _mm_shuffle_ps((v), (v), _MM_SHUFFLE((l), (l), (l), (l)))
+static inline __m128 onepole_sse2(__m128 u, __m128 y, const struct onepolecoeffs* o) {
+    u = _mm_add_ps(u, _mm_set1_ps(AUDIOMIX_DENORMFIX));
+    __m128 r = _mm_mul_ps(_mm_loadu_ps(o->pw), y);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(o->c[0]), AUDIOMIX_SSE2_BCAST(u, 0)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(o->c[1]), AUDIOMIX_SSE2_BCAST(u, 1)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(o->c[2]), AUDIOMIX_SSE2_BCAST(u, 2)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(o->c[3]), AUDIOMIX_SSE2_BCAST(u, 3)));
+    return r;
+}
+static void lpfilt_sse2(float* buf, int len, float a, float* lastout) {
+    int i = 0;
+    if (len >= 4) {
+        struct onepolecoeffs o;
+        calcOnePoleCoeffs(&o, 1.0f - a, a);
+        __m128 y = _mm_set1_ps(*lastout);
+        for (; i + 4 <= len; i += 4) {
+            __m128 r = onepole_sse2(_mm_loadu_ps(buf + i), y, &o);
+            _mm_storeu_ps(buf + i, r);
+            y = AUDIOMIX_SSE2_BCAST(r, 3);
+        }
+        *lastout = _mm_cvtss_f32(y);
+    }
+    if (i < len) lpfilt_scalar(buf + i, len - i, a, lastout);
+}
+static void hpfilt_sse2(float* buf, int len, float h, float* lastin, float* lastout) {
+    int i = 0;
+    if (len >= 4) {
+        struct onepolecoeffs o;
+        calcOnePoleCoeffs(&o, h, h);
+        __m128 y = _mm_set1_ps(*lastout);
+        __m128 x1 = _mm_set1_ps(*lastin);
+        for (; i + 4 <= len; i += 4) {
+            __m128 x = _mm_loadu_ps(buf + i);
+            // x[n - 1] for each lane
+            __m128 xp = _mm_move_ss(_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)), x1);
+            __m128 r = onepole_sse2(_mm_sub_ps(x, xp), y, &o);
+            _mm_storeu_ps(buf + i, r);
+            y = AUDIOMIX_SSE2_BCAST(r, 3);
+            x1 = AUDIOMIX_SSE2_BCAST(x, 3);
+        }
+        *lastout = _mm_cvtss_f32(y);
+        *lastin = _mm_cvtss_f32(x1);
+    }
+    if (i < len) hpfilt_scalar(buf + i, len - i, h, lastin, lastout);
+}
+#undef AUDIOMIX_SSE2_BCAST
+static void pack_sse2(const int* l, const int* r, int16_t* out, int len, int channels) {
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 8 <= len; i += 8) {
+            __m128i vl = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(l + i)), _mm_loadu_si128((const __m128i*)(l + i + 4)));
+            __m128i vr = _mm_packs_epi32(_mm_loadu_si128((const __m128i*)(r + i)), _mm_loadu_si128((const __m128i*)(r + i + 4)));
+            _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi16(vl, vr));
+            _mm_storeu_si128((__m128i*)(out + i * 2 + 8), _mm_unpackhi_epi16(vl, vr));
+        }
+    } else if (channels < 2) {
+        for (; i + 8 <= len; i += 8) {
+            __m128i s0 = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(l + i)), _mm_loadu_si128((const __m128i*)(r + i)));
+            __m128i s1 = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(l + i + 4)), _mm_loadu_si128((const __m128i*)(r + i + 4)));
+            // round towards 0 like the scalar division
+            s0 = _mm_srai_epi32(_mm_add_epi32(s0, _mm_srli_epi32(s0, 31)), 1);
+            s1 = _mm_srai_epi32(_mm_add_epi32(s1, _mm_srli_epi32(s1, 31)), 1);
+            _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(s0, s1));
+        }
+    }
+    if (i < len) {
+        pack_scalar(l + i, r + i, out + i * ((channels < 2) ? 1 : channels), len - i, channels);
+    }
+}
+
+static void sinc_sse2(float* out, int len, const float* src, const int* off, const uint16_t* phase, const float* table, int taps) {
+    for (int i = 0; i < len; ++i) {
+        const float* x = src + off[i];
+        const float* h = table + phase[i] * taps;
+        __m128 acc0 = _mm_mul_ps(_mm_loadu_ps(x), _mm_loadu_ps(h));
+        __m128 acc1 = _mm_mul_ps(_mm_loadu_ps(x + 4), _mm_loadu_ps(h + 4));
+        for (int j = 8; j < taps; j += 8) {
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + j), _mm_loadu_ps(h + j)));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + j + 4), _mm_loadu_ps(h + j + 4)));
+        }
+        acc0 = _mm_add_ps(acc0, acc1);
+        acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+        acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+        out[i] = _mm_cvtss_f32(acc0);
+    }
+}
+
+static const struct audiomixkern audiomixkern_sse2 = {
+    "SSE2",
+    addscaled_sse2,
+    lpfilt_sse2,
+    hpfilt_sse2,
+    pack_sse2,
+    sinc_sse2
+};
+
+#if defined(AUDIOMIX_USEAVX2)
+AUDIOMIX_AVX2FUNC static void addscaled_avx2(int* out, const float* in, int len, int v0, int v1) {
+    int i = 0;
+    float v = v0 / 32768.0f;
+    float dv = (float)(v1 - v0) / 32768.0f / len;
+    __m256 vv = _mm256_add_ps(
+        _mm256_set1_ps(v),
+        _mm256_mul_ps(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), _mm256_set1_ps(dv))
+    );
+    __m256 vstep = _mm256_set1_ps(dv * 8.0f);
+    for (; i + 8 <= len; i += 8) {
+        __m256i s = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(in + i), vv));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(out + i)), s));
+        vv = _mm256_add_ps(vv, vstep);
+    }
+    for (; i < len; ++i) {
+        out[i] += (int)(in[i] * (v + dv * i));
+    }
+}
+
+// the filters are bound by the dependency between groups and the pack runs once per buffer, so only the
+// accumulation gets wider
+static const struct audiomixkern audiomixkern_avx2 = {
+    "AVX2",
+    addscaled_avx2,
+    lpfilt_sse2,
+    hpfilt_sse2,
+    pack_sse2,
+    sinc_sse2
+};
+#endif
+
+#elif defined(AUDIOMIX_USENEON)
+
+static void addscaled_neon(int* out, const float* in, int len, int v0, int v1) {
+    int i = 0;
+    float v = v0 / 32768.0f;
+    float dv = (float)(v1 - v0) / 32768.0f / len;
+    static const float lanes[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float32x4_t vv = vmlaq_n_f32(vdupq_n_f32(v), vld1q_f32(lanes), dv);
+    float32x4_t vstep = vdupq_n_f32(dv * 4.0f);
+    for (; i + 4 <= len; i += 4) {
+        int32x4_t s = vcvtq_s32_f32(vmulq_f32(vld1q_f32(in + i), vv));
+        vst1q_s32(out + i, vaddq_s32(vld1q_s32(out + i), s));
+        vv = vaddq_f32(vv, vstep);
+    }
+    for (; i < len; ++i) {
+        out[i] += (int)(in[i] * (v + dv * i));
+    }
+}
+static inline float32x4_t onepole_neon(float32x4_t u, float32x4_t y, const struct onepolecoeffs* o) {
+    u = vaddq_f32(u, vdupq_n_f32(AUDIOMIX_DENORMFIX));
+    float32x4_t r = vmulq_f32(vld1q_f32(o->pw), y);
+    r = vmlaq_n_f32(r, vld1q_f32(o->c[0]), vgetq_lane_f32(u, 0));
+    r = vmlaq_n_f32(r, vld1q_f32(o->c[1]), vgetq_lane_f32(u, 1));
+    r = vmlaq_n_f32(r, vld1q_f32(o->c[2]), vgetq_lane_f32(u, 2));
+    r = vmlaq_n_f32(r, vld1q_f32(o->c[3]), vgetq_lane_f32(u, 3));
+    return r;
+}
+static void lpfilt_neon(float* buf, int len, float a, float* lastout) {
+    int i = 0;
+    if (len >= 4) {
+        struct onepolecoeffs o;
+        calcOnePoleCoeffs(&o, 1.0f - a, a);
+        float32x4_t y = vdupq_n_f32(*lastout);
+        for (; i + 4 <= len; i += 4) {
+            float32x4_t r = onepole_neon(vld1q_f32(buf + i), y, &o);
+            vst1q_f32(buf + i, r);
+            y = vdupq_n_f32(vgetq_lane_f32(r, 3));
+        }
+        *lastout = vgetq_lane_f32(y, 0);
+    }
+    if (i < len) lpfilt_scalar(buf + i, len - i, a, lastout);
+}
+static void hpfilt_neon(float* buf, int len, float h, float* lastin, float* lastout) {
+    int i = 0;
+    if (len >= 4) {
+        struct onepolecoeffs o;
+        calcOnePoleCoeffs(&o, h, h);
+        float32x4_t y = vdupq_n_f32(*lastout);
+        float32x4_t x1 = vdupq_n_f32(*lastin);
+        for (; i + 4 <= len; i += 4) {
+            float32x4_t x = vld1q_f32(buf + i);
+            float32x4_t xp = vextq_f32(x1, x, 3);
+            float32x4_t r = onepole_neon(vsubq_f32(x, xp), y, &o);
+            vst1q_f32(buf + i, r);
+            y = vdupq_n_f32(vgetq_lane_f32(r, 3));
+            x1 = x;
+        }
+        *lastout = vgetq_lane_f32(y, 0);
+        *lastin = vgetq_lane_f32(x1, 3);
+    }
+    if (i < len) hpfilt_scalar(buf + i, len - i, h, lastin, lastout);
+}
+static void pack_neon(const int* l, const int* r, int16_t* out, int len, int channels) {
+    int i = 0;
+    if (channels == 2) {
+        for (; i + 4 <= len; i += 4) {
+            int16x4x2_t o;
+            o.val[0] = vqmovn_s32(vld1q_s32(l + i));
+            o.val[1] = vqmovn_s32(vld1q_s32(r + i));
+            vst2_s16(out + i * 2, o);
+        }
+    } else if (channels < 2) {
+        for (; i + 4 <= len; i += 4) {
+            int32x4_t s = vaddq_s32(vld1q_s32(l + i), vld1q_s32(r + i));
+            s = vshrq_n_s32(vaddq_s32(s, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(s), 31))), 1);
+            vst1_s16(out + i, vqmovn_s32(s));
+        }
+    }
+    if (i < len) {
+        pack_scalar(l + i, r + i, out + i * ((channels < 2) ? 1 : channels), len - i, channels);
+    }
+}
+
+static void sinc_neon(float* out, int len, const float* src, const int* off, const uint16_t* phase, const float* table, int taps) {
+    for (int i = 0; i < len; ++i) {
+        const float* x = src + off[i];
+        const float* h = table + phase[i] * taps;
+        float32x4_t acc0 = vmulq_f32(vld1q_f32(x), vld1q_f32(h));
+        float32x4_t acc1 = vmulq_f32(vld1q_f32(x + 4), vld1q_f32(h + 4));
+        for (int j = 8; j < taps; j += 8) {
+            acc0 = vmlaq_f32(acc0, vld1q_f32(x + j), vld1q_f32(h + j));
+            acc1 = vmlaq_f32(acc1, vld1q_f32(x + j + 4), vld1q_f32(h + j + 4));
+        }
+        acc0 = vaddq_f32(acc0, acc1);
+        float32x2_t sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+        out[i] = vget_lane_f32(vpadd_f32(sum, sum), 0);
+    }
+}
+
+static const struct audiomixkern audiomixkern_neon = {
+    "NEON",
+    addscaled_neon,
+    lpfilt_neon,
+    hpfilt_neon,
+    pack_neon,
+    sinc_neon
+};
+
+#endif
+
+#define AUDIOMIX_RESAMPLE_ZC 16 // zero crossings on each side of the kernel
+#define AUDIOMIX_RESAMPLE_RES 256 // kernel table entries per zero crossing
+#define AUDIOMIX_RESAMPLE_MAXCH 8
+int16_t* audiomix_resample(const void* in, bool is8bit, int len, int channels, int infreq, int outfreq, int* outlen) {
+    if (len <= 0 || channels <= 0 || channels > AUDIOMIX_RESAMPLE_MAXCH || infreq <= 0 || outfreq <= 0) return NULL;
+    long olen = ((long long)len * outfreq + infreq - 1) / infreq;
+    int16_t* out = malloc(olen * channels * sizeof(*out));
+    if (!out) return NULL;
+    // Blackman windowed sinc, cut off a bit under the lower of the two Nyquist frequencies
+    int tlen = AUDIOMIX_RESAMPLE_ZC * AUDIOMIX_RESAMPLE_RES;
+    float* tab = malloc((tlen + 2) * sizeof(*tab));
+    if (!tab) {
+        free(out);
+        return NULL;
+    }
+    for (int i = 0; i <= tlen; ++i) {
+        double x = (double)i / AUDIOMIX_RESAMPLE_RES;
+        double sinc = (i) ? sin(M_PI * x) / (M_PI * x) : 1.0;
+        double w = x / AUDIOMIX_RESAMPLE_ZC;
+        tab[i] = sinc * (0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2.0 * M_PI * w));
+    }
+    tab[tlen + 1] = 0.0f;
+    float fc = ((outfreq < infreq) ? (float)outfreq / infreq : 1.0f) * 0.95f;
+    double reach = AUDIOMIX_RESAMPLE_ZC / fc;
+    const uint8_t* in8 = in;
+    const int16_t* in16 = in;
+    for (long j = 0; j < olen; ++j) {
+        double t = (double)j * infreq / outfreq;
+        long first = ceil(t - reach);
+        long last = floor(t + reach);
+        if (first < 0) first = 0;
+        if (last > len - 1) last = len - 1;
+        float acc[AUDIOMIX_RESAMPLE_MAXCH] = {0};
+        for (long n = first; n <= last; ++n) {
+            float x = fabsf((float)(t - n)) * fc * AUDIOMIX_RESAMPLE_RES;
+            int xi = x;
+            if (xi >= tlen) continue;
+            float h = tab[xi] + (tab[xi + 1] - tab[xi]) * (x - xi);
+            if (is8bit) {
+                for (int c = 0; c < channels; ++c) {
+                    int v = in8[n * channels + c] - 128;
+                    acc[c] += (v * 256 + (v + 128)) * h;
+                }
+            } else {
+                for (int c = 0; c < channels; ++c) {
+                    acc[c] += in16[n * channels + c] * h;
+                }
+            }
+        }
+        for (int c = 0; c < channels; ++c) {
+            out[j * channels + c] = clamps16(lrintf(acc[c] * fc));
+        }
+    }
+    free(tab);
+    *outlen = olen;
+    return out;
+}
+
+struct audiomixsinc audiomixsinc;
+
+// the highest step each band is meant for, anything faster uses the last one and aliases a bit
+static const float sincbandstep[AUDIOMIX_SINC_BANDS] = {1.0f, 1.5f, 2.0f, 3.0f};
+
+int audiomix_sincband(float step) {
+    for (int i = 0; i < AUDIOMIX_SINC_BANDS - 1; ++i) {
+        if (step <= sincbandstep[i]) return i;
+    }
+    return AUDIOMIX_SINC_BANDS - 1;
+}
+
+long audiomix_sincwindow(int* off, int len, int taps, long* start) {
+    int minpos = off[0], maxpos = off[0];
+    for (int i = 1; i < len; ++i) {
+        if (off[i] < minpos) minpos = off[i];
+        else if (off[i] > maxpos) maxpos = off[i];
+    }
+    // tap 0 is on the sample taps / 2 - 1 before the position, so that is where the window starts and off[i] = 0
+    // for the lowest position reads up to taps - 1 past it
+    for (int i = 0; i < len; ++i) {
+        off[i] -= minpos;
+    }
+    *start = (long)minpos - (taps / 2 - 1);
+    return (long)maxpos - minpos + taps;
+}
+
+bool setAudioMixSinc(int taps) {
+    for (int b = 0; b < AUDIOMIX_SINC_BANDS; ++b) {
+        free(audiomixsinc.table[b]);
+        audiomixsinc.table[b] = NULL;
+    }
+    audiomixsinc.taps = 0;
+    if (taps <= 0) return true;
+    taps = (taps + 7) / 8 * 8;
+    for (int b = 0; b < AUDIOMIX_SINC_BANDS; ++b) {
+        float* t = malloc((AUDIOMIX_SINC_PHASES + 1) * taps * sizeof(*t));
+        if (!t) {
+            setAudioMixSinc(0);
+            return false;
+        }
+        audiomixsinc.table[b] = t;
+        // Blackman windowed sinc, normalized per phase so the gain does not ripple as the phase moves
+        double fc = 0.92 / (double)sincbandstep[b];
+        double hw = taps / 2.0;
+        for (int p = 0; p <= AUDIOMIX_SINC_PHASES; ++p, t += taps) {
+            double ph = (double)p / AUDIOMIX_SINC_PHASES;
+            float sum = 0.0f;
+            for (int j = 0; j < taps; ++j) {
+                double x = j - (hw - 1.0) - ph;
+                double sinc = (x != 0.0) ? sin(M_PI * fc * x) / (M_PI * fc * x) : 1.0;
+                double w = x / hw;
+                double h = (w > -1.0 && w < 1.0) ? sinc * (0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2.0 * M_PI * w)) : 0.0;
+                t[j] = h;
+                sum += t[j];
+            }
+            for (int j = 0; j < taps; ++j) {
+                t[j] /= sum;
+            }
+        }
+    }
+    audiomixsinc.taps = taps;
+    return true;
+}
+
+void setAudioMixKern(bool simd) {
+    audiomixkern = audiomixkern_scalar;
+    if (!simd) return;
+    #if defined(AUDIOMIX_USESSE2)
+    audiomixkern = audiomixkern_sse2;
+    #if defined(AUDIOMIX_USEAVX2)
+    if (SDL_HasAVX2()) audiomixkern = audiomixkern_avx2;
+    #endif
+    #elif defined(AUDIOMIX_USENEON)
+    audiomixkern = audiomixkern_neon;
+    #endif
+}
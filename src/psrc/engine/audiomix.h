@@ -0,0 +1,53 @@
+#ifndef PSRC_ENGINE_AUDIOMIX_H
+#define PSRC_ENGINE_AUDIOMIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Block kernels used by the mixer. Voices are first resampled into a float scratch buffer, then filtered and
+// accumulated into the int mix buffers with these.
+struct audiomixkern {
+    const char* name;
+    // out[i] += in[i] * vol / 32768, where vol ramps linearly from v0 at i = 0 towards v1 at i = len
+    void (*addscaled)(int* out, const float* in, int len, int v0, int v1);
+    // one-pole low-pass, y[n] = y[n - 1] + (x[n] - y[n - 1]) * a, in place
+    void (*lpfilt)(float* buf, int len, float a, float* lastout);
+    // one-pole high-pass, y[n] = (y[n - 1] + x[n] - x[n - 1]) * h, in place
+    void (*hpfilt)(float* buf, int len, float h, float* lastin, float* lastout);
+    // clamps to 16 bits and writes 'channels'-interleaved output (l and r are averaged if 'channels' is 1)
+    void (*pack)(const int* l, const int* r, int16_t* out, int len, int channels);
+    // out[i] = dot(src + off[i], table + phase[i] * taps), 'taps' is a multiple of 8
+    void (*sinc)(float* out, int len, const float* src, const int* off, const uint16_t* phase, const float* table, int taps);
+};
+
+extern struct audiomixkern audiomixkern;
+
+void setAudioMixKern(bool simd); // picks the fastest kernels the CPU supports, or the scalar ones
+// per-sample coefficient versions for when a voice's filter changes mid-buffer
+void audiomix_lpfilt_ramp(float* buf, int len, float a0, float a1, float* lastout);
+void audiomix_hpfilt_ramp(float* buf, int len, float h0, float h1, float* lastin, float* lastout);
+
+// Polyphase windowed sinc tables for resampling in the mixer. Each band is a table of AUDIOMIX_SINC_PHASES + 1 rows of
+// 'taps' coefficients, row p being the kernel for an output p / AUDIOMIX_SINC_PHASES of the way between two source
+// samples, with the first tap on the source sample taps / 2 - 1 before it. The bands are cut off lower for voices
+// that step through the source faster so speeding up does not alias.
+#define AUDIOMIX_SINC_PHASES 256
+#define AUDIOMIX_SINC_BANDS 4
+struct audiomixsinc {
+    int taps; // 0 if the mixer should interpolate linearly instead
+    float* table[AUDIOMIX_SINC_BANDS];
+};
+
+extern struct audiomixsinc audiomixsinc;
+
+bool setAudioMixSinc(int taps); // 0 frees the tables
+int audiomix_sincband(float step); // which band to use for a voice taking 'step' source samples per output sample
+// Turns the source positions in 'off' (relative to anything) into offsets into the window of source samples the
+// 'sinc' kernel reads, which starts 'start' (set) after what the positions are relative to and is the returned length.
+long audiomix_sincwindow(int* off, int len, int taps, long* start);
+
+// Band-limited (windowed sinc) resampling of a whole sound, meant for load time. 'in' is 'channels'-interleaved
+// unsigned 8-bit or 16-bit samples. Returns 16-bit samples and sets 'outlen', or returns NULL.
+int16_t* audiomix_resample(const void* in, bool is8bit, int len, int channels, int infreq, int outfreq, int* outlen);
+
+#endif
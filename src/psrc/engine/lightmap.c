@@ -0,0 +1,359 @@
+#include "../rcmgralloc.h"
+
+#include "lightmap.h"
+
+#include "../common/logging.h"
+
+#include "../common.h"
+#include "../debug.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef PSRC_NOSIMD
+    #if defined(__SSE2__) || defined(_M_AMD64) || defined(_M_X64)
+        #include <emmintrin.h>
+        #define LM_USESSE2
+    #elif defined(__ARM_NEON)
+        #include <arm_neon.h>
+        #define LM_USENEON
+    #endif
+#endif
+
+struct lmstate lmstate;
+
+// dst += src * (scale + 1) / 256 or dst -= ..., n is in bytes
+static void addLuxels(uint16_t* dst, const uint8_t* src, unsigned n, uint8_t scale, bool sub) {
+    unsigned i = 0;
+    uint16_t m = (uint16_t)scale + 1;
+    #if defined(LM_USESSE2)
+    __m128i z = _mm_setzero_si128();
+    __m128i vm = _mm_set1_epi16(m);
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, z), vm), 8);
+        __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, z), vm), 8);
+        __m128i d0 = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i d1 = _mm_loadu_si128((const __m128i*)(dst + i + 8));
+        if (sub) {
+            d0 = _mm_sub_epi16(d0, lo);
+            d1 = _mm_sub_epi16(d1, hi);
+        } else {
+            d0 = _mm_add_epi16(d0, lo);
+            d1 = _mm_add_epi16(d1, hi);
+        }
+        _mm_storeu_si128((__m128i*)(dst + i), d0);
+        _mm_storeu_si128((__m128i*)(dst + i + 8), d1);
+    }
+    #elif defined(LM_USENEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint16x8_t lo = vshrq_n_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(s)), m), 8);
+        uint16x8_t hi = vshrq_n_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(s)), m), 8);
+        uint16x8_t d0 = vld1q_u16(dst + i);
+        uint16x8_t d1 = vld1q_u16(dst + i + 8);
+        if (sub) {
+            d0 = vsubq_u16(d0, lo);
+            d1 = vsubq_u16(d1, hi);
+        } else {
+            d0 = vaddq_u16(d0, lo);
+            d1 = vaddq_u16(d1, hi);
+        }
+        vst1q_u16(dst + i, d0);
+        vst1q_u16(dst + i + 8, d1);
+    }
+    #endif
+    for (; i < n; ++i) {
+        uint16_t v = (uint16_t)((src[i] * m) >> 8);
+        if (sub) dst[i] -= v;
+        else dst[i] += v;
+    }
+}
+
+static void clampLuxels(uint8_t* dst, const uint16_t* src, unsigned n) {
+    unsigned i = 0;
+    #if defined(LM_USESSE2)
+    __m128i c = _mm_set1_epi16(255);
+    for (; i + 16 <= n; i += 16) {
+        __m128i s0 = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        // unsigned min(x, 255) since packus is signed
+        s0 = _mm_sub_epi16(s0, _mm_subs_epu16(s0, c));
+        s1 = _mm_sub_epi16(s1, _mm_subs_epu16(s1, c));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(s0, s1));
+    }
+    #elif defined(LM_USENEON)
+    for (; i + 16 <= n; i += 16) {
+        uint8x8_t lo = vqmovn_u16(vld1q_u16(src + i));
+        uint8x8_t hi = vqmovn_u16(vld1q_u16(src + i + 8));
+        vst1q_u8(dst + i, vcombine_u8(lo, hi));
+    }
+    #endif
+    for (; i < n; ++i) {
+        dst[i] = (src[i] > 255) ? 255 : src[i];
+    }
+}
+
+static void markAllDirty(struct lm_atlas* a) {
+    a->dirty.len = 1;
+    a->dirty.data[0].x = 0;
+    a->dirty.data[0].y = 0;
+    a->dirty.data[0].w = LM_ATLAS_SIZE;
+    a->dirty.data[0].h = LM_ATLAS_SIZE;
+}
+
+static void markDirty(struct lm_atlas* a, unsigned x, unsigned y, unsigned w, unsigned h) {
+    for (uintptr_t i = 0; i < a->dirty.len; ++i) {
+        struct lm_rect* r = &a->dirty.data[i];
+        if (x + w < r->x || r->x + r->w < x || y + h < r->y || r->y + r->h < y) continue;
+        // touching or overlapping, grow the existing rect
+        unsigned x1 = (x + w > (unsigned)r->x + r->w) ? x + w : (unsigned)r->x + r->w;
+        unsigned y1 = (y + h > (unsigned)r->y + r->h) ? y + h : (unsigned)r->y + r->h;
+        if (x < r->x) r->x = x;
+        if (y < r->y) r->y = y;
+        r->w = x1 - r->x;
+        r->h = y1 - r->y;
+        return;
+    }
+    struct lm_rect r = {x, y, w, h};
+    // if the rect can't be tracked, upload the whole atlas
+    VLB_ADD(a->dirty, r, 3, 2, a->dirty.size = a->dirty.len; markAllDirty(a); return;);
+}
+
+static void applyLight(struct vis_sector* s, struct vis_light* l, uint8_t intensity, bool sub) {
+    if (s->lmatlas < 0 || !intensity) return;
+    struct lm_atlas* a = &lmstate.atlases[s->lmatlas];
+    for (unsigned i = 0; i < l->lightmapcount; ++i) {
+        struct vis_lightdata* d = &l->lightmaps[i];
+        if (d->lightmap >= s->lightmapcount || d->maxx < d->minx) continue;
+        struct vis_lightmap* lm = &s->lightmaps[d->lightmap];
+        unsigned size = 1 << lm->sizelog;
+        unsigned w = d->maxx - d->minx + 1;
+        unsigned x = lm->x + d->minx;
+        for (unsigned y = d->miny; y <= d->maxy; ++y) {
+            size_t o = ((size_t)(lm->y + y) * LM_ATLAS_SIZE + x) * 3;
+            addLuxels(&a->accum[o], &d->data[(y * size + d->minx) * 3], w * 3, intensity, sub);
+            clampLuxels(&a->data[o], &a->accum[o], w * 3);
+        }
+        markDirty(a, x, lm->y + d->miny, w, d->maxy - d->miny + 1);
+    }
+}
+
+static void calcLightBounds(struct vis_sector* s, struct vis_light* l) {
+    for (unsigned i = 0; i < l->lightmapcount; ++i) {
+        struct vis_lightdata* d = &l->lightmaps[i];
+        d->minx = d->miny = UINT16_MAX;
+        d->maxx = d->maxy = 0;
+        if (d->lightmap >= s->lightmapcount || !d->data) continue;
+        unsigned size = 1 << s->lightmaps[d->lightmap].sizelog;
+        const uint8_t* p = d->data;
+        for (unsigned y = 0; y < size; ++y) {
+            for (unsigned x = 0; x < size; ++x, p += 3) {
+                if (!(p[0] | p[1] | p[2])) continue;
+                if (x < d->minx) d->minx = x;
+                if (x > d->maxx) d->maxx = x;
+                if (y < d->miny) d->miny = y;
+                if (y > d->maxy) d->maxy = y;
+            }
+        }
+    }
+}
+
+static bool newAtlas(void) {
+    struct lm_atlas* tmp = realloc(lmstate.atlases, (lmstate.atlascount + 1) * sizeof(*tmp));
+    if (!tmp) return false;
+    lmstate.atlases = tmp;
+    struct lm_atlas* a = &tmp[lmstate.atlascount];
+    a->accum = calloc((size_t)LM_ATLAS_SIZE * LM_ATLAS_SIZE * 3, sizeof(*a->accum));
+    a->data = calloc((size_t)LM_ATLAS_SIZE * LM_ATLAS_SIZE * 3, 1);
+    if (!a->accum || !a->data) {
+        free(a->accum);
+        free(a->data);
+        return false;
+    }
+    VLB_INIT(a->dirty, 16, free(a->accum); free(a->data); return false;);
+    a->shelfcount = 0;
+    a->nexty = 0;
+    ++lmstate.atlascount;
+    return true;
+}
+
+static bool packLightmap(struct lm_atlas* a, unsigned size, uint16_t* ox, uint16_t* oy) {
+    int best = -1;
+    for (int i = 0; i < a->shelfcount; ++i) {
+        if (a->shelves[i].h < size || a->shelves[i].x + size > LM_ATLAS_SIZE) continue;
+        if (best < 0 || a->shelves[i].h < a->shelves[best].h) best = i;
+    }
+    if (best < 0) {
+        if (a->nexty + size > LM_ATLAS_SIZE) return false;
+        best = a->shelfcount++;
+        a->shelves[best].y = a->nexty;
+        a->shelves[best].h = size;
+        a->shelves[best].x = 0;
+        a->nexty += size;
+    }
+    *ox = a->shelves[best].x;
+    *oy = a->shelves[best].y;
+    a->shelves[best].x += size;
+    return true;
+}
+
+// all of a sector's lightmaps go into one atlas so the renderer only binds one texture per sector
+static bool packSector(struct lm_atlas* a, struct vis_sector* s) {
+    uint16_t shelfcount = a->shelfcount, nexty = a->nexty;
+    uint16_t shelfx[LM_ATLAS_SIZE];
+    for (unsigned i = 0; i < shelfcount; ++i) shelfx[i] = a->shelves[i].x;
+    uint8_t order[256];
+    unsigned ct = s->lightmapcount;
+    for (unsigned i = 0; i < ct; ++i) {
+        unsigned j = i;
+        for (; j > 0 && s->lightmaps[order[j - 1]].sizelog < s->lightmaps[i].sizelog; --j) order[j] = order[j - 1];
+        order[j] = i;
+    }
+    for (unsigned i = 0; i < ct; ++i) {
+        struct vis_lightmap* lm = &s->lightmaps[order[i]];
+        if (!packLightmap(a, 1 << lm->sizelog, &lm->x, &lm->y)) {
+            a->shelfcount = shelfcount;
+            a->nexty = nexty;
+            for (unsigned j = 0; j < shelfcount; ++j) a->shelves[j].x = shelfx[j];
+            return false;
+        }
+    }
+    return true;
+}
+
+static int cmpLightRef(const void* a, const void* b) {
+    uint32_t ia = ((const struct lm_lightref*)a)->id, ib = ((const struct lm_lightref*)b)->id;
+    return (ia > ib) - (ia < ib);
+}
+
+static void freeAtlases(void) {
+    for (int i = 0; i < lmstate.atlascount; ++i) {
+        free(lmstate.atlases[i].accum);
+        free(lmstate.atlases[i].data);
+        VLB_FREE(lmstate.atlases[i].dirty);
+    }
+    free(lmstate.atlases);
+    lmstate.atlases = NULL;
+    lmstate.atlascount = 0;
+    free(lmstate.lights);
+    lmstate.lights = NULL;
+    lmstate.lightcount = 0;
+}
+
+bool setLightmapLevel(struct vis_level* l) {
+    freeAtlases();
+    ++lmstate.gen;
+    lmstate.level = l;
+    if (!l) return true;
+    uint32_t sectct = (uint32_t)l->sizex * l->sizey * l->sizez;
+    uint32_t lightct = 0;
+    for (uint32_t i = 0; i < sectct; ++i) {
+        struct vis_sector* s = &l->sectors[i];
+        s->lmatlas = -1;
+        if (!s->lightmapcount) continue;
+        if (!lmstate.atlascount || !packSector(&lmstate.atlases[lmstate.atlascount - 1], s)) {
+            if (!newAtlas()) {
+                plog(LL_ERROR | LF_FUNC, LE_MEMALLOC);
+                freeAtlases();
+                return false;
+            }
+            if (!packSector(&lmstate.atlases[lmstate.atlascount - 1], s)) {
+                plog(LL_WARN | LF_FUNC, "Lightmaps of sector %u do not fit in a %dx%d atlas", (unsigned)i, LM_ATLAS_SIZE, LM_ATLAS_SIZE);
+                continue;
+            }
+        }
+        s->lmatlas = lmstate.atlascount - 1;
+        struct lm_atlas* a = &lmstate.atlases[s->lmatlas];
+        for (unsigned j = 0; j < s->lightmapcount; ++j) {
+            struct vis_lightmap* lm = &s->lightmaps[j];
+            unsigned size = 1 << lm->sizelog;
+            for (unsigned y = 0; y < size; ++y) {
+                size_t o = ((size_t)(lm->y + y) * LM_ATLAS_SIZE + lm->x) * 3;
+                const uint8_t* p = &lm->data[y * size * 3];
+                for (unsigned x = 0; x < size * 3; ++x) a->accum[o + x] = p[x];
+            }
+        }
+        for (unsigned j = 0; j < s->dynlightcount; ++j) {
+            calcLightBounds(s, &s->dynlights[j]);
+            s->dynlights[j].intensity = 255;
+            s->dynlights[j].applied = (s->dynlights[j].enabled) ? 255 : 0;
+            applyLight(s, &s->dynlights[j], s->dynlights[j].applied, false);
+        }
+        for (unsigned j = 0; j < s->fastlightcount; ++j) {
+            calcLightBounds(s, &s->fastlights[j]);
+            s->fastlights[j].applied = (s->fastlights[j].enabled) ? s->fastlights[j].intensity : 0;
+            applyLight(s, &s->fastlights[j], s->fastlights[j].applied, false);
+        }
+        lightct += s->dynlightcount + s->fastlightcount;
+    }
+    for (int i = 0; i < lmstate.atlascount; ++i) {
+        struct lm_atlas* a = &lmstate.atlases[i];
+        clampLuxels(a->data, a->accum, LM_ATLAS_SIZE * LM_ATLAS_SIZE * 3);
+        // the renderer uploads everything when 'gen' changes
+        a->dirty.len = 0;
+    }
+    if (lightct) {
+        lmstate.lights = malloc(lightct * sizeof(*lmstate.lights));
+        if (!lmstate.lights) {
+            plog(LL_ERROR | LF_FUNC, LE_MEMALLOC);
+            freeAtlases();
+            return false;
+        }
+        for (uint32_t i = 0; i < sectct; ++i) {
+            struct vis_sector* s = &l->sectors[i];
+            if (s->lmatlas < 0) continue;
+            for (unsigned j = 0; j < s->dynlightcount; ++j) {
+                lmstate.lights[lmstate.lightcount++] = (struct lm_lightref){s->dynlights[j].id, s, &s->dynlights[j], 0};
+            }
+            for (unsigned j = 0; j < s->fastlightcount; ++j) {
+                lmstate.lights[lmstate.lightcount++] = (struct lm_lightref){s->fastlights[j].id, s, &s->fastlights[j], 1};
+            }
+        }
+        qsort(lmstate.lights, lmstate.lightcount, sizeof(*lmstate.lights), cmpLightRef);
+    }
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG, "Packed lightmaps into %d atlas(es) with %u light(s)", lmstate.atlascount, (unsigned)lmstate.lightcount);
+    #endif
+    return true;
+}
+
+static struct lm_lightref* findLight(uint32_t id) {
+    uint32_t lo = 0, hi = lmstate.lightcount;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (lmstate.lights[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < lmstate.lightcount && lmstate.lights[lo].id == id) ? &lmstate.lights[lo] : NULL;
+}
+
+static void updLights(uint32_t id, bool fast, bool enabled, int intensity) {
+    struct lm_lightref* r = findLight(id);
+    if (!r) return;
+    // a light that spans sectors has an entry in each one
+    for (struct lm_lightref* e = &lmstate.lights[lmstate.lightcount]; r < e && r->id == id; ++r) {
+        if (r->fast != fast) continue;
+        struct vis_light* l = r->light;
+        l->enabled = enabled;
+        if (intensity >= 0) l->intensity = intensity;
+        uint8_t target = (l->enabled) ? l->intensity : 0;
+        if (target == l->applied) continue;
+        applyLight(r->sector, l, l->applied, true);
+        applyLight(r->sector, l, target, false);
+        l->applied = target;
+    }
+}
+
+void setDynLight(uint32_t id, bool enabled) {
+    updLights(id, false, enabled, -1);
+}
+
+void setFastLight(uint32_t id, bool enabled, int intensity) {
+    updLights(id, true, enabled, (intensity > 255) ? 255 : intensity);
+}
+
+void quitLightmaps(void) {
+    freeAtlases();
+    lmstate.level = NULL;
+}
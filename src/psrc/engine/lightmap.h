@@ -0,0 +1,51 @@
+#ifndef PSRC_ENGINE_LIGHTMAP_H
+#define PSRC_ENGINE_LIGHTMAP_H
+
+#include "vis.h"
+
+#include "../common/vlb.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LM_ATLAS_SIZE 1024
+
+struct lm_rect {
+    uint16_t x, y, w, h;
+};
+
+struct lm_atlas {
+    uint16_t* accum; // RGB, baked light plus every applied light, wraps instead of saturating so lights can be removed exactly
+    uint8_t* data; // RGB, accum clamped to 255
+    struct VLB(struct lm_rect) dirty; // rects in 'data' changed since the renderer last uploaded
+    uint16_t shelfcount;
+    uint16_t nexty;
+    struct {
+        uint16_t y, h, x;
+    } shelves[LM_ATLAS_SIZE];
+};
+
+struct lm_lightref {
+    uint32_t id;
+    struct vis_sector* sector;
+    struct vis_light* light;
+    uint8_t fast : 1;
+};
+
+struct lmstate {
+    struct vis_level* level;
+    struct lm_atlas* atlases;
+    int atlascount;
+    struct lm_lightref* lights; // sorted by ID
+    uint32_t lightcount;
+    uint32_t gen; // changes when the atlases are rebuilt
+};
+
+extern struct lmstate lmstate;
+
+bool setLightmapLevel(struct vis_level*);
+void setDynLight(uint32_t id, bool enabled);
+void setFastLight(uint32_t id, bool enabled, int intensity); // intensity < 0 keeps the current intensity
+void quitLightmaps(void);
+
+#endif
@@ -0,0 +1,373 @@
+#include "../rcmgralloc.h"
+
+#include "ptmplay.h"
+#include "audiomix.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static void glide_set(struct ptmplay_glide* g, float v) {
+    g->cur = v;
+    g->target = v;
+    g->rate = 0.0f;
+}
+static void glide_to(struct ptmplay_glide* g, float v, unsigned notes) {
+    if (!notes) {
+        glide_set(g, v);
+        return;
+    }
+    g->target = v;
+    g->rate = fabsf(v - g->cur) / notes;
+}
+static void glide_step(struct ptmplay_glide* g, float notes) {
+    if (g->cur < g->target) {
+        g->cur += g->rate * notes;
+        if (g->cur > g->target) g->cur = g->target;
+    } else if (g->cur > g->target) {
+        g->cur -= g->rate * notes;
+        if (g->cur < g->target) g->cur = g->target;
+    }
+}
+
+static inline bool trackenabled(struct ptmplay* p, unsigned t) {
+    return p->ptm->tracks[t].enabled && (p->trackmask[t / 8] & (1 << (t % 8)));
+}
+static void settrack(struct ptmplay* p, unsigned t, int op) {
+    unsigned start, end;
+    if (t == PTM_ALL) {
+        start = 0;
+        end = p->ptm->trackcount;
+    } else {
+        if (t >= p->ptm->trackcount) return;
+        start = t;
+        end = t + 1;
+    }
+    for (unsigned i = start; i < end; ++i) {
+        uint8_t bit = 1 << (i % 8);
+        switch (op) {
+            case 0: p->trackmask[i / 8] &= ~bit; break;
+            case 1: p->trackmask[i / 8] |= bit; break;
+            default: p->trackmask[i / 8] ^= bit; break;
+        }
+    }
+}
+
+static void envlevel(const struct ptmplay_voice* v, float* out) {
+    if (v->reltime >= 0.0f) {
+        float f = (v->release > 0.0f) ? 1.0f - v->reltime / v->release : 0.0f;
+        if (f < 0.0f) f = 0.0f;
+        out[0] = v->rellevel[0] * f;
+        out[1] = v->rellevel[1] * f;
+    } else if (v->time < v->attack) {
+        out[0] = out[1] = v->time / v->attack;
+    } else if (v->time < v->attack + v->decay) {
+        float f = (v->time - v->attack) / v->decay;
+        out[0] = 1.0f + (v->sustain[0] - 1.0f) * f;
+        out[1] = 1.0f + (v->sustain[1] - 1.0f) * f;
+    } else {
+        out[0] = v->sustain[0];
+        out[1] = v->sustain[1];
+    }
+}
+static void releasevoice(struct ptmplay_voice* v) {
+    if (!v->sample || v->reltime >= 0.0f) return;
+    envlevel(v, v->rellevel);
+    v->reltime = 0.0f;
+}
+
+static void noteon(struct ptmplay* p, struct ptmplay_track* t, unsigned tn, int note) {
+    const struct ptm* m = p->ptm;
+    releasevoice(&t->voices[0]);
+    if (t->voices[0].sample) t->voices[1] = t->voices[0];
+    t->voices[0].sample = NULL;
+    glide_set(&t->pitch, note);
+    unsigned instr = t->instrument;
+    if (instr == PTM_ALL) instr = m->tracks[tn].instrument;
+    if (instr >= m->instrumentcount) return;
+    const struct ptm_instrument* in = &m->instruments[instr];
+    if (!in->samplecount) return;
+    const struct ptm_instrsample* is = in->samples;
+    for (unsigned i = 1; i < in->samplecount && is->minnote > note; ++i) ++is;
+    struct ptmplay_voice* v = &t->voices[0];
+    v->sample = &m->samples[is->sample];
+    if (!v->sample->len) {
+        v->sample = NULL;
+        return;
+    }
+    v->pos = 0;
+    v->frac = 0.0f;
+    v->pitch = note;
+    v->time = 0.0f;
+    v->reltime = -1.0f;
+    float d = (note - PTM_INFLUENCE_NOTE) / 12.0f;
+    v->attack = in->attack * exp2f(in->attackinfl * d);
+    v->decay = in->decay * exp2f(in->decayinfl * d);
+    v->sustain[0] = in->sustain[0] * exp2f(in->sustaininfl[0] * d);
+    v->sustain[1] = in->sustain[1] * exp2f(in->sustaininfl[1] * d);
+    v->release = in->release * exp2f(in->releaseinfl * d);
+}
+
+static void dolcmd(struct ptmplay_track* t, const struct ptm_lcmd* c) {
+    switch (c->type) {
+        case PTM_LCMD_VOL: glide_set(&t->vol[0], c->value); glide_set(&t->vol[1], c->value); break;
+        case PTM_LCMD_VOL_L: glide_set(&t->vol[0], c->value); break;
+        case PTM_LCMD_VOL_R: glide_set(&t->vol[1], c->value); break;
+        case PTM_LCMD_GLIDEVOL: {
+            glide_to(&t->vol[0], c->value, t->volglidespeed);
+            glide_to(&t->vol[1], c->value, t->volglidespeed);
+        } break;
+        case PTM_LCMD_GLIDEVOL_L: glide_to(&t->vol[0], c->value, t->volglidespeed); break;
+        case PTM_LCMD_GLIDEVOL_R: glide_to(&t->vol[1], c->value, t->volglidespeed); break;
+        case PTM_LCMD_VOLGLIDESPEED: t->volglidespeed = c->value; break;
+        case PTM_LCMD_PITCH: glide_set(&t->pitch, c->value); break;
+        case PTM_LCMD_GLIDEPITCH: glide_to(&t->pitch, c->value, t->pitchglidespeed); break;
+        case PTM_LCMD_PITCHGLIDESPEED: t->pitchglidespeed = c->value; break;
+        default: break;
+    }
+}
+static void dogcmd(struct ptmplay* p, const struct ptm_gcmd* c) {
+    switch (c->type) {
+        case PTM_GCMD_VOL: glide_set(&p->vol[0], c->value); glide_set(&p->vol[1], c->value); break;
+        case PTM_GCMD_VOL_L: glide_set(&p->vol[0], c->value); break;
+        case PTM_GCMD_VOL_R: glide_set(&p->vol[1], c->value); break;
+        case PTM_GCMD_GLIDEVOL: {
+            glide_to(&p->vol[0], c->value, p->volglidespeed);
+            glide_to(&p->vol[1], c->value, p->volglidespeed);
+        } break;
+        case PTM_GCMD_GLIDEVOL_L: glide_to(&p->vol[0], c->value, p->volglidespeed); break;
+        case PTM_GCMD_GLIDEVOL_R: glide_to(&p->vol[1], c->value, p->volglidespeed); break;
+        case PTM_GCMD_VOLGLIDESPEED: p->volglidespeed = c->value; break;
+        case PTM_GCMD_BPM: glide_set(&p->bpm, (c->value) ? c->value : 1); break;
+        case PTM_GCMD_GLIDEBPM: glide_to(&p->bpm, (c->value) ? c->value : 1, p->bpmglidespeed); break;
+        case PTM_GCMD_BPMGLIDESPEED: p->bpmglidespeed = c->value; break;
+        case PTM_GCMD_ENABLETRACK: settrack(p, c->value, 1); break;
+        case PTM_GCMD_DISABLETRACK: settrack(p, c->value, 0); break;
+        case PTM_GCMD_TOGGLETRACK: settrack(p, c->value, 2); break;
+        default: break;
+    }
+}
+
+static void startpattern(struct ptmplay* p) {
+    p->patpos = 0;
+    p->gcmd = 0;
+    p->gcmdleft = 0;
+    for (unsigned i = 0; i < p->ptm->trackcount; ++i) {
+        p->tracks[i].note = 0;
+        p->tracks[i].left = 0;
+    }
+}
+// runs the commands and notes that start on the current note
+static void tick(struct ptmplay* p) {
+    const struct ptm* m = p->ptm;
+    const struct ptm_pattern* pat = &m->patterns[m->sequence[p->seqindex]];
+    if (p->patpos == pat->duration) {
+        if (++p->seqindex == m->sequencelen) p->seqindex = m->loopindex;
+        pat = &m->patterns[m->sequence[p->seqindex]];
+        startpattern(p);
+    }
+    if (!p->gcmdleft && p->gcmd < pat->gcmdcount) {
+        const struct ptm_gcmd* c = &pat->gcmds[p->gcmd++];
+        dogcmd(p, c);
+        p->gcmdleft = c->duration;
+    }
+    if (p->gcmdleft) --p->gcmdleft;
+    for (unsigned i = 0; i < m->trackcount; ++i) {
+        struct ptmplay_track* t = &p->tracks[i];
+        const struct ptm_trackdata* td = &pat->tracks[i];
+        if (!t->left && t->note < td->notecount) {
+            const struct ptm_note* n = &td->notes[t->note++];
+            const struct ptm_lcmd* c = &td->lcmds[n->lcmd];
+            // the instrument has to be changed before the note starts, and everything else after
+            for (unsigned j = 0; j < n->lcmdcount; ++j) {
+                if (c[j].type == PTM_LCMD_INSTR) t->instrument = c[j].value;
+            }
+            if (n->note == PTM_NOTE_SILENCE) {
+                releasevoice(&t->voices[0]);
+            } else if (n->note >= 0) {
+                noteon(p, t, i, n->note);
+            }
+            for (unsigned j = 0; j < n->lcmdcount; ++j) {
+                dolcmd(t, &c[j]);
+            }
+            t->left = n->duration;
+        }
+        if (t->left) --t->left;
+    }
+    ++p->patpos;
+}
+
+// returns false once the voice has stopped
+static bool rendervoice(struct ptmplay* p, struct ptmplay_voice* v, int* outl, int* outr, int len, float dt, const float* g0, const float* g1) {
+    const struct ptm_sample* s = v->sample;
+    float step = s->rate * exp2f((v->pitch - s->note) / 12.0f) / p->freq;
+    bool loop = (s->loopend > s->loopstart);
+    uint32_t end = (loop) ? s->loopend : s->len;
+    uint32_t pos = v->pos;
+    float frac = v->frac;
+    bool ended = false;
+    int v0[2] = {g0[0] * 32768.0f, g0[1] * 32768.0f};
+    int v1[2] = {g1[0] * 32768.0f, g1[1] * 32768.0f};
+    if (v0[0] || v0[1] || v1[0] || v1[1]) {
+        const int16_t* data = s->data;
+        float* buf = p->buf;
+        int i = 0;
+        for (; i < len; ++i) {
+            if (pos >= end) {
+                if (!loop) {
+                    ended = true;
+                    break;
+                }
+                pos = s->loopstart + (pos - s->loopstart) % (end - s->loopstart);
+            }
+            uint32_t next = pos + 1;
+            if (next >= end) next = (loop) ? s->loopstart : pos;
+            buf[i] = data[pos] + (data[next] - data[pos]) * frac;
+            frac += step;
+            uint32_t whole = frac;
+            pos += whole;
+            frac -= whole;
+        }
+        for (; i < len; ++i) buf[i] = 0.0f;
+        audiomixkern.addscaled(outl, buf, len, v0[0], v1[0]);
+        audiomixkern.addscaled(outr, buf, len, v0[1], v1[1]);
+    } else {
+        // inaudible, so only keep the position moving
+        double adv = (double)frac + (double)step * len;
+        uint32_t whole = adv;
+        frac = adv - whole;
+        pos += whole;
+        if (pos >= end) {
+            if (loop) pos = s->loopstart + (pos - s->loopstart) % (end - s->loopstart);
+            else ended = true;
+        }
+    }
+    v->pos = pos;
+    v->frac = frac;
+    v->time += dt;
+    if (v->reltime >= 0.0f) {
+        v->reltime += dt;
+        if (v->reltime >= v->release) ended = true;
+    }
+    if (ended) {
+        v->sample = NULL;
+        return false;
+    }
+    return true;
+}
+
+void ptmplay_render(struct ptmplay* p, int* outl, int* outr, int len, float vol) {
+    const struct ptm* m = p->ptm;
+    if (!m->sequencelen) return;
+    float vol0 = p->lastvol;
+    float dvol = (vol - vol0) / len;
+    int done = 0;
+    while (done < len) {
+        int n = len - done;
+        if (n > PTMPLAY_BLOCK) n = PTMPLAY_BLOCK;
+        float notespersample = p->bpm.cur * p->bpmmul * m->notesperbeat / 60.0f / p->freq;
+        float untilf = ceilf((1.0f - p->notepos) / notespersample);
+        int until = (untilf < 1.0f) ? 1 : (untilf < PTMPLAY_BLOCK) ? (int)untilf : PTMPLAY_BLOCK + 1;
+        bool notedone = (until <= n);
+        if (notedone) n = until;
+        float dnotes = n * notespersample;
+        float dt = (float)n / p->freq;
+        float bvol0 = vol0 + dvol * done;
+        float bvol1 = vol0 + dvol * (done + n);
+        float gvol0[2], gvol1[2];
+        for (int c = 0; c < 2; ++c) {
+            gvol0[c] = p->vol[c].cur / 255.0f * p->volmul[c];
+            glide_step(&p->vol[c], dnotes);
+            gvol1[c] = p->vol[c].cur / 255.0f * p->volmul[c];
+        }
+        for (unsigned i = 0; i < m->trackcount; ++i) {
+            struct ptmplay_track* t = &p->tracks[i];
+            float on0 = t->on;
+            t->on = (trackenabled(p, i)) ? 1.0f : 0.0f;
+            float tvol0[2], tvol1[2];
+            for (int c = 0; c < 2; ++c) {
+                tvol0[c] = t->vol[c].cur / 255.0f * gvol0[c] * on0 * bvol0;
+                glide_step(&t->vol[c], dnotes);
+                tvol1[c] = t->vol[c].cur / 255.0f * gvol1[c] * t->on * bvol1;
+            }
+            glide_step(&t->pitch, dnotes);
+            if (t->voices[0].sample) t->voices[0].pitch = t->pitch.cur;
+            for (int vi = 0; vi < 2; ++vi) {
+                struct ptmplay_voice* v = &t->voices[vi];
+                if (!v->sample) continue;
+                float e0[2], e1[2];
+                envlevel(v, e0);
+                float time = v->time, reltime = v->reltime;
+                v->time += dt;
+                if (v->reltime >= 0.0f) v->reltime += dt;
+                envlevel(v, e1);
+                v->time = time;
+                v->reltime = reltime;
+                float g0[2] = {e0[0] * tvol0[0], e0[1] * tvol0[1]};
+                float g1[2] = {e1[0] * tvol1[0], e1[1] * tvol1[1]};
+                rendervoice(p, v, outl + done, outr + done, n, dt, g0, g1);
+            }
+        }
+        glide_step(&p->bpm, dnotes);
+        if (notedone) {
+            p->notepos += dnotes - 1.0f;
+            if (p->notepos < 0.0f) p->notepos = 0.0f;
+            else if (p->notepos >= 1.0f) p->notepos = 0.0f;
+            tick(p);
+        } else {
+            p->notepos += dnotes;
+        }
+        done += n;
+    }
+    p->lastvol = vol;
+}
+
+int ptmplay_findgroup(const struct ptm* m, const char* name) {
+    for (unsigned i = 0; i < m->groupcount; ++i) {
+        if (!strcmp(m->groups[i].name, name)) return i;
+    }
+    return -1;
+}
+
+void ptmplay_setgroup(struct ptmplay* p, int g) {
+    const struct ptm* m = p->ptm;
+    if (g < 0 || g >= m->groupcount) {
+        p->bpmmul = 1.0f;
+        p->volmul[0] = 1.0f;
+        p->volmul[1] = 1.0f;
+        memcpy(p->trackmask, m->trackmask, sizeof(p->trackmask));
+    } else {
+        const struct ptm_group* gr = &m->groups[g];
+        p->bpmmul = gr->bpmmul;
+        p->volmul[0] = gr->volmul[0];
+        p->volmul[1] = gr->volmul[1];
+        memcpy(p->trackmask, gr->trackmask, sizeof(p->trackmask));
+    }
+}
+
+bool ptmplay_init(struct ptmplay* p, const struct ptm* m, int freq) {
+    memset(p, 0, sizeof(*p));
+    p->ptm = m;
+    p->freq = freq;
+    if (m->trackcount && !(p->tracks = calloc(m->trackcount, sizeof(*p->tracks)))) return false;
+    for (unsigned i = 0; i < m->trackcount; ++i) {
+        struct ptmplay_track* t = &p->tracks[i];
+        glide_set(&t->vol[0], m->tracks[i].volume[0]);
+        glide_set(&t->vol[1], m->tracks[i].volume[1]);
+        t->instrument = PTM_ALL;
+    }
+    glide_set(&p->vol[0], 255.0f);
+    glide_set(&p->vol[1], 255.0f);
+    glide_set(&p->bpm, m->bpm);
+    ptmplay_setgroup(p, -1);
+    for (unsigned i = 0; i < m->trackcount; ++i) {
+        p->tracks[i].on = (trackenabled(p, i)) ? 1.0f : 0.0f;
+    }
+    if (m->sequencelen) tick(p);
+    return true;
+}
+
+void ptmplay_free(struct ptmplay* p) {
+    free(p->tracks);
+    p->tracks = NULL;
+}
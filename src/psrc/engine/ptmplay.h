@@ -0,0 +1,70 @@
+#ifndef PSRC_ENGINE_PTMPLAY_H
+#define PSRC_ENGINE_PTMPLAY_H
+
+#include "../common/ptm.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sequencer and synth for PTM music. Rendering is done in blocks of at most PTMPLAY_BLOCK samples, cut short at note
+// boundaries so commands take effect on time. Glides and envelopes are evaluated at the ends of each block and ramped
+// across it.
+#define PTMPLAY_BLOCK 64
+
+struct ptmplay_glide {
+    float cur;
+    float target;
+    float rate; // per note
+};
+
+struct ptmplay_voice {
+    const struct ptm_sample* sample; // NULL if not playing
+    uint32_t pos;
+    float frac;
+    float pitch; // in half steps from C0
+    float time; // seconds since the note started
+    float reltime; // seconds since the note was released, or negative if it is still held
+    float attack, decay, sustain[2], release; // with the note influence applied
+    float rellevel[2];
+};
+
+struct ptmplay_track {
+    struct ptmplay_voice voices[2]; // the held note and the last released one
+    struct ptmplay_glide vol[2];
+    struct ptmplay_glide pitch;
+    float on; // ramps between 0 and 1 when the track is disabled or enabled
+    uint16_t note; // next in the pattern track data
+    uint16_t left; // notes until the next note starts
+    uint8_t volglidespeed;
+    uint8_t pitchglidespeed;
+    uint8_t instrument;
+};
+
+struct ptmplay {
+    const struct ptm* ptm;
+    struct ptmplay_track* tracks;
+    struct ptmplay_glide vol[2];
+    struct ptmplay_glide bpm;
+    float bpmmul;
+    float volmul[2];
+    float lastvol;
+    float notepos; // how far into the current note, from 0 to 1
+    int freq;
+    uint16_t patpos; // notes into the pattern
+    uint16_t gcmdleft;
+    uint8_t trackmask[32];
+    uint8_t seqindex;
+    uint8_t gcmd;
+    uint8_t volglidespeed;
+    uint8_t bpmglidespeed;
+    float buf[PTMPLAY_BLOCK];
+};
+
+bool ptmplay_init(struct ptmplay*, const struct ptm*, int freq);
+void ptmplay_free(struct ptmplay*);
+int ptmplay_findgroup(const struct ptm*, const char*); // returns -1 if there is no group with that name
+void ptmplay_setgroup(struct ptmplay*, int); // -1 to go back to the song's own BPM, volume, and tracks
+// adds to 'outl' and 'outr' with the volume ramping from the last call's 'vol' to this one's
+void ptmplay_render(struct ptmplay*, int* outl, int* outr, int len, float vol);
+
+#endif
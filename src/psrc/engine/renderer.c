@@ -1,4 +1,6 @@
 #include "renderer.h"
+#include "vis.h"
+#include "lightmap.h"
 
 #include "../version.h"
 #include "../debug.h"
@@ -48,6 +50,70 @@ const char* const* rendapi_names[RENDAPI__COUNT] = {
 
 static struct rc_model* testmodel;
 
+#define MODELBATCH_MAXIDLE 60
+
+struct modelinst {
+    float mat[4][4]; // column-major model matrix
+};
+struct modelbatch {
+    struct rc_model* model;
+    float min[3], max[3]; // model space bounds
+    struct VLB(struct modelinst) insts; // queued for this frame, culled in place by cullModelBatch()
+    void* cache; // owned by the backend
+    unsigned idle; // frames in a row with nothing queued, culled instances still count as used
+    bool queued;
+};
+static struct VLB(struct modelbatch) modelbatches;
+
+static void cullModelBatch(struct modelbatch* b) {
+    uintptr_t o = 0;
+    for (uintptr_t i = 0; i < b->insts.len; ++i) {
+        float (*m)[4] = b->insts.data[i].mat;
+        float min[3], max[3];
+        // world space AABB of the transformed model space AABB
+        for (int r = 0; r < 3; ++r) {
+            min[r] = max[r] = m[3][r];
+            for (int c = 0; c < 3; ++c) {
+                float a = m[c][r] * b->min[c], d = m[c][r] * b->max[c];
+                if (a < d) {
+                    min[r] += a;
+                    max[r] += d;
+                } else {
+                    min[r] += d;
+                    max[r] += a;
+                }
+            }
+        }
+        if (!isVisBoxVisible(min, max)) continue;
+        if (o != i) b->insts.data[o] = b->insts.data[i];
+        ++o;
+    }
+    b->insts.len = o;
+}
+
+static void endModelBatches(void (*freecache)(void*)) {
+    for (uintptr_t i = 0; i < modelbatches.len; ++i) {
+        struct modelbatch* b = &modelbatches.data[i];
+        b->insts.len = 0;
+        if (b->queued) {
+            b->queued = false;
+            b->idle = 0;
+        } else if (++b->idle > MODELBATCH_MAXIDLE) {
+            if (b->cache && freecache) freecache(b->cache);
+            VLB_FREE(b->insts);
+            rlsRc(b->model, false);
+            modelbatches.data[i--] = modelbatches.data[--modelbatches.len];
+        }
+    }
+}
+
+static void freeModelBatchCaches(void (*freecache)(void*)) {
+    for (uintptr_t i = 0; i < modelbatches.len; ++i) {
+        if (modelbatches.data[i].cache && freecache) freecache(modelbatches.data[i].cache);
+        modelbatches.data[i].cache = NULL;
+    }
+}
+
 #ifdef PSRC_ENGINE_RENDERER_USESR
     #include "renderer/sw.c"
 #endif
@@ -63,6 +129,13 @@ static void* r_dummy_takeScreenshot(int* w, int* h, int* sz) {
     (void)w; (void)h; (void)sz;
     return NULL;
 }
+static bool r_dummy_requestScreenshot(void) {
+    return false;
+}
+static void* r_dummy_getScreenshot(int* w, int* h, int* ch) {
+    (void)w; (void)h; (void)ch;
+    return NULL;
+}
 #endif
 
 static enum rendapi trylist[] = {
@@ -92,6 +165,8 @@ static enum rendapi trylist[] = {
 void (*render)(void);
 void (*display)(void);
 void* (*takeScreenshot)(int* w, int* h, int* sz);
+bool (*requestScreenshot)(void);
+void* (*getScreenshot)(int* w, int* h, int* ch);
 static bool (*beforeCreateWindow)(unsigned*);
 static bool (*afterCreateWindow)(void);
 static bool (*prepRenderer)(void);
@@ -327,6 +402,8 @@ static bool startRenderer_internal(void) {
             //render = r_sw_render;
             //display = r_sw_display;
             //takeScreenshot = r_sw_takeScreenshot;
+            //requestScreenshot = r_sw_requestScreenshot;
+            //getScreenshot = r_sw_getScreenshot;
             //beforeCreateWindow = r_sw_beforeCreateWindow;
             //afterCreateWindow = r_sw_afterCreateWindow;
             //prepRenderer = r_sw_prepRenderer;
@@ -350,6 +427,8 @@ static bool startRenderer_internal(void) {
             render = r_gl_render;
             display = r_gl_display;
             takeScreenshot = r_gl_takeScreenshot;
+            requestScreenshot = r_gl_requestScreenshot;
+            getScreenshot = r_gl_getScreenshot;
             beforeCreateWindow = r_gl_beforeCreateWindow;
             afterCreateWindow = r_gl_afterCreateWindow;
             prepRenderer = r_gl_prepRenderer;
@@ -366,6 +445,8 @@ static bool startRenderer_internal(void) {
             //render = r_xgu_render;
             //display = r_xgu_display;
             takeScreenshot = r_dummy_takeScreenshot;
+            requestScreenshot = r_dummy_requestScreenshot;
+            getScreenshot = r_dummy_getScreenshot;
             //beforeCreateWindow = r_xgu_beforeCreateWindow;
             //afterCreateWindow = r_xgu_afterCreateWindow;
             //prepRenderer = r_xgu_prepRenderer;
@@ -614,11 +695,135 @@ bool initRenderer(void) {
     } else {
         rendstate.fov = 90.0f;
     }
+    tmp = cfg_getvar(&config, "Renderer", "dynres");
+    rendstate.dynres.enabled = strbool(tmp, false);
+    free(tmp);
+    rendstate.dynres.min = 0.5f;
+    rendstate.dynres.max = 1.0f;
+    tmp = cfg_getvar(&config, "Renderer", "dynres.min");
+    if (tmp) {
+        rendstate.dynres.min = atof(tmp);
+        free(tmp);
+    }
+    tmp = cfg_getvar(&config, "Renderer", "dynres.max");
+    if (tmp) {
+        rendstate.dynres.max = atof(tmp);
+        free(tmp);
+    }
+    if (rendstate.dynres.max > 1.0f) rendstate.dynres.max = 1.0f;
+    if (rendstate.dynres.min < 0.1f) rendstate.dynres.min = 0.1f;
+    if (rendstate.dynres.min > rendstate.dynres.max) rendstate.dynres.min = rendstate.dynres.max;
+    {
+        float fps = 60.0f;
+        tmp = cfg_getvar(&config, "Renderer", "dynres.fps");
+        if (tmp) {
+            fps = atof(tmp);
+            free(tmp);
+        }
+        if (fps < 1.0f) fps = 1.0f;
+        rendstate.dynres.budget = 1000000.0f / fps;
+    }
+    rendstate.dynres.scale = rendstate.dynres.max;
+    rendstate.dynres.avg = rendstate.dynres.budget;
+    if (!initVis()) return false;
+    VLB_INIT(modelbatches, 16, plog(LL_CRIT | LF_FUNC, LE_MEMALLOC); return false;);
     testmodel = getRc(RC_MODEL, "game:test/test_model", NULL, 0, NULL);
     return true;
 }
 
+void updateDynRes(uint64_t worktime) {
+    if (!rendstate.dynres.enabled) return;
+    // 1/8 exponential moving average so single hitches don't cause a resize
+    rendstate.dynres.avg = (rendstate.dynres.avg * 7 + worktime) / 8;
+    if (rendstate.dynres.cooldown > 0) {
+        --rendstate.dynres.cooldown;
+        return;
+    }
+    float scale = rendstate.dynres.scale;
+    uint64_t avg = rendstate.dynres.avg, budget = rendstate.dynres.budget;
+    if (avg > budget + budget / 20) {
+        // cost goes with pixel count, so scale by the square root of the overshoot
+        float s = sqrtf((float)budget / (float)avg);
+        if (s < 0.85f) s = 0.85f;
+        scale *= s;
+    } else if (avg < budget - budget / 5) {
+        scale += 0.05f;
+    } else {
+        return;
+    }
+    if (scale < rendstate.dynres.min) scale = rendstate.dynres.min;
+    else if (scale > rendstate.dynres.max) scale = rendstate.dynres.max;
+    scale = roundf(scale * 64.0f) / 64.0f;
+    if (scale == rendstate.dynres.scale) return;
+    rendstate.dynres.scale = scale;
+    rendstate.dynres.cooldown = 8;
+    #if DEBUG(2)
+    plog(LL_INFO | LF_DEBUG, "Dynamic resolution scale: %.3f (avg frame time: %.3fms)", scale, avg / 1000.0);
+    #endif
+}
+
+void addRendModel(struct rc_model* m, const float pos[3], const float rot[3], float scale) {
+    struct modelbatch* b = NULL;
+    for (uintptr_t i = 0; i < modelbatches.len; ++i) {
+        if (modelbatches.data[i].model == m) {
+            b = &modelbatches.data[i];
+            break;
+        }
+    }
+    if (!b) {
+        VLB_NEXTPTR(modelbatches, b, 3, 2, plog(LL_ERROR | LF_FUNC, LE_MEMALLOC); return;);
+        VLB_INIT(b->insts, 16, --modelbatches.len; plog(LL_ERROR | LF_FUNC, LE_MEMALLOC); return;);
+        lockRc(m);
+        b->model = m;
+        b->cache = NULL;
+        b->idle = 0;
+        b->queued = false;
+        b->min[0] = b->min[1] = b->min[2] = INFINITY;
+        b->max[0] = b->max[1] = b->max[2] = -INFINITY;
+        for (int p = 0; p < m->model.partcount; ++p) {
+            struct p3m_vertex* v = m->model.parts[p].vertices;
+            for (unsigned i = 0; i < m->model.parts[p].vertexcount; ++i, ++v) {
+                const float* f = &v->x;
+                for (int j = 0; j < 3; ++j) {
+                    if (f[j] < b->min[j]) b->min[j] = f[j];
+                    if (f[j] > b->max[j]) b->max[j] = f[j];
+                }
+            }
+        }
+    }
+    struct modelinst* inst;
+    VLB_NEXTPTR(b->insts, inst, 3, 2, plog(LL_ERROR | LF_FUNC, LE_MEMALLOC); return;);
+    b->queued = true;
+    float rx = rot[0] * (float)M_PI / 180.0f, ry = rot[1] * (float)M_PI / 180.0f, rz = rot[2] * (float)M_PI / 180.0f;
+    float sx = sinf(rx), cx = cosf(rx), sy = sinf(ry), cy = cosf(ry), sz = sinf(rz), cz = cosf(rz);
+    // Y * X * Z rotation, then scale
+    inst->mat[0][0] = (cy * cz + sy * sx * sz) * scale;
+    inst->mat[0][1] = (cx * sz) * scale;
+    inst->mat[0][2] = (-sy * cz + cy * sx * sz) * scale;
+    inst->mat[0][3] = 0.0f;
+    inst->mat[1][0] = (-cy * sz + sy * sx * cz) * scale;
+    inst->mat[1][1] = (cx * cz) * scale;
+    inst->mat[1][2] = (sy * sz + cy * sx * cz) * scale;
+    inst->mat[1][3] = 0.0f;
+    inst->mat[2][0] = (sy * cx) * scale;
+    inst->mat[2][1] = (-sx) * scale;
+    inst->mat[2][2] = (cy * cx) * scale;
+    inst->mat[2][3] = 0.0f;
+    inst->mat[3][0] = pos[0];
+    inst->mat[3][1] = pos[1];
+    inst->mat[3][2] = pos[2];
+    inst->mat[3][3] = 1.0f;
+}
+
 void quitRenderer(void) {
+    for (uintptr_t i = 0; i < modelbatches.len; ++i) {
+        VLB_FREE(modelbatches.data[i].insts);
+        rlsRc(modelbatches.data[i].model, false);
+    }
+    VLB_FREE(modelbatches);
+    modelbatches.len = 0;
     if (testmodel) rlsRc(testmodel, false);
+    quitLightmaps();
+    quitVis();
     free(rendstate.icon);
 }
@@ -86,6 +86,14 @@ struct rendstate {
     #endif
     enum rcopt_texture_qlt texqlt;
     enum rendlighting lighting;
+    struct {
+        uint8_t enabled : 1;
+        float scale; // 3D scene res relative to 'res.current'
+        float min, max;
+        uint64_t budget; // target frame time in microseconds
+        uint64_t avg; // smoothed frame work time
+        int cooldown;
+    } dynres;
     #if DEBUG(1)
     struct profile* dbgprof;
     #endif
@@ -113,10 +121,14 @@ void lockRendererConfig(void);
 void unlockRendererConfig(void);
 bool restartRenderer(void);
 void stopRenderer(void);
+void updateDynRes(uint64_t worktime); // time spent on the frame, not counting pacing or the swap
+void addRendModel(struct rc_model*, const float pos[3], const float rot[3], float scale); // queue for the next frame
 void quitRenderer(void);
 extern void (*render)(void);
 extern void (*display)(void);
 extern void* (*takeScreenshot)(int* w, int* h, int* sz);
+extern bool (*requestScreenshot)(void); // call between render() and display()
+extern void* (*getScreenshot)(int* w, int* h, int* ch); // bottom-up rows, NULL if none are ready yet
 
 extern const char* const* rendapi_names[RENDAPI__COUNT];
 
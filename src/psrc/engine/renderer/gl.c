@@ -84,6 +84,46 @@ static struct {
     float farplane;
     float projmat[4][4];
     float viewmat[4][4];
+    GLuint* lmtex; // one per lightmap atlas
+    int lmtexcount;
+    uint32_t lmgen;
+    struct {
+        uint8_t active : 1; // rendering the 3D scene below native res this frame
+        int w, h; // 3D viewport
+        int fullw, fullh; // res the targets below were made for
+        float lastscale;
+        #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+        GLuint tex; // copy target, power of 2
+        int texw, texh;
+        #endif
+        #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+        GLuint fbo;
+        GLuint rbo[2]; // color, depth
+        #endif
+    } dynres;
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    struct {
+        GLuint prog;
+        GLint u_vp;
+        GLint u_color;
+        GLint u_uvxform; // atlas offset in xy and scale in zw
+        GLuint vbo; // per-instance model matrices, shared by every model VAO
+        GLuint whitetex;
+    } inst;
+    #endif
+    struct {
+        uint8_t* ready; // read back and waiting to be handed out
+        int w, h, ch;
+        #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+        uint8_t next;
+        struct {
+            GLuint pbo;
+            GLsync fence; // NULL if the slot is free
+            int w, h;
+            size_t size;
+        } slots[2];
+        #endif
+    } sshot;
     union {
         #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
         struct {
@@ -113,6 +153,55 @@ static struct {
     }
 };
 
+#define R_GL_ATLAS_SIZE 512
+#define R_GL_ATLAS_MAXSUBSIZE 64
+#define R_GL_ATLAS_ALIGN 16
+
+#ifndef GL_CLAMP_TO_EDGE
+    #define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+#define R_GL_TEXFLAG_CLAMP (1 << 0) // does not need to repeat, can be packed into an atlas
+
+struct r_gl_atlas {
+    GLuint tex;
+    uint8_t* data; // RGBA mip chain, level 0 first
+    int shelfcount;
+    int nexty;
+    struct {
+        int y, h, x;
+    } shelves[R_GL_ATLAS_SIZE / R_GL_ATLAS_ALIGN];
+};
+
+struct r_gl_texture {
+    struct r_gl_texture* prev; // LRU list, head is the most recently drawn
+    struct r_gl_texture* next;
+    char* rcpath; // NULL if made from data
+    const uint8_t* data; // not owned
+    unsigned width, height;
+    uint8_t channels;
+    uint8_t flags;
+    uint8_t resident : 1;
+    enum rcopt_texture_qlt qlt;
+    GLuint tex;
+    int atlas; // -1 if not in an atlas
+    float uvoff[2];
+    float uvscale[2];
+    size_t vram;
+    uint32_t lastdrawn;
+};
+
+static struct {
+    struct r_gl_texture* head;
+    struct r_gl_texture* tail;
+    struct r_gl_atlas* atlases;
+    int atlascount;
+    size_t vram;
+    size_t budget;
+    uint32_t frame;
+    GLint maxsize;
+} r_gl_texmgr;
+
 static void r_gl_display(void) {
     #ifndef PSRC_USESDL1
     SDL_GL_SwapWindow(rendstate.window);
@@ -166,11 +255,176 @@ static inline void r_gl_calcViewMat(void) {
     r_gl_data.viewmat[3][2] = front[0] * rendstate.campos[0] + front[1] * rendstate.campos[1] + front[2] * rendstate.campos[2];
 }
 
+static void r_gl_updateVis(void) {
+    float clipmat[4][4];
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            clipmat[c][r] = r_gl_data.projmat[0][r] * r_gl_data.viewmat[c][0] +
+                            r_gl_data.projmat[1][r] * r_gl_data.viewmat[c][1] +
+                            r_gl_data.projmat[2][r] * r_gl_data.viewmat[c][2] +
+                            r_gl_data.projmat[3][r] * r_gl_data.viewmat[c][3];
+        }
+    }
+    updateVis(rendstate.campos, clipmat);
+}
+
 static void r_gl_updateFrame(void) {
     glViewport(0, 0, rendstate.res.current.width, rendstate.res.current.height);
     r_gl_calcProjMat();
 }
 
+static void r_gl_freedynres(void) {
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (r_gl_data.dynres.tex) glDeleteTextures(1, &r_gl_data.dynres.tex);
+    r_gl_data.dynres.tex = 0;
+    #endif
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    if (r_gl_data.dynres.fbo) {
+        glDeleteFramebuffers(1, &r_gl_data.dynres.fbo);
+        glDeleteRenderbuffers(2, r_gl_data.dynres.rbo);
+    }
+    r_gl_data.dynres.fbo = 0;
+    #endif
+    r_gl_data.dynres.fullw = 0;
+    r_gl_data.dynres.fullh = 0;
+}
+
+static bool r_gl_makedynres(int w, int h) {
+    r_gl_freedynres();
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api == RENDAPI_GL11) {
+        // no FBOs in 1.1, the scene is copied out of the back buffer instead
+        int tw = 1, th = 1;
+        while (tw < w) tw *= 2;
+        while (th < h) th *= 2;
+        if (tw > r_gl_texmgr.maxsize || th > r_gl_texmgr.maxsize) return false;
+        glGenTextures(1, &r_gl_data.dynres.tex);
+        glBindTexture(GL_TEXTURE_2D, r_gl_data.dynres.tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tw, th, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        r_gl_data.dynres.texw = tw;
+        r_gl_data.dynres.texh = th;
+    }
+    #endif
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api != RENDAPI_GL11)
+    #endif
+    {
+        // made at full res so changing the scale never reallocates
+        glGenFramebuffers(1, &r_gl_data.dynres.fbo);
+        glGenRenderbuffers(2, r_gl_data.dynres.rbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, r_gl_data.dynres.rbo[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+        glBindRenderbuffer(GL_RENDERBUFFER, r_gl_data.dynres.rbo[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, r_gl_data.dynres.fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, r_gl_data.dynres.rbo[0]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, r_gl_data.dynres.rbo[1]);
+        GLenum st = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (st != GL_FRAMEBUFFER_COMPLETE) {
+            r_gl_freedynres();
+            return false;
+        }
+    }
+    #endif
+    r_gl_data.dynres.fullw = w;
+    r_gl_data.dynres.fullh = h;
+    return true;
+}
+
+static void r_gl_begindynres(void) {
+    int fw = rendstate.res.current.width, fh = rendstate.res.current.height;
+    float scale = rendstate.dynres.scale;
+    r_gl_data.dynres.active = 0;
+    if (!rendstate.dynres.enabled || scale >= 1.0f) return;
+    if (r_gl_data.dynres.fullw != fw || r_gl_data.dynres.fullh != fh) {
+        if (!r_gl_makedynres(fw, fh)) {
+            plog(LL_WARN, "Could not create a render target for dynamic resolution, disabling");
+            rendstate.dynres.enabled = 0;
+            return;
+        }
+    }
+    int w = fw * scale + 0.5f, h = fh * scale + 0.5f;
+    if (w < 1) w = 1;
+    if (h < 1) h = 1;
+    r_gl_data.dynres.w = w;
+    r_gl_data.dynres.h = h;
+    r_gl_data.dynres.active = 1;
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    if (r_gl_data.dynres.fbo) glBindFramebuffer(GL_FRAMEBUFFER, r_gl_data.dynres.fbo);
+    #endif
+    glViewport(0, 0, w, h);
+    if (scale != r_gl_data.dynres.lastscale) {
+        // the newly exposed area has stale depth, 0.5 passes for both fast clear depth ranges
+        glClearDepth(0.5);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glClearDepth(1.0);
+        r_gl_data.dynres.lastscale = scale;
+    }
+}
+
+static void r_gl_enddynres(void) {
+    if (!r_gl_data.dynres.active) return;
+    int fw = rendstate.res.current.width, fh = rendstate.res.current.height;
+    int w = r_gl_data.dynres.w, h = r_gl_data.dynres.h;
+    r_gl_data.dynres.active = 0;
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    if (r_gl_data.dynres.fbo) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, r_gl_data.dynres.fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, fw, fh, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, fw, fh);
+        return;
+    }
+    #endif
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (!r_gl_data.dynres.tex) return;
+    glBindTexture(GL_TEXTURE_2D, r_gl_data.dynres.tex);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w, h);
+    glViewport(0, 0, fw, fh);
+    GLboolean depth = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND), cull = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glMatrixMode(GL_TEXTURE);
+    glLoadIdentity();
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glEnable(GL_TEXTURE_2D);
+    float u = (float)w / r_gl_data.dynres.texw, v = (float)h / r_gl_data.dynres.texh;
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glBegin(GL_QUADS);
+        glTexCoord2f(0.0f, 0.0f);
+        glVertex2f(-1.0f, -1.0f);
+        glTexCoord2f(u, 0.0f);
+        glVertex2f(1.0f, -1.0f);
+        glTexCoord2f(u, v);
+        glVertex2f(1.0f, 1.0f);
+        glTexCoord2f(0.0f, v);
+        glVertex2f(-1.0f, 1.0f);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    if (depth) glEnable(GL_DEPTH_TEST);
+    if (blend) glEnable(GL_BLEND);
+    if (cull) glEnable(GL_CULL_FACE);
+    #endif
+}
+
 static void r_gl_updateVSync(void) {
     #ifndef PSRC_USESDL1
     if (rendstate.vsync) {
@@ -183,8 +437,528 @@ static void r_gl_updateVSync(void) {
     #endif
 }
 
+static void r_gl_mipdown(const uint8_t* src, int w, int h, int ch, uint8_t* dst) {
+    int dw = (w > 1) ? w / 2 : 1, dh = (h > 1) ? h / 2 : 1;
+    int sx = (w > 1) ? ch : 0, sy = (h > 1) ? w * ch : 0;
+    for (int y = 0; y < dh; ++y) {
+        const uint8_t* r = src + y * ((h > 1) ? 2 : 1) * w * ch;
+        for (int x = 0; x < dw; ++x) {
+            const uint8_t* p = r + x * ((w > 1) ? 2 : 1) * ch;
+            for (int c = 0; c < ch; ++c) {
+                *dst++ = (p[c] + p[c + sx] + p[c + sy] + p[c + sx + sy] + 2) / 4;
+            }
+        }
+    }
+}
+
+static inline bool r_gl_usegenmipmap(void) {
+    #if !defined(PSRC_ENGINE_RENDERER_GL_USEGL33) && !defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    return false;
+    #elif defined(PSRC_ENGINE_RENDERER_GL_USEGL11)
+    return (rendstate.api != RENDAPI_GL11);
+    #else
+    return true;
+    #endif
+}
+
+static size_t r_gl_uploadmips(const uint8_t* data, int w, int h, int ch) {
+    GLenum fmt = (ch == 4) ? GL_RGBA : GL_RGB;
+    uint8_t* tmp[2] = {NULL, NULL};
+    int l = 0;
+    // drop levels the driver can't take
+    while ((w > r_gl_texmgr.maxsize || h > r_gl_texmgr.maxsize) && (w > 1 || h > 1)) {
+        uint8_t* d = malloc(((w > 1) ? w / 2 : 1) * ((h > 1) ? h / 2 : 1) * ch);
+        r_gl_mipdown(data, w, h, ch, d);
+        free(tmp[0]);
+        tmp[0] = d;
+        data = d;
+        if (w > 1) w /= 2;
+        if (h > 1) h /= 2;
+    }
+    size_t sz = 0;
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    if (r_gl_usegenmipmap()) {
+        glTexImage2D(GL_TEXTURE_2D, 0, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        free(tmp[0]);
+        return (size_t)w * h * ch * 4 / 3;
+    }
+    #endif
+    while (1) {
+        glTexImage2D(GL_TEXTURE_2D, l, fmt, w, h, 0, fmt, GL_UNSIGNED_BYTE, data);
+        sz += (size_t)w * h * ch;
+        if (w == 1 && h == 1) break;
+        uint8_t* d = (tmp[1]) ? tmp[1] : malloc(((w > 1) ? w / 2 : 1) * ((h > 1) ? h / 2 : 1) * ch);
+        r_gl_mipdown(data, w, h, ch, d);
+        tmp[1] = tmp[0];
+        tmp[0] = d;
+        data = d;
+        if (w > 1) w /= 2;
+        if (h > 1) h /= 2;
+        ++l;
+    }
+    free(tmp[0]);
+    free(tmp[1]);
+    return sz;
+}
+
+static size_t r_gl_atlassz(void) {
+    return (size_t)R_GL_ATLAS_SIZE * R_GL_ATLAS_SIZE * 4 * 4 / 3;
+}
+
+static void r_gl_atlas_upd(struct r_gl_atlas* a, int x, int y, int w, int h) {
+    uint8_t* src = a->data;
+    int sz = R_GL_ATLAS_SIZE;
+    int x1 = x + w - 1, y1 = y + h - 1;
+    glBindTexture(GL_TEXTURE_2D, a->tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    if (r_gl_usegenmipmap()) {
+        uint8_t* tmp = malloc(w * h * 4);
+        for (int i = 0; i < h; ++i) memcpy(tmp + i * w * 4, src + ((y + i) * sz + x) * 4, w * 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, tmp);
+        free(tmp);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        return;
+    }
+    #endif
+    uint8_t* tmp = malloc(w * h * 4);
+    for (int l = 0; ; ++l) {
+        int rw = x1 - x + 1, rh = y1 - y + 1;
+        for (int i = 0; i < rh; ++i) memcpy(tmp + i * rw * 4, src + ((y + i) * sz + x) * 4, rw * 4);
+        glTexSubImage2D(GL_TEXTURE_2D, l, x, y, rw, rh, GL_RGBA, GL_UNSIGNED_BYTE, tmp);
+        if (sz == 1) break;
+        // rebuild only the texels of the next level that the rect touches
+        uint8_t* dst = src + sz * sz * 4;
+        int dsz = sz / 2;
+        x /= 2; y /= 2; x1 /= 2; y1 /= 2;
+        for (int j = y; j <= y1; ++j) {
+            for (int i = x; i <= x1; ++i) {
+                const uint8_t* p = src + (j * 2 * sz + i * 2) * 4;
+                uint8_t* d = dst + (j * dsz + i) * 4;
+                for (int c = 0; c < 4; ++c) {
+                    d[c] = (p[c] + p[c + 4] + p[c + sz * 4] + p[c + sz * 4 + 4] + 2) / 4;
+                }
+            }
+        }
+        src = dst;
+        sz = dsz;
+    }
+    free(tmp);
+}
+
+static int r_gl_atlas_alloc(int w, int h, int* ox, int* oy) {
+    w = (w + R_GL_ATLAS_ALIGN - 1) & ~(R_GL_ATLAS_ALIGN - 1);
+    h = (h + R_GL_ATLAS_ALIGN - 1) & ~(R_GL_ATLAS_ALIGN - 1);
+    for (int i = 0; i < r_gl_texmgr.atlascount; ++i) {
+        struct r_gl_atlas* a = &r_gl_texmgr.atlases[i];
+        int best = -1;
+        for (int s = 0; s < a->shelfcount; ++s) {
+            if (a->shelves[s].h < h || a->shelves[s].x + w > R_GL_ATLAS_SIZE) continue;
+            if (best < 0 || a->shelves[s].h < a->shelves[best].h) best = s;
+        }
+        if (best < 0 && a->nexty + h <= R_GL_ATLAS_SIZE) {
+            best = a->shelfcount++;
+            a->shelves[best].y = a->nexty;
+            a->shelves[best].h = h;
+            a->shelves[best].x = 0;
+            a->nexty += h;
+        }
+        if (best < 0) continue;
+        *ox = a->shelves[best].x;
+        *oy = a->shelves[best].y;
+        a->shelves[best].x += w;
+        return i;
+    }
+    struct r_gl_atlas* tmp = realloc(r_gl_texmgr.atlases, (r_gl_texmgr.atlascount + 1) * sizeof(*tmp));
+    if (!tmp) return -1;
+    r_gl_texmgr.atlases = tmp;
+    struct r_gl_atlas* a = &tmp[r_gl_texmgr.atlascount];
+    size_t sz = r_gl_atlassz();
+    a->data = calloc(sz, 1);
+    if (!a->data) return -1;
+    glGenTextures(1, &a->tex);
+    glBindTexture(GL_TEXTURE_2D, a->tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    {
+        uint8_t* d = a->data;
+        for (int l = 0, asz = R_GL_ATLAS_SIZE; asz; ++l, asz /= 2) {
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA, asz, asz, 0, GL_RGBA, GL_UNSIGNED_BYTE, d);
+            d += asz * asz * 4;
+        }
+    }
+    a->shelfcount = 1;
+    a->shelves[0].y = 0;
+    a->shelves[0].h = h;
+    a->shelves[0].x = w;
+    a->nexty = h;
+    r_gl_texmgr.vram += sz;
+    *ox = 0;
+    *oy = 0;
+    return r_gl_texmgr.atlascount++;
+}
+
+static bool r_gl_texupload(struct r_gl_texture* t, enum rcopt_texture_qlt q) {
+    const uint8_t* data;
+    int w, h, ch;
+    struct rc_texture* rc = NULL;
+    uint8_t* tmp = NULL;
+    if (t->rcpath) {
+        struct rcopt_texture o = {.needsalpha = false, .quality = q};
+        rc = getRc(RC_TEXTURE, t->rcpath, &o, 0, NULL);
+        if (!rc) return false;
+        data = rc->data;
+        w = rc->width;
+        h = rc->height;
+        ch = rc->channels;
+    } else {
+        data = t->data;
+        w = t->width;
+        h = t->height;
+        ch = t->channels;
+        for (int i = 0; i < (int)q && (w > 1 || h > 1); ++i) {
+            uint8_t* d = malloc(((w > 1) ? w / 2 : 1) * ((h > 1) ? h / 2 : 1) * ch);
+            if (!d) break; // upload what there is at the last size that worked
+            r_gl_mipdown(data, w, h, ch, d);
+            free(tmp);
+            tmp = d;
+            data = d;
+            if (w > 1) w /= 2;
+            if (h > 1) h /= 2;
+        }
+    }
+    if ((t->flags & R_GL_TEXFLAG_CLAMP) && w <= R_GL_ATLAS_MAXSUBSIZE && h <= R_GL_ATLAS_MAXSUBSIZE) {
+        // small textures share an atlas and are never downgraded or evicted
+        int x, y;
+        int ai = r_gl_atlas_alloc(w, h, &x, &y);
+        if (ai >= 0) {
+            // a downgrade can bring a texture that had its own under the atlas size
+            if (t->tex) {
+                glDeleteTextures(1, &t->tex);
+                t->tex = 0;
+            }
+            r_gl_texmgr.vram -= t->vram;
+            t->vram = 0;
+            struct r_gl_atlas* a = &r_gl_texmgr.atlases[ai];
+            for (int j = 0; j < h; ++j) {
+                uint8_t* d = a->data + ((y + j) * R_GL_ATLAS_SIZE + x) * 4;
+                const uint8_t* sp = data + j * w * ch;
+                for (int i = 0; i < w; ++i) {
+                    d[0] = sp[0]; d[1] = sp[1]; d[2] = sp[2];
+                    d[3] = (ch == 4) ? sp[3] : 255;
+                    d += 4;
+                    sp += ch;
+                }
+            }
+            r_gl_atlas_upd(a, x, y, w, h);
+            t->atlas = ai;
+            t->uvoff[0] = (float)x / R_GL_ATLAS_SIZE;
+            t->uvoff[1] = (float)y / R_GL_ATLAS_SIZE;
+            t->uvscale[0] = (float)w / R_GL_ATLAS_SIZE;
+            t->uvscale[1] = (float)h / R_GL_ATLAS_SIZE;
+            t->qlt = q;
+            t->resident = 1;
+            free(tmp);
+            if (rc) rlsRc(rc, false);
+            return true;
+        }
+    }
+    t->atlas = -1;
+    t->uvoff[0] = 0.0f;
+    t->uvoff[1] = 0.0f;
+    t->uvscale[0] = 1.0f;
+    t->uvscale[1] = 1.0f;
+    if (!t->tex) glGenTextures(1, &t->tex);
+    glBindTexture(GL_TEXTURE_2D, t->tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, (t->flags & R_GL_TEXFLAG_CLAMP) ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, (t->flags & R_GL_TEXFLAG_CLAMP) ? GL_CLAMP_TO_EDGE : GL_REPEAT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    size_t sz = r_gl_uploadmips(data, w, h, ch);
+    r_gl_texmgr.vram -= t->vram;
+    r_gl_texmgr.vram += sz;
+    t->vram = sz;
+    t->qlt = q;
+    t->resident = 1;
+    free(tmp);
+    if (rc) rlsRc(rc, false);
+    return true;
+}
+
+static void r_gl_texevict(struct r_gl_texture* t) {
+    if (t->tex) {
+        glDeleteTextures(1, &t->tex);
+        t->tex = 0;
+    }
+    r_gl_texmgr.vram -= t->vram;
+    t->vram = 0;
+    t->resident = 0;
+}
+
+static void r_gl_texlink(struct r_gl_texture* t) {
+    t->prev = NULL;
+    t->next = r_gl_texmgr.head;
+    if (r_gl_texmgr.head) r_gl_texmgr.head->prev = t;
+    else r_gl_texmgr.tail = t;
+    r_gl_texmgr.head = t;
+}
+static void r_gl_texunlink(struct r_gl_texture* t) {
+    if (t->prev) t->prev->next = t->next;
+    else r_gl_texmgr.head = t->next;
+    if (t->next) t->next->prev = t->prev;
+    else r_gl_texmgr.tail = t->prev;
+}
+
+static struct r_gl_texture* r_gl_newtex(const char* rcpath, const uint8_t* data, unsigned w, unsigned h, unsigned ch, uint8_t flags) {
+    struct r_gl_texture* t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    if (rcpath) t->rcpath = strdup(rcpath);
+    t->data = data;
+    t->width = w;
+    t->height = h;
+    t->channels = ch;
+    t->flags = flags;
+    t->atlas = -1;
+    t->uvscale[0] = 1.0f;
+    t->uvscale[1] = 1.0f;
+    t->qlt = rendstate.texqlt;
+    r_gl_texlink(t);
+    return t;
+}
+static struct r_gl_texture* r_gl_newtex_rc(const char* rcpath, uint8_t flags) {
+    return r_gl_newtex(rcpath, NULL, 0, 0, 0, flags);
+}
+static struct r_gl_texture* r_gl_newtex_data(const uint8_t* data, unsigned w, unsigned h, unsigned ch, uint8_t flags) {
+    return r_gl_newtex(NULL, data, w, h, ch, flags);
+}
+static void r_gl_deltex(struct r_gl_texture* t) {
+    if (!t) return;
+    // atlas space is not reclaimed until the atlases are dropped
+    if (t->atlas < 0) r_gl_texevict(t);
+    r_gl_texunlink(t);
+    free(t->rcpath);
+    free(t);
+}
+
+static bool r_gl_bindtex(struct r_gl_texture* t) {
+    t->lastdrawn = r_gl_texmgr.frame;
+    if (t != r_gl_texmgr.head) {
+        r_gl_texunlink(t);
+        r_gl_texlink(t);
+    }
+    if (!t->resident) {
+        if (!r_gl_texupload(t, t->qlt)) {
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return false;
+        }
+    } else if (t->atlas < 0 && t->qlt > rendstate.texqlt && r_gl_texmgr.vram + t->vram * 4 < r_gl_texmgr.budget * 3 / 4) {
+        // there is room again, win back a quality level
+        r_gl_texupload(t, t->qlt - 1);
+    }
+    if (t->atlas >= 0) glBindTexture(GL_TEXTURE_2D, r_gl_texmgr.atlases[t->atlas].tex);
+    else glBindTexture(GL_TEXTURE_2D, t->tex);
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api == RENDAPI_GL11) {
+        glMatrixMode(GL_TEXTURE);
+        glLoadIdentity();
+        if (t->atlas >= 0) {
+            glTranslatef(t->uvoff[0], t->uvoff[1], 0.0f);
+            glScalef(t->uvscale[0], t->uvscale[1], 1.0f);
+        }
+        glMatrixMode(GL_MODELVIEW);
+    }
+    #endif
+    return true;
+}
+
+static void r_gl_enforcetexbudget(void) {
+    // downgrade to MED, then to LOW, then evict, least recently drawn first
+    for (int pass = 0; pass < 3 && r_gl_texmgr.vram > r_gl_texmgr.budget; ++pass) {
+        for (struct r_gl_texture* t = r_gl_texmgr.tail; t && r_gl_texmgr.vram > r_gl_texmgr.budget; t = t->prev) {
+            if (!t->resident || t->atlas >= 0 || t->lastdrawn == r_gl_texmgr.frame) continue;
+            if (t->qlt < RCOPT_TEXTURE_QLT_LOW) {
+                if (pass < 2) r_gl_texupload(t, t->qlt + 1);
+            } else if (pass == 2) {
+                r_gl_texevict(t);
+            }
+        }
+    }
+    ++r_gl_texmgr.frame;
+}
+
+static void r_gl_texmgr_init(void) {
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &r_gl_texmgr.maxsize);
+    if (r_gl_texmgr.maxsize < 64) r_gl_texmgr.maxsize = 64;
+    char* tmp = cfg_getvar(&config, "Renderer", "gl.texbudget");
+    if (tmp) {
+        r_gl_texmgr.budget = strtoul(tmp, NULL, 10) * 1048576;
+        free(tmp);
+    } else {
+        r_gl_texmgr.budget = 64 * 1048576;
+    }
+}
+
+static void r_gl_texmgr_quit(void) {
+    // the context is going away, everything gets uploaded again on next use
+    for (struct r_gl_texture* t = r_gl_texmgr.head; t; t = t->next) {
+        if (t->atlas < 0) r_gl_texevict(t);
+        t->atlas = -1;
+        t->resident = 0;
+    }
+    for (int i = 0; i < r_gl_texmgr.atlascount; ++i) {
+        glDeleteTextures(1, &r_gl_texmgr.atlases[i].tex);
+        free(r_gl_texmgr.atlases[i].data);
+    }
+    free(r_gl_texmgr.atlases);
+    r_gl_texmgr.atlases = NULL;
+    r_gl_texmgr.atlascount = 0;
+    r_gl_texmgr.vram = 0;
+}
+
+static void r_gl_freelightmaps(void) {
+    if (r_gl_data.lmtexcount) glDeleteTextures(r_gl_data.lmtexcount, r_gl_data.lmtex);
+    free(r_gl_data.lmtex);
+    r_gl_data.lmtex = NULL;
+    r_gl_data.lmtexcount = 0;
+}
+
+static void r_gl_updlightmaps(void) {
+    if (r_gl_data.lmgen != lmstate.gen || r_gl_data.lmtexcount != lmstate.atlascount) {
+        r_gl_freelightmaps();
+        r_gl_data.lmgen = lmstate.gen;
+        if (!lmstate.atlascount) return;
+        r_gl_data.lmtex = malloc(lmstate.atlascount * sizeof(*r_gl_data.lmtex));
+        if (!r_gl_data.lmtex) return;
+        r_gl_data.lmtexcount = lmstate.atlascount;
+        glGenTextures(r_gl_data.lmtexcount, r_gl_data.lmtex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int i = 0; i < r_gl_data.lmtexcount; ++i) {
+            glBindTexture(GL_TEXTURE_2D, r_gl_data.lmtex[i]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, LM_ATLAS_SIZE, LM_ATLAS_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, lmstate.atlases[i].data);
+            lmstate.atlases[i].dirty.len = 0;
+        }
+        return;
+    }
+    uint8_t* tmp = NULL;
+    size_t tmpsz = 0;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < r_gl_data.lmtexcount; ++i) {
+        struct lm_atlas* a = &lmstate.atlases[i];
+        if (!a->dirty.len) continue;
+        glBindTexture(GL_TEXTURE_2D, r_gl_data.lmtex[i]);
+        for (uintptr_t j = 0; j < a->dirty.len; ++j) {
+            struct lm_rect* r = &a->dirty.data[j];
+            size_t sz = (size_t)r->w * r->h * 3;
+            if (sz > tmpsz) {
+                uint8_t* t = realloc(tmp, sz);
+                if (!t) continue;
+                tmp = t;
+                tmpsz = sz;
+            }
+            // no GL_UNPACK_ROW_LENGTH on 1.1 or ES, so pack the rows first
+            for (unsigned y = 0; y < r->h; ++y) {
+                memcpy(tmp + y * r->w * 3, a->data + ((size_t)(r->y + y) * LM_ATLAS_SIZE + r->x) * 3, r->w * 3);
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h, GL_RGB, GL_UNSIGNED_BYTE, tmp);
+        }
+        a->dirty.len = 0;
+    }
+    free(tmp);
+}
+
+// a texture can be clamped (and so put in an atlas) if no part using it has UVs outside of 0 to 1
+static uint8_t r_gl_modeltexflags(struct p3m* m, struct p3m_texture* pt) {
+    bool used = false;
+    for (int p = 0; p < m->partcount; ++p) {
+        struct p3m_part* part = &m->parts[p];
+        if (!part->material || part->material->texture != pt) continue;
+        used = true;
+        for (unsigned v = 0; v < part->vertexcount; ++v) {
+            float u = part->vertices[v].u, vv = part->vertices[v].v;
+            if (u < 0.0f || u > 1.0f || vv < 0.0f || vv > 1.0f) return 0;
+        }
+    }
+    return (used) ? R_GL_TEXFLAG_CLAMP : 0;
+}
+
+static struct r_gl_texture** r_gl_newmodeltex(struct p3m* m) {
+    if (!m->texturecount) return NULL;
+    struct r_gl_texture** t = calloc(m->texturecount, sizeof(*t));
+    if (!t) return NULL;
+    for (int i = 0; i < m->texturecount; ++i) {
+        struct p3m_texture* pt = &m->textures[i];
+        uint8_t flags = r_gl_modeltexflags(m, pt);
+        switch ((uint8_t)pt->type) {
+            case P3M_TEXTYPE_EMBEDDED:
+                if (pt->embedded.data) t[i] = r_gl_newtex_data(pt->embedded.data, pt->embedded.res, pt->embedded.res, pt->embedded.ch, flags);
+                break;
+            case P3M_TEXTYPE_EXTERNAL:
+                t[i] = r_gl_newtex_rc(pt->external.rcpath, flags);
+                break;
+        }
+    }
+    return t;
+}
+static void r_gl_delmodeltex(struct p3m* m, struct r_gl_texture** t) {
+    if (!t) return;
+    for (int i = 0; i < m->texturecount; ++i) r_gl_deltex(t[i]);
+    free(t);
+}
+
+static struct r_gl_texture** r_gl_testmodeltex;
+
+struct r_gl_modelcache {
+    struct p3m* model;
+    struct r_gl_texture** texs;
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    GLuint lists; // one display list per part
+    #endif
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    GLuint vao, vbo, ebo;
+    uint32_t* partinds; // offset of each part in 'ebo'
+    #endif
+};
+
+static void r_gl_freemodelcache(void* p) {
+    struct r_gl_modelcache* c = p;
+    r_gl_delmodeltex(c->model, c->texs);
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (c->lists) glDeleteLists(c->lists, c->model->partcount);
+    #endif
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    if (c->vao) glDeleteVertexArrays(1, &c->vao);
+    if (c->vbo) glDeleteBuffers(1, &c->vbo);
+    if (c->ebo) glDeleteBuffers(1, &c->ebo);
+    free(c->partinds);
+    #endif
+    free(c);
+}
+
+static struct r_gl_modelcache* r_gl_newmodelcache(struct p3m* m) {
+    struct r_gl_modelcache* c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->model = m;
+    c->texs = r_gl_newmodeltex(m);
+    return c;
+}
+
+static inline struct r_gl_texture* r_gl_getparttex(struct r_gl_modelcache* c, int p) {
+    struct p3m_material* mat = c->model->parts[p].material;
+    if (!c->texs || !mat || !mat->texture) return NULL;
+    return c->texs[mat->texture - c->model->textures];
+}
+
 #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
-static void r_gl_rendermodel_legacy(struct p3m* m, struct p3m_vertex** transverts) {
+static void r_gl_rendermodel_legacy(struct p3m* m, struct p3m_vertex** transverts, struct r_gl_texture** texs) {
     long lt = SDL_GetTicks();
     #if 0
     int vertct = 0;
@@ -199,6 +973,12 @@ static void r_gl_rendermodel_legacy(struct p3m* m, struct p3m_vertex** transvert
             uint16_t indcount = m->parts[p].indexcount;
             uint16_t* inds = m->parts[p].indices;
             struct p3m_vertex* verts = (transverts) ? transverts[p] : m->parts[p].vertices;
+            struct r_gl_texture* tex = NULL;
+            if (texs && m->parts[p].material && m->parts[p].material->texture) {
+                tex = texs[m->parts[p].material->texture - m->textures];
+            }
+            if (tex && r_gl_bindtex(tex)) glEnable(GL_TEXTURE_2D);
+            else tex = NULL;
             glBegin(GL_TRIANGLES);
             //glColor3f(1.0f, 1.0f, 1.0f);
             for (uint16_t i = 0; i < indcount; ++i) {
@@ -218,12 +998,14 @@ static void r_gl_rendermodel_legacy(struct p3m* m, struct p3m_vertex** transvert
                 uint8_t c[3] = {ci >> 16, ci >> 8, ci};
                 #endif
                 glColor3f(c[0] / 255.0f * tmp1, c[1] / 255.0f * tmp1, c[2] / 255.0f * tmp1);
+                if (tex) glTexCoord2f(verts[*inds].u, verts[*inds].v);
                 glVertex3f(-verts[*inds].x + tsin, verts[*inds].y - 1.8f + tsin2, -verts[*inds].z + 1.75f + tcos);
                 //glVertex3f(-verts[*inds].x, verts[*inds].y - 1.8f, -verts[*inds].z + 1.75f);
                 //++vertct;
                 ++inds;
             }
             glEnd();
+            if (tex) glDisable(GL_TEXTURE_2D);
         }
     #if 0
         lt += 100;
@@ -231,6 +1013,108 @@ static void r_gl_rendermodel_legacy(struct p3m* m, struct p3m_vertex** transvert
     printf("verts: %d, tris: %d\n", vertct, vertct / 3);
     #endif
 }
+static void r_gl_renderprops_legacy(void) {
+    for (uintptr_t i = 0; i < modelbatches.len; ++i) {
+        struct modelbatch* b = &modelbatches.data[i];
+        cullModelBatch(b);
+        if (!b->insts.len) continue;
+        struct p3m* m = &b->model->model;
+        if (!b->cache) b->cache = r_gl_newmodelcache(m);
+        struct r_gl_modelcache* c = b->cache;
+        if (!c) continue;
+        if (!c->lists && m->partcount) {
+            // compiled once per model and replayed for every instance
+            c->lists = glGenLists(m->partcount);
+            for (int p = 0; p < m->partcount; ++p) {
+                struct p3m_part* part = &m->parts[p];
+                glNewList(c->lists + p, GL_COMPILE);
+                glBegin(GL_TRIANGLES);
+                for (unsigned j = 0; j < part->indexcount; ++j) {
+                    struct p3m_vertex* v = &part->vertices[part->indices[j]];
+                    glTexCoord2f(v->u, v->v);
+                    glVertex3f(v->x, v->y, v->z);
+                }
+                glEnd();
+                glEndList();
+            }
+        }
+        for (int p = 0; p < m->partcount; ++p) {
+            struct p3m_material* mat = m->parts[p].material;
+            struct r_gl_texture* tex = r_gl_getparttex(c, p);
+            if (tex && r_gl_bindtex(tex)) glEnable(GL_TEXTURE_2D);
+            else tex = NULL;
+            if (mat) glColor4ub(mat->color[0], mat->color[1], mat->color[2], mat->color[3]);
+            else glColor3f(1.0f, 1.0f, 1.0f);
+            for (uintptr_t j = 0; j < b->insts.len; ++j) {
+                glPushMatrix();
+                glMultMatrixf((float*)b->insts.data[j].mat);
+                glCallList(c->lists + p);
+                glPopMatrix();
+            }
+            if (tex) glDisable(GL_TEXTURE_2D);
+        }
+    }
+}
+
+static void r_gl_renderlightmaps_legacy(void) {
+    int bound = -1;
+    bool began = false;
+    GLenum mode = GL_QUADS;
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glEnable(GL_TEXTURE_2D);
+    for (uintptr_t i = 0; i < visstate.cubes.len; ++i) {
+        struct vis_sector* s = visstate.cubes.data[i].sector;
+        struct vis_cube* c = visstate.cubes.data[i].cube;
+        if (s->lmatlas < 0 || s->lmatlas >= r_gl_data.lmtexcount) continue;
+        GLenum cmode = (c->tris) ? GL_TRIANGLES : GL_QUADS;
+        if (s->lmatlas != bound || !began || cmode != mode) {
+            if (began) glEnd();
+            if (s->lmatlas != bound) {
+                bound = s->lmatlas;
+                glBindTexture(GL_TEXTURE_2D, r_gl_data.lmtex[bound]);
+            }
+            mode = cmode;
+            glBegin(mode);
+            began = true;
+        }
+        struct vis_vertex* v = &s->verts[c->firstvert];
+        for (int f = 0; f < 6; ++f) {
+            struct vis_lightmap* lm = &s->lightmaps[(c->lightmaps[f] < s->lightmapcount) ? c->lightmaps[f] : 0];
+            float sz = (float)(1 << lm->sizelog);
+            for (unsigned j = 0; j < c->facevertcount[f]; ++j) {
+                glTexCoord2f((lm->x + v->lmu * sz) / LM_ATLAS_SIZE, (lm->y + v->lmv * sz) / LM_ATLAS_SIZE);
+                glVertex3f(v->x, v->y, v->z);
+                ++v;
+            }
+        }
+    }
+    if (began) glEnd();
+    glDisable(GL_TEXTURE_2D);
+}
+
+static void r_gl_rendermap_legacy(void) {
+    GLenum mode = GL_QUADS;
+    bool began = false;
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for (uintptr_t i = 0; i < visstate.cubes.len; ++i) {
+        struct vis_sector* s = visstate.cubes.data[i].sector;
+        struct vis_cube* c = visstate.cubes.data[i].cube;
+        GLenum cmode = (c->tris) ? GL_TRIANGLES : GL_QUADS;
+        if (!began || cmode != mode) {
+            if (began) glEnd();
+            mode = cmode;
+            glBegin(mode);
+            began = true;
+        }
+        struct vis_vertex* v = &s->verts[c->firstvert];
+        for (unsigned j = 0; j < c->vertcount; ++j) {
+            glTexCoord2f(v->u, v->v);
+            glVertex3f(v->x, v->y, v->z);
+            ++v;
+        }
+    }
+    if (began) glEnd();
+}
 #if 0
 static void r_gl_render_legacy(void) {
     r_gl_clearScreen();
@@ -304,6 +1188,8 @@ static void r_gl_render_legacy(void) {
     glMatrixMode(GL_MODELVIEW);
     r_gl_calcViewMat();
     glLoadMatrixf((float*)r_gl_data.viewmat);
+    r_gl_updateVis();
+    r_gl_updlightmaps();
 
     glDepthMask(GL_TRUE);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -359,10 +1245,13 @@ static void r_gl_render_legacy(void) {
         glVertex3f(0.5f, -1.0f, z);
     glEnd();
 
+    r_gl_rendermap_legacy();
+
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
 
-    if (testmodel) r_gl_rendermodel_legacy(&testmodel->model, NULL);
+    if (testmodel) r_gl_rendermodel_legacy(&testmodel->model, NULL, r_gl_testmodeltex);
+    r_gl_renderprops_legacy();
 
     glDepthMask(GL_FALSE);
     glBlendFunc(GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA);
@@ -380,6 +1269,7 @@ static void r_gl_render_legacy(void) {
         glColor3f(0.5f, 0.5f, 0.5f);
         glVertex3f(1.0f, 1.0f, z);
     glEnd();
+    r_gl_renderlightmaps_legacy();
 
     if (!r_gl_data.fastclear) glDepthRange(1.0, 1.0);
     else if (r_gl_data.gl11.oddframe) glDepthRange(0.5, 0.5);
@@ -497,6 +1387,8 @@ static void r_gl_render_legacy(void) {
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glDisable(GL_CULL_FACE);
 
+    r_gl_enddynres();
+
     // ui
     #if DEBUG(1)
     glBegin(GL_QUADS);
@@ -540,6 +1432,186 @@ static void r_gl_render_legacy(void) {
 #endif
 
 #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+static void r_gl_renderprops_advanced(void) {
+    if (!r_gl_data.inst.prog) return;
+    bool bound = false;
+    for (uintptr_t i = 0; i < modelbatches.len; ++i) {
+        struct modelbatch* b = &modelbatches.data[i];
+        cullModelBatch(b);
+        if (!b->insts.len) continue;
+        struct p3m* m = &b->model->model;
+        if (!b->cache) b->cache = r_gl_newmodelcache(m);
+        struct r_gl_modelcache* c = b->cache;
+        if (!c) continue;
+        if (!c->vao) {
+            uint32_t vertct = 0, indct = 0;
+            for (int p = 0; p < m->partcount; ++p) {
+                vertct += m->parts[p].vertexcount;
+                indct += m->parts[p].indexcount;
+            }
+            c->partinds = malloc((m->partcount + 1) * sizeof(*c->partinds));
+            uint32_t* inds = malloc(indct * sizeof(*inds));
+            if (!c->partinds || !inds) {
+                free(c->partinds);
+                c->partinds = NULL;
+                free(inds);
+                continue;
+            }
+            glGenVertexArrays(1, &c->vao);
+            glBindVertexArray(c->vao);
+            glGenBuffers(1, &c->vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, c->vbo);
+            glBufferData(GL_ARRAY_BUFFER, vertct * sizeof(struct p3m_vertex), NULL, GL_STATIC_DRAW);
+            // parts are merged into one buffer, ES 3.0 has no base vertex draws so the indices are rebased
+            uint32_t vo = 0, io = 0;
+            for (int p = 0; p < m->partcount; ++p) {
+                struct p3m_part* part = &m->parts[p];
+                glBufferSubData(GL_ARRAY_BUFFER, vo * sizeof(struct p3m_vertex), part->vertexcount * sizeof(struct p3m_vertex), part->vertices);
+                c->partinds[p] = io;
+                for (unsigned j = 0; j < part->indexcount; ++j) inds[io++] = part->indices[j] + vo;
+                vo += part->vertexcount;
+            }
+            c->partinds[m->partcount] = io;
+            glGenBuffers(1, &c->ebo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, c->ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indct * sizeof(*inds), inds, GL_STATIC_DRAW);
+            free(inds);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct p3m_vertex), (void*)offsetof(struct p3m_vertex, x));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct p3m_vertex), (void*)offsetof(struct p3m_vertex, u));
+            glBindBuffer(GL_ARRAY_BUFFER, r_gl_data.inst.vbo);
+            for (int j = 0; j < 4; ++j) {
+                glEnableVertexAttribArray(2 + j);
+                glVertexAttribPointer(2 + j, 4, GL_FLOAT, GL_FALSE, sizeof(struct modelinst), (void*)(j * 4 * sizeof(float)));
+                glVertexAttribDivisor(2 + j, 1);
+            }
+        }
+        if (!bound) {
+            glUseProgram(r_gl_data.inst.prog);
+            glUniformMatrix4fv(r_gl_data.inst.u_vp, 1, GL_FALSE, (float*)visstate.clipmat);
+            bound = true;
+        }
+        glBindVertexArray(c->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, r_gl_data.inst.vbo);
+        glBufferData(GL_ARRAY_BUFFER, b->insts.len * sizeof(*b->insts.data), b->insts.data, GL_STREAM_DRAW);
+        for (int p = 0; p < m->partcount; ++p) {
+            struct p3m_material* mat = m->parts[p].material;
+            struct r_gl_texture* tex = r_gl_getparttex(c, p);
+            if (tex && r_gl_bindtex(tex)) {
+                glUniform4f(r_gl_data.inst.u_uvxform, tex->uvoff[0], tex->uvoff[1], tex->uvscale[0], tex->uvscale[1]);
+            } else {
+                glBindTexture(GL_TEXTURE_2D, r_gl_data.inst.whitetex);
+                glUniform4f(r_gl_data.inst.u_uvxform, 0.0f, 0.0f, 1.0f, 1.0f);
+            }
+            if (mat) {
+                glUniform4f(r_gl_data.inst.u_color, mat->color[0] / 255.0f, mat->color[1] / 255.0f, mat->color[2] / 255.0f, mat->color[3] / 255.0f);
+            } else {
+                glUniform4f(r_gl_data.inst.u_color, 1.0f, 1.0f, 1.0f, 1.0f);
+            }
+            glDrawElementsInstanced(
+                GL_TRIANGLES, c->partinds[p + 1] - c->partinds[p], GL_UNSIGNED_INT,
+                (void*)(c->partinds[p] * sizeof(uint32_t)), b->insts.len
+            );
+        }
+    }
+    if (bound) {
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+}
+
+static GLuint r_gl_compileshader(GLenum type, const char* src) {
+    const char* srcs[2] = {
+        #ifdef PSRC_ENGINE_RENDERER_GL_USEGLES30
+        (rendstate.api == RENDAPI_GLES30) ? "#version 300 es\nprecision mediump float;\n" :
+        #endif
+        "#version 330 core\n",
+        src
+    };
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 2, srcs, NULL);
+    glCompileShader(s);
+    GLint ok;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(s, sizeof(log), NULL, log);
+        plog(LL_ERROR, "Failed to compile shader: %s", log);
+        glDeleteShader(s);
+        return 0;
+    }
+    return s;
+}
+
+static bool r_gl_initinst(void) {
+    static const char* vs =
+        "layout(location = 0) in vec3 pos;\n"
+        "layout(location = 1) in vec2 uv;\n"
+        "layout(location = 2) in mat4 model;\n"
+        "uniform mat4 vp;\n"
+        "uniform vec4 uvxform;\n"
+        "out vec2 f_uv;\n"
+        "void main() {\n"
+        "    f_uv = uvxform.xy + uv * uvxform.zw;\n"
+        "    gl_Position = vp * model * vec4(pos, 1.0);\n"
+        "}\n";
+    static const char* fs =
+        "in vec2 f_uv;\n"
+        "uniform sampler2D tex;\n"
+        "uniform vec4 color;\n"
+        "out vec4 f_color;\n"
+        "void main() {\n"
+        "    f_color = texture(tex, f_uv) * color;\n"
+        "}\n";
+    GLuint v = r_gl_compileshader(GL_VERTEX_SHADER, vs);
+    if (!v) return false;
+    GLuint f = r_gl_compileshader(GL_FRAGMENT_SHADER, fs);
+    if (!f) {
+        glDeleteShader(v);
+        return false;
+    }
+    GLuint p = glCreateProgram();
+    glAttachShader(p, v);
+    glAttachShader(p, f);
+    glLinkProgram(p);
+    glDeleteShader(v);
+    glDeleteShader(f);
+    GLint ok;
+    glGetProgramiv(p, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(p, sizeof(log), NULL, log);
+        plog(LL_ERROR, "Failed to link shader program: %s", log);
+        glDeleteProgram(p);
+        return false;
+    }
+    r_gl_data.inst.prog = p;
+    r_gl_data.inst.u_vp = glGetUniformLocation(p, "vp");
+    r_gl_data.inst.u_color = glGetUniformLocation(p, "color");
+    r_gl_data.inst.u_uvxform = glGetUniformLocation(p, "uvxform");
+    glUseProgram(p);
+    glUniform1i(glGetUniformLocation(p, "tex"), 0);
+    glUseProgram(0);
+    glGenBuffers(1, &r_gl_data.inst.vbo);
+    static const uint8_t white[4] = {255, 255, 255, 255};
+    glGenTextures(1, &r_gl_data.inst.whitetex);
+    glBindTexture(GL_TEXTURE_2D, r_gl_data.inst.whitetex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    return true;
+}
+
+static void r_gl_quitinst(void) {
+    if (r_gl_data.inst.prog) glDeleteProgram(r_gl_data.inst.prog);
+    if (r_gl_data.inst.vbo) glDeleteBuffers(1, &r_gl_data.inst.vbo);
+    if (r_gl_data.inst.whitetex) glDeleteTextures(1, &r_gl_data.inst.whitetex);
+    r_gl_data.inst.prog = 0;
+    r_gl_data.inst.vbo = 0;
+    r_gl_data.inst.whitetex = 0;
+}
+
 static void r_gl_render_advanced(void) {
     if (r_gl_data.fastclear) {
         glClear(GL_DEPTH_BUFFER_BIT);
@@ -547,6 +1619,10 @@ static void r_gl_render_advanced(void) {
         glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
     }
 
+    r_gl_calcViewMat();
+    r_gl_updateVis();
+    r_gl_updlightmaps();
+
     if (rendstate.lighting >= 1) {
         // TODO: render opaque materials front to back with light mapping
     } else {
@@ -556,6 +1632,7 @@ static void r_gl_render_advanced(void) {
     glEnable(GL_CULL_FACE);
 
     // TODO: render entities
+    r_gl_renderprops_advanced();
 
     glDisable(GL_CULL_FACE);
     glEnable(GL_BLEND);
@@ -570,12 +1647,14 @@ static void r_gl_render_advanced(void) {
     glDisable(GL_BLEND);
     glDepthMask(GL_TRUE);
 
+    r_gl_enddynres();
 
     // TODO: render UI
 }
 #endif
 
 static void r_gl_render(void) {
+    r_gl_begindynres();
     switch (rendstate.api) {
         #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
         case RENDAPI_GL11:
@@ -595,6 +1674,9 @@ static void r_gl_render(void) {
         default:
             break;
     }
+    r_gl_enddynres(); // in case the path did not composite
+    endModelBatches(r_gl_freemodelcache);
+    r_gl_enforcetexbudget();
     glFinish();
 }
 
@@ -619,6 +1701,127 @@ static void* r_gl_takeScreenshot(int* w, int* h, int* s) {
     return frame;
 }
 
+// Called after the frame is drawn and before it is swapped. Under GL 3.3/ES 3.0 this only queues a read
+// into a pixel buffer and the data is fetched once its fence has passed, a frame or two later.
+static bool r_gl_requestScreenshot(void) {
+    int w = rendstate.res.current.width;
+    int h = rendstate.res.current.height;
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api == RENDAPI_GL11) {
+        // no pixel buffers in 1.1
+        if (r_gl_data.sshot.ready) return false;
+        uint8_t* d = malloc(w * h * 3);
+        if (!d) {
+            plog(LL_WARN | LF_FUNC, LE_MEMALLOC);
+            return false;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, d);
+        r_gl_data.sshot.ready = d;
+        r_gl_data.sshot.w = w;
+        r_gl_data.sshot.h = h;
+        r_gl_data.sshot.ch = 3;
+        return true;
+    }
+    #endif
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    int i = r_gl_data.sshot.next;
+    if (r_gl_data.sshot.slots[i].fence) return false; // both slots are in flight
+    size_t size = (size_t)w * h * 4;
+    if (!r_gl_data.sshot.slots[i].pbo) glGenBuffers(1, &r_gl_data.sshot.slots[i].pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, r_gl_data.sshot.slots[i].pbo);
+    if (r_gl_data.sshot.slots[i].size != size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        r_gl_data.sshot.slots[i].size = size;
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r_gl_data.sshot.slots[i].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    r_gl_data.sshot.slots[i].w = w;
+    r_gl_data.sshot.slots[i].h = h;
+    r_gl_data.sshot.next = !i;
+    return true;
+    #else
+    (void)w; (void)h;
+    return false;
+    #endif
+}
+
+// Returns a finished screenshot (bottom-up rows, caller frees) or NULL. Never waits on the GPU.
+static void* r_gl_getScreenshot(int* w, int* h, int* ch) {
+    if (r_gl_data.sshot.ready) {
+        uint8_t* d = r_gl_data.sshot.ready;
+        r_gl_data.sshot.ready = NULL;
+        *w = r_gl_data.sshot.w;
+        *h = r_gl_data.sshot.h;
+        *ch = r_gl_data.sshot.ch;
+        return d;
+    }
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api == RENDAPI_GL11) return NULL;
+    #endif
+    // oldest slot first
+    for (int j = 0; j < 2; ++j) {
+        int i = (r_gl_data.sshot.next + j) % 2;
+        GLsync f = r_gl_data.sshot.slots[i].fence;
+        if (!f) continue;
+        GLenum r = glClientWaitSync(f, 0, 0);
+        if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED) {
+            if (r == GL_WAIT_FAILED) {
+                glDeleteSync(f);
+                r_gl_data.sshot.slots[i].fence = NULL;
+            }
+            return NULL;
+        }
+        glDeleteSync(f);
+        r_gl_data.sshot.slots[i].fence = NULL;
+        size_t size = (size_t)r_gl_data.sshot.slots[i].w * r_gl_data.sshot.slots[i].h * 4;
+        uint8_t* d = malloc(size);
+        if (!d) {
+            plog(LL_WARN | LF_FUNC, LE_MEMALLOC);
+            return NULL;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r_gl_data.sshot.slots[i].pbo);
+        void* m = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (m) {
+            memcpy(d, m, size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!m) {
+            free(d);
+            return NULL;
+        }
+        *w = r_gl_data.sshot.slots[i].w;
+        *h = r_gl_data.sshot.slots[i].h;
+        *ch = 4;
+        return d;
+    }
+    #endif
+    return NULL;
+}
+
+static void r_gl_freescreenshots(void) {
+    free(r_gl_data.sshot.ready);
+    r_gl_data.sshot.ready = NULL;
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api == RENDAPI_GL11) return;
+    #endif
+    for (int i = 0; i < 2; ++i) {
+        if (r_gl_data.sshot.slots[i].fence) glDeleteSync(r_gl_data.sshot.slots[i].fence);
+        if (r_gl_data.sshot.slots[i].pbo) glDeleteBuffers(1, &r_gl_data.sshot.slots[i].pbo);
+        r_gl_data.sshot.slots[i].fence = NULL;
+        r_gl_data.sshot.slots[i].pbo = 0;
+        r_gl_data.sshot.slots[i].size = 0;
+    }
+    r_gl_data.sshot.next = 0;
+    #endif
+}
+
 #define SDL_GL_SetAttribute(a, v) if (SDL_GL_SetAttribute((a), (v))) plog(LL_WARN, "Failed to set " #a " to " #v ": %s", SDL_GetError())
 static bool r_gl_beforeCreateWindow(unsigned* f) {
     switch (rendstate.api) {
@@ -833,10 +2036,31 @@ static bool r_gl_prepRenderer(void) {
     glDepthMask(GL_TRUE);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
+    r_gl_texmgr_init();
+    if (testmodel && !r_gl_testmodeltex) r_gl_testmodeltex = r_gl_newmodeltex(&testmodel->model);
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    #ifdef PSRC_ENGINE_RENDERER_GL_USEGL11
+    if (rendstate.api != RENDAPI_GL11)
+    #endif
+    {
+        if (!r_gl_initinst()) plog(LL_WARN, "Instanced prop rendering is unavailable");
+    }
+    #endif
     return true;
 }
 
 static void r_gl_beforeDestroyWindow(void) {
+    r_gl_freescreenshots();
+    r_gl_freedynres();
+    freeModelBatchCaches(r_gl_freemodelcache);
+    #if defined(PSRC_ENGINE_RENDERER_GL_USEGL33) || defined(PSRC_ENGINE_RENDERER_GL_USEGLES30)
+    r_gl_quitinst();
+    #endif
+    // points into the test model, which is released after this
+    if (testmodel) r_gl_delmodeltex(&testmodel->model, r_gl_testmodeltex);
+    r_gl_testmodeltex = NULL;
+    r_gl_texmgr_quit();
+    r_gl_freelightmaps();
     #ifndef PSRC_USESDL1
         if (r_gl_data.ctx) SDL_GL_DeleteContext(r_gl_data.ctx);
     #endif
@@ -0,0 +1,154 @@
+#include "../rcmgralloc.h"
+
+#include "screenshot.h"
+
+#include "../common/logging.h"
+#include "../common/filesystem.h"
+#include "../common/threading.h"
+
+#include "../common.h"
+#include "../debug.h"
+
+#include "../../stb/stb_image_write.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct screenshot {
+    uint8_t* data;
+    int w, h;
+    int ch;
+    bool bottomup;
+    unsigned seq;
+    time_t time;
+};
+
+static struct {
+    struct screenshot queue[SCREENSHOT_MAXQUEUE];
+    unsigned head, len;
+    unsigned seq;
+    #ifndef PSRC_NOMT
+    bool valid; // the lock and encoder thread are usable
+    mutex_t lock;
+    cond_t wake; // signaled when a screenshot is queued or the thread should stop
+    thread_t thread;
+    #endif
+} sshotstate;
+
+static void encodeScreenshot(struct screenshot* s) {
+    if (!dirs[DIR_SCREENSHOTS]) {
+        plog(LL_WARN, "No screenshot directory, discarding screenshot");
+        free(s->data);
+        return;
+    }
+    md(dirs[DIR_SCREENSHOTS]);
+    char name[64];
+    struct tm t;
+    #if PLATFLAGS & PLATFLAG_WINDOWSLIKE
+    localtime_s(&t, &s->time);
+    #else
+    localtime_r(&s->time, &t);
+    #endif
+    snprintf(
+        name, sizeof(name), "screenshot_%04d%02d%02d_%02d%02d%02d_%04u.png",
+        t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, s->seq % 10000
+    );
+    char* p = mkpath(dirs[DIR_SCREENSHOTS], name, NULL);
+    // the back buffer's alpha is not meaningful
+    if (s->ch == 4) {
+        uint8_t* d = s->data + 3;
+        for (int i = s->w * s->h; i > 0; --i, d += 4) *d = 255;
+    }
+    int stride = s->w * s->ch;
+    bool ok;
+    if (s->bottomup) {
+        // a negative stride writes the rows in reverse without a copy
+        ok = stbi_write_png(p, s->w, s->h, s->ch, s->data + stride * (s->h - 1), -stride);
+    } else {
+        ok = stbi_write_png(p, s->w, s->h, s->ch, s->data, stride);
+    }
+    if (ok) plog(LL_INFO, "Saved screenshot to %s", p);
+    else plog(LL_WARN, "Failed to save screenshot to %s", p);
+    free(p);
+    free(s->data);
+}
+
+#ifndef PSRC_NOMT
+static void* screenshotthread(struct thread_data* td) {
+    plog(LL_INFO, "Screenshot encoder started");
+    lockMutex(&sshotstate.lock);
+    while (1) {
+        while (!sshotstate.len && !td->shouldclose) waitCond(&sshotstate.wake, &sshotstate.lock);
+        // anything still queued is finished before stopping
+        if (!sshotstate.len) break;
+        struct screenshot s = sshotstate.queue[sshotstate.head];
+        sshotstate.head = (sshotstate.head + 1) % SCREENSHOT_MAXQUEUE;
+        --sshotstate.len;
+        unlockMutex(&sshotstate.lock);
+        encodeScreenshot(&s);
+        lockMutex(&sshotstate.lock);
+    }
+    unlockMutex(&sshotstate.lock);
+    plog(LL_INFO, "Screenshot encoder stopped");
+    return NULL;
+}
+#endif
+
+bool queueScreenshot(uint8_t* data, int w, int h, int ch, bool bottomup) {
+    struct screenshot s = {data, w, h, ch, bottomup, sshotstate.seq++, time(NULL)};
+    #ifndef PSRC_NOMT
+    if (!sshotstate.valid) {
+        // no encoder thread, so it is done here
+        encodeScreenshot(&s);
+        return true;
+    }
+    lockMutex(&sshotstate.lock);
+    if (sshotstate.len == SCREENSHOT_MAXQUEUE) {
+        unlockMutex(&sshotstate.lock);
+        plog(LL_WARN, "Screenshot queue is full, dropping screenshot");
+        free(data);
+        return false;
+    }
+    sshotstate.queue[(sshotstate.head + sshotstate.len++) % SCREENSHOT_MAXQUEUE] = s;
+    signalCond(&sshotstate.wake);
+    unlockMutex(&sshotstate.lock);
+    #else
+    encodeScreenshot(&s);
+    #endif
+    return true;
+}
+
+bool initScreenshots(void) {
+    sshotstate.head = 0;
+    sshotstate.len = 0;
+    #ifndef PSRC_NOMT
+    sshotstate.valid = false;
+    if (!createMutex(&sshotstate.lock)) return false;
+    if (!createCond(&sshotstate.wake)) {
+        destroyMutex(&sshotstate.lock);
+        return false;
+    }
+    if (!createThread(&sshotstate.thread, "screenshot", NULL, screenshotthread, NULL)) {
+        destroyCond(&sshotstate.wake);
+        destroyMutex(&sshotstate.lock);
+        return false;
+    }
+    sshotstate.valid = true;
+    #endif
+    return true;
+}
+
+void quitScreenshots(void) {
+    #ifndef PSRC_NOMT
+    if (!sshotstate.valid) return;
+    lockMutex(&sshotstate.lock);
+    quitThread(&sshotstate.thread);
+    signalCond(&sshotstate.wake);
+    unlockMutex(&sshotstate.lock);
+    destroyThread(&sshotstate.thread, NULL);
+    destroyCond(&sshotstate.wake);
+    destroyMutex(&sshotstate.lock);
+    sshotstate.valid = false;
+    #endif
+}
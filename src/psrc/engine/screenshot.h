@@ -0,0 +1,13 @@
+#ifndef PSRC_ENGINE_SCREENSHOT_H
+#define PSRC_ENGINE_SCREENSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCREENSHOT_MAXQUEUE 8
+
+bool initScreenshots(void);
+bool queueScreenshot(uint8_t* data, int w, int h, int ch, bool bottomup); // takes ownership of 'data'
+void quitScreenshots(void); // finishes queued screenshots first
+
+#endif
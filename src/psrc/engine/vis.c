@@ -0,0 +1,591 @@
+#include "../rcmgralloc.h"
+
+#include "vis.h"
+
+#include "../common/logging.h"
+#include "../common/string.h"
+
+#include "../common.h"
+#include "../debug.h"
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#ifndef PSRC_NOSIMD
+    #if defined(__SSE__) || defined(_M_AMD64) || defined(_M_X64)
+        #include <xmmintrin.h>
+        #define VIS_USESSE
+    #elif defined(__ARM_NEON)
+        #include <arm_neon.h>
+        #define VIS_USENEON
+    #endif
+#endif
+
+#define VIS_OCCL_NEARW 0.01f
+
+struct visstate visstate;
+
+static void calcCubeBounds(struct vis_sector* s, uint32_t c, const float min[3], const float max[3]) {
+    struct vis_cube* cube = &s->cubes[c];
+    cube->min[0] = min[0]; cube->min[1] = min[1]; cube->min[2] = min[2];
+    cube->max[0] = max[0]; cube->max[1] = max[1]; cube->max[2] = max[2];
+    cube->visframe = 0;
+    if (cube->type != VIS_CUBE_PARENT) return;
+    float mid[3] = {(min[0] + max[0]) * 0.5f, (min[1] + max[1]) * 0.5f, (min[2] + max[2]) * 0.5f};
+    for (int i = 0; i < 8; ++i) {
+        uint32_t ch = cube->children[i];
+        if (ch == VIS_NOCUBE || ch >= s->cubecount) continue;
+        // PMF child order: bit 0 is -X, bit 1 is -Z, bit 2 is -Y
+        float cmin[3], cmax[3];
+        if (i & 1) {cmin[0] = min[0]; cmax[0] = mid[0];}
+        else {cmin[0] = mid[0]; cmax[0] = max[0];}
+        if (i & 4) {cmin[1] = min[1]; cmax[1] = mid[1];}
+        else {cmin[1] = mid[1]; cmax[1] = max[1];}
+        if (i & 2) {cmin[2] = min[2]; cmax[2] = mid[2];}
+        else {cmin[2] = mid[2]; cmax[2] = max[2];}
+        s->cubes[ch].parent = c;
+        calcCubeBounds(s, ch, cmin, cmax);
+    }
+}
+
+void setVisLevel(struct vis_level* l) {
+    visstate.level = l;
+    visstate.cubes.len = 0;
+    if (!l) return;
+    float sz = l->sectorsize;
+    l->origin[0] = -((float)VIS_SECTIDX_X(l->center) + 0.5f) * sz;
+    l->origin[1] = -((float)VIS_SECTIDX_Y(l->center) + 0.5f) * sz;
+    l->origin[2] = -((float)VIS_SECTIDX_Z(l->center) + 0.5f) * sz;
+    struct vis_sector* s = l->sectors;
+    for (unsigned y = 0; y < l->sizey; ++y) {
+        for (unsigned x = 0; x < l->sizex; ++x) {
+            for (unsigned z = 0; z < l->sizez; ++z) {
+                s->min[0] = l->origin[0] + x * sz;
+                s->min[1] = l->origin[1] + y * sz;
+                s->min[2] = l->origin[2] + z * sz;
+                s->max[0] = s->min[0] + sz;
+                s->max[1] = s->min[1] + sz;
+                s->max[2] = s->min[2] + sz;
+                if (s->cubecount) {
+                    s->cubes[0].parent = VIS_NOCUBE;
+                    calcCubeBounds(s, 0, s->min, s->max);
+                }
+                ++s;
+            }
+        }
+    }
+    #if DEBUG(1)
+    plog(LL_INFO | LF_DEBUG, "Vis level set (%ux%ux%u sectors)", (unsigned)l->sizex, (unsigned)l->sizey, (unsigned)l->sizez);
+    #endif
+}
+
+bool testVisBox(const float min[3], const float max[3]) {
+    for (int p = 0; p < 6; ++p) {
+        const float* f = visstate.frustum[p];
+        float x = (f[0] >= 0.0f) ? max[0] : min[0];
+        float y = (f[1] >= 0.0f) ? max[1] : min[1];
+        float z = (f[2] >= 0.0f) ? max[2] : min[2];
+        if (f[0] * x + f[1] * y + f[2] * z + f[3] < 0.0f) return false;
+    }
+    return true;
+}
+
+static void calcFrustum(float m[4][4]) {
+    // m is column-major (m[col][row]), planes are row 3 +/- rows 0..2
+    for (int i = 0; i < 3; ++i) {
+        float* p = visstate.frustum[i * 2];
+        float* n = visstate.frustum[i * 2 + 1];
+        for (int c = 0; c < 4; ++c) {
+            p[c] = m[c][3] + m[c][i];
+            n[c] = m[c][3] - m[c][i];
+        }
+    }
+}
+
+static bool addCube(struct vis_sector* s, uint32_t c) {
+    if (c >= s->cubecount) return true;
+    struct vis_cube* cube = &s->cubes[c];
+    if (cube->visframe == visstate.frame) return true;
+    cube->visframe = visstate.frame;
+    ++visstate.stats.tested;
+    if (!testVisBox(cube->min, cube->max)) return true;
+    switch (cube->type) {
+        case VIS_CUBE_PARENT: {
+            for (int i = 0; i < 8; ++i) {
+                if (cube->children[i] != VIS_NOCUBE && !addCube(s, cube->children[i])) return false;
+            }
+        } break;
+        case VIS_CUBE_SOLID:
+        case VIS_CUBE_DYNAMIC: {
+            if (!cube->vertcount) break;
+            struct vis_cuberef* r;
+            VLB_NEXTPTR(visstate.cubes, r, 3, 2, plog(LL_CRIT | LF_FUNC, LE_MEMALLOC); return false;);
+            r->sector = s;
+            r->cube = cube;
+            ++visstate.stats.visible;
+        } break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static bool addSector(struct vis_sector* s) {
+    if (!s->cubecount) return true;
+    if (s->cubes[0].visframe == visstate.frame) return true;
+    ++visstate.stats.tested;
+    if (!testVisBox(s->min, s->max)) {
+        s->cubes[0].visframe = visstate.frame;
+        return true;
+    }
+    return addCube(s, 0);
+}
+
+static struct vis_sector* findSector(struct vis_level* l, const float pos[3]) {
+    float x = floorf((pos[0] - l->origin[0]) / l->sectorsize);
+    float y = floorf((pos[1] - l->origin[1]) / l->sectorsize);
+    float z = floorf((pos[2] - l->origin[2]) / l->sectorsize);
+    if (x < 0.0f || y < 0.0f || z < 0.0f) return NULL;
+    if (x >= l->sizex || y >= l->sizey || z >= l->sizez) return NULL;
+    return getVisSector(l, VIS_SECTIDX(y, x, z));
+}
+
+static uint32_t findCube(struct vis_sector* s, const float pos[3]) {
+    uint32_t c = 0;
+    while (s->cubes[c].type == VIS_CUBE_PARENT) {
+        struct vis_cube* cube = &s->cubes[c];
+        int i = 0;
+        if (pos[0] < (cube->min[0] + cube->max[0]) * 0.5f) i |= 1;
+        if (pos[2] < (cube->min[2] + cube->max[2]) * 0.5f) i |= 2;
+        if (pos[1] < (cube->min[1] + cube->max[1]) * 0.5f) i |= 4;
+        uint32_t ch = cube->children[i];
+        if (ch == VIS_NOCUBE || ch >= s->cubecount) break;
+        c = ch;
+    }
+    return c;
+}
+
+static bool addChunk(struct vis_level* l, struct vis_sector* s, uint32_t c) {
+    struct vis_chunk* chunk = s->cubes[c].chunk;
+    if (!addCube(s, c)) return false;
+    for (uint32_t i = 0; i < chunk->cubecount; ++i) {
+        if (!addCube(s, chunk->cubes[i])) return false;
+    }
+    for (uint32_t i = 0; i < chunk->sectorcount; ++i) {
+        struct vis_chunkref* r = &chunk->sectors[i];
+        struct vis_sector* rs = getVisSector(l, r->sector);
+        if (!rs || !rs->cubecount) continue;
+        if (!r->cubecount) {
+            if (!addSector(rs)) return false;
+            continue;
+        }
+        ++visstate.stats.tested;
+        if (!testVisBox(rs->min, rs->max)) continue;
+        for (uint32_t j = 0; j < r->cubecount; ++j) {
+            if (!addCube(rs, r->cubes[j])) return false;
+        }
+    }
+    return true;
+}
+
+struct occlvert {
+    float x, y, w;
+};
+
+static inline bool projOcclVert(const float p[3], struct occlvert* o) {
+    float (*m)[4] = visstate.clipmat;
+    float w = m[0][3] * p[0] + m[1][3] * p[1] + m[2][3] * p[2] + m[3][3];
+    if (w < VIS_OCCL_NEARW) return false;
+    float x = m[0][0] * p[0] + m[1][0] * p[1] + m[2][0] * p[2] + m[3][0];
+    float y = m[0][1] * p[0] + m[1][1] * p[1] + m[2][1] * p[2] + m[3][1];
+    w = 1.0f / w;
+    o->x = (x * w * 0.5f + 0.5f) * visstate.occl.width[0];
+    o->y = (0.5f - y * w * 0.5f) * visstate.occl.height[0];
+    o->w = 1.0f / w;
+    return true;
+}
+
+static void rasterOcclTri(const struct occlvert* a, const struct occlvert* b, const struct occlvert* c) {
+    float area = (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+    if (area > -0.0001f && area < 0.0001f) return;
+    if (area < 0.0f) {
+        const struct occlvert* tmp = b;
+        b = c;
+        c = tmp;
+    }
+    // conservative, the whole triangle uses its farthest depth
+    float depth = a->w;
+    if (b->w > depth) depth = b->w;
+    if (c->w > depth) depth = c->w;
+    int w = visstate.occl.width[0], h = visstate.occl.height[0];
+    int minx = floorf(fminf(a->x, fminf(b->x, c->x)));
+    int maxx = ceilf(fmaxf(a->x, fmaxf(b->x, c->x)));
+    int miny = floorf(fminf(a->y, fminf(b->y, c->y)));
+    int maxy = ceilf(fmaxf(a->y, fmaxf(b->y, c->y)));
+    if (minx < 0) minx = 0;
+    if (miny < 0) miny = 0;
+    if (maxx > w - 1) maxx = w - 1;
+    if (maxy > h - 1) maxy = h - 1;
+    if (minx > maxx || miny > maxy) return;
+    // edge functions in the form e = ex * px + ey * py + ec
+    float ex[3], ey[3], ec[3];
+    const struct occlvert* v[4] = {a, b, c, a};
+    for (int i = 0; i < 3; ++i) {
+        ex[i] = -(v[i + 1]->y - v[i]->y);
+        ey[i] = v[i + 1]->x - v[i]->x;
+        ec[i] = -(ex[i] * v[i]->x + ey[i] * v[i]->y);
+    }
+    int stride = visstate.occl.stride[0];
+    #if defined(VIS_USESSE)
+    minx &= ~3;
+    __m128 vd = _mm_set1_ps(depth);
+    __m128 vz = _mm_setzero_ps();
+    for (int y = miny; y <= maxy; ++y) {
+        float py = y + 0.5f;
+        float* row = visstate.occl.levels[0] + y * stride;
+        __m128 e[3], es[3];
+        for (int i = 0; i < 3; ++i) {
+            e[i] = _mm_set1_ps(ex[i] * (minx + 0.5f) + ey[i] * py + ec[i]);
+            e[i] = _mm_add_ps(e[i], _mm_mul_ps(_mm_set1_ps(ex[i]), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+            es[i] = _mm_set1_ps(ex[i] * 4.0f);
+        }
+        for (int x = minx; x <= maxx; x += 4) {
+            __m128 m = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e[0], vz), _mm_cmpge_ps(e[1], vz)), _mm_cmpge_ps(e[2], vz));
+            __m128 d = _mm_loadu_ps(row + x);
+            d = _mm_or_ps(_mm_and_ps(m, _mm_min_ps(d, vd)), _mm_andnot_ps(m, d));
+            _mm_storeu_ps(row + x, d);
+            e[0] = _mm_add_ps(e[0], es[0]);
+            e[1] = _mm_add_ps(e[1], es[1]);
+            e[2] = _mm_add_ps(e[2], es[2]);
+        }
+    }
+    #elif defined(VIS_USENEON)
+    minx &= ~3;
+    float32x4_t vd = vdupq_n_f32(depth);
+    float32x4_t vz = vdupq_n_f32(0.0f);
+    static const float steps[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    float32x4_t vs = vld1q_f32(steps);
+    for (int y = miny; y <= maxy; ++y) {
+        float py = y + 0.5f;
+        float* row = visstate.occl.levels[0] + y * stride;
+        float32x4_t e[3], es[3];
+        for (int i = 0; i < 3; ++i) {
+            e[i] = vmlaq_n_f32(vdupq_n_f32(ex[i] * (minx + 0.5f) + ey[i] * py + ec[i]), vs, ex[i]);
+            es[i] = vdupq_n_f32(ex[i] * 4.0f);
+        }
+        for (int x = minx; x <= maxx; x += 4) {
+            uint32x4_t m = vandq_u32(vandq_u32(vcgeq_f32(e[0], vz), vcgeq_f32(e[1], vz)), vcgeq_f32(e[2], vz));
+            float32x4_t d = vld1q_f32(row + x);
+            vst1q_f32(row + x, vbslq_f32(m, vminq_f32(d, vd), d));
+            e[0] = vaddq_f32(e[0], es[0]);
+            e[1] = vaddq_f32(e[1], es[1]);
+            e[2] = vaddq_f32(e[2], es[2]);
+        }
+    }
+    #else
+    for (int y = miny; y <= maxy; ++y) {
+        float py = y + 0.5f;
+        float* row = visstate.occl.levels[0] + y * stride;
+        for (int x = minx; x <= maxx; ++x) {
+            float px = x + 0.5f;
+            if (ex[0] * px + ey[0] * py + ec[0] < 0.0f) continue;
+            if (ex[1] * px + ey[1] * py + ec[1] < 0.0f) continue;
+            if (ex[2] * px + ey[2] * py + ec[2] < 0.0f) continue;
+            if (depth < row[x]) row[x] = depth;
+        }
+    }
+    #endif
+}
+
+static void clearOccl(void) {
+    int w = visstate.occl.width[0], h = visstate.occl.height[0], stride = visstate.occl.stride[0];
+    float* row = visstate.occl.levels[0];
+    // padding is left at 0 so it never wins the max when building mips
+    for (int y = 0; y < h; ++y) {
+        int x = 0;
+        #if defined(VIS_USESSE)
+        __m128 vf = _mm_set1_ps(FLT_MAX);
+        for (; x + 4 <= w; x += 4) _mm_storeu_ps(row + x, vf);
+        #elif defined(VIS_USENEON)
+        float32x4_t vf = vdupq_n_f32(FLT_MAX);
+        for (; x + 4 <= w; x += 4) vst1q_f32(row + x, vf);
+        #endif
+        for (; x < w; ++x) row[x] = FLT_MAX;
+        for (; x < stride; ++x) row[x] = 0.0f;
+        row += stride;
+    }
+    memset(row, 0, stride * sizeof(*row));
+}
+
+static void buildOcclMips(void) {
+    for (int l = 1; l < visstate.occl.levelcount; ++l) {
+        const float* src = visstate.occl.levels[l - 1];
+        int sstride = visstate.occl.stride[l - 1];
+        float* dst = visstate.occl.levels[l];
+        int w = visstate.occl.width[l], h = visstate.occl.height[l], dstride = visstate.occl.stride[l];
+        // sources have a zeroed padding column and row, so odd sizes need no special cases
+        for (int y = 0; y < h; ++y) {
+            const float* r0 = src + y * 2 * sstride;
+            const float* r1 = r0 + sstride;
+            float* d = dst + y * dstride;
+            int x = 0;
+            #if defined(VIS_USESSE)
+            for (; x * 2 + 8 <= sstride && x + 4 <= w; x += 4) {
+                __m128 a = _mm_max_ps(_mm_loadu_ps(r0 + x * 2), _mm_loadu_ps(r1 + x * 2));
+                __m128 b = _mm_max_ps(_mm_loadu_ps(r0 + x * 2 + 4), _mm_loadu_ps(r1 + x * 2 + 4));
+                __m128 e = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 o = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+                _mm_storeu_ps(d + x, _mm_max_ps(e, o));
+            }
+            #elif defined(VIS_USENEON)
+            for (; x * 2 + 8 <= sstride && x + 4 <= w; x += 4) {
+                float32x4x2_t a = vld2q_f32(r0 + x * 2);
+                float32x4x2_t b = vld2q_f32(r1 + x * 2);
+                vst1q_f32(d + x, vmaxq_f32(vmaxq_f32(a.val[0], a.val[1]), vmaxq_f32(b.val[0], b.val[1])));
+            }
+            #endif
+            for (; x < w; ++x) {
+                float m = r0[x * 2];
+                if (r0[x * 2 + 1] > m) m = r0[x * 2 + 1];
+                if (r1[x * 2] > m) m = r1[x * 2];
+                if (r1[x * 2 + 1] > m) m = r1[x * 2 + 1];
+                d[x] = m;
+            }
+            for (; x < dstride; ++x) d[x] = 0.0f;
+        }
+        memset(dst + h * dstride, 0, dstride * sizeof(*dst));
+    }
+}
+
+static void updateOccl(void) {
+    visstate.occl.valid = 0;
+    visstate.stats.occltris = 0;
+    if (!visstate.occl.enabled || !visstate.occl.data) return;
+    clearOccl();
+    unsigned tris = 0;
+    for (uintptr_t i = 0; i < visstate.cubes.len && tris < visstate.occl.maxtris; ++i) {
+        struct vis_sector* s = visstate.cubes.data[i].sector;
+        struct vis_cube* c = visstate.cubes.data[i].cube;
+        if (c->type != VIS_CUBE_SOLID) continue;
+        struct vis_vertex* v = &s->verts[c->firstvert];
+        int step = (c->tris) ? 3 : 4;
+        for (unsigned j = 0; j + step <= c->vertcount; j += step, v += step) {
+            struct occlvert o[4];
+            bool ok = true;
+            for (int k = 0; k < step; ++k) {
+                if (!projOcclVert((const float[3]){v[k].x, v[k].y, v[k].z}, &o[k])) {
+                    ok = false;
+                    break;
+                }
+            }
+            // occluders crossing the near plane are skipped instead of clipped
+            if (!ok) continue;
+            rasterOcclTri(&o[0], &o[1], &o[2]);
+            ++tris;
+            if (step == 4) {
+                rasterOcclTri(&o[0], &o[2], &o[3]);
+                ++tris;
+            }
+        }
+    }
+    if (!tris) return;
+    buildOcclMips();
+    visstate.occl.valid = 1;
+    visstate.stats.occltris = tris;
+}
+
+bool testVisOcclusion(const float min[3], const float max[3]) {
+    if (!visstate.occl.valid) return true;
+    ++visstate.stats.occltested;
+    float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX, nearw = FLT_MAX;
+    for (int i = 0; i < 8; ++i) {
+        float p[3] = {(i & 1) ? max[0] : min[0], (i & 2) ? max[1] : min[1], (i & 4) ? max[2] : min[2]};
+        struct occlvert o;
+        if (!projOcclVert(p, &o)) return true;
+        if (o.x < x0) x0 = o.x;
+        if (o.x > x1) x1 = o.x;
+        if (o.y < y0) y0 = o.y;
+        if (o.y > y1) y1 = o.y;
+        if (o.w < nearw) nearw = o.w;
+    }
+    int w = visstate.occl.width[0], h = visstate.occl.height[0];
+    if (x0 < 0.0f) x0 = 0.0f;
+    if (y0 < 0.0f) y0 = 0.0f;
+    if (x1 > w - 1) x1 = w - 1;
+    if (y1 > h - 1) y1 = h - 1;
+    if (x0 > x1 || y0 > y1) return true;
+    int ix0 = x0, iy0 = y0, ix1 = x1, iy1 = y1;
+    int l = 0;
+    while ((ix1 - ix0 > 1 || iy1 - iy0 > 1) && l < visstate.occl.levelcount - 1) {
+        ix0 >>= 1; iy0 >>= 1; ix1 >>= 1; iy1 >>= 1;
+        ++l;
+    }
+    const float* buf = visstate.occl.levels[l];
+    int stride = visstate.occl.stride[l];
+    for (int y = iy0; y <= iy1; ++y) {
+        for (int x = ix0; x <= ix1; ++x) {
+            if (nearw <= buf[y * stride + x]) return true;
+        }
+    }
+    ++visstate.stats.occlculled;
+    return false;
+}
+
+// clips 't0' to 't1' along 'o + d * t' to the box
+static bool clipSegBox(const float o[3], const float d[3], const float min[3], const float max[3], float* t0, float* t1) {
+    float a = *t0, b = *t1;
+    for (int i = 0; i < 3; ++i) {
+        if (d[i] == 0.0f) {
+            if (o[i] < min[i] || o[i] > max[i]) return false;
+            continue;
+        }
+        float inv = 1.0f / d[i];
+        float n = (min[i] - o[i]) * inv;
+        float f = (max[i] - o[i]) * inv;
+        if (n > f) {
+            float tmp = n;
+            n = f;
+            f = tmp;
+        }
+        if (n > a) a = n;
+        if (f < b) b = f;
+        if (a >= b) return false;
+    }
+    *t0 = a;
+    *t1 = b;
+    return true;
+}
+static float traceCube(const struct vis_sector* s, uint32_t c, const float o[3], const float d[3], float t0, float t1) {
+    if (c >= s->cubecount) return 0.0f;
+    const struct vis_cube* cube = &s->cubes[c];
+    if (cube->type == VIS_CUBE_EMPTY || !clipSegBox(o, d, cube->min, cube->max, &t0, &t1)) return 0.0f;
+    if (cube->type != VIS_CUBE_PARENT) return t1 - t0;
+    float t = 0.0f;
+    for (int i = 0; i < 8; ++i) {
+        if (cube->children[i] != VIS_NOCUBE) t += traceCube(s, cube->children[i], o, d, t0, t1);
+    }
+    return t;
+}
+float traceVisSolid(struct vis_level* l, const float from[3], const float to[3]) {
+    float d[3] = {to[0] - from[0], to[1] - from[1], to[2] - from[2]};
+    float len = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    if (!(len > 0.0f)) return 0.0f;
+    // every sector the segment's bounds touch, most are skipped by the box test
+    int lo[3], hi[3];
+    int size[3] = {l->sizex, l->sizey, l->sizez};
+    for (int i = 0; i < 3; ++i) {
+        float a = (fminf(from[i], to[i]) - l->origin[i]) / l->sectorsize;
+        float b = (fmaxf(from[i], to[i]) - l->origin[i]) / l->sectorsize;
+        if (!(b >= 0.0f) || !(a < size[i])) return 0.0f;
+        lo[i] = (a > 0.0f) ? (int)a : 0;
+        hi[i] = (b < size[i] - 1) ? (int)b : size[i] - 1;
+    }
+    float t = 0.0f;
+    for (int y = lo[1]; y <= hi[1]; ++y) {
+        for (int x = lo[0]; x <= hi[0]; ++x) {
+            for (int z = lo[2]; z <= hi[2]; ++z) {
+                const struct vis_sector* s = &l->sectors[(y * l->sizex + x) * l->sizez + z];
+                if (!s->cubecount) continue;
+                float t0 = 0.0f, t1 = 1.0f;
+                if (clipSegBox(from, d, s->min, s->max, &t0, &t1)) t += traceCube(s, 0, from, d, t0, t1);
+            }
+        }
+    }
+    return t * len;
+}
+
+void updateVis(const float campos[3], float clipmat[4][4]) {
+    visstate.cubes.len = 0;
+    visstate.occl.valid = 0;
+    visstate.stats.tested = 0;
+    visstate.stats.visible = 0;
+    visstate.stats.occltested = 0;
+    visstate.stats.occlculled = 0;
+    visstate.stats.usedpvs = 0;
+    memcpy(visstate.clipmat, clipmat, sizeof(visstate.clipmat));
+    calcFrustum(clipmat);
+    struct vis_level* l = visstate.level;
+    if (!l) return;
+    if (!++visstate.frame) visstate.frame = 1;
+    struct vis_sector* s = findSector(l, campos);
+    if (s && s->cubecount) {
+        uint32_t c = findCube(s, campos);
+        while (c != VIS_NOCUBE && !s->cubes[c].chunk) c = s->cubes[c].parent;
+        if (c != VIS_NOCUBE) {
+            visstate.stats.usedpvs = 1;
+            if (addChunk(l, s, c)) updateOccl();
+            return;
+        }
+    }
+    // outside of the map or no chunk data, fall back to frustum culling everything
+    uint32_t ct = (uint32_t)l->sizex * l->sizey * l->sizez;
+    for (uint32_t i = 0; i < ct; ++i) {
+        if (!addSector(&l->sectors[i])) return;
+    }
+    updateOccl();
+}
+
+static bool initOccl(int w, int h) {
+    size_t sz = 0;
+    int l = 0;
+    while (1) {
+        visstate.occl.width[l] = w;
+        visstate.occl.height[l] = h;
+        // room for at least one zeroed padding column, kept a multiple of 4 for SIMD
+        visstate.occl.stride[l] = (w + 4) & ~3;
+        sz += (size_t)visstate.occl.stride[l] * (h + 1);
+        ++l;
+        if ((w == 1 && h == 1) || l == VIS_OCCL_MAXLEVELS) break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    visstate.occl.levelcount = l;
+    visstate.occl.data = malloc(sz * sizeof(*visstate.occl.data));
+    if (!visstate.occl.data) {
+        plog(LL_ERROR | LF_FUNC, LE_MEMALLOC);
+        return false;
+    }
+    float* p = visstate.occl.data;
+    for (int i = 0; i < l; ++i) {
+        visstate.occl.levels[i] = p;
+        p += visstate.occl.stride[i] * (visstate.occl.height[i] + 1);
+    }
+    return true;
+}
+
+bool initVis(void) {
+    VLB_INIT(visstate.cubes, 256, plog(LL_CRIT | LF_FUNC, LE_MEMALLOC); return false;);
+    char* tmp = cfg_getvar(&config, "Renderer", "occlusion");
+    visstate.occl.enabled = strbool(tmp, true);
+    free(tmp);
+    if (visstate.occl.enabled) {
+        int w = 128, h = 64;
+        tmp = cfg_getvar(&config, "Renderer", "occlusion.res");
+        if (tmp) {
+            sscanf(tmp, "%dx%d", &w, &h);
+            free(tmp);
+        }
+        if (w < 8) w = 8;
+        else if (w > VIS_OCCL_MAXRES) w = VIS_OCCL_MAXRES;
+        if (h < 8) h = 8;
+        else if (h > VIS_OCCL_MAXRES) h = VIS_OCCL_MAXRES;
+        tmp = cfg_getvar(&config, "Renderer", "occlusion.maxtris");
+        if (tmp) {
+            visstate.occl.maxtris = strtoul(tmp, NULL, 10);
+            free(tmp);
+        } else {
+            visstate.occl.maxtris = 4096;
+        }
+        if (!initOccl(w, h)) visstate.occl.enabled = 0;
+    }
+    return true;
+}
+
+void quitVis(void) {
+    visstate.level = NULL;
+    VLB_FREE(visstate.cubes);
+    free(visstate.occl.data);
+    visstate.occl.data = NULL;
+    visstate.occl.valid = 0;
+}
@@ -0,0 +1,161 @@
+#ifndef PSRC_ENGINE_VIS_H
+#define PSRC_ENGINE_VIS_H
+
+#include "../common/vlb.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../attribs.h"
+
+// sector index as stored in PMF (8 bits Y, 12 bits X, 12 bits Z)
+#define VIS_SECTIDX(y, x, z) (((uint32_t)(y) << 24) | ((uint32_t)(x) << 12) | (uint32_t)(z))
+#define VIS_SECTIDX_Y(i) ((uint32_t)(i) >> 24)
+#define VIS_SECTIDX_X(i) (((uint32_t)(i) >> 12) & 0xFFF)
+#define VIS_SECTIDX_Z(i) ((uint32_t)(i) & 0xFFF)
+
+#define VIS_NOCUBE UINT32_MAX
+
+#define VIS_OCCL_MAXLEVELS 8
+#define VIS_OCCL_MAXRES 1024 // per side, the buffer is software rasterized every frame
+
+PACKEDENUM vis_cubetype {
+    VIS_CUBE_EMPTY,
+    VIS_CUBE_PARENT,
+    VIS_CUBE_SOLID,
+    VIS_CUBE_DYNAMIC
+};
+
+#pragma pack(push, 1)
+struct vis_vertex {
+    float x, y, z;
+    float u, v;
+    float lmu, lmv;
+};
+#pragma pack(pop)
+
+struct vis_lightmap {
+    uint8_t* data; // RGB luxels
+    uint8_t sizelog; // 2^(n) size
+    uint16_t x, y; // position in the lightmap atlas, set by setLightmapLevel()
+};
+
+struct vis_lightdata {
+    uint8_t lightmap;
+    uint8_t* data; // RGB luxels, same size as the lightmap
+    uint16_t minx, miny, maxx, maxy; // bounds of the non-zero luxels, set by setLightmapLevel()
+};
+struct vis_light {
+    uint32_t id; // global ID
+    uint8_t color[3];
+    uint8_t enabled : 1;
+    uint8_t intensity; // always 255 for dynamic lights
+    uint8_t applied; // intensity currently added to the atlas, used internally
+    uint8_t lightmapcount;
+    struct vis_lightdata* lightmaps;
+};
+
+struct vis_chunkref {
+    uint32_t sector; // VIS_SECTIDX
+    uint32_t cubecount; // 0 means all
+    uint32_t* cubes;
+};
+struct vis_chunk {
+    uint32_t cubecount;
+    uint32_t* cubes;
+    uint32_t sectorcount;
+    struct vis_chunkref* sectors;
+};
+
+struct vis_cube {
+    float min[3];
+    float max[3];
+    struct vis_chunk* chunk; // NULL if the cube has no chunk data
+    uint32_t parent; // VIS_NOCUBE for the root cube
+    uint32_t children[8]; // PMF order, VIS_NOCUBE if there is no child
+    uint32_t firstvert; // index in 'verts' of 'struct vis_sector'
+    uint16_t vertcount;
+    uint8_t tris : 1; // verts are triangles instead of quads (extended cubes)
+    uint8_t facevertcount[6]; // vertex count per face (+X, +Y, +Z, -X, -Y, -Z)
+    uint8_t lightmaps[6]; // lightmap per face
+    enum vis_cubetype type;
+    uint32_t visframe; // used internally
+};
+
+struct vis_sector {
+    float min[3];
+    float max[3];
+    struct vis_cube* cubes; // cube 0 is the root
+    struct vis_vertex* verts;
+    struct vis_lightmap* lightmaps;
+    struct vis_light* dynlights;
+    struct vis_light* fastlights;
+    uint32_t cubecount;
+    uint32_t vertcount;
+    uint8_t lightmapcount;
+    uint8_t dynlightcount;
+    uint8_t fastlightcount;
+    int16_t lmatlas; // -1 if the lightmaps are not in an atlas, set by setLightmapLevel()
+};
+
+struct vis_level {
+    struct vis_sector* sectors; // ordered by [Y][X][Z]
+    float sectorsize;
+    float origin[3]; // min corner of sector (0, 0, 0)
+    uint32_t center; // VIS_SECTIDX
+    uint16_t sizex, sizey, sizez;
+};
+
+struct vis_cuberef {
+    struct vis_sector* sector;
+    struct vis_cube* cube;
+};
+
+struct visstate {
+    struct vis_level* level;
+    float clipmat[4][4];
+    float frustum[6][4];
+    uint32_t frame;
+    struct VLB(struct vis_cuberef) cubes; // visible cubes from the last updateVis()
+    struct {
+        float* data;
+        float* levels[VIS_OCCL_MAXLEVELS]; // farthest depth (clip w) per texel
+        int width[VIS_OCCL_MAXLEVELS];
+        int height[VIS_OCCL_MAXLEVELS];
+        int stride[VIS_OCCL_MAXLEVELS];
+        uint8_t levelcount;
+        uint8_t enabled : 1;
+        uint8_t valid : 1;
+        unsigned maxtris;
+    } occl;
+    struct {
+        uint32_t tested;
+        uint32_t visible;
+        uint32_t occltris;
+        uint32_t occltested;
+        uint32_t occlculled;
+        uint8_t usedpvs : 1;
+    } stats;
+};
+
+extern struct visstate visstate;
+
+bool initVis(void);
+void setVisLevel(struct vis_level*);
+void updateVis(const float campos[3], float clipmat[4][4]);
+bool testVisBox(const float min[3], const float max[3]);
+bool testVisOcclusion(const float min[3], const float max[3]);
+static inline bool isVisBoxVisible(const float min[3], const float max[3]) {
+    return testVisBox(min, max) && testVisOcclusion(min, max);
+}
+// length of the segment inside solid and dynamic cubes, only reads the level so it is safe to call from any thread
+float traceVisSolid(struct vis_level*, const float from[3], const float to[3]);
+void quitVis(void);
+
+static inline struct vis_sector* getVisSector(struct vis_level* l, uint32_t i) {
+    uint32_t y = VIS_SECTIDX_Y(i), x = VIS_SECTIDX_X(i), z = VIS_SECTIDX_Z(i);
+    if (y >= l->sizey || x >= l->sizex || z >= l->sizez) return NULL;
+    return &l->sectors[(y * l->sizex + x) * l->sizez + z];
+}
+
+#endif
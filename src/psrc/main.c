@@ -89,7 +89,7 @@ static void* watchdog(struct thread_data* td) {
     return NULL;
 }
 static void armWatchdog(unsigned sec) {
-    createThread(&watchdogthread, "watchdog", watchdog, (void*)sec);
+    createThread(&watchdogthread, "watchdog", NULL, watchdog, (void*)sec);
 }
 static void cancelWatchdog(void) {
     killwatchdog = true;
@@ -98,7 +98,7 @@ static void cancelWatchdog(void) {
 static void rearmWatchdog(unsigned sec) {
     killwatchdog = true;
     destroyThread(&watchdogthread, NULL);
-    createThread(&watchdogthread, "watchdog", watchdog, (void*)sec);
+    createThread(&watchdogthread, "watchdog", NULL, watchdog, (void*)sec);
 }
 #endif
 
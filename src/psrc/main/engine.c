@@ -2,6 +2,8 @@
 #include "../engine/input.h"
 #include "../engine/ui.h"
 #include "../engine/audio.h"
+#include "../engine/audiomix.h"
+#include "../engine/screenshot.h"
 #include "../common/arg.h"
 #if DEBUG(1)
     #include "../common/profiling.h"
@@ -20,6 +22,198 @@ static uint64_t framestamp;
     static bool printprof;
 #endif
 
+static struct {
+    uint64_t period; // 0 if not limiting
+    uint64_t next; // target time for the next frame to start
+    uint64_t spin; // how much of the wait is spent spinning instead of sleeping
+    uint64_t workstart;
+    uint64_t workavg; // smoothed time from input sampling to the end of the frame
+    uint8_t lowlatency : 1; // delay input sampling so the frame finishes right at 'next'
+    struct {
+        uint64_t laststart;
+        uint64_t sum;
+        uint64_t max;
+        unsigned count;
+    } jitter;
+} framepacer;
+
+static struct {
+    uint8_t active : 1;
+    unsigned burst; // frames per capture, 0 to keep capturing until pressed again
+    unsigned interval; // capture every Nth frame
+    unsigned left;
+    unsigned wait;
+} sshotcap;
+
+static struct {
+    bool enabled;
+    struct cfg opts;
+} audiobench;
+
+static const char* audiobenchfmt(struct rc_sound* rc) {
+    switch ((uint8_t)rc->format) {
+        case RC_SOUND_FRMT_WAV: return (rc->is8bit) ? "WAV 8-bit" : "WAV 16-bit";
+        case RC_SOUND_FRMT_VORBIS: return "Vorbis";
+        #ifdef PSRC_USEMINIMP3
+        case RC_SOUND_FRMT_MP3: return "MP3";
+        #endif
+    }
+    return "?";
+}
+
+// Mixes the same scene once per sound in the list and prints throughput and the cost of each voice (the cost
+// of mixing an empty scene is subtracted out). Audio is mixed in one buffer steps so the per-update work is
+// included like it would be in game.
+static int runAudioBench(void) {
+    char* tmp;
+    unsigned voices = 64;
+    if ((tmp = cfg_getvar(&audiobench.opts, NULL, "voices"))) {
+        voices = atoi(tmp);
+        free(tmp);
+    }
+    float seconds = 10.0f;
+    if ((tmp = cfg_getvar(&audiobench.opts, NULL, "seconds"))) {
+        seconds = atof(tmp);
+        free(tmp);
+    }
+    tmp = cfg_getvar(&audiobench.opts, NULL, "filters");
+    bool filters = strbool(tmp, false);
+    free(tmp);
+    tmp = cfg_getvar(&audiobench.opts, NULL, "reverb");
+    bool reverb = strbool(tmp, false);
+    free(tmp);
+    char* out = cfg_getvar(&audiobench.opts, NULL, "out");
+    int ct;
+    tmp = cfg_getvar(&audiobench.opts, NULL, "sounds");
+    char** l = splitstrlist((tmp) ? tmp : "sounds/ac1", ',', false, &ct);
+    free(tmp);
+    cfg_close(&audiobench.opts);
+
+    cfg_setvar(&config, "Audio", "output", (out) ? "wav" : "null", true);
+    if (out) cfg_setvar(&config, "Audio", "output.file", out, true);
+    free(out);
+    char vs[16];
+    snprintf(vs, sizeof(vs), "%u", voices);
+    cfg_setvar(&config, "Audio", "worldvoices", vs, true);
+
+    plog(LL_INFO, "Initializing audio manager...");
+    if (!initAudio()) {
+        plog(LL_CRIT | LF_FUNCLN, "Failed to init audio manager");
+        free(*l);
+        free(l);
+        return 1;
+    }
+    plog(LL_INFO, "Starting audio manager...");
+    if (!startAudio() || !audiostate.valid) {
+        plog(LL_CRIT | LF_FUNCLN, "Failed to start audio manager");
+        quitAudio();
+        free(*l);
+        free(l);
+        return 1;
+    }
+    if (reverb) editSoundEnv(SOUNDENV_REVERB(0.07, 0.9, 0.5, 0.6, 0.15));
+
+    int buflen = audiostate.audbuf.len;
+    unsigned buffers = seconds * audiostate.freq / buflen;
+    if (!buffers) buffers = 1;
+    double audiotime = (double)buffers * buflen / audiostate.freq;
+    printf("Audio benchmark: %u voices, %u x %d samples at %d Hz (%.2fs), filters %s, reverb %s, %s kernels\n",
+        voices, buffers, buflen, audiostate.freq, audiotime, (filters) ? "on" : "off", (reverb) ? "on" : "off",
+        audiomixkern.name);
+
+    uint64_t t = altutime();
+    for (unsigned i = 0; i < buffers; ++i) renderAudio(1);
+    uint64_t basetime = altutime() - t;
+    printf("  Empty scene: %.3fms (%.1fx real time)\n", basetime / 1000.0, audiotime * 1000000.0 / basetime);
+
+    int* emitters = malloc(voices * sizeof(*emitters));
+    for (unsigned i = 0; i < voices; ++i) {
+        // spread the voices around the listener at different distances
+        float a = i * 2.0f * (float)M_PI / voices;
+        float d = 2.0f + (i % 8) * 2.0f;
+        emitters[i] = newAudioEmitter(1, false, SOUNDFX_POS(sinf(a) * d, 0.0, cosf(a) * d));
+    }
+    for (int si = 0; si < ct; ++si) {
+        struct charbuf e;
+        cb_init(&e, 128);
+        struct rc_sound* rc = getRc(RC_SOUND, l[si], &audiostate.soundrcopt, 0, &e);
+        if (!rc) {
+            printf("  %s: Failed to load: %s\n", l[si], cb_peek(&e));
+            cb_dump(&e);
+            continue;
+        }
+        cb_dump(&e);
+        for (unsigned i = 0; i < voices; ++i) {
+            if (filters) {
+                playSound(emitters[i], rc, SOUNDFLAG_LOOP | SOUNDFLAG_WRAP, SOUNDFX_LPFILT(0.5), SOUNDFX_HPFILT(0.25));
+            } else {
+                playSound(emitters[i], rc, SOUNDFLAG_LOOP | SOUNDFLAG_WRAP);
+            }
+        }
+        t = altutime();
+        for (unsigned i = 0; i < buffers; ++i) renderAudio(1);
+        t = altutime() - t;
+        uint64_t vt = (t > basetime) ? t - basetime : 0;
+        printf("  %s (%s, %s, %d Hz): %.3fms, %.0f samples/s (%.1fx real time), %.2fns per voice sample\n",
+            l[si], audiobenchfmt(rc), (rc->channels == 1) ? "mono" : "stereo", rc->freq,
+            t / 1000.0, (double)buffers * buflen * 1000000.0 / t, audiotime * 1000000.0 / t,
+            (voices) ? vt * 1000.0 / ((double)buffers * buflen * voices) : 0.0);
+        for (unsigned i = 0; i < voices; ++i) stopAudioEmitter(emitters[i]);
+        rlsRc(rc, false);
+    }
+    free(*l);
+    free(l);
+    for (unsigned i = 0; i < voices; ++i) deleteAudioEmitter(emitters[i]);
+    free(emitters);
+
+    plog(LL_INFO, "Stopping audio manager...");
+    stopAudio();
+    plog(LL_INFO, "Quitting audio manager...");
+    quitAudio();
+    quitreq = 1;
+    return 0;
+}
+
+static void paceFrame(void) {
+    #if PLATFORM != PLAT_EMSCR
+    // vsync already paces the loop when it is on
+    framepacer.period = (rendstate.fps > 0 && !rendstate.vsync) ? 1000000 / rendstate.fps : 0;
+    #endif
+    if (!framepacer.period) {
+        framepacer.workstart = altutime();
+        return;
+    }
+    uint64_t target = framepacer.next;
+    if (framepacer.lowlatency) {
+        uint64_t w = framepacer.workavg + framepacer.workavg / 8;
+        target = (w < target) ? target - w : 0;
+    }
+    uint64_t t = altutime();
+    if (t < target) {
+        // sleeps can overshoot by the timer granularity, so the tail is spun
+        if (target - t > framepacer.spin) microwait(target - t - framepacer.spin);
+        while ((t = altutime()) < target) {}
+    }
+    if (framepacer.jitter.laststart) {
+        uint64_t d = t - framepacer.jitter.laststart;
+        d = (d > framepacer.period) ? d - framepacer.period : framepacer.period - d;
+        framepacer.jitter.sum += d;
+        if (d > framepacer.jitter.max) framepacer.jitter.max = d;
+        ++framepacer.jitter.count;
+    }
+    framepacer.jitter.laststart = t;
+    framepacer.workstart = t;
+}
+
+static void endFramePacing(uint64_t t) {
+    if (!framepacer.period) return;
+    uint64_t w = t - framepacer.workstart;
+    framepacer.workavg = (framepacer.workavg * 7 + w) / 8;
+    framepacer.next += framepacer.period;
+    // fell too far behind, don't try to catch up with a burst of frames
+    if (t > framepacer.next + framepacer.period) framepacer.next = t;
+}
+
 PACKEDENUM action {
     ACTION_NONE,
     ACTION_MENU,
@@ -65,6 +259,8 @@ static inline void printprofpoint(uint8_t r, uint8_t g, uint8_t b, unsigned t, u
 #endif
 
 int initLoop(void) {
+    if (audiobench.enabled) return runAudioBench();
+
     plog(LL_INFO, "Initializing renderer...");
     if (!initRenderer()) {
         plog(LL_CRIT | LF_MSGBOX | LF_FUNCLN, "Failed to init renderer");
@@ -75,6 +271,9 @@ int initLoop(void) {
         plog(LL_CRIT | LF_MSGBOX | LF_FUNCLN, "Failed to init input manager");
         return 1;
     }
+    if (!initScreenshots()) {
+        plog(LL_WARN, "Failed to init screenshot encoder");
+    }
     plog(LL_INFO, "Initializing audio manager...");
     if (!initAudio()) {
         plog(LL_CRIT | LF_MSGBOX | LF_FUNCLN, "Failed to init audio manager");
@@ -132,7 +331,7 @@ int initLoop(void) {
         playSound(testemt_map, test, SOUNDFLAG_LOOP | SOUNDFLAG_WRAP, SOUNDFX_POS(0.0, 0.0, 2.0));
         rlsRc(test, false);
     }
-    if ((test = getRc(RC_SOUND, "sounds/siren", &audiostate.soundrcopt, 0, NULL))) {
+    if ((test = getRc(RC_SOUND, "sounds/siren", &audiostate.sfxrcopt, 0, NULL))) {
         playSound(testemt_map, test, 0, SOUNDFX_POS(0.0, 1.0, 0.0));
         rlsRc(test, false);
     }
@@ -144,7 +343,7 @@ int initLoop(void) {
         playSound(testemt_map, test, SOUNDFLAG_LOOP | SOUNDFLAG_WRAP, SOUNDFX_POS(-5.0, 1.0, -20.0));
         rlsRc(test, false);
     }
-    if ((test = getRc(RC_SOUND, "sounds/env/drip1", &audiostate.soundrcopt, 0, NULL))) {
+    if ((test = getRc(RC_SOUND, "sounds/env/drip1", &audiostate.sfxrcopt, 0, NULL))) {
         playSound(testemt_map, test, SOUNDFLAG_LOOP | SOUNDFLAG_WRAP, SOUNDFX_POS(0.0, -1.0, -20.0));
         rlsRc(test, false);
     }
@@ -152,7 +351,7 @@ int initLoop(void) {
         playSound(testemt_map, test, SOUNDFLAG_LOOP | SOUNDFLAG_WRAP, SOUNDFX_POS(5.0, 1.0, -20.0));
         rlsRc(test, false);
     }
-    if ((test = getRc(RC_SOUND, "sounds/env/drip2", &audiostate.soundrcopt, 0, NULL))) {
+    if ((test = getRc(RC_SOUND, "sounds/env/drip2", &audiostate.sfxrcopt, 0, NULL))) {
         playSound(testemt_obj, test, SOUNDFLAG_LOOP);
         rlsRc(test, false);
     }
@@ -274,9 +473,36 @@ int initLoop(void) {
         rendstate.dbgprof = &dbgprof;
     #endif
 
+    tmp = cfg_getvar(&config, "Renderer", "fps.spin");
+    if (tmp) {
+        framepacer.spin = strtoul(tmp, NULL, 10);
+        free(tmp);
+    } else {
+        framepacer.spin = 1500;
+    }
+    tmp = cfg_getvar(&config, "Renderer", "lowlatency");
+    framepacer.lowlatency = strbool(tmp, false);
+    free(tmp);
+    tmp = cfg_getvar(&config, "Renderer", "screenshot.burst");
+    if (tmp) {
+        sshotcap.burst = strtoul(tmp, NULL, 10);
+        free(tmp);
+    } else {
+        sshotcap.burst = 1;
+    }
+    tmp = cfg_getvar(&config, "Renderer", "screenshot.interval");
+    if (tmp) {
+        sshotcap.interval = strtoul(tmp, NULL, 10);
+        free(tmp);
+        if (sshotcap.interval < 1) sshotcap.interval = 1;
+    } else {
+        sshotcap.interval = 1;
+    }
+
     plog(LL_INFO, "All systems go!");
     toff = SDL_GetTicks();
     framestamp = altutime();
+    framepacer.next = framestamp;
 
     return 0;
 }
@@ -287,6 +513,8 @@ static float fwrap(float n, float d) {
     return tmp;
 }
 void doLoop(void) {
+    paceFrame();
+
     #if DEBUG(1)
     prof_start(&dbgprof);
     #endif
@@ -345,8 +573,6 @@ void doLoop(void) {
     prof_end(&dbgprof);
     #endif
 
-    static bool screenshot = false;
-
     bool walk = false;
     float movex = 0.0f, movez = 0.0f, movey = 0.0f;
     float lookx = 0.0f, looky = 0.0f;
@@ -359,7 +585,15 @@ void doLoop(void) {
         switch ((enum action)(uintptr_t)a.userdata) {
             case ACTION_MENU: ++quitreq; break;
             case ACTION_FULLSCREEN: updateRendererConfig(RENDOPT_FULLSCREEN, -1, RENDOPT_END); break;
-            case ACTION_SCREENSHOT: screenshot = true; break;
+            case ACTION_SCREENSHOT:
+                if (sshotcap.active && !sshotcap.burst) {
+                    sshotcap.active = false;
+                } else {
+                    sshotcap.active = true;
+                    sshotcap.left = sshotcap.burst;
+                    sshotcap.wait = 0;
+                }
+                break;
             case ACTION_MOVE_FORWARDS: movez += (float)a.amount / 32767.0f; break;
             case ACTION_MOVE_BACKWARDS: movez -= (float)a.amount / 32767.0f; break;
             case ACTION_MOVE_LEFT: movex -= (float)a.amount / 32767.0f; break;
@@ -418,6 +652,15 @@ void doLoop(void) {
     prof_begin(&dbgprof, DBGPROF_RENDERER);
     #endif
     render();
+    if (sshotcap.active) {
+        // if the renderer is still busy with earlier captures, try again next frame
+        if (sshotcap.wait) {
+            --sshotcap.wait;
+        } else if (requestScreenshot()) {
+            sshotcap.wait = sshotcap.interval - 1;
+            if (sshotcap.left && !--sshotcap.left) sshotcap.active = false;
+        }
+    }
     #if DEBUG(1)
     prof_begin(&dbgprof, DBGPROF_RCMGR);
     #endif
@@ -425,25 +668,25 @@ void doLoop(void) {
     #if DEBUG(1)
     prof_begin(&dbgprof, DBGPROF_RENDSWAP);
     #endif
+    // the swap can block on vsync, so it is left out of what the resolution scaler sees
+    uint64_t worktime = altutime() - framepacer.workstart;
     display();
     #if DEBUG(1)
     prof_end(&dbgprof);
     #endif
 
-    if (screenshot) {
-        int sz;
-        void* d = takeScreenshot(NULL, NULL, &sz);
-        FILE* f = fopen("screenshot.data", "wb");
-        fwrite(d, 1, sz, f);
-        fclose(f);
-        free(d);
-        screenshot = false;
+    {
+        int w, h, ch;
+        void* d;
+        while ((d = getScreenshot(&w, &h, &ch))) queueScreenshot(d, w, h, ch, true);
     }
 
     uint64_t tmputime = altutime();
     uint64_t frametime = tmputime - framestamp;
     framestamp = tmputime;
     framemult = frametime / 1000000.0;
+    endFramePacing(tmputime);
+    updateDynRes(worktime);
 
     #if DEBUG(1)
         static uint64_t fpstime = 0;
@@ -459,8 +702,18 @@ void doLoop(void) {
             if (printfps) {
                 uint64_t avgframetime = fpsframetime / fpsframecount;
                 double avgfps = 1000000.0 / (uint64_t)avgframetime;
-                printf("FPS: %.03f (%.03fms)\n", avgfps, avgframetime / 1000.0);
+                if (framepacer.jitter.count) {
+                    printf(
+                        "FPS: %.03f (%.03fms, jitter: %.03fms avg, %.03fms max)\n", avgfps, avgframetime / 1000.0,
+                        framepacer.jitter.sum / framepacer.jitter.count / 1000.0, framepacer.jitter.max / 1000.0
+                    );
+                } else {
+                    printf("FPS: %.03f (%.03fms)\n", avgfps, avgframetime / 1000.0);
+                }
             }
+            framepacer.jitter.sum = 0;
+            framepacer.jitter.max = 0;
+            framepacer.jitter.count = 0;
             fpsframetime = 0;
             fpsframecount = 0;
             if (profcurwait <= 0) {
@@ -491,6 +744,8 @@ void doLoop(void) {
 }
 
 void quitLoop(void) {
+    if (audiobench.enabled) return;
+
     plog(LL_INFO, "Quit requested");
 
     #if PLATFORM == PLAT_NXDK && !defined(PSRC_NOMT)
@@ -507,6 +762,8 @@ void quitLoop(void) {
     cancelWatchdog();
     #endif
 
+    plog(LL_INFO, "Finishing screenshots...");
+    quitScreenshots();
     plog(LL_INFO, "Quitting audio manager...");
     quitAudio();
     plog(LL_INFO, "Quitting input manager...");
@@ -558,6 +815,9 @@ static int parseargs(int argc, char** argv) {
             puts("    -{config|cfg|c}=FILE        Set the config file path.");
             puts("    -{nouserconfig|nousercfg}   Do not load the user config.");
             puts("    -nocontroller               Do not init controllers.");
+            puts("    -audiobench [VAR=VAL]...    Benchmark the audio mixer instead of running the game.");
+            puts("                                VAR is voices, sounds (list of sound resources), seconds,");
+            puts("                                filters, reverb, or out (WAV file to mix into).");
             ret = 0;
         } else if (!strcmp(opt.data, "version")) {
             e = args_getoptval(&a, 0, -1, &val, &err);
@@ -689,6 +949,40 @@ static int parseargs(int argc, char** argv) {
                 break;
             }
             options.nocontroller = true;
+        } else if (!strcmp(opt.data, "audiobench")) {
+            e = args_getoptval(&a, 0, -1, &val, &err);
+            if (e == -1) {
+                fprintf(stderr, "-%s: %s\n", opt.data, cb_peek(&err));
+                ret = 1;
+                break;
+            }
+            if (!audiobench.enabled) {
+                cfg_open(NULL, &audiobench.opts);
+                audiobench.enabled = true;
+            }
+            while (1) {
+                e = args_getvar(&a, &var, &err);
+                if (e == -1) {
+                    fprintf(stderr, "-%s: %s\n", opt.data, cb_peek(&err));
+                    ret = 1;
+                    goto longbreak;
+                } else if (e == 0) {
+                    break;
+                }
+                e = args_getvarval(&a, -1, &val, &err);
+                if (e == -1) {
+                    fprintf(stderr, "-%s: %s: %s\n", opt.data, var.data, cb_peek(&err));
+                    ret = 1;
+                    goto longbreak;
+                } else if (e == 0) {
+                    fprintf(stderr, "-%s: %s: Expected a value\n", opt.data, cb_peek(&var));
+                    ret = 1;
+                    goto longbreak;
+                }
+                cfg_setvar(&audiobench.opts, NULL, cb_peek(&var), cb_peek(&val), true);
+                cb_clear(&val);
+                cb_clear(&var);
+            }
         } else {
             fprintf(stderr, "Unknown option: -%s\n", opt.data);
             ret = 1;
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <engine/audiomix.h>
+
+#define LEN 256
+
+static int fails;
+
+static void fail(const char* kern, int taps, double step, const char* what) {
+    printf("    %s, %d taps, step %.3f: %s\n", kern, taps, step, what);
+    ++fails;
+}
+
+// Steps through the source like the mixer does (32.32 fixed point, starting at 'pos0'), sinc filters an impulse on the
+// position of output 'at', and checks that the output peaks there and that no more than the window is read.
+static void testwindow(int taps, double step, long pos0, int at) {
+    int off[LEN];
+    uint16_t phase[LEN];
+    float out[LEN];
+    uint64_t fstep = step * 4294967296.0;
+    for (int i = 0; i < LEN; ++i) {
+        uint64_t p = fstep * i;
+        off[i] = pos0 + (long)(p >> 32);
+        phase[i] = ((p & 0xFFFFFFFFU) * AUDIOMIX_SINC_PHASES + 0x80000000U) >> 32;
+    }
+    long impulse = off[at] + (phase[at] >= AUDIOMIX_SINC_PHASES / 2);
+    int maxoff = 0;
+    long start;
+    long win = audiomix_sincwindow(off, LEN, taps, &start);
+    for (int i = 0; i < LEN; ++i) {
+        if (off[i] < 0) {
+            fail(audiomixkern.name, taps, step, "negative offset");
+            return;
+        }
+        if (off[i] > maxoff) maxoff = off[i];
+    }
+    if (maxoff + taps > win) {
+        fail(audiomixkern.name, taps, step, "offsets read past the window");
+        return;
+    }
+    // sized to exactly the window so reading past it shows up under a memory checker
+    float* src = malloc(win * sizeof(*src));
+    for (long i = 0; i < win; ++i) {
+        src[i] = (start + i == impulse) ? 1.0f : 0.0f;
+    }
+    audiomixkern.sinc(out, LEN, src, off, phase, audiomixsinc.table[audiomix_sincband(step)], taps);
+    free(src);
+    int peak = 0;
+    for (int i = 1; i < LEN; ++i) {
+        if (out[i] > out[peak]) peak = i;
+    }
+    if (peak != at) {
+        char tmp[64];
+        snprintf(tmp, sizeof(tmp), "impulse peaked at %d instead of %d", peak, at);
+        fail(audiomixkern.name, taps, step, tmp);
+    }
+}
+
+static void testkern(void) {
+    static const int taps[] = {8, 16, 32};
+    static const double steps[] = {1.0, 0.5, 0.75, 1.3, 2.5};
+    for (unsigned t = 0; t < sizeof(taps) / sizeof(*taps); ++t) {
+        if (!setAudioMixSinc(taps[t])) {
+            puts("    could not make the sinc tables");
+            ++fails;
+            return;
+        }
+        for (unsigned s = 0; s < sizeof(steps) / sizeof(*steps); ++s) {
+            testwindow(taps[t], steps[s], 0, 120);
+            testwindow(taps[t], steps[s], 1000, 120);
+            testwindow(taps[t], steps[s], -40, 0);
+            testwindow(taps[t], steps[s], 0, LEN - 1);
+        }
+    }
+    setAudioMixSinc(0);
+}
+
+int main(void) {
+    puts("Testing sinc window alignment and bounds...");
+    setAudioMixKern(false);
+    void (*scalar)(float*, int, const float*, const int*, const uint16_t*, const float*, int) = audiomixkern.sinc;
+    printf("  %s kernels\n", audiomixkern.name);
+    testkern();
+    setAudioMixKern(true);
+    if (audiomixkern.sinc != scalar) {
+        printf("  %s kernels\n", audiomixkern.name);
+        testkern();
+    }
+    if (fails) {
+        printf("%d failed\n", fails);
+        return 1;
+    }
+    puts("Passed");
+    return 0;
+}
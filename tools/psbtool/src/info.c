@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <common/psb.h>
+
+static inline uint32_t get32(const uint8_t* d) {
+    return d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+}
+
+static void psbinf(char* p) {
+    fputs(p, stdout);
+    putchar(':');
+    {
+        DIR* d = opendir(p);
+        if (d) {
+            closedir(d);
+            fputs(" failed (is a directory)\n", stdout);
+            return;
+        }
+    }
+    FILE* f = fopen(p, "rb");
+    if (!f) {
+        fputs(" failed (could not open: ", stdout);
+        fputs(strerror(errno), stdout);
+        fputs(")\n", stdout);
+        return;
+    }
+    uint8_t h[12];
+    if (fread(h, 1, 12, f) != 12 || h[0] != 'P' || h[1] != 'S' || h[2] != 'B') {
+        fclose(f);
+        fputs(" failed (not a PSB file)\n", stdout);
+        return;
+    }
+    if (h[3] != PSB_VER) {
+        fclose(f);
+        printf(" failed (incorrect version %d (expected %d))\n", h[3], PSB_VER);
+        return;
+    }
+    uint32_t count = get32(h + 4);
+    uint32_t namessize = get32(h + 8);
+    uint8_t* clips = malloc(count * 20 + namessize + 1);
+    if (fread(clips, 1, count * 20 + namessize, f) != count * 20 + namessize) {
+        fclose(f);
+        free(clips);
+        fputs(" failed (unexpected end of file)\n", stdout);
+        return;
+    }
+    fclose(f);
+    char* names = (char*)clips + count * 20;
+    names[namessize] = 0;
+    putchar('\n');
+    printf("    Clips: %u\n", (unsigned)count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint8_t* c = clips + i * 20;
+        uint32_t nameoff = get32(c);
+        uint32_t len = get32(c + 8);
+        uint32_t rate = get32(c + 12);
+        printf(
+            "    '%s': %s, %u Hz, %u samples (%.3fs)\n",
+            (nameoff < namessize) ? names + nameoff : "?", (c[16] & 1) ? "stereo" : "mono",
+            (unsigned)rate, (unsigned)len, (rate) ? (double)len / rate : 0.0
+        );
+    }
+    free(clips);
+}
+
+int psb_info(char* argv0, int argc, char** argv) {
+    bool onlyfile = false;
+    for (int i = 0; i < argc; ++i) {
+        if (!onlyfile && argv[i][0] == '-' && argv[i][1]) {
+            bool shortopt = !(argv[i][1] == '-');
+            if (!shortopt && !argv[i][2]) {onlyfile = true; continue;}
+            char* lopt = argv[i];
+            char sopt = 0;
+            int sopos = 0;
+            soret:;
+            ++sopos;
+            if (shortopt) {
+                if (!(sopt = lopt[sopos])) continue;
+            } else {
+                lopt += 2;
+            }
+            {
+                fputs(argv0, stderr);
+                fputs(": Unknown option '", stderr);
+                if (shortopt) {
+                    char tmp[3] = {'-', sopt, 0};
+                    fputs(tmp, stderr);
+                } else {
+                    fputs(argv[i], stderr);
+                }
+                fputs("'\n", stderr);
+                return 1;
+            }
+            if (shortopt) goto soret;
+        } else {
+            psbinf(argv[i]);
+        }
+    }
+    return 0;
+}
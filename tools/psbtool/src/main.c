@@ -0,0 +1,34 @@
+#include <string.h>
+#include <stdio.h>
+
+int psb_pack(char*, int, char**);
+int psb_info(char*, int, char**);
+
+int main(int argc, char** argv) {
+    if (argc < 2 || !strcmp(argv[1], "--help")) {
+        printf("USAGE: %s <COMMAND> ...\n", argv[0]);
+        putchar('\n');
+        puts("COMMANDS:");
+        puts("    p, pack [ARGUMENT]... <OUTPUT> <FILE>...");
+        puts("    Pack WAV and Ogg Vorbis (using stb_vorbis) files into a PSB sound bank, named by file name");
+        puts("        -o, --overwrite     Overwrite output");
+        puts("        -r, --rate          Resample clips to a rate (should match the audio output rate)");
+        puts("    i, info <FILE>...");
+        puts("    Show info about a PSB file");
+        return 0;
+    } else if (!strcmp(argv[1], "p") || !strcmp(argv[1], "pack")) {
+        if (argc == 2) {
+            fprintf(stderr, "%s: No files provided\n", argv[0]);
+            return 1;
+        }
+        return psb_pack(argv[0], argc - 2, &argv[2]);
+    } else if (!strcmp(argv[1], "i") || !strcmp(argv[1], "info")) {
+        if (argc == 2) {
+            fprintf(stderr, "%s: No files provided\n", argv[0]);
+            return 1;
+        }
+        return psb_info(argv[0], argc - 2, &argv[2]);
+    }
+    fprintf(stderr, "%s: Unknown command '%s'\n", argv[0], argv[1]);
+    return 1;
+}
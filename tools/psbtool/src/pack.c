@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#define STB_VORBIS_HEADER_ONLY
+#include <../stb/stb_vorbis.c>
+
+#include <common/psb.h>
+
+static struct {
+    bool overwrite;
+    long rate;
+} opt;
+
+struct clip {
+    char* name;
+    int16_t* data;
+    uint32_t len;
+    uint32_t rate;
+    int channels;
+};
+
+static inline uint32_t get32(const uint8_t* d) {
+    return d[0] | (d[1] << 8) | (d[2] << 16) | ((uint32_t)d[3] << 24);
+}
+static inline uint16_t get16(const uint8_t* d) {
+    return d[0] | (d[1] << 8);
+}
+static inline void put32(FILE* f, uint32_t v) {
+    fputc(v, f);
+    fputc(v >> 8, f);
+    fputc(v >> 16, f);
+    fputc(v >> 24, f);
+}
+
+static bool loadwav(FILE* f, struct clip* c) {
+    uint8_t h[12];
+    if (fread(h, 1, 12, f) != 12 || memcmp(h, "RIFF", 4) || memcmp(h + 8, "WAVE", 4)) {
+        fputs(" failed (not a WAV file)\n", stdout);
+        return false;
+    }
+    int bits = 0;
+    while (1) {
+        uint8_t ch[8];
+        if (fread(ch, 1, 8, f) != 8) {
+            fputs(" failed (no data chunk)\n", stdout);
+            return false;
+        }
+        uint32_t sz = get32(ch + 4);
+        if (!memcmp(ch, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if (sz < 16 || fread(fmt, 1, 16, f) != 16) {
+                fputs(" failed (invalid fmt chunk)\n", stdout);
+                return false;
+            }
+            c->channels = get16(fmt + 2);
+            c->rate = get32(fmt + 4);
+            bits = get16(fmt + 14);
+            if (get16(fmt) != 1 || (bits != 8 && bits != 16) || c->channels < 1 || c->channels > 2 || !c->rate) {
+                fputs(" failed (only 8-bit or 16-bit mono or stereo PCM is supported)\n", stdout);
+                return false;
+            }
+            fseek(f, (sz - 16) + (sz & 1), SEEK_CUR);
+        } else if (!memcmp(ch, "data", 4)) {
+            if (!bits) {
+                fputs(" failed (data chunk before fmt chunk)\n", stdout);
+                return false;
+            }
+            uint32_t count = sz / (bits / 8);
+            c->len = count / c->channels;
+            count = c->len * c->channels;
+            uint8_t* raw = malloc(sz ? sz : 1);
+            c->data = malloc((count ? count : 1) * sizeof(*c->data));
+            if (fread(raw, 1, sz, f) != sz) {
+                free(raw);
+                fputs(" failed (unexpected end of file)\n", stdout);
+                return false;
+            }
+            if (bits == 8) {
+                for (uint32_t i = 0; i < count; ++i) c->data[i] = (raw[i] - 128) << 8;
+            } else {
+                for (uint32_t i = 0; i < count; ++i) c->data[i] = (int16_t)get16(raw + i * 2);
+            }
+            free(raw);
+            return true;
+        } else {
+            fseek(f, sz + (sz & 1), SEEK_CUR);
+        }
+    }
+}
+
+static void resample(struct clip* c, uint32_t rate) {
+    uint32_t len = (uint64_t)c->len * rate / c->rate;
+    int16_t* data = malloc((len ? len : 1) * c->channels * sizeof(*data));
+    for (uint32_t i = 0; i < len; ++i) {
+        double p = (double)i * c->rate / rate;
+        uint32_t s = p;
+        double f = p - s;
+        uint32_t s2 = (s + 1 < c->len) ? s + 1 : s;
+        for (int ch = 0; ch < c->channels; ++ch) {
+            double v = c->data[s * c->channels + ch] * (1.0 - f) + c->data[s2 * c->channels + ch] * f;
+            data[i * c->channels + ch] = (v < 0.0) ? v - 0.5 : v + 0.5;
+        }
+    }
+    free(c->data);
+    c->data = data;
+    c->len = len;
+    c->rate = rate;
+}
+
+static bool loadclip(char* p, struct clip* c) {
+    fputs(p, stdout);
+    putchar(':');
+    char* name = strrchr(p, '/');
+    name = (name) ? name + 1 : p;
+    char* ext = strrchr(name, '.');
+    size_t namelen = (ext && ext != name) ? (size_t)(ext - name) : strlen(name);
+    c->name = malloc(namelen + 1);
+    memcpy(c->name, name, namelen);
+    c->name[namelen] = 0;
+    c->data = NULL;
+    if (ext && !strcasecmp(ext, ".ogg")) {
+        int ch, rate;
+        short* data;
+        int len = stb_vorbis_decode_filename(p, &ch, &rate, &data);
+        if (len < 0 || ch < 1 || ch > 2) {
+            fputs(" failed (could not decode, or not mono or stereo)\n", stdout);
+            return false;
+        }
+        c->data = data;
+        c->len = len;
+        c->rate = rate;
+        c->channels = ch;
+    } else {
+        FILE* f = fopen(p, "rb");
+        if (!f) {
+            fputs(" failed (could not open: ", stdout);
+            fputs(strerror(errno), stdout);
+            fputs(")\n", stdout);
+            return false;
+        }
+        bool r = loadwav(f, c);
+        fclose(f);
+        if (!r) return false;
+    }
+    if (opt.rate > 0 && (uint32_t)opt.rate != c->rate) resample(c, opt.rate);
+    fputs(" done\n", stdout);
+    return true;
+}
+
+static int clipcmp(const void* a, const void* b) {
+    return strcmp(((const struct clip*)a)->name, ((const struct clip*)b)->name);
+}
+
+static int writebank(char* argv0, char* out, struct clip* clips, uint32_t count) {
+    qsort(clips, count, sizeof(*clips), clipcmp);
+    for (uint32_t i = 1; i < count; ++i) {
+        if (!strcmp(clips[i - 1].name, clips[i].name)) {
+            fprintf(stderr, "%s: Duplicate clip name '%s'\n", argv0, clips[i].name);
+            return 1;
+        }
+    }
+    if (!opt.overwrite) {
+        FILE* f = fopen(out, "rb");
+        if (f) {
+            fclose(f);
+            fprintf(stderr, "%s: '%s' already exists\n", argv0, out);
+            return 1;
+        }
+    }
+    FILE* f = fopen(out, "wb");
+    if (!f) {
+        fprintf(stderr, "%s: Could not open '%s': %s\n", argv0, out, strerror(errno));
+        return 1;
+    }
+    uint32_t namessize = 0;
+    for (uint32_t i = 0; i < count; ++i) namessize += strlen(clips[i].name) + 1;
+    fputs("PSB", f);
+    fputc(PSB_VER, f);
+    put32(f, count);
+    put32(f, namessize);
+    uint32_t nameoff = 0;
+    uint32_t dataoff = 12 + count * 20 + namessize;
+    dataoff = (dataoff + PSB_ALIGN - 1) / PSB_ALIGN * PSB_ALIGN;
+    for (uint32_t i = 0; i < count; ++i) {
+        put32(f, nameoff);
+        put32(f, dataoff);
+        put32(f, clips[i].len);
+        put32(f, clips[i].rate);
+        fputc(clips[i].channels == 2, f);
+        fputc(0, f);
+        fputc(0, f);
+        fputc(0, f);
+        nameoff += strlen(clips[i].name) + 1;
+        uint32_t bytes = clips[i].len * clips[i].channels * 2;
+        dataoff += (bytes + PSB_ALIGN - 1) / PSB_ALIGN * PSB_ALIGN;
+    }
+    for (uint32_t i = 0; i < count; ++i) fwrite(clips[i].name, 1, strlen(clips[i].name) + 1, f);
+    while (ftell(f) % PSB_ALIGN) fputc(0, f);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t samples = clips[i].len * clips[i].channels;
+        for (uint32_t j = 0; j < samples; ++j) {
+            fputc(clips[i].data[j], f);
+            fputc(clips[i].data[j] >> 8, f);
+        }
+        while (ftell(f) % PSB_ALIGN) fputc(0, f);
+    }
+    if (fclose(f)) {
+        fprintf(stderr, "%s: Could not write '%s': %s\n", argv0, out, strerror(errno));
+        return 1;
+    }
+    printf("Wrote %u clips to %s\n", (unsigned)count, out);
+    return 0;
+}
+
+int psb_pack(char* argv0, int argc, char** argv) {
+    bool onlyfile = false;
+    char* out = NULL;
+    struct clip* clips = NULL;
+    uint32_t count = 0;
+    int ret = 0;
+    for (int i = 0; i < argc; ++i) {
+        if (!onlyfile && argv[i][0] == '-' && argv[i][1]) {
+            bool shortopt = !(argv[i][1] == '-');
+            if (!shortopt && !argv[i][2]) {onlyfile = true; continue;}
+            char* lopt = argv[i];
+            char sopt = 0;
+            int sopos = 0;
+            soret:;
+            ++sopos;
+            if (shortopt) {
+                if (!(sopt = lopt[sopos])) continue;
+            } else {
+                lopt += 2;
+            }
+            if ((shortopt && sopt == 'o') || (!shortopt && !strcmp(lopt, "overwrite"))) {
+                opt.overwrite = true;
+            } else if ((shortopt && sopt == 'r') || (!shortopt && !strcmp(lopt, "rate"))) {
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "%s: Expected rate\n", argv0);
+                    ret = 1;
+                    goto ret;
+                }
+                char* e;
+                opt.rate = strtol(argv[++i], &e, 10);
+                if (*e || opt.rate <= 0) {
+                    fprintf(stderr, "%s: Invalid rate '%s'\n", argv0, argv[i]);
+                    ret = 1;
+                    goto ret;
+                }
+            } else {
+                fputs(argv0, stderr);
+                fputs(": Unknown option '", stderr);
+                if (shortopt) {
+                    char tmp[3] = {'-', sopt, 0};
+                    fputs(tmp, stderr);
+                } else {
+                    fputs(argv[i], stderr);
+                }
+                fputs("'\n", stderr);
+                ret = 1;
+                goto ret;
+            }
+            if (shortopt) goto soret;
+        } else if (!out) {
+            out = argv[i];
+        } else {
+            clips = realloc(clips, (count + 1) * sizeof(*clips));
+            if (!loadclip(argv[i], &clips[count])) {
+                free(clips[count].name);
+                free(clips[count].data);
+                ret = 1;
+                goto ret;
+            }
+            ++count;
+        }
+    }
+    if (!out) {
+        fprintf(stderr, "%s: No output provided\n", argv0);
+        ret = 1;
+    } else {
+        ret = writebank(argv0, out, clips, count);
+    }
+    ret:;
+    for (uint32_t i = 0; i < count; ++i) {
+        free(clips[i].name);
+        free(clips[i].data);
+    }
+    free(clips);
+    return ret;
+}
@@ -0,0 +1 @@
+#include <../stb/stb_vorbis.c>